@@ -0,0 +1,113 @@
+#include <string.h>
+#include "archive.h"
+
+/* Name length, flags, size, stored and offset around the name */
+#define ENTRY_FIXED (2 + 4 + 8 + 8 + 8)
+
+int archive_name_ok(const char *name)
+{
+    size_t len = strlen(name);
+
+    return len > 0 && len <= ARCHIVE_MAX_NAME && strchr(name, '/') == NULL &&
+           strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+size_t archive_toc_size(const ArchiveEntry *entries, size_t n)
+{
+    size_t size = ARCHIVE_PREFIX_SIZE;
+
+    for (size_t i = 0; i < n; i++)
+        size += ENTRY_FIXED + strlen(entries[i].name);
+    return size;
+}
+
+size_t archive_toc_pack(const ArchiveEntry *entries, size_t n, unsigned char *buf)
+{
+    size_t toc_len = archive_toc_size(entries, n);
+    unsigned char *p = buf + ARCHIVE_PREFIX_SIZE;
+
+    stego_put_u32(buf, (uint32_t)toc_len);
+    stego_put_u32(buf + 4, (uint32_t)n);
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t len = strlen(entries[i].name);
+
+        p[0] = (unsigned char)(len >> 8);
+        p[1] = (unsigned char)len;
+        memcpy(p + 2, entries[i].name, len);
+        p += 2 + len;
+        stego_put_u32(p, entries[i].flags);
+        stego_put_u64(p + 4, entries[i].size);
+        stego_put_u64(p + 12, entries[i].stored);
+        stego_put_u64(p + 20, entries[i].offset);
+        p += ENTRY_FIXED - 2;
+    }
+    return toc_len;
+}
+
+StegoError archive_toc_prefix(const unsigned char *buf, size_t *toc_len, size_t *count)
+{
+    *toc_len = stego_get_u32(buf);
+    *count = stego_get_u32(buf + 4);
+
+    if (*count > ARCHIVE_MAX_MEMBERS || *toc_len < ARCHIVE_PREFIX_SIZE + *count * ENTRY_FIXED ||
+        *toc_len > ARCHIVE_MAX_TOC)
+        return STEGO_ERR_CORRUPT;
+    return STEGO_OK;
+}
+
+/*===========================================================
+ * FUNCTION NAME : archive_toc_unpack
+ * PURPOSE       : Parse the entries and check names, flags
+ *                 and body ranges; the TOC comes from an
+ *                 image, so nothing in it is trusted
+ ===========================================================*/
+StegoError archive_toc_unpack(const unsigned char *buf, size_t toc_len, uint64_t data_len,
+                              ArchiveEntry *entries, size_t count)
+{
+    const unsigned char *p = buf + ARCHIVE_PREFIX_SIZE;
+    const unsigned char *end = buf + toc_len;
+
+    if (data_len < toc_len)
+        return STEGO_ERR_CORRUPT;
+    uint64_t body_len = data_len - toc_len;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ArchiveEntry *e = &entries[i];
+
+        if (end - p < 2)
+            return STEGO_ERR_CORRUPT;
+        size_t len = (size_t)p[0] << 8 | p[1];
+        if (len > ARCHIVE_MAX_NAME || (size_t)(end - p) < 2 + len + ENTRY_FIXED - 2)
+            return STEGO_ERR_CORRUPT;
+
+        memcpy(e->name, p + 2, len);
+        e->name[len] = '\0';
+        p += 2 + len;
+        e->flags = stego_get_u32(p);
+        e->size = stego_get_u64(p + 4);
+        e->stored = stego_get_u64(p + 12);
+        e->offset = stego_get_u64(p + 20);
+        p += ENTRY_FIXED - 2;
+
+        if (strlen(e->name) != len || !archive_name_ok(e->name))
+            return STEGO_ERR_CORRUPT;
+        if ((e->flags & ~ARCHIVE_KNOWN_MEMBER_FLAGS) != 0)
+            return STEGO_ERR_UNSUPPORTED;
+        if (e->offset > body_len || e->stored > body_len - e->offset ||
+            (!(e->flags & ARCHIVE_MEMBER_LZ) && e->stored != e->size))
+            return STEGO_ERR_CORRUPT;
+    }
+    return p == end ? STEGO_OK : STEGO_ERR_CORRUPT;
+}
+
+long archive_find(const ArchiveEntry *entries, size_t n, const char *name)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (strcmp(entries[i].name, name) == 0)
+            return (long)i;
+    }
+    return -1;
+}
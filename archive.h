@@ -0,0 +1,63 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stego.h"
+
+/*
+ * Archive payload (STEGO_FLAG_ARCHIVE): several files in one image.
+ *
+ * The secret data is a table of contents followed by the member
+ * bodies, back to back:
+ *   TOC length (4) | member count (4) | entries | bodies
+ * with every entry
+ *   name length (2) | name | flags (4) | size (8) | stored (8) | offset (8)
+ * all big endian. offset is where the body starts, counted from the
+ * end of the TOC, and stored its length in the image. Members with
+ * ARCHIVE_MEMBER_LZ hold LZ frames (lz.h) of their size bytes, so
+ * each member decompresses on its own and any one of them can be
+ * read without touching the others.
+ */
+
+#define ARCHIVE_PREFIX_SIZE 8
+#define ARCHIVE_MAX_NAME 255
+#define ARCHIVE_MAX_MEMBERS 65535
+#define ARCHIVE_MAX_TOC (ARCHIVE_PREFIX_SIZE + (size_t)ARCHIVE_MAX_MEMBERS * (2 + ARCHIVE_MAX_NAME + 28))
+
+#define ARCHIVE_MEMBER_LZ 0x1u      /* body is LZ frames */
+#define ARCHIVE_KNOWN_MEMBER_FLAGS ARCHIVE_MEMBER_LZ
+
+typedef struct
+{
+    char name[ARCHIVE_MAX_NAME + 1];
+    uint32_t flags;
+    uint64_t size;              /* bytes after decompression */
+    uint64_t stored;            /* bytes in the image */
+    uint64_t offset;            /* body offset after the TOC */
+} ArchiveEntry;
+
+/* True if name is usable as a member name (one path component) */
+int archive_name_ok(const char *name);
+
+/* Bytes taken by the TOC of n entries */
+size_t archive_toc_size(const ArchiveEntry *entries, size_t n);
+
+/* Serialize the TOC into buf (archive_toc_size bytes), return its length */
+size_t archive_toc_pack(const ArchiveEntry *entries, size_t n, unsigned char *buf);
+
+/* Read TOC length and member count from the first ARCHIVE_PREFIX_SIZE bytes */
+StegoError archive_toc_prefix(const unsigned char *buf, size_t *toc_len, size_t *count);
+
+/*
+ * Parse a complete TOC (toc_len bytes) into entries (count slots).
+ * data_len is the size of the whole archive stream, so every body
+ * can be checked to lie inside it.
+ */
+StegoError archive_toc_unpack(const unsigned char *buf, size_t toc_len, uint64_t data_len,
+                              ArchiveEntry *entries, size_t count);
+
+/* Index of the member called name, -1 if none */
+long archive_find(const ArchiveEntry *entries, size_t n, const char *name);
+
+#endif
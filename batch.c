@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "parallel.h"
+#include "pipeio.h"
+#include "stats.h"
+
+/* Jobs run side by side, so none of them may use stdin/stdout ("-") */
+static int jobs_own_files(const BatchJob *job)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (pipe_is_std(job->fields[i]))
+            return -1;
+    }
+    return 1;
+}
+
+/*===========================================================
+ * FUNCTION NAME : batch_parse_line
+ * PURPOSE       : Split one manifest line into a job
+ * RETURN        : 1 for a job, 0 for blank/comment lines,
+ *                 -1 for a malformed line
+ ===========================================================*/
+int batch_parse_line(char *line, BatchJob *job)
+{
+    char *tok[5];
+    int n = 0;
+
+    char *hash = strchr(line, '#');
+    if (hash)
+        *hash = '\0';
+
+    for (char *t = strtok(line, " \t\r\n"); t != NULL && n < 5; t = strtok(NULL, " \t\r\n"))
+    {
+        tok[n++] = t;
+    }
+    if (n == 0)
+        return 0;
+
+    if ((strcmp(tok[0], "e") == 0 || strcmp(tok[0], "-e") == 0) && n == 4)
+    {
+        job->op = e_encode;
+        job->fields[0] = tok[1];
+        job->fields[1] = tok[2];
+        job->fields[2] = tok[3];
+        return jobs_own_files(job);
+    }
+    if ((strcmp(tok[0], "d") == 0 || strcmp(tok[0], "-d") == 0) && (n == 3 || (n == 4 && strcmp(tok[2], "-") == 0)))
+    {
+        job->op = e_decode;
+        job->fields[0] = tok[1];
+        job->fields[1] = NULL;
+        job->fields[2] = tok[n - 1];
+        return jobs_own_files(job);
+    }
+    return -1;
+}
+
+/* Encode job: same validation and pipeline as the -e command */
+static Status run_encode_job(BatchJob *job)
+{
+    char *argv[] = { "stego", "-e", job->fields[0], job->fields[1], job->fields[2], NULL };
+    EncodeInfo encInfo;
+    Status ret;
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.buf_size = job->config->buf_size;
+    encInfo.use_mmap = job->config->use_mmap;
+    encInfo.bits = job->config->bits;
+    encInfo.compress = job->config->compress;
+    encInfo.crc = job->config->crc;
+    encInfo.passphrase = job->config->passphrase;
+    encInfo.scatter = job->config->scatter;
+    encInfo.quiet = 1;
+
+    if (read_and_validate_encode_args(argv, &encInfo) == e_failure)
+        return e_failure;
+    if (job->open_as[0])
+        encInfo.src_image_fname = job->open_as[0];
+    if (job->open_as[1])
+        encInfo.secret_fname = job->open_as[1];
+    if (job->open_as[2])
+        encInfo.stego_image_fname = job->open_as[2];
+
+    ret = do_encoding(&encInfo);
+    job->payload_bytes = encInfo.size_secret_file;
+    job->image_bytes = encInfo.image_capacity;
+    close_files(&encInfo);
+    return ret;
+}
+
+/* Decode job: same validation and pipeline as the -d command */
+static Status run_decode_job(BatchJob *job)
+{
+    char *argv[] = { "stego", "-d", job->fields[0], job->fields[2], NULL };
+    DecodeInfo decInfo;
+    Status ret = e_failure;
+
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.buf_size = job->config->buf_size;
+    decInfo.use_mmap = job->config->use_mmap;
+    decInfo.passphrase = job->config->passphrase;
+    decInfo.quiet = 1;
+
+    if (read_and_validate_decode_args(argv, &decInfo) == e_failure)
+        return e_failure;
+    if (job->open_as[0])
+        decInfo.stego_image_fname = job->open_as[0];
+    if (job->open_as[2])
+        decInfo.output_fname = job->open_as[2];
+
+    if (open_decode_files(&decInfo) == e_success)
+        ret = do_decoding(&decInfo);
+    job->payload_bytes = decInfo.file_size;
+    job->image_bytes = decInfo.file_size * 8;
+    close_decode_files(&decInfo);
+    return ret;
+}
+
+void batch_run_job(void *arg, int worker)
+{
+    BatchJob *job = arg;
+    double start = stats_now_ms();
+
+    (void)worker;
+    job->status = (job->op == e_encode) ? run_encode_job(job) : run_decode_job(job);
+    job->elapsed_ms = stats_now_ms() - start;
+}
+
+/* Read every job of the manifest into a growable array */
+static BatchJob *load_manifest(const char *manifest_fname, const BatchConfig *config, size_t *count)
+{
+    FILE *fptr = fopen(manifest_fname, "r");
+    BatchJob *jobs = NULL;
+    size_t n = 0, cap = 0;
+    char line[MAX_MANIFEST_LINE];
+    int line_no = 0;
+
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open manifest %s\n", manifest_fname);
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), fptr))
+    {
+        line_no++;
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            BatchJob *grown = realloc(jobs, cap * sizeof(*jobs));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "ERROR: Out of memory reading manifest\n");
+                free(jobs);
+                fclose(fptr);
+                return NULL;
+            }
+            jobs = grown;
+        }
+
+        /* Fields point into the job's own copy of the line */
+        BatchJob *job = &jobs[n];
+        memset(job, 0, sizeof(*job));
+        strcpy(job->text, line);
+
+        int parsed = batch_parse_line(job->text, job);
+        if (parsed < 0)
+        {
+            printf("ERROR: Manifest line %d is malformed, expected 'e cover secret output' or 'd stego output'\n", line_no);
+            free(jobs);
+            fclose(fptr);
+            return NULL;
+        }
+        if (parsed == 0)
+            continue;
+
+        job->line_no = line_no;
+        job->config = config;
+        job->status = e_failure;
+        n++;
+    }
+
+    fclose(fptr);
+    *count = n;
+    return jobs;
+}
+
+/*===========================================================
+ * FUNCTION NAME : run_batch
+ * PURPOSE       : Load the manifest, run all jobs on a
+ *                 work-stealing pool and report per-job
+ *                 status plus aggregate throughput
+ ===========================================================*/
+Status run_batch(const char *manifest_fname, const BatchConfig *config)
+{
+    size_t count = 0, failed = 0;
+    uint64_t payload_total = 0, image_total = 0;
+    BatchJob *jobs = load_manifest(manifest_fname, config, &count);
+
+    if (jobs == NULL)
+        return e_failure;
+
+    WorkPool *pool = workpool_create(config->threads > 0 ? config->threads : 1);
+    if (pool == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to start worker threads\n");
+        free(jobs);
+        return e_failure;
+    }
+
+    double start = stats_now_ms();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (workpool_submit(pool, batch_run_job, &jobs[i]) != 0)
+            fprintf(stderr, "ERROR: Unable to queue manifest line %d\n", jobs[i].line_no);
+    }
+    workpool_wait(pool);
+    double elapsed = stats_now_ms() - start;
+    workpool_destroy(pool);
+
+    /* Per-job status in manifest order */
+    for (size_t i = 0; i < count; i++)
+    {
+        BatchJob *job = &jobs[i];
+
+        printf("%-4s line %d: %s %s -> %s (%llu bytes, %.2f ms)\n",
+               job->status == e_success ? "OK" : "FAIL", job->line_no,
+               job->op == e_encode ? "encode" : "decode", job->fields[0], job->fields[2],
+               (unsigned long long)job->payload_bytes, job->elapsed_ms);
+
+        if (job->status == e_success)
+        {
+            payload_total += job->payload_bytes;
+            image_total += job->image_bytes;
+        }
+        else
+            failed++;
+    }
+
+    double secs = elapsed / 1000.0;
+    printf("INFO: Batch finished: %zu jobs, %zu failed, %.3f s, %.1f jobs/s\n",
+           count, failed, secs, secs > 0 ? count / secs : 0.0);
+    printf("INFO: Throughput: payload %.2f MB/s, pixels %.2f MB/s\n",
+           secs > 0 ? payload_total / 1e6 / secs : 0.0,
+           secs > 0 ? image_total / 1e6 / secs : 0.0);
+
+    free(jobs);
+    return failed == 0 ? e_success : e_failure;
+}
@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Batch mode: run many encode/decode jobs from a manifest in one
+ * process on a work-stealing pool.
+ *
+ * Manifest format, one job per line ('#' starts a comment):
+ *   e <cover.bmp> <secret.txt> <output.bmp>
+ *   d <stego.bmp> [-] <output_secret>
+ */
+
+#define MAX_MANIFEST_LINE 1024
+
+typedef struct _BatchConfig
+{
+    int threads;        /* pool size (-j) */
+    size_t buf_size;    /* per-job block size (-B), 0 = default */
+    int use_mmap;       /* map input images (-m) */
+    int bits;           /* encode depth (--bits), 0 = 1 bit per channel */
+    int compress;       /* LZ compress secrets (-z) */
+    int crc;            /* CRC32C trailer after every secret (--crc) */
+    const char *passphrase; /* encrypt and decrypt every secret (-p), NULL = off */
+    int scatter;        /* scatter the tiles of every payload (--scatter) */
+} BatchConfig;
+
+/* One manifest line and its outcome */
+typedef struct
+{
+    int line_no;
+    OperationType op;
+    char *fields[3];            /* image, secret (encode only), output */
+    char *open_as[3];           /* path to open instead of fields[i], NULL = fields[i] */
+    char text[MAX_MANIFEST_LINE];
+
+    const BatchConfig *config;
+    Status status;
+    double elapsed_ms;
+    uint64_t payload_bytes;
+    uint64_t image_bytes;
+} BatchJob;
+
+/* Split one manifest line (in place) into job: 1 for a job, 0 for a
+ * blank or comment line, -1 if malformed */
+int batch_parse_line(char *line, BatchJob *job);
+
+/* Run one parsed job and fill in its outcome (a work_fn) */
+void batch_run_job(void *arg, int worker);
+
+/* Run every job of the manifest, print per-job status and totals */
+Status run_batch(const char *manifest_fname, const BatchConfig *config);
+
+#endif
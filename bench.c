@@ -0,0 +1,724 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "encode.h"
+#include "decode.h"
+#include "lsb.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "types.h"
+
+/*
+ * stego_bench: synthetic BMP/payload generator, kernel micro-
+ * benchmarks and end-to-end encode/decode timings.
+ *
+ *   stego_bench [-r reps] [-q] [-d dir] [-o report.json]
+ *               [--bits k] [-z] [--crc] [--image WxHxBPP]... [--size bytes]...
+ *   stego_bench gen-bmp <out.bmp> <width> <height> <24|32>
+ *   stego_bench gen-payload <out.txt> <bytes>
+ *
+ * The report is one JSON document (stdout by default, e.g.
+ * bench_output.txt) so runs of two builds can be diffed.
+ */
+
+#define BENCH_MAX_IMAGES 8
+#define BENCH_MAX_SIZES 16
+#define BENCH_MAX_REPS 1000
+#define BENCH_KERNEL_BYTES (1024 * 1024)   // payload bytes per kernel run
+
+typedef struct
+{
+    uint32_t width;
+    uint32_t height;
+    int bpp;
+} BenchImage;
+
+typedef struct
+{
+    int reps;
+    int quick;
+    int bits;
+    int compress;
+    int crc;
+    const char *dir;
+    const char *report;
+    BenchImage images[BENCH_MAX_IMAGES];
+    int n_images;
+    size_t sizes[BENCH_MAX_SIZES];
+    int n_sizes;
+} BenchConfig;
+
+/* Report sink: the JSON array entries are separated as they are written */
+typedef struct
+{
+    FILE *out;
+    int entries;
+} Report;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* xorshift64*: reproducible pixels and payloads without libc rand state */
+static uint64_t bench_rand(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+static void fill_random(unsigned char *buf, size_t n, uint64_t seed)
+{
+    uint64_t state = seed | 1;
+
+    for (size_t i = 0; i < n; i += 8)
+    {
+        uint64_t v = bench_rand(&state);
+        size_t k = n - i < 8 ? n - i : 8;
+        memcpy(buf + i, &v, k);
+    }
+}
+
+static void put_le16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    put_le16(p, (uint16_t)v);
+    put_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+/*===========================================================
+ * FUNCTION NAME : write_bmp
+ * PURPOSE       : Write a BITMAPINFOHEADER image of random
+ *                 pixels (24 or 32 bpp, rows padded to 4 bytes);
+ *                 only the pixel bits in keep are left set
+ ===========================================================*/
+static Status write_bmp(const char *fname, uint32_t width, uint32_t height, int bpp, uint64_t seed,
+                        unsigned char keep)
+{
+    unsigned char hdr[BMP_MIN_HEADER_SIZE] = { 'B', 'M' };
+    uint64_t stride = (((uint64_t)width * bpp + 31) / 32) * 4;
+    uint64_t size = BMP_MIN_HEADER_SIZE + stride * height;
+    unsigned char *row = malloc(stride);
+    FILE *fp = fopen(fname, "w");
+    Status ret = e_success;
+
+    if (row == NULL || fp == NULL || (bpp != 24 && bpp != 32) || width == 0 || height == 0)
+    {
+        fprintf(stderr, "ERROR: Cannot create %s\n", fname);
+        free(row);
+        if (fp)
+            fclose(fp);
+        return e_failure;
+    }
+
+    put_le32(hdr + 2, size > UINT32_MAX ? 0 : (uint32_t)size);
+    put_le32(hdr + 10, BMP_MIN_HEADER_SIZE);
+    put_le32(hdr + 14, 40);
+    put_le32(hdr + 18, width);
+    put_le32(hdr + 22, height);
+    put_le16(hdr + 26, 1);
+    put_le16(hdr + 28, (uint16_t)bpp);
+    put_le32(hdr + 34, (uint32_t)(stride * height));
+    put_le32(hdr + 38, 2835);
+    put_le32(hdr + 42, 2835);
+    if (fwrite(hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+        ret = e_failure;
+
+    for (uint32_t y = 0; y < height && ret == e_success; y++)
+    {
+        fill_random(row, stride, seed + y);
+        for (uint64_t x = 0; keep != 0xFF && x < stride; x++)
+            row[x] &= keep;
+        if (fwrite(row, 1, stride, fp) != stride)
+            ret = e_failure;
+    }
+
+    free(row);
+    if (fclose(fp) != 0 || ret == e_failure)
+    {
+        fprintf(stderr, "ERROR: Writing %s failed\n", fname);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Random payload file of n bytes */
+static Status write_payload(const char *fname, size_t n, uint64_t seed)
+{
+    unsigned char buf[64 * 1024];
+    FILE *fp = fopen(fname, "w");
+    Status ret = e_success;
+
+    if (fp == NULL)
+    {
+        perror("fopen");
+        return e_failure;
+    }
+    for (size_t done = 0; done < n && ret == e_success; done += sizeof(buf))
+    {
+        size_t k = n - done < sizeof(buf) ? n - done : sizeof(buf);
+        fill_random(buf, k, seed + done);
+        if (fwrite(buf, 1, k, fp) != k)
+            ret = e_failure;
+    }
+    if (fclose(fp) != 0)
+        ret = e_failure;
+    return ret;
+}
+
+/*-----------------------------------------------------------
+ * Statistics and JSON output
+ -----------------------------------------------------------*/
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static double percentile(const double *sorted, int n, double p)
+{
+    int rank = (int)(p / 100.0 * n + 0.999999);
+
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank > n ? n - 1 : rank - 1];
+}
+
+/* One result object: samples are per-run times in ns for `bytes` payload bytes */
+static void report_result(Report *rep, const char *group, const char *name, const char *image,
+                          uint64_t bytes, double *samples, int n)
+{
+    qsort(samples, n, sizeof(*samples), cmp_double);
+
+    double p50 = percentile(samples, n, 50);
+    fprintf(rep->out, "%s\n    {\"group\": \"%s\", \"name\": \"%s\"", rep->entries++ ? "," : "", group, name);
+    if (image)
+        fprintf(rep->out, ", \"image\": \"%s\"", image);
+    fprintf(rep->out, ", \"bytes\": %llu, \"runs\": %d, \"mb_per_s\": %.2f, \"ns_per_byte\": %.3f, "
+                      "\"min_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}",
+            (unsigned long long)bytes, n, p50 > 0 ? bytes / (p50 / 1e9) / 1e6 : 0.0, bytes ? p50 / bytes : 0.0,
+            samples[0] / 1e3, p50 / 1e3, percentile(samples, n, 90) / 1e3, percentile(samples, n, 99) / 1e3,
+            samples[n - 1] / 1e3);
+    fflush(rep->out);
+}
+
+/*===========================================================
+ * Kernel microbenchmarks
+ * Every entry times one kernel over BENCH_KERNEL_BYTES of
+ * payload; new kernels only need a row in kernel_table.
+ ===========================================================*/
+typedef struct
+{
+    unsigned char *image;       /* 8 * BENCH_KERNEL_BYTES channel bytes */
+    unsigned char *payload;     /* BENCH_KERNEL_BYTES */
+    unsigned char *scratch;     /* LZ_FRAME_MAX */
+    size_t n;
+} KernelCtx;
+
+static void k_encode_byte(KernelCtx *c, int bits)
+{
+    (void)bits;
+    for (size_t i = 0; i < c->n; i++)
+        encode_byte_to_lsb((char)c->payload[i], (char *)c->image + i * 8);
+}
+
+static void k_decode_byte(KernelCtx *c, int bits)
+{
+    (void)bits;
+    for (size_t i = 0; i < c->n; i++)
+        c->payload[i] = (unsigned char)decode_byte_from_lsb((char *)c->image + i * 8);
+}
+
+static void k_embed_bits(KernelCtx *c, int bits)
+{
+    lsb_embed_bits(c->image, c->image, c->payload, c->n, bits);
+}
+
+static void k_extract_bits(KernelCtx *c, int bits)
+{
+    lsb_extract_bits(c->image, c->payload, c->n, bits);
+}
+
+static void k_lz_frame(KernelCtx *c, int bits)
+{
+    (void)bits;
+    for (size_t off = 0; off < c->n; off += LZ_CHUNK_SIZE)
+        lz_frame(c->payload + off, LZ_CHUNK_SIZE, c->scratch);
+}
+
+static void k_crc32c(KernelCtx *c, int bits)
+{
+    (void)bits;
+    c->scratch[0] ^= (unsigned char)crc32c(0, c->payload, c->n);
+}
+
+typedef struct
+{
+    const char *name;
+    void (*run)(KernelCtx *c, int bits);
+    int bits;
+} KernelBench;
+
+static const KernelBench kernel_table[] = {
+    { "encode_byte_to_lsb", k_encode_byte, 1 },
+    { "decode_byte_from_lsb", k_decode_byte, 1 },
+    { "lsb_embed_bits_k1", k_embed_bits, 1 },
+    { "lsb_extract_bits_k1", k_extract_bits, 1 },
+    { "lsb_embed_bits_k2", k_embed_bits, 2 },
+    { "lsb_extract_bits_k2", k_extract_bits, 2 },
+    { "lsb_embed_bits_k3", k_embed_bits, 3 },
+    { "lsb_extract_bits_k3", k_extract_bits, 3 },
+    { "lsb_embed_bits_k4", k_embed_bits, 4 },
+    { "lsb_extract_bits_k4", k_extract_bits, 4 },
+    { "lz_frame", k_lz_frame, 1 },
+    { "crc32c", k_crc32c, 1 },
+};
+
+static Status bench_kernels(const BenchConfig *cfg, Report *rep)
+{
+    KernelCtx c;
+    int reps = cfg->reps * 4;
+    double *samples = malloc(sizeof(double) * reps);
+
+    c.n = cfg->quick ? BENCH_KERNEL_BYTES / 8 : BENCH_KERNEL_BYTES;
+    c.image = malloc(c.n * 8);
+    c.payload = malloc(c.n);
+    c.scratch = malloc(LZ_FRAME_MAX);
+    if (samples == NULL || c.image == NULL || c.payload == NULL || c.scratch == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate kernel buffers\n");
+        free(samples), free(c.image), free(c.payload), free(c.scratch);
+        return e_failure;
+    }
+    fill_random(c.image, c.n * 8, 1);
+
+    for (size_t k = 0; k < sizeof(kernel_table) / sizeof(kernel_table[0]); k++)
+    {
+        const KernelBench *kb = &kernel_table[k];
+
+        fill_random(c.payload, c.n, 2);
+        kb->run(&c, kb->bits);              /* warm caches and page in */
+        for (int r = 0; r < reps; r++)
+        {
+            double t0 = now_ns();
+            kb->run(&c, kb->bits);
+            samples[r] = now_ns() - t0;
+        }
+        report_result(rep, "kernel", kb->name, NULL, c.n, samples, reps);
+    }
+
+    free(samples);
+    free(c.image);
+    free(c.payload);
+    free(c.scratch);
+    return e_success;
+}
+
+/*===========================================================
+ * End-to-end: do_encoding / do_decoding on files in the
+ * bench directory, the first decode checked against the
+ * payload
+ ===========================================================*/
+static Status files_equal(const char *a, const char *b)
+{
+    unsigned char x[64 * 1024], y[64 * 1024];
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    Status ret = (fa && fb) ? e_success : e_failure;
+    size_t na, nb;
+
+    while (ret == e_success && (na = fread(x, 1, sizeof(x), fa)) + (nb = fread(y, 1, sizeof(y), fb)) > 0)
+    {
+        if (na != nb || memcmp(x, y, na) != 0)
+            ret = e_failure;
+    }
+    if (fa)
+        fclose(fa);
+    if (fb)
+        fclose(fb);
+    return ret;
+}
+
+static Status copy_file(const char *src, const char *dst)
+{
+    unsigned char buf[64 * 1024];
+    FILE *fs = fopen(src, "r"), *fd = fopen(dst, "w");
+    Status ret = (fs && fd) ? e_success : e_failure;
+    size_t n;
+
+    while (ret == e_success && (n = fread(buf, 1, sizeof(buf), fs)) > 0)
+    {
+        if (fwrite(buf, 1, n, fd) != n)
+            ret = e_failure;
+    }
+    if (fs)
+        fclose(fs);
+    if (fd && fclose(fd) != 0)
+        ret = e_failure;
+    return ret;
+}
+
+static Status run_encode(const BenchConfig *cfg, int bits, char *cover, char *secret, char *stego)
+{
+    char *argv[] = { "stego_bench", "-e", cover, secret, stego, NULL };
+    EncodeInfo encInfo;
+    Status ret;
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.bits = bits;
+    encInfo.compress = cfg->compress;
+    encInfo.crc = cfg->crc;
+    encInfo.quiet = 1;
+    if (read_and_validate_encode_args(argv, &encInfo) == e_failure)
+        return e_failure;
+    ret = do_encoding(&encInfo);
+    close_files(&encInfo);
+    return ret;
+}
+
+static Status run_update(const BenchConfig *cfg, int bits, char *image, char *secret)
+{
+    char *argv[] = { "stego_bench", "-u", image, secret, NULL };
+    EncodeInfo encInfo;
+    Status ret;
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.bits = bits;
+    encInfo.compress = cfg->compress;
+    encInfo.crc = cfg->crc;
+    encInfo.quiet = 1;
+    if (read_and_validate_update_args(argv, &encInfo) == e_failure)
+        return e_failure;
+    ret = do_inplace_update(&encInfo);
+    close_files(&encInfo);
+    return ret;
+}
+
+static Status run_decode(char *stego, char *output)
+{
+    char *argv[] = { "stego_bench", "-d", stego, output, NULL };
+    DecodeInfo decInfo;
+    Status ret = e_failure;
+
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.quiet = 1;
+    if (read_and_validate_decode_args(argv, &decInfo) == e_failure)
+        return e_failure;
+    if (open_decode_files(&decInfo) == e_success)
+        ret = do_decoding(&decInfo);
+    close_decode_files(&decInfo);
+    return ret;
+}
+
+static Status bench_end_to_end(const BenchConfig *cfg, Report *rep)
+{
+    char cover[512], secret[512], stego[512], output[512], image[64];
+    double *samples = malloc(sizeof(double) * cfg->reps);
+    Status ret = e_success;
+
+    if (samples == NULL)
+        return e_failure;
+
+    for (int i = 0; i < cfg->n_images && ret == e_success; i++)
+    {
+        const BenchImage *img = &cfg->images[i];
+        uint64_t capacity = (uint64_t)img->width * img->height * 3;
+        int bits = cfg->bits > 0 ? cfg->bits : 1;
+
+        snprintf(image, sizeof(image), "%ux%ux%d", img->width, img->height, img->bpp);
+        snprintf(cover, sizeof(cover), "%s/bench_cover_%s.bmp", cfg->dir, image);
+        snprintf(stego, sizeof(stego), "%s/bench_stego.bmp", cfg->dir);
+        snprintf(output, sizeof(output), "%s/bench_decoded.txt", cfg->dir);
+        if (write_bmp(cover, img->width, img->height, img->bpp, 42 + i, 0xFF) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+
+        for (int s = 0; s < cfg->n_sizes && ret == e_success; s++)
+        {
+            size_t size = cfg->sizes[s];
+            char name[64];
+
+            /* Leave room for the header; sizes the cover cannot hold are skipped */
+            if (LSB_CHANNELS(size, bits) + STEGO_MAX_HEADER_SIZE * 8 > capacity)
+                continue;
+
+            snprintf(secret, sizeof(secret), "%s/bench_payload_%zu.txt", cfg->dir, size);
+            if (write_payload(secret, size, 7 + s) == e_failure)
+            {
+                ret = e_failure;
+                break;
+            }
+
+            for (int r = 0; r < cfg->reps && ret == e_success; r++)
+            {
+                double t0 = now_ns();
+                ret = run_encode(cfg, cfg->bits, cover, secret, stego);
+                samples[r] = now_ns() - t0;
+            }
+            snprintf(name, sizeof(name), "encode_%zu", size);
+            if (ret == e_success)
+                report_result(rep, "end_to_end", name, image, size, samples, cfg->reps);
+
+            for (int r = 0; r < cfg->reps && ret == e_success; r++)
+            {
+                double t0 = now_ns();
+                ret = run_decode(stego, output);
+                samples[r] = now_ns() - t0;
+                if (r == 0 && ret == e_success && files_equal(secret, output) == e_failure)
+                {
+                    fprintf(stderr, "ERROR: Decoded payload differs (%s, %zu bytes)\n", image, size);
+                    ret = e_failure;
+                }
+            }
+            snprintf(name, sizeof(name), "decode_%zu", size);
+            if (ret == e_success)
+                report_result(rep, "end_to_end", name, image, size, samples, cfg->reps);
+
+            unlink(secret);
+        }
+
+        unlink(cover);
+        unlink(stego);
+        unlink(output);
+    }
+
+    free(samples);
+    return ret;
+}
+
+/*===========================================================
+ * In-place update: every rep rewrites a copy of an image that
+ * holds a longer payload at the deepest depth, the first one
+ * checked against a fresh encode of the new payload. The
+ * cover's low LSB_MAX_BITS bits are zero, so any bit the old
+ * payload left behind shows up as a difference.
+ ===========================================================*/
+static Status bench_update(const BenchConfig *cfg, Report *rep)
+{
+    char cover[512], old_secret[512], old_stego[512], secret[512], stego[512], fresh[512], image[64];
+    double *samples = malloc(sizeof(double) * cfg->reps);
+    Status ret = e_success;
+
+    if (samples == NULL)
+        return e_failure;
+
+    for (int i = 0; i < cfg->n_images && ret == e_success; i++)
+    {
+        const BenchImage *img = &cfg->images[i];
+        uint64_t capacity = (uint64_t)img->width * img->height * 3;
+        int bits = cfg->bits > 0 ? cfg->bits : 1;
+        size_t old_size = (size_t)(capacity * LSB_MAX_BITS / 16);   /* half the image */
+
+        snprintf(image, sizeof(image), "%ux%ux%d", img->width, img->height, img->bpp);
+        snprintf(cover, sizeof(cover), "%s/bench_cover_%s.bmp", cfg->dir, image);
+        snprintf(old_secret, sizeof(old_secret), "%s/bench_payload_old.txt", cfg->dir);
+        snprintf(old_stego, sizeof(old_stego), "%s/bench_old.bmp", cfg->dir);
+        snprintf(stego, sizeof(stego), "%s/bench_update.bmp", cfg->dir);
+        snprintf(fresh, sizeof(fresh), "%s/bench_stego.bmp", cfg->dir);
+        if (write_bmp(cover, img->width, img->height, img->bpp, 42 + i, (unsigned char)(0xFF << LSB_MAX_BITS)) == e_failure ||
+            write_payload(old_secret, old_size, 5) == e_failure ||
+            run_encode(cfg, LSB_MAX_BITS, cover, old_secret, old_stego) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+
+        for (int s = 0; s < cfg->n_sizes && ret == e_success; s++)
+        {
+            size_t size = cfg->sizes[s];
+            char name[64];
+
+            if (size >= old_size || LSB_CHANNELS(size, bits) + STEGO_MAX_HEADER_SIZE * 8 > capacity)
+                continue;
+
+            snprintf(secret, sizeof(secret), "%s/bench_payload_%zu.txt", cfg->dir, size);
+            if (write_payload(secret, size, 7 + s) == e_failure)
+            {
+                ret = e_failure;
+                break;
+            }
+
+            for (int r = 0; r < cfg->reps && ret == e_success; r++)
+            {
+                if (copy_file(old_stego, stego) == e_failure)
+                {
+                    ret = e_failure;
+                    break;
+                }
+                double t0 = now_ns();
+                ret = run_update(cfg, bits, stego, secret);
+                samples[r] = now_ns() - t0;
+                if (r == 0 && ret == e_success &&
+                    (run_encode(cfg, bits, cover, secret, fresh) == e_failure || files_equal(stego, fresh) == e_failure))
+                {
+                    fprintf(stderr, "ERROR: Updated image differs from a fresh encode (%s, %zu bytes)\n", image, size);
+                    ret = e_failure;
+                }
+            }
+            snprintf(name, sizeof(name), "update_%zu", size);
+            if (ret == e_success)
+                report_result(rep, "end_to_end", name, image, size, samples, cfg->reps);
+
+            unlink(secret);
+        }
+
+        unlink(cover);
+        unlink(old_secret);
+        unlink(old_stego);
+        unlink(stego);
+        unlink(fresh);
+    }
+
+    free(samples);
+    return ret;
+}
+
+/*-----------------------------------------------------------
+ * Command line
+ -----------------------------------------------------------*/
+
+static int parse_image(const char *str, BenchImage *img)
+{
+    unsigned w, h;
+    int bpp = 24;
+
+    if (sscanf(str, "%ux%ux%d", &w, &h, &bpp) < 2 || w == 0 || h == 0 || (bpp != 24 && bpp != 32))
+        return -1;
+    img->width = w;
+    img->height = h;
+    img->bpp = bpp;
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-r reps] [-q] [-d dir] [-o report.json] [--bits k] [-z] [--crc]\n"
+           "          [--image WxH[xBPP]]... [--size bytes]...\n", prog);
+    printf("       %s gen-bmp <out.bmp> <width> <height> <24|32>\n", prog);
+    printf("       %s gen-payload <out.txt> <bytes>\n", prog);
+}
+
+static int parse_args(int argc, char *argv[], BenchConfig *cfg)
+{
+    static const BenchImage default_images[] = { { 1024, 768, 24 }, { 1021, 769, 24 }, { 2048, 2048, 32 } };
+    static const size_t default_sizes[] = { 4096, 65536, 1024 * 1024, 8 * 1024 * 1024 };
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->reps = 5;
+    cfg->dir = "/tmp";
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "-q") == 0)
+            cfg->quick = 1;
+        else if (strcmp(arg, "-z") == 0)
+            cfg->compress = 1;
+        else if (strcmp(arg, "--crc") == 0)
+            cfg->crc = 1;
+        else if (val == NULL)
+            return -1;
+        else if (strcmp(arg, "-r") == 0)
+        {
+            cfg->reps = atoi(val);
+            if (cfg->reps < 1 || cfg->reps > BENCH_MAX_REPS)
+                return -1;
+            i++;
+        }
+        else if (strcmp(arg, "-d") == 0)
+            cfg->dir = argv[++i];
+        else if (strcmp(arg, "-o") == 0)
+            cfg->report = argv[++i];
+        else if (strcmp(arg, "--bits") == 0)
+        {
+            cfg->bits = atoi(val);
+            if (cfg->bits < 1 || cfg->bits > LSB_MAX_BITS)
+                return -1;
+            i++;
+        }
+        else if (strcmp(arg, "--image") == 0)
+        {
+            if (cfg->n_images == BENCH_MAX_IMAGES || parse_image(val, &cfg->images[cfg->n_images++]) != 0)
+                return -1;
+            i++;
+        }
+        else if (strcmp(arg, "--size") == 0)
+        {
+            if (cfg->n_sizes == BENCH_MAX_SIZES || (cfg->sizes[cfg->n_sizes++] = strtoull(val, NULL, 10)) == 0)
+                return -1;
+            i++;
+        }
+        else
+            return -1;
+    }
+
+    if (cfg->n_images == 0)
+    {
+        cfg->n_images = cfg->quick ? 1 : (int)(sizeof(default_images) / sizeof(default_images[0]));
+        memcpy(cfg->images, default_images, sizeof(BenchImage) * cfg->n_images);
+    }
+    if (cfg->n_sizes == 0)
+    {
+        cfg->n_sizes = cfg->quick ? 2 : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+        memcpy(cfg->sizes, default_sizes, sizeof(size_t) * cfg->n_sizes);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig cfg;
+    Report rep = { stdout, 0 };
+    Status ret;
+
+    /* Generators for hand-made test data */
+    if (argc == 6 && strcmp(argv[1], "gen-bmp") == 0)
+        return write_bmp(argv[2], (uint32_t)atoi(argv[3]), (uint32_t)atoi(argv[4]), atoi(argv[5]), 42, 0xFF) == e_success ? 0 : 1;
+    if (argc == 4 && strcmp(argv[1], "gen-payload") == 0)
+        return write_payload(argv[2], strtoull(argv[3], NULL, 10), 7) == e_success ? 0 : 1;
+
+    if (parse_args(argc, argv, &cfg) != 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (cfg.report && (rep.out = fopen(cfg.report, "w")) == NULL)
+    {
+        perror("fopen");
+        return 1;
+    }
+
+    fprintf(rep.out, "{\n  \"tool\": \"stego_bench\",\n  \"kernel\": \"%s\",\n  \"crc_kernel\": \"%s\",\n  \"compiler\": \"%s\",\n"
+                     "  \"reps\": %d,\n  \"bits\": %d,\n  \"compress\": %s,\n  \"crc\": %s,\n  \"results\": [",
+            lsb_kernel_name(), crc32c_kernel_name(), __VERSION__, cfg.reps, cfg.bits > 0 ? cfg.bits : 1, cfg.compress ? "true" : "false",
+            cfg.crc ? "true" : "false");
+
+    ret = bench_kernels(&cfg, &rep);
+    if (ret == e_success)
+        ret = bench_end_to_end(&cfg, &rep);
+    if (ret == e_success)
+        ret = bench_update(&cfg, &rep);
+
+    fprintf(rep.out, "\n  ],\n  \"status\": \"%s\"\n}\n", ret == e_success ? "ok" : "failed");
+    if (rep.out != stdout)
+        fclose(rep.out);
+    return ret == e_success ? 0 : 1;
+}
@@ -0,0 +1,332 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bmp.h"
+#include "lsb.h"
+
+/* 32 bpp rows are gathered into this many channel bytes at a time */
+#define BMP_GATHER_SIZE 4096
+
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get_le16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/*===========================================================
+ * FUNCTION NAME : bmp_parse
+ * PURPOSE       : Fill a BmpInfo from the file + DIB headers.
+ *                 Accepts BITMAPINFOHEADER, V4 and V5 with
+ *                 uncompressed 24 bpp or 32 bpp (BI_RGB or
+ *                 BI_BITFIELDS with the standard BGRA masks)
+ ===========================================================*/
+StegoError bmp_parse(const unsigned char *hdr, size_t len, uint64_t file_len, BmpInfo *info)
+{
+    if (hdr == NULL || info == NULL)
+        return STEGO_ERR_ARGS;
+    if (len < BMP_MIN_HEADER_SIZE || hdr[0] != 'B' || hdr[1] != 'M')
+        return STEGO_ERR_NOT_BMP;
+
+    memset(info, 0, sizeof(*info));
+    info->pixel_offset = get_le32(hdr + 10);
+    info->dib_size = get_le32(hdr + 14);
+
+    int32_t width = (int32_t)get_le32(hdr + 18);
+    int32_t height = (int32_t)get_le32(hdr + 22);
+    uint16_t planes = get_le16(hdr + 26);
+    uint32_t compression = get_le32(hdr + 30);
+    info->bpp = get_le16(hdr + 28);
+
+    if (info->dib_size < 40 || planes != 1 || width <= 0 || height == 0 || height == INT32_MIN)
+        return STEGO_ERR_NOT_BMP;
+    if (info->bpp != 24 && info->bpp != 32)
+        return STEGO_ERR_NOT_BMP;
+    if (info->pixel_offset < BMP_FILE_HEADER_SIZE + info->dib_size)
+        return STEGO_ERR_NOT_BMP;
+
+    if (compression == BI_BITFIELDS)
+    {
+        /* Masks follow a 40 byte header, or sit inside V4/V5 at the same offset */
+        if (info->bpp != 32 || len < BMP_FILE_HEADER_SIZE + 40 + 12)
+            return STEGO_ERR_NOT_BMP;
+        if (get_le32(hdr + 54) != 0x00FF0000 || get_le32(hdr + 58) != 0x0000FF00 ||
+            get_le32(hdr + 62) != 0x000000FF)
+            return STEGO_ERR_NOT_BMP;
+    }
+    else if (compression != BI_RGB)
+        return STEGO_ERR_NOT_BMP;
+
+    info->width = (uint32_t)width;
+    info->top_down = height < 0;
+    info->height = (uint32_t)(height < 0 ? -height : height);
+
+    /* Rows are padded to a multiple of 4 bytes */
+    info->stride = (((uint64_t)info->width * info->bpp + 31) / 32) * 4;
+    info->row_channels = (uint64_t)info->width * 3;
+    info->capacity = info->row_channels * info->height;
+    info->pixel_end = info->pixel_offset + info->stride * info->height;
+
+    if (file_len != 0 && info->pixel_end > file_len)
+        return STEGO_ERR_NOT_BMP;
+    return STEGO_OK;
+}
+
+uint64_t bmp_channel_offset(const BmpInfo *info, uint64_t c)
+{
+    if (c >= info->capacity)
+        return info->pixel_end;
+
+    uint64_t row = c / info->row_channels;
+    uint64_t col = c % info->row_channels;
+
+    if (info->bpp == 32)
+        col = col / 3 * 4 + col % 3;
+    return info->pixel_offset + row * info->stride + col;
+}
+
+int bmp_is_dense(const BmpInfo *info)
+{
+    return info->bpp == 24 && info->stride == info->row_channels;
+}
+
+uint64_t bmp_span_max(const BmpInfo *info, uint64_t channels)
+{
+    /* Padding and alpha add at most a third, plus one partial row */
+    return channels + (channels + 2) / 3 + info->stride + 8;
+}
+
+/*===========================================================
+ * FUNCTION NAME : bmp_read_fd
+ * PURPOSE       : Parse the header of an open image with
+ *                 pread, so the file position is untouched
+ ===========================================================*/
+StegoError bmp_read_fd(int fd, BmpInfo *info)
+{
+    unsigned char hdr[BMP_MAX_HEADER_SIZE];
+    struct stat st;
+    ssize_t got = pread(fd, hdr, sizeof(hdr), 0);
+
+    if (got < 0 || fstat(fd, &st) != 0)
+        return STEGO_ERR_ARGS;
+    return bmp_parse(hdr, (size_t)got, S_ISREG(st.st_mode) ? (uint64_t)st.st_size : 0, info);
+}
+
+/* read() exactly n bytes; 0 on success */
+static int read_full(int fd, unsigned char *buf, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t got = read(fd, buf, n);
+
+        if (got <= 0)
+            return -1;
+        buf += got;
+        n -= (size_t)got;
+    }
+    return 0;
+}
+
+/*===========================================================
+ * FUNCTION NAME : bmp_read_prefix
+ * PURPOSE       : Header parse for pipes: the file header
+ *                 gives bfOffBits, then everything up to the
+ *                 pixel array is read in one more call
+ ===========================================================*/
+StegoError bmp_read_prefix(int fd, unsigned char *buf, size_t cap, BmpInfo *info)
+{
+    if (buf == NULL || info == NULL || cap < BMP_MIN_HEADER_SIZE)
+        return STEGO_ERR_ARGS;
+    if (read_full(fd, buf, BMP_FILE_HEADER_SIZE) != 0)
+        return STEGO_ERR_NOT_BMP;
+
+    uint32_t pixel_offset = get_le32(buf + 10);
+    if (buf[0] != 'B' || buf[1] != 'M' || pixel_offset < BMP_MIN_HEADER_SIZE || pixel_offset > cap)
+        return STEGO_ERR_NOT_BMP;
+    if (read_full(fd, buf + BMP_FILE_HEADER_SIZE, pixel_offset - BMP_FILE_HEADER_SIZE) != 0)
+        return STEGO_ERR_NOT_BMP;
+
+    return bmp_parse(buf, pixel_offset, 0, info);
+}
+
+/* Offset of channel col inside a 32 bpp row (alpha skipped) */
+static inline uint64_t channel32(uint64_t col)
+{
+    return col / 3 * 4 + col % 3;
+}
+
+/*
+ * Run a straddling or short group through the kernel: gather its
+ * channel bytes (at most 8) into tmp, embed or extract, scatter back.
+ */
+static void group_embed(const BmpInfo *info, unsigned char *buf, uint64_t buf_off, uint64_t c,
+                        const unsigned char *data, size_t take, int bits)
+{
+    unsigned char tmp[8];
+    int channels = (int)LSB_CHANNELS(take, bits);
+
+    for (int j = 0; j < channels; j++)
+        tmp[j] = buf[bmp_channel_offset(info, c + j) - buf_off];
+    lsb_embed_bits(tmp, tmp, data, take, bits);
+    for (int j = 0; j < channels; j++)
+        buf[bmp_channel_offset(info, c + j) - buf_off] = tmp[j];
+}
+
+static void group_extract(const BmpInfo *info, const unsigned char *buf, uint64_t buf_off, uint64_t c,
+                          unsigned char *data, size_t take, int bits)
+{
+    unsigned char tmp[8];
+    int channels = (int)LSB_CHANNELS(take, bits);
+
+    for (int j = 0; j < channels; j++)
+        tmp[j] = buf[bmp_channel_offset(info, c + j) - buf_off];
+    lsb_extract_bits(tmp, data, take, bits);
+}
+
+/*===========================================================
+ * FUNCTION NAME : bmp_embed
+ * PURPOSE       : Run the bulk kernel over one row at a time.
+ *                 24 bpp rows are contiguous and go straight to
+ *                 the kernel; 32 bpp rows are gathered into a
+ *                 contiguous scratch block first. A group split
+ *                 across two rows goes through group_embed.
+ ===========================================================*/
+void bmp_embed(const BmpInfo *info, unsigned char *dst, const unsigned char *src,
+               uint64_t buf_off, uint64_t c0, const unsigned char *data, size_t n, int bits)
+{
+    uint64_t start = bmp_channel_offset(info, c0) - buf_off;
+    size_t g = LSB_GROUP_BYTES(bits);
+    size_t group_channels = g * 8 / bits;
+
+    if (bmp_is_dense(info))
+    {
+        lsb_embed_bits(dst + start, src + start, data, n, bits);
+        return;
+    }
+
+    /* Keep padding and alpha bytes, then work in place on dst */
+    if (dst != src)
+        memcpy(dst + start, src + start, bmp_channel_offset(info, c0 + LSB_CHANNELS(n, bits)) - buf_off - start);
+
+    uint64_t c = c0;
+    size_t i = 0;
+    unsigned char scratch[BMP_GATHER_SIZE];
+
+    while (i < n)
+    {
+        uint64_t row = c / info->row_channels;
+        uint64_t col = c % info->row_channels;
+        size_t whole = (info->row_channels - col) / group_channels * g;
+        unsigned char *row_ptr = dst + info->pixel_offset + row * info->stride - buf_off;
+
+        if (whole > n - i)
+            whole = (n - i) / g * g;
+
+        if (whole == 0)
+        {
+            /* Group straddles the end of the row, or is the short last one */
+            size_t take = n - i < g ? n - i : g;
+
+            group_embed(info, dst, buf_off, c, data + i, take, bits);
+            c += LSB_CHANNELS(take, bits);
+            i += take;
+            continue;
+        }
+
+        if (info->bpp == 24)
+        {
+            lsb_embed_bits(row_ptr + col, row_ptr + col, data + i, whole, bits);
+        }
+        else
+        {
+            size_t step = BMP_GATHER_SIZE / group_channels * g;
+
+            for (size_t done = 0; done < whole;)
+            {
+                size_t k = whole - done < step ? whole - done : step;
+                uint64_t base = col + done * 8 / bits;
+                size_t channels = k * 8 / bits;
+
+                for (size_t t = 0; t < channels; t++)
+                    scratch[t] = row_ptr[channel32(base + t)];
+                lsb_embed_bits(scratch, scratch, data + i + done, k, bits);
+                for (size_t t = 0; t < channels; t++)
+                    row_ptr[channel32(base + t)] = scratch[t];
+                done += k;
+            }
+        }
+        c += whole * 8 / bits;
+        i += whole;
+    }
+}
+
+/*===========================================================
+ * FUNCTION NAME : bmp_extract
+ * PURPOSE       : Row-wise counterpart of bmp_embed
+ ===========================================================*/
+void bmp_extract(const BmpInfo *info, const unsigned char *buf, uint64_t buf_off,
+                 uint64_t c0, unsigned char *data, size_t n, int bits)
+{
+    size_t g = LSB_GROUP_BYTES(bits);
+    size_t group_channels = g * 8 / bits;
+
+    if (bmp_is_dense(info))
+    {
+        lsb_extract_bits(buf + bmp_channel_offset(info, c0) - buf_off, data, n, bits);
+        return;
+    }
+
+    uint64_t c = c0;
+    size_t i = 0;
+    unsigned char scratch[BMP_GATHER_SIZE];
+
+    while (i < n)
+    {
+        uint64_t row = c / info->row_channels;
+        uint64_t col = c % info->row_channels;
+        size_t whole = (info->row_channels - col) / group_channels * g;
+        const unsigned char *row_ptr = buf + info->pixel_offset + row * info->stride - buf_off;
+
+        if (whole > n - i)
+            whole = (n - i) / g * g;
+
+        if (whole == 0)
+        {
+            size_t take = n - i < g ? n - i : g;
+
+            group_extract(info, buf, buf_off, c, data + i, take, bits);
+            c += LSB_CHANNELS(take, bits);
+            i += take;
+            continue;
+        }
+
+        if (info->bpp == 24)
+        {
+            lsb_extract_bits(row_ptr + col, data + i, whole, bits);
+        }
+        else
+        {
+            size_t step = BMP_GATHER_SIZE / group_channels * g;
+
+            for (size_t done = 0; done < whole;)
+            {
+                size_t k = whole - done < step ? whole - done : step;
+                uint64_t base = col + done * 8 / bits;
+                size_t channels = k * 8 / bits;
+
+                for (size_t t = 0; t < channels; t++)
+                    scratch[t] = row_ptr[channel32(base + t)];
+                lsb_extract_bits(scratch, data + i + done, k, bits);
+                done += k;
+            }
+        }
+        c += whole * 8 / bits;
+        i += whole;
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stego.h"
+
+/*
+ * BMP container layer
+ *
+ * Parses the file and DIB headers into a descriptor and maps
+ * "channel bytes" (the B, G, R bytes that carry payload bits)
+ * to file offsets. Row padding and the alpha byte of 32 bpp
+ * images are never touched. Channels are numbered in file order,
+ * so bottom-up and top-down images are walked the same way.
+ */
+
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_MAX_HEADER_SIZE (BMP_FILE_HEADER_SIZE + 124 + 12)  // up to BITMAPV5 + masks
+#define BMP_MIN_HEADER_SIZE 54
+#define BMP_MAX_PREFIX_SIZE (64 * 1024)  // headers + gap before the pixels of a piped image
+
+typedef struct
+{
+    uint32_t pixel_offset;      /* bfOffBits: first pixel byte */
+    uint32_t dib_size;          /* 40 (INFO), 108 (V4), 124 (V5) */
+    uint32_t width;
+    uint32_t height;            /* always positive */
+    int top_down;               /* negative height in the header */
+    uint16_t bpp;               /* 24 or 32 */
+    uint64_t stride;            /* bytes per row, padding included */
+    uint64_t row_channels;      /* payload carrying bytes per row */
+    uint64_t capacity;          /* payload carrying bytes in the image */
+    uint64_t pixel_end;         /* file offset just past the pixel array */
+} BmpInfo;
+
+/*
+ * Parse the first len bytes of a BMP (at least BMP_MIN_HEADER_SIZE,
+ * BMP_MAX_HEADER_SIZE covers every variant). file_len is the total
+ * file size used to check the pixel array, 0 if unknown.
+ */
+StegoError bmp_parse(const unsigned char *hdr, size_t len, uint64_t file_len, BmpInfo *info);
+
+/* File offset of channel byte c; c == capacity gives pixel_end */
+uint64_t bmp_channel_offset(const BmpInfo *info, uint64_t c);
+
+/* Parse the header of an open file descriptor (regular files get a size check) */
+StegoError bmp_read_fd(int fd, BmpInfo *info);
+
+/*
+ * Parse the image on a stream that cannot seek (pipe): read() every
+ * byte before the pixel array into buf (cap bytes), leaving the
+ * stream at the first pixel. The caller copies buf to the output.
+ */
+StegoError bmp_read_prefix(int fd, unsigned char *buf, size_t cap, BmpInfo *info);
+
+/* True when channel bytes are one contiguous run (24 bpp, no padding) */
+int bmp_is_dense(const BmpInfo *info);
+
+/* Upper bound of file bytes spanned by any run of `channels` channel bytes */
+uint64_t bmp_span_max(const BmpInfo *info, uint64_t channels);
+
+/*
+ * Embed n payload bytes, bits (1..4) per channel, into channels
+ * [c0, c0 + LSB_CHANNELS(n, bits)). src and dst hold file bytes
+ * starting at file offset buf_off and must cover that channel span.
+ * Bytes in between (padding, alpha) are copied from src when
+ * dst != src. c0 must start a group (see lsb.h).
+ */
+void bmp_embed(const BmpInfo *info, unsigned char *dst, const unsigned char *src,
+               uint64_t buf_off, uint64_t c0, const unsigned char *data, size_t n, int bits);
+
+/* Extract n payload bytes stored bits per channel from c0 on (file bytes from buf_off) */
+void bmp_extract(const BmpInfo *info, const unsigned char *buf, uint64_t buf_off,
+                 uint64_t c0, unsigned char *data, size_t n, int bits);
+
+#endif
@@ -0,0 +1,480 @@
+#include <string.h>
+#include "cipher.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CIPHER_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+/* "expand 32-byte k" */
+static const uint32_t chacha_sigma[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+/*-----------------------------------------------------------
+ * ChaCha20 keystream. Block b uses counter b (words 12-13),
+ * the nonce words are 0. Stream byte i is keystream byte i of
+ * block 1 on: block 0 keys the MAC.
+ -----------------------------------------------------------*/
+#define CHACHA_QR(a, b, c, d)                   \
+    do {                                        \
+        a += b; d ^= a; d = ROTL32(d, 16);      \
+        c += d; b ^= c; b = ROTL32(b, 12);      \
+        a += b; d ^= a; d = ROTL32(d, 8);       \
+        c += d; b ^= c; b = ROTL32(b, 7);       \
+    } while (0)
+
+static void chacha_block(const uint32_t key[8], uint64_t counter, unsigned char out[64])
+{
+    uint32_t in[16], x[16];
+
+    memcpy(in, chacha_sigma, sizeof(chacha_sigma));
+    memcpy(in + 4, key, 8 * sizeof(uint32_t));
+    in[12] = (uint32_t)counter;
+    in[13] = (uint32_t)(counter >> 32);
+    in[14] = in[15] = 0;
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; i++)
+    {
+        CHACHA_QR(x[0], x[4], x[8], x[12]);
+        CHACHA_QR(x[1], x[5], x[9], x[13]);
+        CHACHA_QR(x[2], x[6], x[10], x[14]);
+        CHACHA_QR(x[3], x[7], x[11], x[15]);
+        CHACHA_QR(x[0], x[5], x[10], x[15]);
+        CHACHA_QR(x[1], x[6], x[11], x[12]);
+        CHACHA_QR(x[2], x[7], x[8], x[13]);
+        CHACHA_QR(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++)
+        put_le32(out + 4 * i, x[i] + in[i]);
+}
+
+/* XOR blocks keystream blocks from counter into buf, one at a time */
+static void chacha_xor_portable(const uint32_t key[8], uint64_t counter, unsigned char *buf, size_t blocks)
+{
+    unsigned char ks[64];
+
+    for (; blocks > 0; blocks--, counter++, buf += 64)
+    {
+        chacha_block(key, counter, ks);
+        for (int i = 0; i < 64; i++)
+            buf[i] ^= ks[i];
+    }
+}
+
+#ifdef CIPHER_HAVE_X86
+/*-----------------------------------------------------------
+ * Vector kernels: lane j of vector i holds word i of block
+ * counter + j, so the rounds run on whole vectors and the
+ * state is transposed back to block order at the end.
+ -----------------------------------------------------------*/
+#define CHACHA_ROUNDS(QR)                       \
+    for (int r = 0; r < 10; r++)                \
+    {                                           \
+        QR(x[0], x[4], x[8], x[12]);            \
+        QR(x[1], x[5], x[9], x[13]);            \
+        QR(x[2], x[6], x[10], x[14]);           \
+        QR(x[3], x[7], x[11], x[15]);           \
+        QR(x[0], x[5], x[10], x[15]);           \
+        QR(x[1], x[6], x[11], x[12]);           \
+        QR(x[2], x[7], x[8], x[13]);            \
+        QR(x[3], x[4], x[9], x[14]);            \
+    }
+
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define SSE2_QR(a, b, c, d)                                                     \
+    do {                                                                        \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 16); \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 12); \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 8);  \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 7);  \
+    } while (0)
+
+/* 4 blocks per iteration, returns the blocks done */
+__attribute__((target("sse2")))
+static size_t chacha_xor_sse2(const uint32_t key[8], uint64_t counter, unsigned char *buf, size_t blocks)
+{
+    size_t done = 0;
+
+    for (; blocks - done >= 4; done += 4, counter += 4, buf += 256)
+    {
+        __m128i in[16], x[16];
+        uint32_t lo[4], hi[4];
+
+        for (int i = 0; i < 4; i++)
+        {
+            in[i] = _mm_set1_epi32((int)chacha_sigma[i]);
+            lo[i] = (uint32_t)(counter + i);
+            hi[i] = (uint32_t)((counter + i) >> 32);
+        }
+        for (int i = 0; i < 8; i++)
+            in[4 + i] = _mm_set1_epi32((int)key[i]);
+        in[12] = _mm_loadu_si128((const __m128i *)lo);
+        in[13] = _mm_loadu_si128((const __m128i *)hi);
+        in[14] = in[15] = _mm_setzero_si128();
+        memcpy(x, in, sizeof(x));
+
+        CHACHA_ROUNDS(SSE2_QR)
+
+        /* Words 4g..4g+3 of the four blocks form one 4x4 transpose */
+        for (int g = 0; g < 4; g++)
+        {
+            __m128i a = _mm_add_epi32(x[4 * g], in[4 * g]);
+            __m128i b = _mm_add_epi32(x[4 * g + 1], in[4 * g + 1]);
+            __m128i c = _mm_add_epi32(x[4 * g + 2], in[4 * g + 2]);
+            __m128i d = _mm_add_epi32(x[4 * g + 3], in[4 * g + 3]);
+            __m128i t0 = _mm_unpacklo_epi32(a, b), t1 = _mm_unpacklo_epi32(c, d);
+            __m128i t2 = _mm_unpackhi_epi32(a, b), t3 = _mm_unpackhi_epi32(c, d);
+            __m128i ks[4] = { _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                              _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3) };
+
+            for (int j = 0; j < 4; j++)
+            {
+                __m128i *p = (__m128i *)(buf + 64 * j + 16 * g);
+                _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), ks[j]));
+            }
+        }
+    }
+    return done;
+}
+
+#define AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_QR(a, b, c, d)                                                                 \
+    do {                                                                                    \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX2_ROTL(b, 12);       \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8); \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX2_ROTL(b, 7);        \
+    } while (0)
+
+/* 8 blocks per iteration, returns the blocks done */
+__attribute__((target("avx2")))
+static size_t chacha_xor_avx2(const uint32_t key[8], uint64_t counter, unsigned char *buf, size_t blocks)
+{
+    /* Rotations by 16 and 8 are byte shuffles */
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    size_t done = 0;
+
+    for (; blocks - done >= 8; done += 8, counter += 8, buf += 512)
+    {
+        __m256i in[16], x[16], ks[4][4];
+        uint32_t lo[8], hi[8];
+
+        for (int i = 0; i < 8; i++)
+        {
+            lo[i] = (uint32_t)(counter + i);
+            hi[i] = (uint32_t)((counter + i) >> 32);
+            in[4 + i] = _mm256_set1_epi32((int)key[i]);
+        }
+        for (int i = 0; i < 4; i++)
+            in[i] = _mm256_set1_epi32((int)chacha_sigma[i]);
+        in[12] = _mm256_loadu_si256((const __m256i *)lo);
+        in[13] = _mm256_loadu_si256((const __m256i *)hi);
+        in[14] = in[15] = _mm256_setzero_si256();
+        memcpy(x, in, sizeof(x));
+
+        CHACHA_ROUNDS(AVX2_QR)
+
+        /* Per 128-bit lane as in SSE2: ks[g][j] = words 4g..4g+3 of blocks j and j + 4 */
+        for (int g = 0; g < 4; g++)
+        {
+            __m256i a = _mm256_add_epi32(x[4 * g], in[4 * g]);
+            __m256i b = _mm256_add_epi32(x[4 * g + 1], in[4 * g + 1]);
+            __m256i c = _mm256_add_epi32(x[4 * g + 2], in[4 * g + 2]);
+            __m256i d = _mm256_add_epi32(x[4 * g + 3], in[4 * g + 3]);
+            __m256i t0 = _mm256_unpacklo_epi32(a, b), t1 = _mm256_unpacklo_epi32(c, d);
+            __m256i t2 = _mm256_unpackhi_epi32(a, b), t3 = _mm256_unpackhi_epi32(c, d);
+
+            ks[g][0] = _mm256_unpacklo_epi64(t0, t1);
+            ks[g][1] = _mm256_unpackhi_epi64(t0, t1);
+            ks[g][2] = _mm256_unpacklo_epi64(t2, t3);
+            ks[g][3] = _mm256_unpackhi_epi64(t2, t3);
+        }
+
+        /* Pair the lanes of words 0-7 and 8-15 into 32 contiguous bytes */
+        for (int j = 0; j < 4; j++)
+        {
+            for (int half = 0; half < 2; half++)
+            {
+                __m256i lo_blk = _mm256_permute2x128_si256(ks[2 * half][j], ks[2 * half + 1][j], 0x20);
+                __m256i hi_blk = _mm256_permute2x128_si256(ks[2 * half][j], ks[2 * half + 1][j], 0x31);
+                __m256i *p = (__m256i *)(buf + 64 * j + 32 * half);
+                __m256i *q = (__m256i *)(buf + 64 * (j + 4) + 32 * half);
+
+                _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), lo_blk));
+                _mm256_storeu_si256(q, _mm256_xor_si256(_mm256_loadu_si256(q), hi_blk));
+            }
+        }
+    }
+    return done;
+}
+#endif
+
+/* Whole blocks through the widest kernel the CPU has, the rest one by one */
+static void chacha_xor_blocks(const uint32_t key[8], uint64_t counter, unsigned char *buf, size_t blocks)
+{
+    size_t done = 0;
+
+#ifdef CIPHER_HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+        done = chacha_xor_avx2(key, counter, buf, blocks);
+    else if (__builtin_cpu_supports("sse2"))
+        done = chacha_xor_sse2(key, counter, buf, blocks);
+#endif
+    chacha_xor_portable(key, counter + done, buf + 64 * done, blocks - done);
+}
+
+void cipher_xor(const Cipher *c, uint64_t offset, unsigned char *buf, size_t n)
+{
+    unsigned char ks[64];
+    uint64_t counter = 1 + offset / 64;
+    size_t skip = (size_t)(offset % 64);
+
+    /* A range starting inside a block takes the rest of that block first */
+    if (skip > 0 && n > 0)
+    {
+        size_t take = 64 - skip < n ? 64 - skip : n;
+
+        chacha_block(c->key, counter++, ks);
+        for (size_t i = 0; i < take; i++)
+            buf[i] ^= ks[skip + i];
+        buf += take;
+        n -= take;
+    }
+
+    chacha_xor_blocks(c->key, counter, buf, n / 64);
+    counter += n / 64;
+    buf += n / 64 * 64;
+    n %= 64;
+
+    if (n > 0)
+    {
+        chacha_block(c->key, counter, ks);
+        for (size_t i = 0; i < n; i++)
+            buf[i] ^= ks[i];
+    }
+}
+
+/*-----------------------------------------------------------
+ * Poly1305 modulo 2^130 - 5 in five 26-bit limbs (products
+ * fit 64 bits without 128-bit arithmetic)
+ -----------------------------------------------------------*/
+#define LIMB_MASK 0x3ffffff
+
+/* h = h * r, partly reduced (h and r may be the same array) */
+static void poly_mul(uint32_t h[5], const uint32_t r[5])
+{
+    uint64_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4];
+    uint64_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint64_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+    uint64_t d0, d1, d2, d3, d4, c;
+
+    d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+    d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + h4 * s2;
+    d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + h4 * s3;
+    d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + h4 * s4;
+    d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + h4 * r0;
+
+    c = d0 >> 26; h[0] = (uint32_t)d0 & LIMB_MASK;
+    d1 += c; c = d1 >> 26; h[1] = (uint32_t)d1 & LIMB_MASK;
+    d2 += c; c = d2 >> 26; h[2] = (uint32_t)d2 & LIMB_MASK;
+    d3 += c; c = d3 >> 26; h[3] = (uint32_t)d3 & LIMB_MASK;
+    d4 += c; c = d4 >> 26; h[4] = (uint32_t)d4 & LIMB_MASK;
+    h[0] += (uint32_t)c * 5;
+    h[1] += h[0] >> 26;
+    h[0] &= LIMB_MASK;
+}
+
+/* Absorb whole 16-byte blocks */
+static void poly_blocks(Cipher *c, const unsigned char *m, size_t n)
+{
+    for (; n >= 16; n -= 16, m += 16)
+    {
+        c->h[0] += get_le32(m) & LIMB_MASK;
+        c->h[1] += (get_le32(m + 3) >> 2) & LIMB_MASK;
+        c->h[2] += (get_le32(m + 6) >> 4) & LIMB_MASK;
+        c->h[3] += (get_le32(m + 9) >> 6) & LIMB_MASK;
+        c->h[4] += (get_le32(m + 12) >> 8) | (1u << 24);
+        poly_mul(c->h, c->r);
+    }
+}
+
+void cipher_init(Cipher *c, const unsigned char key[CIPHER_KEY_SIZE])
+{
+    unsigned char block0[64];
+
+    memset(c, 0, sizeof(*c));
+    for (int i = 0; i < 8; i++)
+        c->key[i] = get_le32(key + 4 * i);
+
+    /* One-time MAC key: the first 32 bytes of keystream block 0, r clamped */
+    chacha_block(c->key, 0, block0);
+    c->r[0] = get_le32(block0) & 0x3ffffff;
+    c->r[1] = (get_le32(block0 + 3) >> 2) & 0x3ffff03;
+    c->r[2] = (get_le32(block0 + 6) >> 4) & 0x3ffc0ff;
+    c->r[3] = (get_le32(block0 + 9) >> 6) & 0x3f03fff;
+    c->r[4] = (get_le32(block0 + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 4; i++)
+        c->s[i] = get_le32(block0 + 16 + 4 * i);
+    memset(block0, 0, sizeof(block0));
+}
+
+void cipher_auth(Cipher *c, const unsigned char *data, size_t n)
+{
+    c->len += n;
+    if (c->n_pending > 0)
+    {
+        size_t take = 16 - c->n_pending < n ? 16 - c->n_pending : n;
+
+        memcpy(c->pending + c->n_pending, data, take);
+        c->n_pending += take;
+        data += take;
+        n -= take;
+        if (c->n_pending < 16)
+            return;
+        poly_blocks(c, c->pending, 16);
+        c->n_pending = 0;
+    }
+
+    poly_blocks(c, data, n / 16 * 16);
+    memcpy(c->pending, data + n / 16 * 16, n % 16);
+    c->n_pending = n % 16;
+}
+
+void cipher_encrypt(Cipher *c, unsigned char *buf, size_t n)
+{
+    cipher_xor(c, c->len, buf, n);
+    cipher_auth(c, buf, n);
+}
+
+void cipher_decrypt(Cipher *c, unsigned char *buf, size_t n)
+{
+    uint64_t offset = c->len;
+
+    cipher_auth(c, buf, n);
+    cipher_xor(c, offset, buf, n);
+}
+
+void cipher_fork(const Cipher *c, Cipher *piece)
+{
+    *piece = *c;
+    memset(piece->h, 0, sizeof(piece->h));
+    piece->n_pending = 0;
+    piece->len = 0;
+}
+
+/* h(A then B) = h(A) * r^(blocks of B) + h(B), the same as moving a CRC over B */
+void cipher_join(Cipher *c, const Cipher *piece)
+{
+    uint32_t rk[5] = { 1, 0, 0, 0, 0 };
+    uint32_t base[5];
+    uint64_t k = (piece->len - piece->n_pending) / 16;
+
+    memcpy(base, c->r, sizeof(base));
+    for (; k > 0; k >>= 1)
+    {
+        if (k & 1)
+            poly_mul(rk, base);
+        poly_mul(base, base);
+    }
+    poly_mul(c->h, rk);
+
+    for (int i = 0; i < 5; i++)
+        c->h[i] += piece->h[i];
+    for (int i = 0; i < 4; i++)
+    {
+        c->h[i + 1] += c->h[i] >> 26;
+        c->h[i] &= LIMB_MASK;
+    }
+    c->h[0] += (c->h[4] >> 26) * 5;
+    c->h[4] &= LIMB_MASK;
+
+    memcpy(c->pending, piece->pending, piece->n_pending);
+    c->n_pending = piece->n_pending;
+    c->len += piece->len;
+}
+
+void cipher_tag(const Cipher *c, unsigned char tag[CIPHER_TAG_SIZE])
+{
+    Cipher t = *c;
+    unsigned char lengths[16] = {0};
+    uint32_t h0, h1, h2, h3, h4, g0, g1, g2, g3, g4, mask;
+    uint64_t f;
+
+    /* Ciphertext zero padded to 16 bytes, then the lengths: no additional data */
+    if (t.n_pending > 0)
+    {
+        memset(t.pending + t.n_pending, 0, 16 - t.n_pending);
+        poly_blocks(&t, t.pending, 16);
+    }
+    put_le32(lengths + 8, (uint32_t)t.len);
+    put_le32(lengths + 12, (uint32_t)(t.len >> 32));
+    poly_blocks(&t, lengths, 16);
+
+    /* Full carry, then h - p if h >= p */
+    h0 = t.h[0]; h1 = t.h[1]; h2 = t.h[2]; h3 = t.h[3]; h4 = t.h[4];
+    h2 += h1 >> 26; h1 &= LIMB_MASK;
+    h3 += h2 >> 26; h2 &= LIMB_MASK;
+    h4 += h3 >> 26; h3 &= LIMB_MASK;
+    h0 += (h4 >> 26) * 5; h4 &= LIMB_MASK;
+    h1 += h0 >> 26; h0 &= LIMB_MASK;
+
+    g0 = h0 + 5; g1 = h1 + (g0 >> 26); g0 &= LIMB_MASK;
+    g2 = h2 + (g1 >> 26); g1 &= LIMB_MASK;
+    g3 = h3 + (g2 >> 26); g2 &= LIMB_MASK;
+    g4 = h4 + (g3 >> 26) - (1u << 26); g3 &= LIMB_MASK;
+
+    mask = (g4 >> 31) - 1;              /* all ones if h >= p */
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    /* tag = (h + s) mod 2^128 */
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+    f = (uint64_t)h0 + t.s[0];             put_le32(tag, (uint32_t)f);
+    f = (uint64_t)h1 + t.s[1] + (f >> 32); put_le32(tag + 4, (uint32_t)f);
+    f = (uint64_t)h2 + t.s[2] + (f >> 32); put_le32(tag + 8, (uint32_t)f);
+    f = (uint64_t)h3 + t.s[3] + (f >> 32); put_le32(tag + 12, (uint32_t)f);
+}
+
+int cipher_tag_equal(const unsigned char *a, const unsigned char *b)
+{
+    unsigned char diff = 0;
+
+    for (int i = 0; i < CIPHER_TAG_SIZE; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+const char *cipher_kernel_name(void)
+{
+#ifdef CIPHER_HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+    if (__builtin_cpu_supports("sse2"))
+        return "sse2";
+#endif
+    return "portable";
+}
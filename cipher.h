@@ -0,0 +1,68 @@
+#ifndef CIPHER_H
+#define CIPHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * ChaCha20-Poly1305 (RFC 8439) over the stored bytes of a
+ * STEGO_FLAG_ENCRYPT payload, with no additional data and an
+ * all-zero nonce: every image gets its own key (see kdf.h).
+ *
+ * The keystream is addressed by byte offset, so any range can be
+ * encrypted or decrypted on its own (parallel chunks, --range).
+ * The block counter is 64 bits wide, which is RFC 8439 for the
+ * first 256 GiB. Keystream blocks are generated 8 (AVX2) or 4
+ * (SSE2) at a time when the CPU has them, picked at runtime.
+ *
+ * The MAC is sequential, but pieces can be authenticated apart
+ * and joined in order (cipher_fork / cipher_join), like
+ * crc32c_combine.
+ */
+
+#define CIPHER_KEY_SIZE 32
+#define CIPHER_TAG_SIZE 16
+
+typedef struct
+{
+    uint32_t key[8];            /* ChaCha20 key words */
+    uint32_t r[5];              /* Poly1305 key, 26-bit limbs */
+    uint32_t s[4];
+    uint32_t h[5];              /* accumulator */
+    unsigned char pending[16];  /* bytes short of a whole MAC block */
+    size_t n_pending;
+    uint64_t len;               /* ciphertext bytes authenticated */
+} Cipher;
+
+/* Set up the keystream and the one-time MAC key (keystream block 0) */
+void cipher_init(Cipher *c, const unsigned char key[CIPHER_KEY_SIZE]);
+
+/* XOR the keystream of stream bytes [offset, offset + n) into buf */
+void cipher_xor(const Cipher *c, uint64_t offset, unsigned char *buf, size_t n);
+
+/* Add ciphertext bytes to the MAC */
+void cipher_auth(Cipher *c, const unsigned char *data, size_t n);
+
+/* Encrypt the next n bytes of the stream in place and authenticate them */
+void cipher_encrypt(Cipher *c, unsigned char *buf, size_t n);
+
+/* Authenticate the next n bytes of the stream, then decrypt them in place */
+void cipher_decrypt(Cipher *c, unsigned char *buf, size_t n);
+
+/* Copy of c with nothing authenticated yet, for the MAC of one piece */
+void cipher_fork(const Cipher *c, Cipher *piece);
+
+/* Append a piece forked from c that follows everything c has seen;
+ * c must hold a multiple of 16 bytes */
+void cipher_join(Cipher *c, const Cipher *piece);
+
+/* Tag of the ciphertext so far (c is not changed) */
+void cipher_tag(const Cipher *c, unsigned char tag[CIPHER_TAG_SIZE]);
+
+/* 1 if the tags match, in constant time */
+int cipher_tag_equal(const unsigned char *a, const unsigned char *b);
+
+/* Name of the keystream kernel ("avx2", "sse2" or "portable") */
+const char *cipher_kernel_name(void);
+
+#endif
@@ -1,7 +1,22 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <sys/types.h>
+#include "stego.h"
+
+/* Images and secrets past 2 GiB need a 64-bit off_t */
+_Static_assert(sizeof(off_t) == 8, "build with -D_FILE_OFFSET_BITS=64");
+
 /* Magic string to identify whether stegged or not */
-#define MAGIC_STRING "#*"
+#define MAGIC_STRING STEGO_MAGIC
+
+/* INFO messages, silenced when the info struct has quiet set */
+#define LOG_INFO(info, ...) do { if (!(info)->quiet) printf(__VA_ARGS__); } while (0)
+
+/* Target of LOG_INFO for code without an info struct of its own */
+typedef struct
+{
+    int quiet;
+} LogTarget;
 
 #endif
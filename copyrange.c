@@ -0,0 +1,74 @@
+#define _GNU_SOURCE             /* copy_file_range */
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "copyrange.h"
+
+/* copy_file_range until len bytes are done or the kernel declines */
+static uint64_t kernel_copy(int src_fd, uint64_t src_off, int dst_fd, uint64_t dst_off, uint64_t len)
+{
+    loff_t in = (loff_t)src_off, out = (loff_t)dst_off;
+    uint64_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = copy_file_range(src_fd, &in, dst_fd, &out, (size_t)(len - done), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += (uint64_t)n;
+    }
+    return done;
+}
+
+/*===========================================================
+ * FUNCTION NAME : copy_range
+ * PURPOSE       : Copy up to the next block boundary with
+ *                 copy_file_range, reflink the whole blocks
+ *                 after it, and copy_file_range whatever the
+ *                 reflink would not take
+ ===========================================================*/
+uint64_t copy_range(int src_fd, uint64_t src_off, int dst_fd, uint64_t dst_off, uint64_t len)
+{
+    struct stat src_st, dst_st;
+    uint64_t done = 0;
+
+    if (len == 0 || fstat(src_fd, &src_st) < 0 || fstat(dst_fd, &dst_st) < 0 ||
+        !S_ISREG(src_st.st_mode) || !S_ISREG(dst_st.st_mode))
+        return 0;
+
+    /* Extents are shared a block at a time, at the same place in the block on both sides */
+    uint64_t blk = dst_st.st_blksize > 0 ? (uint64_t)dst_st.st_blksize : 4096;
+#ifdef FICLONERANGE
+    if (src_off % blk == dst_off % blk)
+    {
+        uint64_t head = (blk - dst_off % blk) % blk;
+
+        if (head > len)
+            head = len;
+        done = kernel_copy(src_fd, src_off, dst_fd, dst_off, head);
+
+        /* A range ending at the source's end of file may end mid-block */
+        uint64_t rest = len - done;
+        if (src_off + len != (uint64_t)src_st.st_size)
+            rest -= rest % blk;
+        if (done == head && rest > 0)
+        {
+            struct file_clone_range range = {
+                .src_fd = src_fd,
+                .src_offset = src_off + done,
+                .src_length = rest,
+                .dest_offset = dst_off + done,
+            };
+            if (ioctl(dst_fd, FICLONERANGE, &range) == 0)
+                done += rest;
+        }
+    }
+#endif
+
+    return done + kernel_copy(src_fd, src_off + done, dst_fd, dst_off + done, len - done);
+}
@@ -0,0 +1,24 @@
+#ifndef COPYRANGE_H
+#define COPYRANGE_H
+
+#include <stdint.h>
+
+/*
+ * Kernel-side file copy for bytes that pass through unchanged.
+ * Whole blocks are reflinked (FICLONERANGE) where the file system
+ * can share extents (XFS, btrfs), so the copy is a metadata update;
+ * anything else goes through copy_file_range, which still never
+ * brings the data into userspace. Pipes, other file systems and
+ * kernels without either call copy nothing, and the caller falls
+ * back to read/write.
+ */
+
+/*
+ * Copy len bytes of src_fd at src_off to dst_fd at dst_off. The
+ * descriptors' file positions are not used or moved. Returns the
+ * bytes copied from the start of the range; fewer than len means
+ * the caller copies the rest itself.
+ */
+uint64_t copy_range(int src_fd, uint64_t src_off, int dst_fd, uint64_t dst_off, uint64_t len);
+
+#endif
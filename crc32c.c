@@ -0,0 +1,148 @@
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u
+
+/* Buffers from this size on are split into three interleaved streams */
+#define CRC32C_STRIPE_MIN 4096
+
+/*-----------------------------------------------------------
+ * Polynomial arithmetic modulo CRC32C_POLY (bit-reflected,
+ * as zlib's crc32_combine): moving a CRC register over n zero
+ * bytes multiplies it by x^(8n)
+ -----------------------------------------------------------*/
+
+/* a * b modulo the polynomial */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x^(8n) modulo the polynomial, squaring x^8, x^16, x^32, ... */
+static uint32_t x8nmodp(uint64_t n)
+{
+    uint32_t x2k = 1u << 23;            /* x^8 */
+    uint32_t p = 1u << 31;              /* x^0 */
+
+    for (; n > 0; n >>= 1)
+    {
+        if (n & 1)
+            p = multmodp(x2k, p);
+        x2k = multmodp(x2k, x2k);
+    }
+    return p;
+}
+
+/*-----------------------------------------------------------
+ * Portable kernel: 4 bits per lookup, a table small enough to
+ * write out (no start-up initialization, no global state)
+ -----------------------------------------------------------*/
+static const uint32_t crc32c_nibble[16] = {
+    0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+    0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9, 0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75,
+};
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n--)
+    {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ crc32c_nibble[crc & 15];
+        crc = (crc >> 4) ^ crc32c_nibble[crc & 15];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_X86
+/*-----------------------------------------------------------
+ * SSE4.2: 8 bytes per crc32 instruction. The instruction has
+ * a latency of 3 and a throughput of 1, so large buffers run
+ * three independent streams over thirds of the buffer and
+ * join them by shifting the first two registers forward.
+ -----------------------------------------------------------*/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t n)
+{
+    uint64_t c0 = crc;
+
+    if (n >= CRC32C_STRIPE_MIN)
+    {
+        size_t len = n / 24 * 8;
+        uint64_t c1 = 0, c2 = 0;
+
+        for (size_t i = 0; i < len; i += 8)
+        {
+            uint64_t v0, v1, v2;
+            memcpy(&v0, p + i, 8);
+            memcpy(&v1, p + len + i, 8);
+            memcpy(&v2, p + 2 * len + i, 8);
+            c0 = _mm_crc32_u64(c0, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+        }
+
+        uint32_t shift = x8nmodp(len);
+        c0 = multmodp(shift, (uint32_t)c0) ^ (uint32_t)c1;
+        c0 = multmodp(shift, (uint32_t)c0) ^ (uint32_t)c2;
+        p += 3 * len;
+        n -= 3 * len;
+    }
+
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c0 = _mm_crc32_u64(c0, v);
+    }
+    crc = (uint32_t)c0;
+    while (n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t n)
+{
+    const unsigned char *p = buf;
+
+    crc = ~crc;
+#ifdef CRC32C_HAVE_X86
+    if (__builtin_cpu_supports("sse4.2"))
+        return ~crc32c_sse42(crc, p, n);
+#endif
+    return ~crc32c_table(crc, p, n);
+}
+
+/* crc1 moved over len2 bytes, then the CRC of those bytes added in */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    return multmodp(x8nmodp(len2), crc1) ^ crc2;
+}
+
+const char *crc32c_kernel_name(void)
+{
+#ifdef CRC32C_HAVE_X86
+    if (__builtin_cpu_supports("sse4.2"))
+        return "sse4.2";
+#endif
+    return "table";
+}
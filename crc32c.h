@@ -0,0 +1,24 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli, reflected polynomial 0x82F63B78), the checksum
+ * of STEGO_FLAG_CRC payloads. The SSE4.2 crc32 instruction is used
+ * when the CPU has it (picked at runtime), a table kernel otherwise.
+ * Values chain like zlib's crc32: start from 0 and pass the last
+ * result back in, in any number of pieces.
+ */
+
+/* Checksum of buf continued from crc (0 for the first piece) */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t n);
+
+/* Checksum of A followed by B from crc1 = crc32c(A), crc2 = crc32c(B) and len2 = |B| */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+/* Name of the kernel crc32c runs ("sse4.2" or "table") */
+const char *crc32c_kernel_name(void);
+
+#endif
@@ -1,13 +1,29 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include "decode.h"
+#include "bmp.h"
+#include "lsb.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "kdf.h"
+#include "mapping.h"
+#include "parallel.h"
+#include "pipeio.h"
 #include "common.h"
 #include "types.h"
 
 /*****************************************************
  * Validate command-line args for decode mode
  * argv[2] = stego_image.bmp
- * argv[3] = output secret file (optional)
+ * argv[3] = output secret file (optional), or the
+ *           directory members of an archive go to
+ * Either may be "-" (stdin/stdout)
  *****************************************************/
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 {
@@ -19,7 +35,7 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 
     /* Check .bmp */
     char *ext = strstr(argv[2], ".bmp");
-    if (ext == NULL || strcmp(ext, ".bmp") != 0)
+    if (!pipe_is_std(argv[2]) && (ext == NULL || strcmp(ext, ".bmp") != 0))
     {
         printf("ERROR: Input stego image must be .bmp\n");
         return e_failure;
@@ -27,59 +43,308 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 
     decInfo->stego_image_fname = argv[2];
 
-    /* Output filename */
-    if (argv[3] != NULL)
-        strcpy(decInfo->output_fname, argv[3]);
-    else
-        strcpy(decInfo->output_fname, "decoded_secret.txt");
+    /* Output filename; the default depends on the payload, see do_decoding */
+    decInfo->output_fname = argv[3];
 
     return e_success;
 }
 
+/* Parse the stego image header; a pipe is left at the first pixel */
+static StegoError read_stego_bmp(DecodeInfo *decInfo)
+{
+    if (!decInfo->image_pipe)
+        return bmp_read_fd(fileno(decInfo->fptr_stego_image), &decInfo->bmp);
+
+    unsigned char *prefix = malloc(BMP_MAX_PREFIX_SIZE);
+    if (prefix == NULL)
+        return STEGO_ERR_NO_MEMORY;
+
+    StegoError err = bmp_read_prefix(fileno(decInfo->fptr_stego_image), prefix, BMP_MAX_PREFIX_SIZE, &decInfo->bmp);
+    decInfo->stream_pos = decInfo->bmp.pixel_offset;
+    free(prefix);
+    return err;
+}
+
 /*****************************************************
  * Open files for decoding
  *****************************************************/
 Status open_decode_files(DecodeInfo *decInfo)
 {
-    decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "r");
+    stats_stage(decInfo->stats, "open");
+    decInfo->fptr_stego_image = pipe_open(decInfo->stego_image_fname, "r");
     if (decInfo->fptr_stego_image == NULL)
     {
         perror("fopen");
         return e_failure;
     }
 
-    decInfo->fptr_output = fopen(decInfo->output_fname, "w");
+    /* Whole blocks are read/written at once, stdio buffering only adds copies */
+    setvbuf(decInfo->fptr_stego_image, NULL, _IONBF, 0);
+    decInfo->image_pipe = !pipe_seekable(decInfo->fptr_stego_image);
+
+    /* The pixel layout sizes the raw block buffer */
+    StegoError err = read_stego_bmp(decInfo);
+    if (err != STEGO_OK)
+    {
+        printf("ERROR: %s: %s\n", decInfo->stego_image_fname, stego_strerror(err));
+        return e_failure;
+    }
+
+    if (decInfo->buf_size == 0)
+        decInfo->buf_size = DEFAULT_DECODE_BUF_SIZE;
+    decInfo->image_data = malloc(bmp_span_max(&decInfo->bmp, decInfo->buf_size * 8));
+    decInfo->secret_data = malloc(decInfo->buf_size);
+    decInfo->view_off = decInfo->view_len = 0;
+    if (decInfo->image_data == NULL || decInfo->secret_data == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate %zu byte stream buffers\n", decInfo->buf_size);
+        return e_failure;
+    }
+
+    /* Only the pages holding the payload get touched through the mapping */
+    if (decInfo->use_mmap)
+    {
+        decInfo->image_map = map_input_file(decInfo->fptr_stego_image, &decInfo->image_map_len);
+        if (decInfo->image_map == NULL)
+            LOG_INFO(decInfo, "INFO: Stego image cannot be mapped, using buffered reads\n");
+    }
+
+    return e_success;
+}
+
+/*****************************************************
+ * Open (create or truncate) an output file, only
+ * after the payload header has been read
+ *****************************************************/
+static Status open_decode_output(DecodeInfo *decInfo, const char *fname)
+{
+    if (decInfo->fptr_output)
+        fclose(decInfo->fptr_output);
+    decInfo->fptr_output = pipe_open(fname, "w");
     if (decInfo->fptr_output == NULL)
     {
-        perror("fopen");
+        perror(fname);
         return e_failure;
     }
+    setvbuf(decInfo->fptr_output, NULL, _IONBF, 0);
+    decInfo->output_pipe = !pipe_seekable(decInfo->fptr_output);
 
+    struct stat st;
+    decInfo->output_file = fstat(fileno(decInfo->fptr_output), &st) == 0 && S_ISREG(st.st_mode);
     return e_success;
 }
 
 /*****************************************************
- * Decode a single byte from 8 bytes LSB
+ * Remove an output whose data failed its checks, so
+ * no garbage is left behind; a pipe or device has
+ * been handed the bytes already
  *****************************************************/
-char decode_byte_from_lsb(char *image_buffer)
+static void discard_output(DecodeInfo *decInfo, const char *fname)
+{
+    if (decInfo->output_file && remove(fname) == 0)
+        LOG_INFO(decInfo, "INFO: Removed %s\n", fname);
+    decInfo->output_file = 0;
+}
+
+/*****************************************************
+ * Open the output the shards of a striped payload
+ * share (created by the caller) and go to the place
+ * of this image's shard in it
+ *****************************************************/
+static Status open_shard_output(DecodeInfo *decInfo)
+{
+    if (decInfo->shard.count == 0)
+    {
+        printf("ERROR: %s is not part of a striped payload\n", decInfo->stego_image_fname);
+        return e_failure;
+    }
+
+    decInfo->fptr_output = fopen(decInfo->output_fname, "r+");
+    if (decInfo->fptr_output == NULL)
+    {
+        perror(decInfo->output_fname);
+        return e_failure;
+    }
+    setvbuf(decInfo->fptr_output, NULL, _IONBF, 0);
+    /* The caller removes the output of a set that fails */
+    decInfo->output_file = 0;
+    decInfo->output_off = decInfo->shard.offset;
+    if (fseeko(decInfo->fptr_output, (off_t)decInfo->output_off, SEEK_SET) != 0)
+    {
+        perror("fseeko");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*****************************************************
+ * Close decode files and free buffers
+ *****************************************************/
+void close_decode_files(DecodeInfo *decInfo)
+{
+    /* Rings left by a failed pass go first, their threads use the files */
+    ioring_close(decInfo->image_ring);
+    ioring_close(decInfo->output_ring);
+    decInfo->image_ring = decInfo->output_ring = NULL;
+    if (decInfo->fptr_stego_image)
+        fclose(decInfo->fptr_stego_image);
+    if (decInfo->fptr_output)
+        fclose(decInfo->fptr_output);
+    free(decInfo->image_data);
+    free(decInfo->secret_data);
+    unmap_input_file(decInfo->image_map, decInfo->image_map_len);
+
+    decInfo->image_map = NULL;
+    decInfo->fptr_stego_image = NULL;
+    decInfo->fptr_output = NULL;
+    decInfo->image_data = NULL;
+    decInfo->secret_data = NULL;
+}
+
+/*****************************************************
+ * Read the file bytes [span_start, span_start + span)
+ * into image_data. Bytes still held from the last
+ * refill are moved down instead of read again; a pipe
+ * only moves forward, skipping what is not needed.
+ *****************************************************/
+static Status read_image_span(DecodeInfo *decInfo, uint64_t span_start, size_t span)
 {
-    char data = 0;
-    for (int i = 0; i < 8; i++)
+    size_t keep = 0;
+
+    if (decInfo->image_view == decInfo->image_data && span_start >= decInfo->view_off &&
+        span_start < decInfo->view_off + decInfo->view_len)
     {
-        data = (data << 1) | (image_buffer[i] & 1);
+        keep = (size_t)(decInfo->view_off + decInfo->view_len - span_start);
+        memmove(decInfo->image_data, decInfo->image_data + (span_start - decInfo->view_off), keep);
+    }
+
+    uint64_t pos = span_start + keep;
+    if (decInfo->image_ring)
+    {
+        /* The ring has read ahead on its own thread */
+        if (ioring_read_at(decInfo->image_ring, decInfo->image_data + keep, span - keep, pos) != 0)
+            return e_failure;
+    }
+    else
+    {
+        if (decInfo->image_pipe)
+        {
+            if (pos < decInfo->stream_pos ||
+                pipe_skip(decInfo->fptr_stego_image, pos - decInfo->stream_pos) == e_failure)
+                return e_failure;
+            decInfo->stream_pos = span_start + span;
+        }
+        else if (fseeko(decInfo->fptr_stego_image, (off_t)pos, SEEK_SET) != 0)
+            return e_failure;
+
+        if (fread(decInfo->image_data + keep, 1, span - keep, decInfo->fptr_stego_image) != span - keep)
+            return e_failure;
+    }
+    stats_io(decInfo->stats, STAT_BYTES_READ, span - keep);
+
+    decInfo->image_view = decInfo->image_data;
+    decInfo->view_off = span_start;
+    decInfo->view_len = span;
+    return e_success;
+}
+
+/*****************************************************
+ * Extract payload bytes through the block buffer.
+ * The view is a window of raw file bytes; a refill reads
+ * the pixel rows holding the next decInfo->readahead
+ * payload bytes (padding included) at the current depth.
+ * Calls at depth 3 take whole groups except the last.
+ * Scattered payloads are read one tile piece at a time.
+ *****************************************************/
+Status decode_payload_bytes(DecodeInfo *decInfo, unsigned char *data, size_t n)
+{
+    const BmpInfo *bmp = &decInfo->bmp;
+    int bits = decInfo->stream_bits;
+    size_t g = LSB_GROUP_BYTES(bits);
+    size_t block = decInfo->buf_size / g * g;
+
+    while (n > 0)
+    {
+        size_t chunk = scatter_piece(decInfo->layout, decInfo->channel_pos, n < block ? n : block, bits);
+        uint64_t channels = LSB_CHANNELS(chunk, bits);
+
+        if (decInfo->channel_pos + channels > bmp->capacity)
+        {
+            printf("ERROR: Stego image ended before secret data\n");
+            return e_failure;
+        }
+
+        uint64_t c0 = scatter_channel(decInfo->layout, decInfo->channel_pos);
+
+        uint64_t span_start = bmp_channel_offset(bmp, c0);
+        uint64_t span_end = bmp_channel_offset(bmp, c0 + channels);
+
+        if (span_start < decInfo->view_off || span_end > decInfo->view_off + decInfo->view_len)
+        {
+            /* Refill: at least this chunk, up to readahead bytes, at most one block */
+            size_t want = decInfo->readahead > (int64_t)chunk ? (size_t)decInfo->readahead : chunk;
+            if (want > block)
+                want = block;
+            want = scatter_piece(decInfo->layout, decInfo->channel_pos, want, bits);
+            while (want > chunk && c0 + LSB_CHANNELS(want, bits) > bmp->capacity)
+                want = chunk;
+            size_t span = bmp_channel_offset(bmp, c0 + LSB_CHANNELS(want, bits)) - span_start;
+
+            if (decInfo->image_map)
+            {
+                /* Point straight into the mapping */
+                if (span_start + span > decInfo->image_map_len)
+                {
+                    printf("ERROR: Stego image ended before secret data\n");
+                    return e_failure;
+                }
+                decInfo->image_view = decInfo->image_map;
+                decInfo->view_off = 0;
+                decInfo->view_len = decInfo->image_map_len;
+                map_prefetch(decInfo->image_map, decInfo->image_map_len, span_start, span);
+            }
+            else if (read_image_span(decInfo, span_start, span) == e_failure)
+            {
+                printf("ERROR: Stego image ended before secret data\n");
+                return e_failure;
+            }
+        }
+
+        bmp_extract(bmp, decInfo->image_view, decInfo->view_off, c0, data, chunk, bits);
+        decInfo->channel_pos += channels;
+        decInfo->readahead -= (int64_t)chunk;
+        data += chunk;
+        n -= chunk;
     }
-    return data;
+    return e_success;
+}
+
+/*****************************************************
+ * Decode a single byte from 8 bytes LSB
+ *****************************************************/
+char decode_byte_from_lsb(char *image_buffer)
+{
+    unsigned char data;
+
+    lsb_extract_bytes((unsigned char *)image_buffer, &data, 1);
+    return (char)data;
 }
 
 /*****************************************************
- * Decode 32-bit value from 32 bytes LSB
+ * Decode a 32 or 64-bit size field (4 or 8 bytes)
+ * from 8 bytes LSB per byte
  *****************************************************/
-long decode_size_from_lsb(unsigned char *buffer)
+uint64_t decode_size_from_lsb(unsigned char *buffer, size_t size_len)
 {
-    long value = 0;
-    for (int i = 0; i < 32; i++)
+    unsigned char bytes[8];
+    uint64_t value = 0;
+
+    if (size_len > sizeof(bytes))
+        size_len = sizeof(bytes);
+    lsb_extract_bytes(buffer, bytes, size_len);
+    for (size_t i = 0; i < size_len; i++)
     {
-        value = (value << 1) | (buffer[i] & 1);
+        value = (value << 8) | bytes[i];
     }
     return value;
 }
@@ -89,22 +354,24 @@ long decode_size_from_lsb(unsigned char *buffer)
  *****************************************************/
 Status decode_magic_string(DecodeInfo *decInfo)
 {
-    char buffer[8];
     char magic_read[3];
     magic_read[2] = '\0';
 
-    /* Skip BMP header (54 bytes) */
-    fseek(decInfo->fptr_stego_image, 54, SEEK_SET);
+    /* Payload starts at the first pixel, the header at 1 bit per channel */
+    decInfo->channel_pos = 0;
+    decInfo->stream_bits = decInfo->bits = 1;
+    decInfo->flags = 0;
+    decInfo->version = 0;
+    decInfo->view_off = decInfo->view_len = 0;
 
-    for (int i = 0; i < 2; i++)
-    {
-        fread(buffer, 8, 1, decInfo->fptr_stego_image);
-        magic_read[i] = decode_byte_from_lsb(buffer);
-    }
+    /* First refill covers all header fields in one read */
+    decInfo->readahead = DECODE_HEADER_READAHEAD;
+    if (decode_payload_bytes(decInfo, (unsigned char *)magic_read, 2) == e_failure)
+        return e_failure;
 
     if (strcmp(magic_read, MAGIC_STRING) == 0)
     {
-        printf("INFO: Magic string verified\n");
+        LOG_INFO(decInfo, "INFO: Magic string verified\n");
         return e_success;
     }
     else
@@ -119,11 +386,69 @@ Status decode_magic_string(DecodeInfo *decInfo)
  *****************************************************/
 Status decode_secret_extn_size(DecodeInfo *decInfo, int *extn_size)
 {
-    unsigned char buffer[32];
+    unsigned char bytes[4];
+
+    if (decode_payload_bytes(decInfo, bytes, 4) == e_failure)
+        return e_failure;
+
+    /* An extended header puts version and flags before the real size */
+    uint32_t word = stego_get_u32(bytes);
+    if (word & STEGO_HDR_EXTENDED)
+    {
+        if (decode_payload_format(decInfo, word) == e_failure)
+            return e_failure;
+        if (decode_payload_bytes(decInfo, bytes, 4) == e_failure)
+            return e_failure;
+        word = stego_get_u32(bytes);
+    }
+    *extn_size = (int)word;
+
+    /* Guard the fixed-size extension buffer */
+    if (*extn_size < 0 || *extn_size >= MAX_SECRET_EXT)
+    {
+        printf("ERROR: Invalid secret file extension size %d\n", *extn_size);
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/*****************************************************
+ * Decode the extended header version and flags
+ * (data depth, compression, size field width)
+ *****************************************************/
+Status decode_payload_format(DecodeInfo *decInfo, uint32_t marker)
+{
+    unsigned char bytes[4];
+
+    if (decode_payload_bytes(decInfo, bytes, 4) == e_failure)
+        return e_failure;
+    uint32_t flags = stego_get_u32(bytes);
 
-    fread(buffer, 32, 1, decInfo->fptr_stego_image);
-    *extn_size = decode_size_from_lsb(buffer);
+    decInfo->version = marker & ~STEGO_HDR_EXTENDED;
+    if (decInfo->version < STEGO_HDR_VERSION_SIZE32 || decInfo->version > STEGO_HDR_VERSION ||
+        (flags & ~STEGO_KNOWN_FLAGS) != 0)
+    {
+        printf("ERROR: Payload format %u (flags 0x%x) is not supported\n",
+               (unsigned)decInfo->version, (unsigned)flags);
+        return e_failure;
+    }
 
+    decInfo->bits = (int)(flags & STEGO_FLAG_BITS_MASK);
+    decInfo->flags = flags & ~STEGO_FLAG_BITS_MASK;
+    if (decInfo->bits < 1 || decInfo->bits > LSB_MAX_BITS)
+    {
+        printf("ERROR: Invalid bits per channel %d\n", decInfo->bits);
+        return e_failure;
+    }
+    LOG_INFO(decInfo, "INFO: Payload uses %d bits per channel%s%s%s%s%s%s%s\n", decInfo->bits,
+             (decInfo->flags & STEGO_FLAG_LZ) ? ", LZ compressed" : "",
+             (decInfo->flags & STEGO_FLAG_STREAM) ? ", streamed" : "",
+             (decInfo->flags & STEGO_FLAG_ARCHIVE) ? ", archive" : "",
+             (decInfo->flags & STEGO_FLAG_CRC) ? ", CRC32C" : "",
+             (decInfo->flags & STEGO_FLAG_ENCRYPT) ? ", encrypted" : "",
+             (decInfo->flags & STEGO_FLAG_SCATTER) ? ", scattered" : "",
+             (decInfo->flags & STEGO_FLAG_SHARD) ? ", shard" : "");
     return e_success;
 }
 
@@ -132,77 +457,925 @@ Status decode_secret_extn_size(DecodeInfo *decInfo, int *extn_size)
  *****************************************************/
 Status decode_secret_extn(DecodeInfo *decInfo, char *extn, int extn_size)
 {
-    unsigned char buffer[8];
+    if (decode_payload_bytes(decInfo, (unsigned char *)extn, extn_size) == e_failure)
+        return e_failure;
+    extn[extn_size] = '\0';
+
+    return e_success;
+}
+
+/* Read one size field: 8 bytes from header version 2 on, else 4 */
+static Status decode_payload_size(DecodeInfo *decInfo, uint64_t *value)
+{
+    unsigned char bytes[8];
 
-    for (int i = 0; i < extn_size; i++)
+    if (decInfo->version < STEGO_HDR_VERSION)
     {
-        fread(buffer, 8, 1, decInfo->fptr_stego_image);
-        extn[i] = decode_byte_from_lsb((char *)buffer);
+        if (decode_payload_bytes(decInfo, bytes, 4) == e_failure)
+            return e_failure;
+        *value = stego_get_u32(bytes);
+        return e_success;
     }
-    extn[extn_size] = '\0';
-
+    if (decode_payload_bytes(decInfo, bytes, 8) == e_failure)
+        return e_failure;
+    *value = stego_get_u64(bytes);
     return e_success;
 }
 
 /*****************************************************
  * Decode secret file size
  *****************************************************/
-Status decode_secret_file_size(DecodeInfo *decInfo, long *fsize)
+Status decode_secret_file_size(DecodeInfo *decInfo, uint64_t *fsize)
+{
+    if (decode_payload_size(decInfo, fsize) == e_failure)
+        return e_failure;
+    decInfo->file_size = *fsize;
+
+    /* Compressed data: *fsize is what is stored, the original size follows */
+    if ((decInfo->flags & STEGO_FLAG_LZ) &&
+        decode_payload_size(decInfo, &decInfo->file_size) == e_failure)
+        return e_failure;
+
+    return e_success;
+}
+
+/*****************************************************
+ * Decode the shard record of one image of a striped
+ * payload: which part of the secret its data is
+ *****************************************************/
+Status decode_shard_record(DecodeInfo *decInfo)
+{
+    unsigned char rec[STEGO_SHARD_SIZE];
+    const StegoShard *shard = &decInfo->shard;
+
+    if (decode_payload_bytes(decInfo, rec, sizeof(rec)) == e_failure)
+        return e_failure;
+    stego_shard_unpack(rec, &decInfo->shard);
+
+    if (shard->index >= shard->count || shard->offset > shard->total ||
+        decInfo->file_size > shard->total - shard->offset ||
+        (decInfo->flags & (STEGO_FLAG_STREAM | STEGO_FLAG_ARCHIVE)))
+    {
+        printf("ERROR: Invalid shard record\n");
+        return e_failure;
+    }
+    LOG_INFO(decInfo, "INFO: Shard %u of %u: secret bytes %llu to %llu of %llu\n",
+             (unsigned)shard->index + 1, (unsigned)shard->count, (unsigned long long)shard->offset,
+             (unsigned long long)(shard->offset + decInfo->file_size), (unsigned long long)shard->total);
+    return e_success;
+}
+
+/*****************************************************
+ * Decode the salt of an encrypted payload and derive
+ * its key from the passphrase given with -p (and the
+ * tile layout of a scattered one)
+ *****************************************************/
+Status decode_key_salt(DecodeInfo *decInfo)
+{
+    unsigned char salt[STEGO_SALT_SIZE], key[KDF_KEY_SIZE];
+
+    if (decode_payload_bytes(decInfo, salt, STEGO_SALT_SIZE) == e_failure)
+        return e_failure;
+    if (decInfo->passphrase == NULL)
+    {
+        printf("ERROR: Payload is encrypted, give its passphrase with -p\n");
+        return e_failure;
+    }
+
+    LOG_INFO(decInfo, "INFO: Deriving Key from Passphrase...\n");
+    kdf_derive_key(decInfo->passphrase, salt, key);
+    cipher_init(&decInfo->cipher, key);
+
+    /* The salt ends the header, the tiles start right after it */
+    if (decInfo->flags & STEGO_FLAG_SCATTER)
+    {
+        scatter_init(&decInfo->tiles, key, decInfo->channel_pos, decInfo->bmp.capacity);
+        decInfo->layout = &decInfo->tiles;
+    }
+    memset(key, 0, sizeof(key));
+
+    if (decInfo->layout && decInfo->image_pipe)
+    {
+        printf("ERROR: Scattered payloads need the stego image as a file, not a pipe\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*****************************************************
+ * Multi-threaded data decode (-j N)
+ * Secret byte i sits at channel data_pos + i * 8 / bits,
+ * so each worker preads (or maps) the pixel span of one
+ * whole-group chunk and pwrites the decoded bytes at i.
+ *****************************************************/
+typedef struct
+{
+    DecodeInfo *decInfo;
+    uint64_t data_pos;              /* channel of secret byte 0 */
+    uint64_t fsize;
+    size_t chunk;                   /* PARALLEL_CHUNK_SIZE in whole groups (and MAC blocks) */
+    int bits;
+    unsigned char *image_bufs[MAX_THREADS];
+    unsigned char *secret_bufs[MAX_THREADS];
+    uint32_t *crcs;                 /* CRC32C of every chunk, when verified */
+    Cipher *macs;                   /* MAC of every chunk, when verified */
+    atomic_int failed;
+} ParallelDecode;
+
+static void decode_chunk(void *ctx, size_t index, int worker)
+{
+    ParallelDecode *job = ctx;
+    DecodeInfo *decInfo = job->decInfo;
+    uint64_t off = (uint64_t)index * job->chunk;
+    size_t n = job->fsize - off < job->chunk ? (size_t)(job->fsize - off) : job->chunk;
+    uint64_t c = job->data_pos + LSB_CHANNELS(off, job->bits);
+
+    if (atomic_load(&job->failed))
+        return;
+
+    /* One pixel span, or one per tile when scattered */
+    for (size_t done = 0; done < n;)
+    {
+        size_t piece = scatter_piece(decInfo->layout, c, n - done, job->bits);
+        uint64_t c0 = scatter_channel(decInfo->layout, c);
+        uint64_t span_start = bmp_channel_offset(&decInfo->bmp, c0);
+        size_t span = bmp_channel_offset(&decInfo->bmp, c0 + LSB_CHANNELS(piece, job->bits)) - span_start;
+        const unsigned char *src = job->image_bufs[worker];
+
+        if (decInfo->image_map)
+            src = decInfo->image_map + span_start;
+        else if (pread(fileno(decInfo->fptr_stego_image), job->image_bufs[worker], span, (off_t)span_start) != (ssize_t)span)
+        {
+            atomic_store(&job->failed, 1);
+            return;
+        }
+        else
+            stats_io(decInfo->stats, STAT_BYTES_READ, span);
+
+        bmp_extract(&decInfo->bmp, src, span_start, c0, job->secret_bufs[worker] + done, piece, job->bits);
+        c += LSB_CHANNELS(piece, job->bits);
+        done += piece;
+    }
+    if (job->crcs)
+        job->crcs[index] = crc32c(0, job->secret_bufs[worker], n);
+    if (job->macs)
+    {
+        cipher_fork(&decInfo->cipher, &job->macs[index]);
+        cipher_auth(&job->macs[index], job->secret_bufs[worker], n);
+    }
+    if (decInfo->flags & STEGO_FLAG_ENCRYPT)
+        cipher_xor(&decInfo->cipher, off, job->secret_bufs[worker], n);
+    if (pwrite(fileno(decInfo->fptr_output), job->secret_bufs[worker], n, (off_t)(decInfo->output_off + off)) !=
+        (ssize_t)n)
+        atomic_store(&job->failed, 1);
+    else
+        stats_io(decInfo->stats, STAT_BYTES_WRITTEN, n);
+}
+
+static Status decode_secret_file_data_parallel(DecodeInfo *decInfo, uint64_t fsize)
+{
+    ParallelDecode job;
+    int threads = decInfo->threads > MAX_THREADS ? MAX_THREADS : decInfo->threads;
+    Status ret = e_success;
+
+    memset(&job, 0, sizeof(job));
+    job.decInfo = decInfo;
+    job.fsize = fsize;
+    job.bits = decInfo->stream_bits;
+    atomic_init(&job.failed, 0);
+
+    /* MAC pieces can only be joined on whole 16 byte blocks */
+    size_t align = LSB_GROUP_BYTES(job.bits) * ((decInfo->flags & STEGO_FLAG_ENCRYPT) ? 16 : 1);
+    job.chunk = PARALLEL_CHUNK_SIZE / align * align;
+
+    /* The header may have read ahead: data starts at the first unconsumed channel */
+    job.data_pos = decInfo->channel_pos;
+
+    size_t chunks = (fsize + job.chunk - 1) / job.chunk;
+    uint64_t channels = LSB_CHANNELS(fsize, job.bits);
+    uint64_t data_end = bmp_channel_offset(&decInfo->bmp, job.data_pos + channels);
+    if (job.data_pos + channels > decInfo->bmp.capacity ||
+        (decInfo->image_map && data_end > decInfo->image_map_len))
+    {
+        printf("ERROR: Stego image ended before secret data\n");
+        return e_failure;
+    }
+
+    if (decInfo->verify_crc && (job.crcs = malloc(sizeof(*job.crcs) * (chunks + 1))) == NULL)
+        atomic_store(&job.failed, 1);
+    if (decInfo->verify_tag && (job.macs = malloc(sizeof(*job.macs) * (chunks + 1))) == NULL)
+        atomic_store(&job.failed, 1);
+
+    for (int t = 0; t < threads; t++)
+    {
+        job.image_bufs[t] = malloc(bmp_span_max(&decInfo->bmp, PARALLEL_CHUNK_SIZE * 8));
+        job.secret_bufs[t] = malloc(PARALLEL_CHUNK_SIZE);
+        if (job.image_bufs[t] == NULL || job.secret_bufs[t] == NULL)
+            atomic_store(&job.failed, 1);
+    }
+
+    if (!atomic_load(&job.failed))
+        parallel_for(threads, chunks, decode_chunk, &job);
+
+    if (atomic_load(&job.failed))
+    {
+        printf("ERROR: Parallel decode of secret data failed\n");
+        ret = e_failure;
+    }
+    else
+    {
+        /* Chunk CRCs and MACs chain into those of the whole data */
+        for (size_t i = 0; i < chunks; i++)
+        {
+            uint64_t off = (uint64_t)i * job.chunk;
+            uint64_t len = fsize - off < job.chunk ? fsize - off : job.chunk;
+
+            if (job.crcs)
+                decInfo->crc = crc32c_combine(decInfo->crc, job.crcs[i], len);
+            if (job.macs)
+                cipher_join(&decInfo->cipher, &job.macs[i]);
+        }
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        free(job.image_bufs[t]);
+        free(job.secret_bufs[t]);
+    }
+    free(job.crcs);
+    free(job.macs);
+    return ret;
+}
+
+/* Undecodable data of an encrypted payload most likely means a wrong passphrase */
+static const char *corrupt_hint(const DecodeInfo *decInfo)
+{
+    return (decInfo->flags & STEGO_FLAG_ENCRYPT) ? " (wrong passphrase?)" : "";
+}
+
+/* Append to the output, through the write-behind ring during the serial data pass */
+static int write_output(DecodeInfo *decInfo, const unsigned char *buf, size_t n)
+{
+    if (decInfo->output_ring)
+        return ioring_write(decInfo->output_ring, buf, n);
+    return fwrite(buf, 1, n, decInfo->fptr_output) == n ? 0 : -1;
+}
+
+/* Sink of the LZ reader: append one decompressed chunk */
+static int write_chunk(void *ctx, const unsigned char *raw, size_t n)
+{
+    DecodeInfo *decInfo = ctx;
+
+    if (write_output(decInfo, raw, n) != 0)
+    {
+        perror("fwrite");
+        return -1;
+    }
+    stats_io(decInfo->stats, STAT_BYTES_WRITTEN, n);
+    decInfo->raw_written += n;
+    return 0;
+}
+
+/*****************************************************
+ * Decode LZ frames: extract stored bytes block by
+ * block and decompress every frame as it completes
+ *****************************************************/
+static Status decode_compressed_data(DecodeInfo *decInfo, uint64_t fsize, size_t block)
+{
+    LzReader *reader = malloc(sizeof(*reader));
+    Status ret = e_success;
+
+    if (reader == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate decompression buffers\n");
+        return e_failure;
+    }
+    lz_reader_init(reader);
+    decInfo->raw_written = 0;
+
+    while (fsize > 0 && ret == e_success)
+    {
+        size_t n = fsize < block ? (size_t)fsize : block;
+
+        if (decode_payload_bytes(decInfo, decInfo->secret_data, n) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+        if (decInfo->verify_crc)
+            decInfo->crc = crc32c(decInfo->crc, decInfo->secret_data, n);
+        if (decInfo->flags & STEGO_FLAG_ENCRYPT)
+            cipher_decrypt(&decInfo->cipher, decInfo->secret_data, n);
+        if (lz_reader_feed(reader, decInfo->secret_data, n, write_chunk, decInfo) != 0)
+        {
+            printf("ERROR: Compressed secret data is corrupt%s\n", corrupt_hint(decInfo));
+            ret = e_failure;
+        }
+        fsize -= n;
+    }
+
+    if (ret == e_success && (!lz_reader_done(reader) || decInfo->raw_written != decInfo->file_size))
+    {
+        printf("ERROR: Compressed secret data is truncated%s\n", corrupt_hint(decInfo));
+        ret = e_failure;
+    }
+
+    free(reader);
+    return ret;
+}
+
+/* Sink of the chunk reader: chunk bodies are LZ frames or the secret itself */
+static int write_stored(void *ctx, const unsigned char *data, size_t n)
+{
+    DecodeInfo *decInfo = ctx;
+
+    /* Bodies are decrypted in a copy, the extracted bytes still feed the CRC */
+    if (decInfo->plain_data)
+    {
+        memcpy(decInfo->plain_data, data, n);
+        cipher_decrypt(&decInfo->cipher, decInfo->plain_data, n);
+        data = decInfo->plain_data;
+    }
+    if (decInfo->lz_reader)
+        return lz_reader_feed(decInfo->lz_reader, data, n, write_chunk, decInfo);
+    return write_chunk(decInfo, data, n);
+}
+
+/*****************************************************
+ * Decode a streamed payload: no sizes in the header,
+ * so blocks are extracted until the zero length chunk
+ * (at most up to the end of the image)
+ *****************************************************/
+static Status decode_streamed_data(DecodeInfo *decInfo, size_t block, uint64_t *stored)
+{
+    StegoChunkReader chunks;
+    Status ret = e_success;
+    uint64_t capacity = decInfo->bmp.capacity;
+
+    if (decInfo->flags & STEGO_FLAG_LZ)
+    {
+        if ((decInfo->lz_reader = malloc(sizeof(*decInfo->lz_reader))) == NULL)
+        {
+            fprintf(stderr, "ERROR: Unable to allocate decompression buffers\n");
+            return e_failure;
+        }
+        lz_reader_init(decInfo->lz_reader);
+    }
+    if ((decInfo->flags & STEGO_FLAG_ENCRYPT) && (decInfo->plain_data = malloc(block)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate decryption buffers\n");
+        free(decInfo->lz_reader);
+        decInfo->lz_reader = NULL;
+        return e_failure;
+    }
+    stego_chunk_reader_init(&chunks);
+    decInfo->raw_written = 0;
+
+    uint64_t left = decInfo->channel_pos < capacity ? (capacity - decInfo->channel_pos) * decInfo->bits / 8 : 0;
+    decInfo->readahead = (int64_t)left;
+
+    while (!chunks.done && left > 0 && ret == e_success)
+    {
+        size_t n = left < block ? (size_t)left : block;
+
+        uint64_t before = chunks.stored;
+
+        if (decode_payload_bytes(decInfo, decInfo->secret_data, n) == e_failure)
+            ret = e_failure;
+        else if (stego_chunk_reader_feed(&chunks, decInfo->secret_data, n, write_stored, decInfo) != 0)
+        {
+            printf("ERROR: Streamed secret data is corrupt%s\n", corrupt_hint(decInfo));
+            ret = e_failure;
+        }
+        /* Bytes after the last chunk are not part of the data */
+        else if (decInfo->verify_crc)
+            decInfo->crc = crc32c(decInfo->crc, decInfo->secret_data, (size_t)(chunks.stored - before));
+        left -= n;
+    }
+
+    if (ret == e_success && (!chunks.done || (decInfo->lz_reader && !lz_reader_done(decInfo->lz_reader))))
+    {
+        printf("ERROR: Streamed secret data is truncated%s\n", corrupt_hint(decInfo));
+        ret = e_failure;
+    }
+
+    decInfo->file_size = decInfo->raw_written;
+    *stored = chunks.stored;
+    free(decInfo->lz_reader);
+    free(decInfo->plain_data);
+    decInfo->lz_reader = NULL;
+    decInfo->plain_data = NULL;
+    return ret;
+}
+
+/* Decode plain data block by block */
+static Status decode_plain_data(DecodeInfo *decInfo, uint64_t fsize, size_t block)
+{
+    /* Refills now fetch whole blocks, capped at what the payload (and its trailer) needs */
+    decInfo->readahead = (int64_t)fsize;
+    if (decInfo->verify_crc || decInfo->verify_tag)
+        decInfo->readahead = (int64_t)(stego_trailer_offset(fsize, decInfo->bits) +
+                                       stego_trailer_size(decInfo->flags));
+
+    while (fsize > 0)
+    {
+        size_t n = fsize < block ? (size_t)fsize : block;
+
+        if (decode_payload_bytes(decInfo, decInfo->secret_data, n) == e_failure)
+            return e_failure;
+        if (decInfo->verify_crc)
+            decInfo->crc = crc32c(decInfo->crc, decInfo->secret_data, n);
+        if (decInfo->flags & STEGO_FLAG_ENCRYPT)
+            cipher_decrypt(&decInfo->cipher, decInfo->secret_data, n);
+        if (write_output(decInfo, decInfo->secret_data, n) != 0)
+        {
+            perror("fwrite");
+            return e_failure;
+        }
+        stats_io(decInfo->stats, STAT_BYTES_WRITTEN, n);
+        fsize -= n;
+    }
+
+    return e_success;
+}
+
+/*****************************************************
+ * Compare the trailer that follows stored data bytes
+ * (from channel data_c0) with the CRC and MAC of the
+ * bytes extracted; only the trailer is read here. The
+ * CRC goes first: a mismatch there is a modified image,
+ * a tag mismatch alone is a wrong passphrase.
+ *****************************************************/
+static Status verify_trailer(DecodeInfo *decInfo, uint64_t data_c0, uint64_t stored)
+{
+    unsigned char trailer[STEGO_TAG_SIZE + STEGO_CRC_SIZE], tag[CIPHER_TAG_SIZE];
+    size_t len = stego_trailer_size(decInfo->flags);
+    const unsigned char *stored_tag = trailer;
+
+    decInfo->stream_bits = decInfo->bits;
+    decInfo->channel_pos = data_c0 + LSB_CHANNELS(stego_trailer_offset(stored, decInfo->bits), decInfo->bits);
+    decInfo->readahead = (int64_t)len;
+    if (decode_payload_bytes(decInfo, trailer, len) == e_failure)
+        return e_failure;
+
+    /* A wrong key also misplaces scattered tiles, so there a bad CRC may be the passphrase */
+    if (decInfo->verify_crc && stego_get_u32(trailer + len - STEGO_CRC_SIZE) != decInfo->crc)
+    {
+        if (decInfo->layout)
+            printf("ERROR: Secret data does not authenticate, wrong passphrase or the image was modified\n");
+        else
+            printf("ERROR: Secret data does not match its CRC32C, the image was modified\n");
+        return e_failure;
+    }
+    if (decInfo->verify_crc)
+        LOG_INFO(decInfo, "INFO: CRC32C verified\n");
+
+    if (decInfo->verify_tag)
+    {
+        cipher_tag(&decInfo->cipher, tag);
+        if (!cipher_tag_equal(tag, stored_tag))
+        {
+            printf("ERROR: Secret data does not authenticate, wrong passphrase or the image was modified\n");
+            return e_failure;
+        }
+        LOG_INFO(decInfo, "INFO: Passphrase and data authenticated\n");
+    }
+    return e_success;
+}
+
+/*****************************************************
+ * Let the serial data pass read the pixels ahead and
+ * write the output behind on helper threads, so block
+ * N is extracted while N + 1 is read and N - 1 written.
+ * stored is the data size, 0 when it is not known.
+ * Without a ring the pass uses stdio as before.
+ *****************************************************/
+static void start_overlap(DecodeInfo *decInfo, uint64_t stored)
 {
-    unsigned char buffer[32];
+    const BmpInfo *bmp = &decInfo->bmp;
+    uint64_t end = bmp->capacity;
+
+    if (!ioring_enabled())
+        return;
+
+    /* Scattered tiles are read out of order, mappings and pipes need no ring */
+    if (!decInfo->image_pipe && !decInfo->image_map && !decInfo->layout)
+    {
+        /* Up to the trailer's last group, a streamed payload up to the last pixel */
+        if (stored > 0)
+        {
+            uint64_t bytes = stego_trailer_offset(stored, decInfo->bits) + stego_trailer_size(decInfo->flags);
+            uint64_t channels = decInfo->channel_pos + LSB_CHANNELS(bytes, decInfo->bits) + 8;
+            if (channels < end)
+                end = channels;
+        }
+        decInfo->image_ring = ioring_reader(fileno(decInfo->fptr_stego_image),
+                                            bmp_channel_offset(bmp, decInfo->channel_pos),
+                                            bmp_channel_offset(bmp, end), bmp_span_max(bmp, decInfo->buf_size * 8));
+    }
+    decInfo->output_ring = ioring_writer(fileno(decInfo->fptr_output), decInfo->buf_size);
+}
 
-    fread(buffer, 32, 1, decInfo->fptr_stego_image);
-    *fsize = decode_size_from_lsb(buffer);
+/* Drain the rings; the output is complete once this succeeds */
+static Status stop_overlap(DecodeInfo *decInfo)
+{
+    int failed = ioring_close(decInfo->output_ring);
 
+    ioring_close(decInfo->image_ring);
+    decInfo->image_ring = decInfo->output_ring = NULL;
+    if (failed)
+    {
+        printf("ERROR: Unable to write %s\n", decInfo->output_fname);
+        return e_failure;
+    }
     return e_success;
 }
 
 /*****************************************************
  * Decode file data and write to output file
  *****************************************************/
-Status decode_secret_file_data(DecodeInfo *decInfo, long fsize)
+Status decode_secret_file_data(DecodeInfo *decInfo, uint64_t fsize)
 {
-    unsigned char buffer[8];
-    char ch;
+    uint64_t data_c0 = decInfo->channel_pos;
+    uint64_t stored = fsize;
+    Status ret;
+
+    /* Secret data uses the depth from the header */
+    decInfo->stream_bits = decInfo->bits;
+    size_t block = decInfo->buf_size / LSB_GROUP_BYTES(decInfo->bits) * LSB_GROUP_BYTES(decInfo->bits);
 
-    for (long i = 0; i < fsize; i++)
+    /* Workers pread and pwrite at any offset, pipes stay sequential */
+    if (!(decInfo->flags & (STEGO_FLAG_STREAM | STEGO_FLAG_LZ)) && decInfo->threads > 1 &&
+        !decInfo->image_pipe && !decInfo->output_pipe)
+        ret = decode_secret_file_data_parallel(decInfo, fsize);
+    else
     {
-        fread(buffer, 8, 1, decInfo->fptr_stego_image);
-        ch = decode_byte_from_lsb((char *)buffer);
-        fwrite(&ch, 1, 1, decInfo->fptr_output);
+        start_overlap(decInfo, (decInfo->flags & STEGO_FLAG_STREAM) ? 0 : fsize);
+        if (decInfo->flags & STEGO_FLAG_STREAM)
+            ret = decode_streamed_data(decInfo, block, &stored);
+        else if (decInfo->flags & STEGO_FLAG_LZ)
+            ret = decode_compressed_data(decInfo, fsize, block);
+        else
+            ret = decode_plain_data(decInfo, fsize, block);
     }
 
+    /* CRC and MAC were taken while extracting; the trailer is all that is left to read */
+    if (ret == e_success && (decInfo->verify_crc || decInfo->verify_tag))
+        ret = verify_trailer(decInfo, data_c0, stored);
+    if (stop_overlap(decInfo) == e_failure)
+        ret = e_failure;
+
+    /* A wrong key shows as a bad tag, or as LZ frames or chunks that do not parse */
+    if (ret == e_failure)
+        discard_output(decInfo, decInfo->output_fname);
+    return ret;
+}
+
+/*****************************************************
+ * Pass bytes [start, start + len) of the secret data
+ * (which begins at channel data_c0) to sink, without
+ * extracting anything before them. Reads start on a
+ * whole group, the bytes ahead of start are dropped.
+ *****************************************************/
+static Status decode_range(DecodeInfo *decInfo, uint64_t data_c0, uint64_t start, uint64_t len,
+                           stego_sink sink, void *ctx)
+{
+    size_t g = LSB_GROUP_BYTES(decInfo->bits);
+    size_t block = decInfo->buf_size / g * g;
+    uint64_t first = start / g * g;
+    size_t skip = (size_t)(start - first);
+    uint64_t left = skip + len;
+
+    decInfo->stream_bits = decInfo->bits;
+    decInfo->channel_pos = data_c0 + LSB_CHANNELS(first, decInfo->bits);
+    decInfo->readahead = (int64_t)left;
+
+    while (left > 0)
+    {
+        size_t n = left < block ? (size_t)left : block;
+
+        if (decode_payload_bytes(decInfo, decInfo->secret_data, n) == e_failure)
+            return e_failure;
+        if (decInfo->verify_crc)
+            decInfo->crc = crc32c(decInfo->crc, decInfo->secret_data + skip, n - skip);
+        /* The keystream is addressed by offset, so a range decrypts on its own */
+        if (decInfo->verify_tag)
+            cipher_auth(&decInfo->cipher, decInfo->secret_data + skip, n - skip);
+        if (decInfo->flags & STEGO_FLAG_ENCRYPT)
+            cipher_xor(&decInfo->cipher, first, decInfo->secret_data, n);
+        if (sink(ctx, decInfo->secret_data + skip, n - skip) != 0)
+            return e_failure;
+        skip = 0;
+        first += n;
+        left -= n;
+    }
     return e_success;
 }
 
+/* Sink collecting bytes into a buffer (the archive TOC) */
+typedef struct
+{
+    unsigned char *buf;
+    size_t len;
+} TocSink;
+
+static int collect_toc(void *ctx, const unsigned char *data, size_t n)
+{
+    TocSink *toc = ctx;
+
+    memcpy(toc->buf + toc->len, data, n);
+    toc->len += n;
+    return 0;
+}
+
+/* Write one member body to the open output, decompressing LZ members */
+static Status extract_member(DecodeInfo *decInfo, uint64_t data_c0, size_t toc_len, const ArchiveEntry *entry)
+{
+    Status ret;
+
+    decInfo->raw_written = 0;
+    if (entry->flags & ARCHIVE_MEMBER_LZ)
+    {
+        if ((decInfo->lz_reader = malloc(sizeof(*decInfo->lz_reader))) == NULL)
+        {
+            fprintf(stderr, "ERROR: Unable to allocate decompression buffers\n");
+            return e_failure;
+        }
+        lz_reader_init(decInfo->lz_reader);
+    }
+
+    ret = decode_range(decInfo, data_c0, toc_len + entry->offset, entry->stored, write_stored, decInfo);
+    if (ret == e_success && ((decInfo->lz_reader && !lz_reader_done(decInfo->lz_reader)) ||
+                             decInfo->raw_written != entry->size))
+    {
+        printf("ERROR: Archive member %s is corrupt%s\n", entry->name, corrupt_hint(decInfo));
+        ret = e_failure;
+    }
+
+    free(decInfo->lz_reader);
+    decInfo->lz_reader = NULL;
+    return ret;
+}
+
+/*****************************************************
+ * Decode an archive payload: read the TOC, then list
+ * it, extract one member (--member) straight from its
+ * offset, or extract every member into a directory
+ *****************************************************/
+Status decode_archive(DecodeInfo *decInfo, uint64_t fsize)
+{
+    uint64_t data_c0 = decInfo->channel_pos;
+    unsigned char prefix[ARCHIVE_PREFIX_SIZE];
+    TocSink toc = { prefix, 0 };
+    ArchiveEntry *entries = NULL;
+    unsigned char *created = NULL;  /* members written to regular files */
+    size_t toc_len, count;
+    Status ret = e_failure;
+
+    if (decInfo->flags & (STEGO_FLAG_LZ | STEGO_FLAG_STREAM))
+    {
+        printf("ERROR: Archive payload with flags 0x%x is not supported\n", (unsigned)decInfo->flags);
+        return e_failure;
+    }
+
+    /* TOC length and count first, then the whole TOC */
+    if (fsize < ARCHIVE_PREFIX_SIZE ||
+        decode_range(decInfo, data_c0, 0, ARCHIVE_PREFIX_SIZE, collect_toc, &toc) == e_failure ||
+        archive_toc_prefix(prefix, &toc_len, &count) != STEGO_OK || toc_len > fsize)
+    {
+        printf("ERROR: Archive table of contents is corrupt%s\n", corrupt_hint(decInfo));
+        return e_failure;
+    }
+
+    toc.buf = malloc(toc_len);
+    toc.len = 0;
+    decInfo->crc = 0;                   /* the full TOC is read again */
+    if (decInfo->verify_tag)
+        cipher_fork(&decInfo->cipher, &decInfo->cipher);
+    entries = calloc(count ? count : 1, sizeof(*entries));
+    if (toc.buf == NULL || entries == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the archive table\n");
+        goto out;
+    }
+    if (decode_range(decInfo, data_c0, 0, toc_len, collect_toc, &toc) == e_failure ||
+        archive_toc_unpack(toc.buf, toc_len, fsize, entries, count) != STEGO_OK)
+    {
+        printf("ERROR: Archive table of contents is corrupt%s\n", corrupt_hint(decInfo));
+        goto out;
+    }
+    LOG_INFO(decInfo, "INFO: Archive holds %zu files\n", count);
+
+    if (decInfo->archive_list)
+    {
+        for (size_t i = 0; i < count; i++)
+            printf("MEMBER %s size=%llu stored=%llu offset=%llu%s\n", entries[i].name,
+                   (unsigned long long)entries[i].size, (unsigned long long)entries[i].stored,
+                   (unsigned long long)entries[i].offset,
+                   (entries[i].flags & ARCHIVE_MEMBER_LZ) ? " lz" : "");
+        ret = e_success;
+        goto out;
+    }
+
+    if (decInfo->member)
+    {
+        long i = archive_find(entries, count, decInfo->member);
+        if (i < 0)
+        {
+            printf("ERROR: Archive has no member %s\n", decInfo->member);
+            goto out;
+        }
+        /* Defaults to the member name, in the current directory */
+        if (decInfo->output_fname == NULL)
+            decInfo->output_fname = (char *)decInfo->member;
+        if (open_decode_output(decInfo, decInfo->output_fname) == e_success &&
+            (ret = extract_member(decInfo, data_c0, toc_len, &entries[i])) == e_failure)
+            discard_output(decInfo, decInfo->output_fname);
+        goto out;
+    }
+
+    /* Every member, in body order, into the output directory */
+    const char *dir = decInfo->output_fname ? decInfo->output_fname : ".";
+    char path[PATH_MAX];
+
+    if (pipe_is_std(dir) || (mkdir(dir, 0777) != 0 && errno != EEXIST))
+    {
+        printf("ERROR: Cannot extract archive members into %s\n", dir);
+        goto out;
+    }
+    decInfo->output_fname = (char *)dir;
+    if ((created = calloc(count + 1, 1)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        goto out;
+    }
+    ret = e_success;
+    for (size_t i = 0; i < count && ret == e_success; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+        ret = open_decode_output(decInfo, path);
+        created[i] = ret == e_success && decInfo->output_file;
+        if (ret == e_success)
+            ret = extract_member(decInfo, data_c0, toc_len, &entries[i]);
+        if (ret == e_success)
+            LOG_INFO(decInfo, "INFO: Extracted %s (%llu bytes)\n", path, (unsigned long long)entries[i].size);
+    }
+
+    /* Every stored byte went by, TOC and bodies in order */
+    if (ret == e_success && (decInfo->verify_crc || decInfo->verify_tag))
+        ret = verify_trailer(decInfo, data_c0, fsize);
+
+    /* A failed archive leaves none of its members behind */
+    for (size_t i = 0; i < count && ret == e_failure; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+        decInfo->output_file = created[i];
+        discard_output(decInfo, path);
+    }
+
+out:
+    free(created);
+    free(toc.buf);
+    free(entries);
+    return ret;
+}
+
+/*****************************************************
+ * --range: write just the requested payload bytes,
+ * reading only the pixel rows that hold them
+ *****************************************************/
+static Status decode_secret_range(DecodeInfo *decInfo, uint64_t fsize)
+{
+    uint64_t off, len;
+
+    /* Frames and chunks shift the bytes, only plain payloads map directly */
+    if (decInfo->flags & (STEGO_FLAG_LZ | STEGO_FLAG_STREAM))
+    {
+        printf("ERROR: --range needs a payload stored without -z or streaming\n");
+        return e_failure;
+    }
+
+    if (decInfo->range_off < 0)
+        off = (uint64_t)-decInfo->range_off < fsize ? fsize - (uint64_t)-decInfo->range_off : 0;
+    else
+        off = (uint64_t)decInfo->range_off;
+    if (off > fsize)
+    {
+        printf("ERROR: Range starts past the end of the %llu byte payload\n", (unsigned long long)fsize);
+        return e_failure;
+    }
+    len = decInfo->range_len < fsize - off ? decInfo->range_len : fsize - off;
+
+    if (decInfo->output_fname == NULL)
+        decInfo->output_fname = "decoded_secret.txt";
+    if (open_decode_output(decInfo, decInfo->output_fname) == e_failure)
+        return e_failure;
+
+    LOG_INFO(decInfo, "INFO: Extracting payload bytes %llu to %llu\n",
+             (unsigned long long)off, (unsigned long long)(off + len));
+    decInfo->raw_written = 0;
+    return decode_range(decInfo, decInfo->channel_pos, off, len, write_chunk, decInfo);
+}
+
 /*****************************************************
  * MASTER DECODING FUNCTION
  *****************************************************/
 Status do_decoding(DecodeInfo *decInfo)
 {
     /* 1. Decode MAGIC */
+    stats_stage(decInfo->stats, "magic");
     if (decode_magic_string(decInfo) == e_failure)
         return e_failure;
 
     /* 2. EXTENSION SIZE */
     int extn_size;
+    stats_stage(decInfo->stats, "extn_size");
     if (decode_secret_extn_size(decInfo, &extn_size) == e_failure)
         return e_failure;
 
     /* 3. EXTENSION */
+    stats_stage(decInfo->stats, "extn");
     if (decode_secret_extn(decInfo, decInfo->file_extn, extn_size) == e_failure)
         return e_failure;
 
     /* 4. FILE SIZE */
-    long fsize;
+    uint64_t fsize;
+    stats_stage(decInfo->stats, "file_size");
     if (decode_secret_file_size(decInfo, &fsize) == e_failure)
         return e_failure;
 
-    /* 5. FILE DATA */
-    if (decode_secret_file_data(decInfo, fsize) == e_failure)
+    /* 5. SHARD record, for one image of a striped payload */
+    memset(&decInfo->shard, 0, sizeof(decInfo->shard));
+    if (decInfo->flags & STEGO_FLAG_SHARD)
+    {
+        stats_stage(decInfo->stats, "shard");
+        if (decode_shard_record(decInfo) == e_failure)
+            return e_failure;
+    }
+
+    /* 6. SALT of the key, for an encrypted payload */
+    if (decInfo->flags & STEGO_FLAG_ENCRYPT)
+    {
+        stats_stage(decInfo->stats, "kdf");
+        if (decode_key_salt(decInfo) == e_failure)
+            return e_failure;
+    }
+
+    /* 7. FILE DATA: a TOC and member bodies, or one secret */
+    stats_stage(decInfo->stats, "data");
+    int whole = !decInfo->range && !decInfo->archive_list && !decInfo->member;
+    decInfo->crc = 0;
+    decInfo->verify_crc = (decInfo->flags & STEGO_FLAG_CRC) && whole;
+    decInfo->verify_tag = (decInfo->flags & STEGO_FLAG_ENCRYPT) && whole;
+    if (decInfo->range)
+    {
+        if (decode_secret_range(decInfo, fsize) == e_failure)
+            return e_failure;
+    }
+    else if (decInfo->flags & STEGO_FLAG_ARCHIVE)
+    {
+        if (decode_archive(decInfo, fsize) == e_failure)
+            return e_failure;
+    }
+    else if (decInfo->archive_list || decInfo->member)
+    {
+        printf("ERROR: Payload is a single file, not an archive\n");
         return e_failure;
+    }
+    else
+    {
+        /* Created only now that the image is known to carry a payload */
+        if (decInfo->stripe)
+        {
+            if (open_shard_output(decInfo) == e_failure)
+                return e_failure;
+        }
+        else
+        {
+            if (decInfo->output_fname == NULL)
+                decInfo->output_fname = "decoded_secret.txt";
+            if (open_decode_output(decInfo, decInfo->output_fname) == e_failure)
+                return e_failure;
+        }
+        if (decode_secret_file_data(decInfo, fsize) == e_failure)
+            return e_failure;
+        if (decInfo->shard.count > 0 && !decInfo->stripe)
+            LOG_INFO(decInfo, "INFO: Image holds shard %u of %u of a striped payload, decode the set with --stripe\n",
+                     (unsigned)decInfo->shard.index + 1, (unsigned)decInfo->shard.count);
+    }
+
+    /* Let the writer of a piped image finish instead of failing on a closed pipe */
+    if (decInfo->image_pipe)
+    {
+        stats_stage(decInfo->stats, "drain");
+        pipe_drain(decInfo->fptr_stego_image);
+    }
+    stats_stage(decInfo->stats, NULL);
 
-    printf("INFO: Decode complete! Output file: %s\n", decInfo->output_fname);
+    if (decInfo->archive_list)
+        LOG_INFO(decInfo, "INFO: Decode complete! Archive listed\n");
+    else
+        LOG_INFO(decInfo, "INFO: Decode complete! Output file: %s\n", decInfo->output_fname);
 
     return e_success;
 }
@@ -3,8 +3,18 @@
 
 #include <stdio.h>
 #include "types.h"
+#include "stego.h"
+#include "bmp.h"
+#include "lz.h"
+#include "archive.h"
+#include "cipher.h"
+#include "scatter.h"
+#include "ioring.h"
+#include "stats.h"
 
-#define MAX_SECRET_EXT 10
+#define MAX_SECRET_EXT (STEGO_MAX_EXTN + 1)
+#define DEFAULT_DECODE_BUF_SIZE (256 * 1024)   // payload bytes per block
+#define DECODE_HEADER_READAHEAD STEGO_MAX_HEADER_SIZE   // payload bytes read for the header fields
 
 typedef struct _DecodeInfo
 {
@@ -13,13 +23,83 @@ typedef struct _DecodeInfo
     FILE *fptr_stego_image;
 
     /* Output Secret File Info */
-    char output_fname[50];
+    char *output_fname;
     FILE *fptr_output;
+    int output_file;                /* a regular file: removed if the data fails its checks */
 
     /* Decoded metadata */
     char magic_string[3];
     char file_extn[MAX_SECRET_EXT];
-    long file_size;
+    uint64_t file_size;             /* secret size once decoded */
+
+    /* Pixel layout of the stego image */
+    BmpInfo bmp;
+
+    /* Streaming buffers: raw stego bytes and decoded payload */
+    size_t buf_size;                /* payload bytes per block, 0 = default */
+    unsigned char *image_data;      /* pixel span of buf_size payload bytes */
+    unsigned char *secret_data;     /* buf_size bytes */
+    const unsigned char *image_view; /* image_data, or image_map */
+    uint64_t view_off;              /* file offset of image_view[0] */
+    uint64_t view_len;              /* file bytes held by image_view */
+    uint64_t channel_pos;           /* next channel byte to extract */
+    int stream_bits;                /* depth of the bytes being read (header: 1) */
+    int bits;                       /* secret data depth from the header */
+    uint32_t flags;                 /* STEGO_FLAG_LZ from the header */
+    uint32_t version;               /* header version, 0 = original layout */
+    uint64_t raw_written;           /* decompressed bytes written so far */
+    LzReader *lz_reader;            /* frames of a streamed -z payload */
+    int64_t readahead;              /* payload bytes to fetch per refill */
+    int verify_crc;                 /* STEGO_FLAG_CRC and the whole data is read */
+    uint32_t crc;                   /* CRC32C of the stored bytes extracted so far */
+
+    /* Encrypted payloads (-p): the key, and the MAC when the whole data is read */
+    const char *passphrase;
+    Cipher cipher;
+    int verify_tag;
+    unsigned char *plain_data;      /* decrypted copy of streamed chunk bodies */
+
+    /* Tile layout of a scattered payload: &tiles once the key is known, else NULL */
+    Scatter tiles;
+    const Scatter *layout;
+
+    /* "-" arguments: pipes are read/written front to back only */
+    int image_pipe;
+    int output_pipe;
+    uint64_t stream_pos;            /* bytes consumed of a piped stego image */
+
+    /* Read-ahead and write-behind rings of the serial data pass, NULL when off */
+    IoRing *image_ring;
+    IoRing *output_ring;
+
+    /* Worker threads for the data region (-j), 0/1 = single thread */
+    int threads;
+
+    /* Suppress INFO messages (errors are still printed) */
+    int quiet;
+
+    /* Optional read-only mapping of the stego image (-m) */
+    int use_mmap;
+    const unsigned char *image_map;
+    size_t image_map_len;
+
+    /* Stage timings and I/O counters (--stats), NULL when off */
+    Stats *stats;
+
+    /* Archive payloads: --list prints the TOC, --member extracts one file */
+    int archive_list;
+    const char *member;
+
+    /* Striped payloads (stripe.h): the shard record of the image, and
+     * --stripe writes its data at shard.offset of an existing output */
+    StegoShard shard;               /* count 0: not a shard */
+    int stripe;
+    uint64_t output_off;            /* output file offset of secret byte 0 */
+
+    /* --range: only payload bytes [range_off, range_off + range_len) */
+    int range;
+    int64_t range_off;              /* negative: counted back from the end */
+    uint64_t range_len;             /* UINT64_MAX: up to the end */
 
 } DecodeInfo;
 
@@ -28,21 +108,33 @@ typedef struct _DecodeInfo
 /* Validate args for decoding */
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
 
-/* Open stego and output files */
+/* Open the stego image; the output is opened once the header checks out */
 Status open_decode_files(DecodeInfo *decInfo);
 
+/* Close files and release streaming buffers */
+void close_decode_files(DecodeInfo *decInfo);
+
 /* Perform decoding */
 Status do_decoding(DecodeInfo *decInfo);
 
 /* Decode functions (bit extraction) */
 Status decode_magic_string(DecodeInfo *decInfo);
 Status decode_secret_extn_size(DecodeInfo *decInfo, int *extn_size);
+Status decode_payload_format(DecodeInfo *decInfo, uint32_t marker);
 Status decode_secret_extn(DecodeInfo *decInfo, char *extn, int extn_size);
-Status decode_secret_file_size(DecodeInfo *decInfo, long *fsize);
-Status decode_secret_file_data(DecodeInfo *decInfo, long fsize);
+Status decode_secret_file_size(DecodeInfo *decInfo, uint64_t *fsize);
+Status decode_shard_record(DecodeInfo *decInfo);
+Status decode_key_salt(DecodeInfo *decInfo);
+Status decode_secret_file_data(DecodeInfo *decInfo, uint64_t fsize);
+
+/* List or extract the members of an archive payload of fsize bytes */
+Status decode_archive(DecodeInfo *decInfo, uint64_t fsize);
+
+/* Extract n payload bytes through the buffered block path */
+Status decode_payload_bytes(DecodeInfo *decInfo, unsigned char *data, size_t n);
 
 /* Helper LSB decoders */
 char decode_byte_from_lsb(char *image_buffer);
-long decode_size_from_lsb(unsigned char *buffer);
+uint64_t decode_size_from_lsb(unsigned char *buffer, size_t size_len);
 
 #endif
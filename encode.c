@@ -1,14 +1,29 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "encode.h"
+#include "lsb.h"
+#include "lz.h"
+#include "copyrange.h"
+#include "crc32c.h"
+#include "kdf.h"
+#include "mapping.h"
+#include "parallel.h"
+#include "pipeio.h"
 #include "types.h"
 #include "common.h"
 
 /*===========================================================
  * FUNCTION NAME : check_operation_type
  * PURPOSE       : Reads argv[1] to decide whether user wants
- *                  ENCODING (-e) or DECODING (-d)
- * RETURN        : e_encode, e_decode or e_unsupported
+ *                  ENCODING (-e), DECODING (-d), an
+ *                  IN-PLACE UPDATE (-u), a BATCH (-b), a
+ *                  directory SCAN (-s) or a DAEMON (--serve)
+ * RETURN        : e_encode, e_decode, e_update, e_batch,
+ *                 e_scan, e_serve or e_unsupported
  *===========================================================*/
 OperationType check_operation_type(char *argv[])
 {
@@ -22,6 +37,26 @@ OperationType check_operation_type(char *argv[])
     {
         return e_decode;
     }
+    /* Check if user typed -u for in-place update */
+    else if (strcmp(argv[1], "-u") == 0)
+    {
+        return e_update;
+    }
+    /* Check if user typed -b for a batch manifest */
+    else if (strcmp(argv[1], "-b") == 0)
+    {
+        return e_batch;
+    }
+    /* Check if user typed -s to scan a directory */
+    else if (strcmp(argv[1], "-s") == 0)
+    {
+        return e_scan;
+    }
+    /* Check if user typed --serve to run as a daemon */
+    else if (strcmp(argv[1], "--serve") == 0)
+    {
+        return e_serve;
+    }
     /* If user typed anything else */
     else
     {
@@ -36,6 +71,8 @@ OperationType check_operation_type(char *argv[])
  *      argv[2] = source BMP file
  *      argv[3] = secret .txt file
  *      argv[4] = optional output BMP (stego image)
+ *      Any of them may be "-" (stdin/stdout), the cover and
+ *      the secret not both
  *===========================================================*/
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
@@ -47,9 +84,16 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
         return e_failure;
     }
 
+    /* Only one of the inputs can come from stdin */
+    if (pipe_is_std(argv[2]) && pipe_is_std(argv[3]))
+    {
+        printf("ERROR: Source image and secret cannot both be read from stdin\n");
+        return e_failure;
+    }
+
     /* Validate Source BMP image – it must contain .bmp extension */
     char *ext = strstr(argv[2], ".bmp");
-    if (ext == NULL || strcmp(ext, ".bmp") != 0)
+    if (!pipe_is_std(argv[2]) && (ext == NULL || strcmp(ext, ".bmp") != 0))
     {
         printf("ERROR: Source file must have .bmp extension\n");
         return e_failure;
@@ -58,14 +102,17 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 
     /* Validate secret file – here we only allow .txt for simplicity */
     ext = strstr(argv[3], ".txt");
-    if (ext == NULL || strcmp(ext, ".txt") != 0)
+    if (!pipe_is_std(argv[3]) && (ext == NULL || strcmp(ext, ".txt") != 0))
     {
         printf("ERROR: Secret file must have .txt extension\n");
         return e_failure;
     }
     encInfo->secret_fname = argv[3];
 
-    /* Extract the extension from secret file name (ex: ".txt") */
+    /* Extract the extension from secret file name (ex: ".txt"); stdin has none */
+    if (pipe_is_std(argv[3]))
+        encInfo->extn_secret_file[0] = '\0';
+    else
     {
         char *dot = strrchr(argv[3], '.');
         if (dot == NULL)
@@ -82,7 +129,7 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     if (argv[4] != NULL)    /* If user supplied output file name */
     {
         ext = strstr(argv[4], ".bmp");
-        if (ext == NULL || strcmp(ext, ".bmp") != 0)
+        if (!pipe_is_std(argv[4]) && (ext == NULL || strcmp(ext, ".bmp") != 0))
         {
             printf("ERROR: Output file must have .bmp extension\n");
             return e_failure;
@@ -92,309 +139,2001 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     else    /* If user did not specify output name */
     {
         encInfo->stego_image_fname = "stego.bmp";  /* Default */
-        printf("INFO: Output file not provided. Using default: stego.bmp\n");
+        LOG_INFO(encInfo, "INFO: Output file not provided. Using default: stego.bmp\n");
     }
 
     return e_success;
 }
 
 /*===========================================================
- * FUNCTION NAME : open_files
- * PURPOSE       : Open 3 files required during encoding:
- *                  1. Source BMP image (read mode)
- *                  2. Secret text file (read mode)
- *                  3. Stego(BMP) output image (write mode)
+ * FUNCTION NAME : read_and_validate_archive_args
+ * PURPOSE       : Validates command line arguments for an
+ *                 archive encode (-e -a)
+ * EXPECTED ARGS :
+ *      argv[2]    = source BMP file (or "-")
+ *      argv[3]    = output BMP (or "-")
+ *      argv[4...] = member files, stored under their base names
  *===========================================================*/
-Status open_files(EncodeInfo *encInfo)
+Status read_and_validate_archive_args(char *argv[], EncodeInfo *encInfo)
 {
-    /* Open source image for reading */
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
-    if (encInfo->fptr_src_image == NULL)
+    if (argv[2] == NULL || argv[3] == NULL || argv[4] == NULL)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR: Unable to open source BMP %s\n", encInfo->src_image_fname);
+        printf("ERROR: Missing required files\n");
+        printf("Usage: %s -e -a <input.bmp> <output_stego.bmp> <file>...\n", argv[0]);
         return e_failure;
     }
 
-    /* Open secret file for reading */
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
-    if (encInfo->fptr_secret == NULL)
+    char *ext = strstr(argv[2], ".bmp");
+    if (!pipe_is_std(argv[2]) && (ext == NULL || strcmp(ext, ".bmp") != 0))
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR: Unable to open secret file %s\n", encInfo->secret_fname);
+        printf("ERROR: Source file must have .bmp extension\n");
         return e_failure;
     }
-
-    /* Open output Stego BMP for writing (this stores hidden content) */
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
-    if (encInfo->fptr_stego_image == NULL)
+    ext = strstr(argv[3], ".bmp");
+    if (!pipe_is_std(argv[3]) && (ext == NULL || strcmp(ext, ".bmp") != 0))
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR: Unable to open stego image %s\n", encInfo->stego_image_fname);
+        printf("ERROR: Output file must have .bmp extension\n");
         return e_failure;
     }
+    encInfo->src_image_fname = argv[2];
+    encInfo->stego_image_fname = argv[3];
+    encInfo->members = &argv[4];
+    encInfo->extn_secret_file[0] = '\0';
+
+    /* Members are looked up by base name, so those must be usable and unique */
+    for (encInfo->n_members = 0; argv[4 + encInfo->n_members] != NULL; encInfo->n_members++)
+    {
+        const char *path = argv[4 + encInfo->n_members];
+        const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+        if (encInfo->n_members == ARCHIVE_MAX_MEMBERS)
+        {
+            printf("ERROR: An archive holds at most %d files\n", ARCHIVE_MAX_MEMBERS);
+            return e_failure;
+        }
+        if (pipe_is_std(path) || !archive_name_ok(name))
+        {
+            printf("ERROR: %s cannot be stored in an archive\n", path);
+            return e_failure;
+        }
+        for (int i = 0; i < encInfo->n_members; i++)
+        {
+            const char *other = encInfo->members[i];
+            if (strcmp(strrchr(other, '/') ? strrchr(other, '/') + 1 : other, name) == 0)
+            {
+                printf("ERROR: Two archive members are named %s\n", name);
+                return e_failure;
+            }
+        }
+    }
 
+    encInfo->archive = 1;
     return e_success;
 }
 
 /*===========================================================
- * FUNCTION NAME : get_image_size_for_bmp
- * PURPOSE       : Reads width and height from BMP header
- *                 starting at byte 18 and 22.
- * RETURN VALUE  : Capacity in bytes (width * height * 3)
- ===========================================================*/
-uint get_image_size_for_bmp(FILE *fptr_image)
+ * FUNCTION NAME : read_and_validate_update_args
+ * PURPOSE       : Validates command line arguments for an
+ *                 in-place update of an existing image
+ * EXPECTED ARGS :
+ *      argv[2] = BMP file, rewritten in place
+ *      argv[3] = new secret .txt file
+ *===========================================================*/
+Status read_and_validate_update_args(char *argv[], EncodeInfo *encInfo)
 {
-    uint width, height;
+    if (argv[2] == NULL || argv[3] == NULL || argv[4] != NULL)
+    {
+        printf("ERROR: Update takes exactly an image and a secret file\n");
+        printf("Usage: %s -u <image.bmp> <secret.txt>\n", argv[0]);
+        return e_failure;
+    }
 
-    /* Move to byte 18 where width is stored inside BMP */
-    fseek(fptr_image, 18, SEEK_SET);
+    char *ext = strstr(argv[2], ".bmp");
+    if (ext == NULL || strcmp(ext, ".bmp") != 0)
+    {
+        printf("ERROR: Image file must have .bmp extension\n");
+        return e_failure;
+    }
 
-    /* Read width & height (each 4 bytes) */
-    fread(&width, sizeof(int), 1, fptr_image);
-    fread(&height, sizeof(int), 1, fptr_image);
+    ext = strrchr(argv[3], '.');
+    if (ext == NULL || strcmp(ext, ".txt") != 0)
+    {
+        printf("ERROR: Secret file must have .txt extension\n");
+        return e_failure;
+    }
 
-    /* Restore pointer back to start of file */
-    fseek(fptr_image, 0, SEEK_SET);
+    encInfo->src_image_fname = argv[2];
+    encInfo->stego_image_fname = argv[2];
+    encInfo->secret_fname = argv[3];
+    strncpy(encInfo->extn_secret_file, ext, MAX_FILE_SUFFIX - 1);
+    encInfo->extn_secret_file[MAX_FILE_SUFFIX - 1] = '\0';
+    encInfo->in_place = 1;
 
-    /* Total bytes = pixels * 3 (R,G,B for 24-bit image) */
-    return width * height * 3;
+    return e_success;
 }
 
-/*===========================================================
- * FUNCTION NAME : get_file_size
- * PURPOSE       : Get number of bytes inside secret file
- ===========================================================*/
-uint get_file_size(FILE *fptr)
+/*
+ * Parse the source image header into encInfo->bmp. A piped image
+ * cannot be read twice, so its headers are kept for the output.
+ */
+static Status read_source_bmp(EncodeInfo *encInfo)
 {
-    long size;
+    StegoError err;
 
-    fseek(fptr, 0, SEEK_END);
-    size = ftell(fptr);
-    fseek(fptr, 0, SEEK_SET);
+    if (pipe_seekable(encInfo->fptr_src_image))
+        err = bmp_read_fd(fileno(encInfo->fptr_src_image), &encInfo->bmp);
+    else if ((encInfo->src_header = malloc(BMP_MAX_PREFIX_SIZE)) == NULL)
+        err = STEGO_ERR_NO_MEMORY;
+    else
+    {
+        err = bmp_read_prefix(fileno(encInfo->fptr_src_image), encInfo->src_header,
+                              BMP_MAX_PREFIX_SIZE, &encInfo->bmp);
+        encInfo->src_header_len = encInfo->bmp.pixel_offset;
+    }
 
-    return (uint)size;
+    if (err != STEGO_OK)
+    {
+        printf("ERROR: %s: %s\n", encInfo->src_image_fname, stego_strerror(err));
+        return e_failure;
+    }
+    return e_success;
 }
 
 /*===========================================================
- * FUNCTION NAME : check_capacity
- * PURPOSE       : Make sure source BMP has enough capacity
- *                 to store:
- *                   - magic string
- *                   - extension size
- *                   - extension name
- *                   - secret file size
- *                   - entire secret data
+ * FUNCTION NAME : load_shared_cover
+ * PURPOSE       : Open a cover, parse its headers and map it
+ *                 read-only, once, for every encode of a
+ *                 fan-out to embed and copy from
  ===========================================================*/
-Status check_capacity(EncodeInfo *encInfo)
+Status load_shared_cover(const char *fname, SharedCover *cover)
 {
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    FILE *fptr = pipe_is_std(fname) ? NULL : fopen(fname, "r");
+    StegoError err;
 
-    int magic_len = strlen(MAGIC_STRING);
-    int extn_len  = strlen(encInfo->extn_secret_file);
+    memset(cover, 0, sizeof(*cover));
+    cover->fd = -1;
+    if (fptr == NULL)
+    {
+        printf("ERROR: Unable to open cover %s (it must be a file)\n", fname);
+        return e_failure;
+    }
 
-    /* Total required bits */
-    uint required_bits =
-            (magic_len +      /* magic string */
-             4 +              /* extension size (int) */
-             extn_len +       /* extension chars */
-             4 +              /* secret file size (int) */
-             encInfo->size_secret_file) * 8; /* data bytes */
+    err = bmp_read_fd(fileno(fptr), &cover->bmp);
+    if (err == STEGO_OK)
+        cover->map = map_input_file(fptr, &cover->map_len);
+    if (cover->map != NULL)
+        cover->fd = dup(fileno(fptr));
+    fclose(fptr);
 
-    /* Compare capacity vs requirement */
-    if (encInfo->image_capacity < required_bits)
+    if (err != STEGO_OK)
     {
-        printf("ERROR: Image is too small to store secret data\n");
+        printf("ERROR: %s: %s\n", fname, stego_strerror(err));
+        return e_failure;
+    }
+    if (cover->map == NULL || cover->fd < 0)
+    {
+        printf("ERROR: Unable to map cover %s\n", fname);
+        free_shared_cover(cover);
         return e_failure;
     }
-
-    printf("INFO: Image capacity is sufficient\n");
     return e_success;
 }
 
-/*===========================================================
- * FUNCTION NAME : copy_bmp_header
- * PURPOSE       : First 54 bytes of BMP must be copied
- *                 exactly (not modified)
- ===========================================================*/
-Status copy_bmp_header(FILE *fptr_src, FILE *fptr_dest)
+void free_shared_cover(SharedCover *cover)
 {
-    unsigned char header[54];
-
-    fseek(fptr_src, 0, SEEK_SET);
-    fread(header, 1, 54, fptr_src);
-    fwrite(header, 1, 54, fptr_dest);
+    unmap_input_file(cover->map, cover->map_len);
+    if (cover->fd >= 0)
+        close(cover->fd);
+    cover->map = NULL;
+    cover->fd = -1;
+}
 
-    return e_success;
+/*
+ * Position in the source image. Encodes of a shared cover use one
+ * open file, so each keeps its own position in cover_pos instead.
+ */
+static off_t source_tell(EncodeInfo *encInfo)
+{
+    return encInfo->cover ? (off_t)encInfo->cover_pos : ftello(encInfo->fptr_src_image);
 }
 
-/*===========================================================
- * Encode functions:
- *   - magic string
- *   - extension size
- *   - extension characters
- *   - file size
- *   - file data bytes
- -----------------------------------------------------------*/
+static void source_seek(EncodeInfo *encInfo, off_t pos)
+{
+    if (encInfo->cover)
+        encInfo->cover_pos = (uint64_t)pos;
+    else
+        fseeko(encInfo->fptr_src_image, pos, SEEK_SET);
+}
 
-/* Encodes a single character using 8 bytes (LSB method) */
-Status encode_byte_to_lsb(char data, char *image_buffer)
+/* Allocate the block buffers shared by encode and update */
+static Status alloc_stream_buffers(EncodeInfo *encInfo)
 {
-    for (int i = 0; i < 8; i++)
+    if (encInfo->buf_size == 0)
+        encInfo->buf_size = DEFAULT_SECRET_BUF_SIZE;
+    encInfo->secret_data = malloc(encInfo->buf_size);
+    encInfo->image_buf_len = bmp_span_max(&encInfo->bmp, IMAGE_BUF_SIZE(encInfo->buf_size));
+    encInfo->image_data = malloc(encInfo->image_buf_len);
+    if (encInfo->in_place)
+        encInfo->prev_pixels = malloc(encInfo->image_buf_len);
+    if (encInfo->compress)
     {
-        image_buffer[i] = (image_buffer[i] & 0xFE) | ((data >> (7 - i)) & 1);
+        encInfo->lz_raw = malloc(LZ_CHUNK_SIZE);
+        encInfo->lz_frame = malloc(LZ_FRAME_MAX);
     }
-    return e_success;
-}
+    if (encInfo->streamed)
+        encInfo->chunk = malloc(4 + STEGO_STREAM_CHUNK);
+    encInfo->secret_pending = 0;
+    encInfo->chunk_len = encInfo->chunk_pos = 0;
+    encInfo->chunk_end = 0;
 
-/* Encodes a 32-bit numeric value using LSB in 32 bytes */
-Status encode_size_to_lsb(long value, unsigned char *buffer)
-{
-    for (int i = 0; i < 32; i++)
+    if (encInfo->secret_data == NULL || encInfo->image_data == NULL ||
+        (encInfo->in_place && encInfo->prev_pixels == NULL) ||
+        (encInfo->compress && (encInfo->lz_raw == NULL || encInfo->lz_frame == NULL)) ||
+        (encInfo->streamed && encInfo->chunk == NULL))
     {
-        buffer[i] = (buffer[i] & 0xFE) | ((value >> (31 - i)) & 1);
+        fprintf(stderr, "ERROR: Unable to allocate %zu byte stream buffers\n", encInfo->buf_size);
+        return e_failure;
     }
     return e_success;
 }
 
-/* Encode magic string */
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+/*===========================================================
+ * FUNCTION NAME : open_files
+ * PURPOSE       : Open 3 files required during encoding:
+ *                  1. Source BMP image (read mode)
+ *                  2. Secret text file (read mode)
+ *                  3. Stego(BMP) output image (write mode)
+ *                 "-" opens stdin or stdout instead
+ *===========================================================*/
+Status open_files(EncodeInfo *encInfo)
 {
-    unsigned char buffer[8];
-    int len = strlen(magic_string);
+    /* Open source image for reading; a shared cover is the file opened once for all */
+    if (encInfo->cover)
+    {
+        int fd = dup(encInfo->cover->fd);
+        if ((encInfo->fptr_src_image = fd >= 0 ? fdopen(fd, "r") : NULL) == NULL && fd >= 0)
+            close(fd);
+    }
+    else
+        encInfo->fptr_src_image = pipe_open(encInfo->src_image_fname, "r");
+    if (encInfo->fptr_src_image == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open source BMP %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    /* Open secret file for reading (archive members are opened one at a time) */
+    if (!encInfo->archive)
+    {
+        encInfo->fptr_secret = pipe_open(encInfo->secret_fname, "r");
+        if (encInfo->fptr_secret == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "ERROR: Unable to open secret file %s\n", encInfo->secret_fname);
+            return e_failure;
+        }
+        setvbuf(encInfo->fptr_secret, NULL, _IONBF, 0);
+    }
 
-    for (int i = 0; i < len; i++)
+    /* Open output Stego BMP for writing (this stores hidden content) */
+    encInfo->fptr_stego_image = pipe_open(encInfo->stego_image_fname, "w");
+    if (encInfo->fptr_stego_image == NULL)
     {
-        fread(buffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(magic_string[i], (char *)buffer);
-        fwrite(buffer, 8, 1, encInfo->fptr_stego_image);
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open stego image %s\n", encInfo->stego_image_fname);
+        return e_failure;
     }
+    struct stat st;
+    encInfo->output_file = fstat(fileno(encInfo->fptr_stego_image), &st) == 0 && S_ISREG(st.st_mode);
 
-    return e_success;
-}
+    /* Blocks are large, so skip stdio buffering: one syscall per block */
+    setvbuf(encInfo->fptr_src_image, NULL, _IONBF, 0);
+    setvbuf(encInfo->fptr_stego_image, NULL, _IONBF, 0);
 
-/* Encode extension size (stored as integer value) */
-Status encode_secret_file_extn_size(int extn_size, EncodeInfo *encInfo)
-{
-    unsigned char buffer[32];
+    /* A piped secret is read once, its size is only known at the end */
+    encInfo->streamed = !encInfo->archive && !pipe_seekable(encInfo->fptr_secret);
+    encInfo->seekable = !encInfo->streamed && pipe_seekable(encInfo->fptr_src_image) &&
+                        pipe_seekable(encInfo->fptr_stego_image);
+
+    /* Tiles are patched in anywhere, and a streamed payload must stay walkable without the key */
+    if (encInfo->scatter && !encInfo->seekable)
+    {
+        printf("ERROR: --scatter needs the secret and both images as files, not pipes\n");
+        return e_failure;
+    }
+
+    /* Header layout decides how large a block of pixels can get; a shared cover was parsed once */
+    if (encInfo->cover)
+        encInfo->bmp = encInfo->cover->bmp;
+    else if (read_source_bmp(encInfo) == e_failure)
+        return e_failure;
+
+    /* Allocate the streaming buffers */
+    if (alloc_stream_buffers(encInfo) == e_failure)
+        return e_failure;
 
-    fread(buffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(extn_size, buffer);
-    fwrite(buffer, 32, 1, encInfo->fptr_stego_image);
+    /* Kernels read pixels straight from the mapping when it is available */
+    if (encInfo->cover)
+    {
+        encInfo->src_map = encInfo->cover->map;
+        encInfo->src_map_len = encInfo->cover->map_len;
+    }
+    else if (encInfo->use_mmap)
+    {
+        encInfo->src_map = map_input_file(encInfo->fptr_src_image, &encInfo->src_map_len);
+        if (encInfo->src_map == NULL)
+            LOG_INFO(encInfo, "INFO: Source image cannot be mapped, using buffered reads\n");
+    }
 
     return e_success;
 }
 
-/* Encode extension characters (e.g., ".txt") */
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+/*===========================================================
+ * FUNCTION NAME : open_update_files
+ * PURPOSE       : Open the image read-write and the secret
+ *                 read-only for an in-place update
+ *===========================================================*/
+static Status open_update_files(EncodeInfo *encInfo)
 {
-    unsigned char buffer[8];
-    int len = strlen(file_extn);
+    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r+");
+    if (encInfo->fptr_src_image == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open image %s for update\n", encInfo->src_image_fname);
+        return e_failure;
+    }
 
-    for (int i = 0; i < len; i++)
+    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+    if (encInfo->fptr_secret == NULL)
     {
-        fread(buffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(file_extn[i], (char *)buffer);
-        fwrite(buffer, 8, 1, encInfo->fptr_stego_image);
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open secret file %s\n", encInfo->secret_fname);
+        return e_failure;
     }
 
-    return e_success;
+    /* Pixels go through pread/pwrite, keep stdio out of the way */
+    setvbuf(encInfo->fptr_src_image, NULL, _IONBF, 0);
+    setvbuf(encInfo->fptr_secret, NULL, _IONBF, 0);
+    encInfo->seekable = 1;
+
+    if (read_source_bmp(encInfo) == e_failure)
+        return e_failure;
+    return alloc_stream_buffers(encInfo);
 }
 
-/* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
+/*===========================================================
+ * FUNCTION NAME : close_files
+ * PURPOSE       : Close every file opened by open_files and
+ *                 release the streaming buffers
+ *===========================================================*/
+void close_files(EncodeInfo *encInfo)
 {
-    unsigned char buffer[32];
+    /* Rings left by a failed pass go first, their threads use the files */
+    ioring_close(encInfo->src_ring);
+    ioring_close(encInfo->dst_ring);
+    encInfo->src_ring = encInfo->dst_ring = NULL;
+    if (encInfo->fptr_src_image)
+        fclose(encInfo->fptr_src_image);
+    if (encInfo->fptr_secret)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->fptr_stego_image)
+        fclose(encInfo->fptr_stego_image);
+    free(encInfo->secret_data);
+    free(encInfo->image_data);
+    free(encInfo->prev_pixels);
+    free(encInfo->lz_raw);
+    free(encInfo->lz_frame);
+    free(encInfo->chunk);
+    free(encInfo->src_header);
+    free(encInfo->toc);
+    free(encInfo->toc_buf);
+    if (encInfo->cover == NULL)
+        unmap_input_file(encInfo->src_map, encInfo->src_map_len);
 
-    fread(buffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(file_size, buffer);
-    fwrite(buffer, 32, 1, encInfo->fptr_stego_image);
+    encInfo->src_map = NULL;
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    encInfo->secret_data = NULL;
+    encInfo->image_data = NULL;
+    encInfo->prev_pixels = NULL;
+    encInfo->lz_raw = NULL;
+    encInfo->lz_frame = NULL;
+    encInfo->chunk = NULL;
+    encInfo->src_header = NULL;
+    encInfo->toc = NULL;
+    encInfo->toc_buf = NULL;
+}
 
-    return e_success;
+/*===========================================================
+ * FUNCTION NAME : get_image_size_for_bmp
+ * PURPOSE       : Parses the BMP header (pixel offset, stride,
+ *                 bit depth, orientation)
+ * RETURN VALUE  : Capacity in bytes: the B,G,R bytes of every
+ *                 pixel, without row padding or alpha; 0 if the
+ *                 image is not a supported BMP
+ ===========================================================*/
+uint64_t get_image_size_for_bmp(FILE *fptr_image)
+{
+    BmpInfo info;
+
+    if (bmp_read_fd(fileno(fptr_image), &info) != STEGO_OK)
+        return 0;
+    return info.capacity;
 }
 
-/* Encode entire secret file content byte-by-byte */
-Status encode_secret_file_data(EncodeInfo *encInfo)
+/*===========================================================
+ * FUNCTION NAME : get_file_size
+ * PURPOSE       : Get number of bytes inside secret file
+ ===========================================================*/
+off_t get_file_size(FILE *fptr)
 {
-    unsigned char buffer[8];
-    char ch;
+    off_t size;
 
-    /* Read secret file character-by-character */
-    while (fread(&ch, 1, 1, encInfo->fptr_secret))
-    {
-        fread(buffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(ch, (char *)buffer);
-        fwrite(buffer, 8, 1, encInfo->fptr_stego_image);
-    }
+    if (fseeko(fptr, 0, SEEK_END) != 0)
+        return -1;
+    size = ftello(fptr);
+    if (fseeko(fptr, 0, SEEK_SET) != 0)
+        return -1;
 
-    return e_success;
+    return size;
 }
 
-/* Write all leftover image bytes without encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+static size_t read_secret(EncodeInfo *encInfo, unsigned char *buf, size_t n);
+
+/* Go back to the first secret byte of the image: the start of its shard, or of the file */
+static int rewind_secret(EncodeInfo *encInfo)
 {
-    char buffer[1024];
-    size_t bytes_read;
+    encInfo->secret_left = encInfo->shard_len;
+    return fseeko(encInfo->fptr_secret, (off_t)encInfo->shard.offset, SEEK_SET);
+}
 
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), fptr_src)) > 0)
+/*===========================================================
+ * FUNCTION NAME : measure_compressed_size
+ * PURPOSE       : Frame the whole secret once without storing
+ *                 it, then rewind for the real pass
+ ===========================================================*/
+static Status measure_compressed_size(EncodeInfo *encInfo)
+{
+    size_t n;
+
+    encInfo->size_stored = 0;
+    do
     {
-        fwrite(buffer, 1, bytes_read, fptr_dest);
-    }
+        n = read_secret(encInfo, encInfo->lz_raw, LZ_CHUNK_SIZE);
+        if (n > 0)
+            encInfo->size_stored += lz_frame(encInfo->lz_raw, n, encInfo->lz_frame);
+    } while (n > 0);
 
+    if (ferror(encInfo->fptr_secret) || rewind_secret(encInfo) != 0)
+    {
+        perror("fread");
+        return e_failure;
+    }
+    encInfo->lz_frame_len = encInfo->lz_frame_pos = 0;
     return e_success;
 }
 
 /*===========================================================
- * Top-level encoding:
- * Performs the whole encoding pipeline step-by-step
+ * FUNCTION NAME : check_stream_capacity
+ * PURPOSE       : Fix the depth for a secret read from a pipe;
+ *                 auto needs the size up front
  ===========================================================*/
-Status do_encoding(EncodeInfo *encInfo)
+static Status check_stream_capacity(EncodeInfo *encInfo)
 {
-    /* Open required input/output files */
-    if (open_files(encInfo) == e_failure)
-        return e_failure;
+    StegoHeader hdr;
 
-    /* Check if image is large enough */
-    if (check_capacity(encInfo) == e_failure)
+    if (encInfo->bits == STEGO_BITS_AUTO)
+    {
+        printf("ERROR: --bits auto needs the secret size, give a depth for a piped secret\n");
         return e_failure;
+    }
 
-    /* Copy BMP header unmodified */
-    printf("INFO: Copying BMP header...\n");
-    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
-        return e_failure;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.extn_len = strlen(encInfo->extn_secret_file);
+    hdr.flags = STEGO_FLAG_STREAM | (encInfo->compress ? STEGO_FLAG_LZ : 0) |
+                (encInfo->crc ? STEGO_FLAG_CRC : 0) | (encInfo->passphrase ? STEGO_FLAG_ENCRYPT : 0) |
+                (encInfo->scatter ? STEGO_FLAG_SCATTER : 0);
+    encInfo->image_capacity = encInfo->bmp.capacity;
+    encInfo->size_secret_file = encInfo->size_stored = 0;
 
-    /* Encode magic string */
-    printf("INFO: Encoding Magic String...\n");
-    if (encode_magic_string(MAGIC_STRING, encInfo) == e_failure)
+    if (stego_choose_bits(&hdr, encInfo->image_capacity, encInfo->bits) != STEGO_OK)
+    {
+        printf("ERROR: Image is too small to store secret data\n");
         return e_failure;
+    }
+    encInfo->bits = hdr.bits;
+    encInfo->hdr_version = stego_header_version(&hdr);
+    encInfo->hdr_flags = hdr.flags;
+    encInfo->framed = encInfo->compress;
 
-    int ext_size = strlen(encInfo->extn_secret_file);
+    LOG_INFO(encInfo, "INFO: Secret is streamed, %d bit%s per channel\n",
+             encInfo->bits, encInfo->bits > 1 ? "s" : "");
+    return e_success;
+}
 
-    /* Encode extension metadata */
-    printf("INFO: Encoding Secret File Extension Size...\n");
-    if (encode_secret_file_extn_size(ext_size, encInfo) == e_failure)
-        return e_failure;
+static Status fit_payload(EncodeInfo *encInfo, uint32_t flags);
 
-    printf("INFO: Encoding Secret File Extension...\n");
-    if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_failure)
-        return e_failure;
+/*===========================================================
+ * FUNCTION NAME : check_archive_capacity
+ * PURPOSE       : Size every member (a dry run of the
+ *                 compressor with -z, kept only where it
+ *                 helps), lay out the bodies and pack the TOC
+ ===========================================================*/
+static Status check_archive_capacity(EncodeInfo *encInfo)
+{
+    uint64_t offset = 0, raw_total = 0;
 
-    /* Encode size of secret text */
-    printf("INFO: Encoding Secret File Size...\n");
-    if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_failure)
+    encInfo->toc = calloc(encInfo->n_members, sizeof(*encInfo->toc));
+    if (encInfo->toc == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the archive table\n");
         return e_failure;
+    }
 
-    /* Encode the actual file data */
-    printf("INFO: Encoding Secret File Data...\n");
-    if (encode_secret_file_data(encInfo) == e_failure)
-        return e_failure;
+    for (int i = 0; i < encInfo->n_members; i++)
+    {
+        ArchiveEntry *entry = &encInfo->toc[i];
+        const char *path = encInfo->members[i];
+        FILE *fptr = fopen(path, "r");
+        off_t size = fptr ? get_file_size(fptr) : -1;
 
-    /* Copy remaining pixels */
-    printf("INFO: Copying Remaining Image Data...\n");
-    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
-        return e_failure;
+        if (size < 0)
+        {
+            perror(path);
+            if (fptr)
+                fclose(fptr);
+            return e_failure;
+        }
+        strcpy(entry->name, strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
+        entry->size = entry->stored = (uint64_t)size;
+
+        if (encInfo->compress)
+        {
+            setvbuf(fptr, NULL, _IONBF, 0);
+            encInfo->fptr_secret = fptr;
+            Status ret = measure_compressed_size(encInfo);
+            encInfo->fptr_secret = NULL;
+            if (ret == e_failure)
+            {
+                fclose(fptr);
+                return e_failure;
+            }
+            if (encInfo->size_stored < entry->size)
+            {
+                entry->stored = encInfo->size_stored;
+                entry->flags = ARCHIVE_MEMBER_LZ;
+            }
+        }
+        fclose(fptr);
+
+        entry->offset = offset;
+        offset += entry->stored;
+        raw_total += entry->size;
+    }
+
+    encInfo->toc_len = archive_toc_size(encInfo->toc, encInfo->n_members);
+    encInfo->toc_buf = malloc(encInfo->toc_len);
+    if (encInfo->toc_buf == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate the archive table\n");
+        return e_failure;
+    }
+    archive_toc_pack(encInfo->toc, encInfo->n_members, encInfo->toc_buf);
+
+    encInfo->image_capacity = encInfo->bmp.capacity;
+    encInfo->size_stored = encInfo->toc_len + offset;
+    encInfo->framed = 0;
+    LOG_INFO(encInfo, "INFO: Archive of %d files, %llu bytes (%llu stored)\n", encInfo->n_members,
+             (unsigned long long)raw_total, (unsigned long long)encInfo->size_stored);
+
+    /* The payload is TOC plus bodies; it has no size to restore of its own */
+    encInfo->size_secret_file = encInfo->size_stored;
+    return fit_payload(encInfo, STEGO_FLAG_ARCHIVE);
+}
+
+/*===========================================================
+ * FUNCTION NAME : check_capacity
+ * PURPOSE       : Make sure source BMP has enough capacity
+ *                 to store:
+ *                   - magic string
+ *                   - extension size
+ *                   - extension name
+ *                   - secret file size
+ *                   - entire secret data
+ ===========================================================*/
+Status check_capacity(EncodeInfo *encInfo)
+{
+    /* Sizes of a piped secret are unknown: chunks carry the data, flushes check the space */
+    if (encInfo->streamed)
+        return check_stream_capacity(encInfo);
+
+    if (encInfo->archive)
+        return check_archive_capacity(encInfo);
+
+    off_t secret_size = get_file_size(encInfo->fptr_secret);
+
+    if (secret_size < 0)
+    {
+        perror("fseeko");
+        return e_failure;
+    }
+
+    /* A striped image holds only its shard of the secret */
+    if (encInfo->shard.count > 0)
+    {
+        if (encInfo->shard.offset > (uint64_t)secret_size ||
+            encInfo->shard_len > (uint64_t)secret_size - encInfo->shard.offset)
+        {
+            printf("ERROR: Shard lies past the end of %s\n", encInfo->secret_fname);
+            return e_failure;
+        }
+        if (rewind_secret(encInfo) != 0)
+        {
+            perror("fseeko");
+            return e_failure;
+        }
+        secret_size = (off_t)encInfo->shard_len;
+    }
+
+    encInfo->image_capacity = encInfo->bmp.capacity;
+    encInfo->size_secret_file = (uint64_t)secret_size;
+    encInfo->size_stored = encInfo->size_secret_file;
+
+    /* A dry run of the compressor gives the exact stored size */
+    if (encInfo->compress)
+    {
+        if (measure_compressed_size(encInfo) == e_failure)
+            return e_failure;
+        LOG_INFO(encInfo, "INFO: Secret compresses from %llu to %llu bytes\n",
+                 (unsigned long long)encInfo->size_secret_file, (unsigned long long)encInfo->size_stored);
+    }
+
+    encInfo->framed = encInfo->compress;
+    return fit_payload(encInfo, encInfo->compress ? STEGO_FLAG_LZ : 0);
+}
+
+/*===========================================================
+ * FUNCTION NAME : fit_payload
+ * PURPOSE       : Header fields, data size and depth give the
+ *                 channel bytes needed; pick the depth and
+ *                 header version that fit the cover
+ ===========================================================*/
+static Status fit_payload(EncodeInfo *encInfo, uint32_t flags)
+{
+    StegoHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.extn_len = strlen(encInfo->extn_secret_file);
+    hdr.payload_len = encInfo->size_stored;
+    hdr.raw_len = encInfo->size_secret_file;
+    hdr.flags = flags | (encInfo->crc ? STEGO_FLAG_CRC : 0) | (encInfo->passphrase ? STEGO_FLAG_ENCRYPT : 0) |
+                (encInfo->scatter ? STEGO_FLAG_SCATTER : 0) | (encInfo->shard.count ? STEGO_FLAG_SHARD : 0);
+
+    StegoError err = stego_choose_bits(&hdr, encInfo->image_capacity, encInfo->bits);
+    if (err == STEGO_ERR_ARGS)
+    {
+        printf("ERROR: Bits per channel must be 1 to %d or auto\n", LSB_MAX_BITS);
+        return e_failure;
+    }
+    if (err != STEGO_OK)
+    {
+        printf("ERROR: Image is too small to store secret data\n");
+        return e_failure;
+    }
+    encInfo->bits = hdr.bits;
+    encInfo->hdr_version = stego_header_version(&hdr);
+    encInfo->hdr_flags = hdr.flags;
+    encInfo->payload_channels = stego_channels_needed(&hdr);
+
+    LOG_INFO(encInfo, "INFO: Image capacity is sufficient (%d bit%s per channel)\n",
+             encInfo->bits, encInfo->bits > 1 ? "s" : "");
+    return e_success;
+}
+
+/*===========================================================
+ * FUNCTION NAME : copy_bmp_header
+ * PURPOSE       : Everything before the pixel array (file and
+ *                 DIB headers, masks, colour table) is copied
+ *                 exactly (not modified)
+ ===========================================================*/
+Status copy_bmp_header(FILE *fptr_src, FILE *fptr_dest, Stats *stats)
+{
+    unsigned char file_header[BMP_FILE_HEADER_SIZE];
+    unsigned char buffer[1024];
+
+    fseek(fptr_src, 0, SEEK_SET);
+    if (fread(file_header, 1, sizeof(file_header), fptr_src) != sizeof(file_header))
+        return e_failure;
+    if (fwrite(file_header, 1, sizeof(file_header), fptr_dest) != sizeof(file_header))
+        return e_failure;
+    stats_io(stats, STAT_BYTES_READ, sizeof(file_header));
+    stats_io(stats, STAT_BYTES_WRITTEN, sizeof(file_header));
+
+    /* bfOffBits: where the pixel array starts */
+    long left = (long)(file_header[10] | (file_header[11] << 8) | (file_header[12] << 16) |
+                       ((uint)file_header[13] << 24)) - BMP_FILE_HEADER_SIZE;
+
+    while (left > 0)
+    {
+        size_t n = left < (long)sizeof(buffer) ? (size_t)left : sizeof(buffer);
+        if (fread(buffer, 1, n, fptr_src) != n || fwrite(buffer, 1, n, fptr_dest) != n)
+            return e_failure;
+        stats_io(stats, STAT_BYTES_READ, n);
+        stats_io(stats, STAT_BYTES_WRITTEN, n);
+        left -= n;
+    }
+
+    return e_success;
+}
+
+/*===========================================================
+ * Encode functions:
+ *   - magic string
+ *   - extension size
+ *   - extension characters
+ *   - file size
+ *   - file data bytes
+ * Every field is queued in the same payload buffer, so header
+ * and data share one image read and one write per block.
+ -----------------------------------------------------------*/
+
+/* Encodes a single character using 8 bytes (LSB method) */
+Status encode_byte_to_lsb(char data, char *image_buffer)
+{
+    unsigned char byte = (unsigned char)data;
+
+    lsb_embed_bytes((unsigned char *)image_buffer, (unsigned char *)image_buffer, &byte, 1);
+    return e_success;
+}
+
+/* Encodes a 32 or 64-bit size field using LSB in 8 bytes per byte (MSB first) */
+Status encode_size_to_lsb(uint64_t value, size_t size_len, unsigned char *buffer)
+{
+    unsigned char bytes[8];
+
+    if (size_len != 4 && size_len != 8)
+        return e_failure;
+    for (size_t i = 0; i < size_len; i++)
+    {
+        bytes[i] = (unsigned char)(value >> (8 * (size_len - 1 - i)));
+    }
+    lsb_embed_bytes(buffer, buffer, bytes, size_len);
+    return e_success;
+}
+
+/*
+ * bmp_embed of the queued block (n bytes over span file bytes).
+ * With --stats the pixels are compared before and after; an
+ * in-place embed keeps a copy of the original bytes for that.
+ */
+static void embed_counted(EncodeInfo *encInfo, unsigned char *dst, const unsigned char *src,
+                          uint64_t span_start, uint64_t c0, const unsigned char *data, size_t n, size_t span)
+{
+    const unsigned char *before = src;
+
+    if (encInfo->stats && dst == src)
+    {
+        unsigned char *copy = stats_scratch(encInfo->stats, span);
+        if (copy != NULL)
+            memcpy(copy, src, span);
+        before = copy;
+    }
+    bmp_embed(&encInfo->bmp, dst, src, span_start, c0, data, n, encInfo->stream_bits);
+    if (encInfo->stats && before != NULL)
+        stats_count_changes(encInfo->stats, &encInfo->bmp, before, dst, span, span_start);
+}
+
+/* pwrite one run of changed pixel bytes back into the image */
+static Status write_changed_run(EncodeInfo *encInfo, uint64_t span_start, size_t start, size_t end)
+{
+    size_t len = end - start;
+
+    if (pwrite(fileno(encInfo->fptr_src_image), encInfo->image_data + start, len,
+               (off_t)(span_start + start)) != (ssize_t)len)
+    {
+        perror("pwrite");
+        return e_failure;
+    }
+    encInfo->bytes_written += len;
+    encInfo->write_calls++;
+    stats_io(encInfo->stats, STAT_BYTES_WRITTEN, len);
+    return e_success;
+}
+
+/*
+ * Previous payload bits in the block that the new one does not
+ * overwrite: where the old depth at a channel (1 in its header,
+ * old_bits after) exceeds the block's depth, the bits in between
+ * are cleared so no bit plane keeps part of the old payload.
+ */
+static void clear_stale_bits(EncodeInfo *encInfo, uint64_t span_start, uint64_t c0, uint64_t channels)
+{
+    const BmpInfo *bmp = &encInfo->bmp;
+    int bits = encInfo->stream_bits;
+    uint64_t end = c0 + channels < encInfo->old_end ? c0 + channels : encInfo->old_end;
+
+    /* Data no deeper than the block's only leaves its header to check */
+    if (encInfo->old_bits <= bits && end > encInfo->old_hdr_end)
+        end = encInfo->old_hdr_end;
+    for (uint64_t c = c0; c < end; c++)
+    {
+        int old = c < encInfo->old_hdr_end ? 1 : encInfo->old_bits;
+        if (old <= bits)
+            continue;
+        encInfo->image_data[bmp_channel_offset(bmp, c) - span_start] &=
+            (unsigned char)~(((1u << old) - 1) & ~((1u << bits) - 1));
+    }
+}
+
+/*
+ * In-place flush: read the block, embed the new payload (and
+ * clear what is stale of the old one), then pwrite only the
+ * pixel bytes that changed. Runs closer than INPLACE_MERGE_GAP
+ * are merged.
+ */
+static Status flush_inplace_block(EncodeInfo *encInfo, size_t n)
+{
+    const BmpInfo *bmp = &encInfo->bmp;
+    const unsigned char *prev = encInfo->prev_pixels;
+    const unsigned char *cur = encInfo->image_data;
+    uint64_t c0 = encInfo->channel_pos;
+    uint64_t channels = LSB_CHANNELS(n, encInfo->stream_bits);
+    uint64_t span_start = bmp_channel_offset(bmp, c0);
+    size_t span = bmp_channel_offset(bmp, c0 + channels) - span_start;
+    size_t run_start = 0, run_end = 0;
+    int in_run = 0;
+
+    if (pread(fileno(encInfo->fptr_src_image), encInfo->image_data, span, (off_t)span_start) != (ssize_t)span)
+    {
+        printf("ERROR: Image ended before secret data\n");
+        return e_failure;
+    }
+    stats_io(encInfo->stats, STAT_BYTES_READ, span);
+    memcpy(encInfo->prev_pixels, encInfo->image_data, span);
+    bmp_embed(bmp, encInfo->image_data, encInfo->image_data, span_start, c0, encInfo->secret_data, n,
+              encInfo->stream_bits);
+    clear_stale_bits(encInfo, span_start, c0, channels);
+    if (encInfo->stats)
+        stats_count_changes(encInfo->stats, bmp, prev, cur, span, span_start);
+
+    for (size_t i = 0; i < span; i++)
+    {
+        /* Most of a block is unchanged: skip it a word at a time */
+        while (i + 8 <= span && memcmp(prev + i, cur + i, 8) == 0)
+            i += 8;
+        if (i == span || prev[i] == cur[i])
+            continue;
+
+        if (in_run && i <= run_end + INPLACE_MERGE_GAP)
+        {
+            run_end = i + 1;
+            continue;
+        }
+        if (in_run && write_changed_run(encInfo, span_start, run_start, run_end) == e_failure)
+            return e_failure;
+        run_start = i;
+        run_end = i + 1;
+        in_run = 1;
+    }
+    if (in_run && write_changed_run(encInfo, span_start, run_start, run_end) == e_failure)
+        return e_failure;
+
+    encInfo->channel_pos += channels;
+    encInfo->secret_pending = 0;
+    return e_success;
+}
+
+/*
+ * --scatter flush: the output already holds a copy of the image,
+ * so every tile piece of the block is read from the source (or
+ * the mapping), embedded and pwritten over its copy
+ */
+static Status flush_scattered_block(EncodeInfo *encInfo, size_t n)
+{
+    const BmpInfo *bmp = &encInfo->bmp;
+    int bits = encInfo->stream_bits;
+    uint64_t c = encInfo->channel_pos;
+    const unsigned char *data = encInfo->secret_data;
+
+    if (c + LSB_CHANNELS(n, bits) > bmp->capacity)
+    {
+        printf("ERROR: Source image ended before secret data\n");
+        return e_failure;
+    }
+
+    while (n > 0)
+    {
+        size_t piece = scatter_piece(encInfo->layout, c, n, bits);
+        uint64_t c0 = scatter_channel(encInfo->layout, c);
+        uint64_t span_start = bmp_channel_offset(bmp, c0);
+        size_t span = bmp_channel_offset(bmp, c0 + LSB_CHANNELS(piece, bits)) - span_start;
+        const unsigned char *src = encInfo->image_data;
+
+        if (encInfo->src_map)
+            src = encInfo->src_map + span_start;
+        else if (pread(fileno(encInfo->fptr_src_image), encInfo->image_data, span, (off_t)span_start) != (ssize_t)span)
+        {
+            printf("ERROR: Source image ended before secret data\n");
+            return e_failure;
+        }
+        else
+            stats_io(encInfo->stats, STAT_BYTES_READ, span);
+
+        embed_counted(encInfo, encInfo->image_data, src, span_start, c0, data, piece, span);
+        if (pwrite(fileno(encInfo->fptr_stego_image), encInfo->image_data, span, (off_t)span_start) != (ssize_t)span)
+        {
+            perror("pwrite");
+            return e_failure;
+        }
+        stats_io(encInfo->stats, STAT_BYTES_WRITTEN, span);
+
+        c += LSB_CHANNELS(piece, bits);
+        data += piece;
+        n -= piece;
+    }
+
+    encInfo->channel_pos = c;
+    encInfo->secret_pending = 0;
+    return e_success;
+}
+
+/*
+ * Embed the queued payload block into the next image block.
+ * The block covers the pixel span of its channel bytes, padding
+ * and alpha included, so consecutive blocks tile the pixel array.
+ */
+Status flush_payload_block(EncodeInfo *encInfo)
+{
+    size_t n = encInfo->secret_pending;
+
+    if (n == 0)
+        return e_success;
+
+    if (encInfo->in_place)
+        return flush_inplace_block(encInfo, n);
+    if (encInfo->scatter)
+        return flush_scattered_block(encInfo, n);
+
+    const BmpInfo *bmp = &encInfo->bmp;
+    int bits = encInfo->stream_bits;
+    uint64_t c0 = encInfo->channel_pos;
+    uint64_t channels = LSB_CHANNELS(n, bits);
+    uint64_t span_start = bmp_channel_offset(bmp, c0);
+    size_t span = bmp_channel_offset(bmp, c0 + channels) - span_start;
+
+    if (c0 + channels > bmp->capacity)
+    {
+        printf("ERROR: Source image ended before secret data\n");
+        return e_failure;
+    }
+
+    /* With a write-behind ring the pixels are embedded straight into its buffer */
+    unsigned char *dst = encInfo->dst_ring ? ioring_claim(encInfo->dst_ring, span) : encInfo->image_data;
+
+    if (encInfo->src_map)
+    {
+        /* Pixels come straight from the mapping; the file position stays the cursor */
+        if (span_start + span > encInfo->src_map_len)
+        {
+            printf("ERROR: Source image ended before secret data\n");
+            return e_failure;
+        }
+        embed_counted(encInfo, dst, encInfo->src_map + span_start, span_start, c0, encInfo->secret_data, n, span);
+        source_seek(encInfo, (off_t)(span_start + span));
+        map_prefetch(encInfo->src_map, encInfo->src_map_len, span_start + span, encInfo->image_buf_len);
+    }
+    else
+    {
+        int got = encInfo->src_ring ? ioring_read_at(encInfo->src_ring, encInfo->image_data, span, span_start) == 0
+                                    : fread(encInfo->image_data, 1, span, encInfo->fptr_src_image) == span;
+        if (!got)
+        {
+            printf("ERROR: Source image ended before secret data\n");
+            return e_failure;
+        }
+        stats_io(encInfo->stats, STAT_BYTES_READ, span);
+        embed_counted(encInfo, dst, encInfo->image_data, span_start, c0, encInfo->secret_data, n, span);
+    }
+    if (encInfo->dst_ring ? ioring_commit(encInfo->dst_ring, span) != 0
+                          : fwrite(encInfo->image_data, 1, span, encInfo->fptr_stego_image) != span)
+    {
+        perror("fwrite");
+        return e_failure;
+    }
+    stats_io(encInfo->stats, STAT_BYTES_WRITTEN, span);
+
+    encInfo->channel_pos += channels;
+    encInfo->secret_pending = 0;
+    return e_success;
+}
+
+/* Payload bytes per block: whole groups at the current depth */
+static size_t block_size(const EncodeInfo *encInfo)
+{
+    size_t g = LSB_GROUP_BYTES(encInfo->stream_bits);
+
+    return encInfo->buf_size / g * g;
+}
+
+/* Switch the depth of the queued bytes; a block never mixes depths */
+static Status set_stream_bits(EncodeInfo *encInfo, int bits)
+{
+    if (bits == encInfo->stream_bits)
+        return e_success;
+    if (flush_payload_block(encInfo) == e_failure)
+        return e_failure;
+    encInfo->stream_bits = bits;
+    return e_success;
+}
+
+/* Queue payload bytes, flushing every time the block fills up */
+Status encode_payload_bytes(EncodeInfo *encInfo, const unsigned char *data, size_t n)
+{
+    size_t block = block_size(encInfo);
+
+    while (n > 0)
+    {
+        size_t room = block - encInfo->secret_pending;
+        size_t chunk = n < room ? n : room;
+
+        memcpy(encInfo->secret_data + encInfo->secret_pending, data, chunk);
+        encInfo->secret_pending += chunk;
+        data += chunk;
+        n -= chunk;
+
+        if (encInfo->secret_pending == block &&
+            flush_payload_block(encInfo) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+/* Queue a 32-bit value, MSB first (same bits as encode_size_to_lsb) */
+static Status encode_payload_u32(EncodeInfo *encInfo, uint32_t value)
+{
+    unsigned char bytes[4];
+
+    stego_put_u32(bytes, value);
+    return encode_payload_bytes(encInfo, bytes, 4);
+}
+
+/* Queue a size field: 8 bytes from header version 2 on, else 4 */
+static Status encode_payload_size(EncodeInfo *encInfo, uint64_t value)
+{
+    unsigned char bytes[8];
+
+    if (encInfo->hdr_version < STEGO_HDR_VERSION)
+        return encode_payload_u32(encInfo, (uint32_t)value);
+    stego_put_u64(bytes, value);
+    return encode_payload_bytes(encInfo, bytes, 8);
+}
+
+/* Encode magic string */
+Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+{
+    return encode_payload_bytes(encInfo, (const unsigned char *)magic_string, strlen(magic_string));
+}
+
+/* Encode the extended header marker and flags (depth > 1, -z or 4 GiB sizes) */
+Status encode_payload_format(EncodeInfo *encInfo)
+{
+    uint32_t flags = encInfo->bits | encInfo->hdr_flags;
+
+    if (encode_payload_u32(encInfo, STEGO_HDR_EXTENDED | encInfo->hdr_version) == e_failure)
+        return e_failure;
+    return encode_payload_u32(encInfo, flags);
+}
+
+/* Encode extension size (stored as integer value) */
+Status encode_secret_file_extn_size(int extn_size, EncodeInfo *encInfo)
+{
+    return encode_payload_u32(encInfo, extn_size);
+}
+
+/* Encode extension characters (e.g., ".txt") */
+Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+{
+    return encode_payload_bytes(encInfo, (const unsigned char *)file_extn, strlen(file_extn));
+}
+
+/* Encode secret file size */
+Status encode_secret_file_size(uint64_t file_size, EncodeInfo *encInfo)
+{
+    return encode_payload_size(encInfo, file_size);
+}
+
+/* Encode the shard record: payload ID, index, count, offset and total size */
+Status encode_shard_record(EncodeInfo *encInfo)
+{
+    unsigned char rec[STEGO_SHARD_SIZE];
+
+    stego_shard_pack(&encInfo->shard, rec);
+    return encode_payload_bytes(encInfo, rec, sizeof(rec));
+}
+
+/*===========================================================
+ * FUNCTION NAME : encode_key_salt
+ * PURPOSE       : Draw a fresh salt, derive this image's key
+ *                 from it and the passphrase, and queue the
+ *                 salt as the last header field; --scatter
+ *                 lays out the data tiles from the same key
+ ===========================================================*/
+Status encode_key_salt(EncodeInfo *encInfo)
+{
+    unsigned char key[KDF_KEY_SIZE];
+
+    if (kdf_random(encInfo->salt, STEGO_SALT_SIZE) != 0)
+    {
+        perror("getrandom");
+        return e_failure;
+    }
+    kdf_derive_key(encInfo->passphrase, encInfo->salt, key);
+    cipher_init(&encInfo->cipher, key);
+    if (encode_payload_bytes(encInfo, encInfo->salt, STEGO_SALT_SIZE) == e_failure)
+        return e_failure;
+
+    /* The salt ends the header (queued at 1 bit), the tiles start right after it */
+    if (encInfo->scatter)
+    {
+        scatter_init(&encInfo->tiles, key, encInfo->channel_pos + (uint64_t)encInfo->secret_pending * 8,
+                     encInfo->bmp.capacity);
+        encInfo->layout = &encInfo->tiles;
+    }
+    memset(key, 0, sizeof(key));
+    return e_success;
+}
+
+/*===========================================================
+ * Multi-threaded data encode (-j N)
+ * Secret byte i always lands in channel data_pos + i * 8 / bits,
+ * so the secret is cut into whole-group slices and every
+ * worker preads its slice (secret and pixel span) and pwrites the
+ * embedded span, with no ordering between chunks. Spans of
+ * neighbouring chunks tile the pixel array, padding included.
+ ===========================================================*/
+typedef struct
+{
+    EncodeInfo *encInfo;
+    uint64_t data_pos;              /* channel of secret byte 0 */
+    uint64_t fsize;
+    uint64_t padded;                /* fsize, up to a whole group before a trailer */
+    size_t chunk;                   /* PARALLEL_CHUNK_SIZE in whole groups (and MAC blocks) */
+    int bits;
+    unsigned char *secret_bufs[MAX_THREADS];
+    unsigned char *image_bufs[MAX_THREADS];
+    unsigned char *orig_bufs[MAX_THREADS];     /* --stats: pixels before embedding */
+    uint32_t *crcs;                 /* --crc: CRC32C of every chunk */
+    Cipher *macs;                   /* -p: MAC of every chunk */
+    atomic_int failed;
+} ParallelEncode;
+
+static void encode_chunk(void *ctx, size_t index, int worker)
+{
+    ParallelEncode *job = ctx;
+    EncodeInfo *encInfo = job->encInfo;
+    const BmpInfo *bmp = &encInfo->bmp;
+    uint64_t off = (uint64_t)index * job->chunk;
+    size_t n = job->padded - off < job->chunk ? (size_t)(job->padded - off) : job->chunk;
+    size_t data = job->fsize - off < n ? (size_t)(job->fsize - off) : n;
+    unsigned char *secret = job->secret_bufs[worker];
+    unsigned char *image = job->image_bufs[worker];
+    uint64_t c = job->data_pos + LSB_CHANNELS(off, job->bits);
+
+    if (atomic_load(&job->failed))
+        return;
+
+    if (pread(fileno(encInfo->fptr_secret), secret, data, (off_t)(encInfo->shard.offset + off)) != (ssize_t)data)
+    {
+        atomic_store(&job->failed, 1);
+        return;
+    }
+    stats_io(encInfo->stats, STAT_BYTES_READ, data);
+    memset(secret + data, 0, n - data);
+    if (job->macs)
+    {
+        /* The keystream is addressed by offset, the MAC pieces are joined in order later */
+        cipher_xor(&encInfo->cipher, off, secret, data);
+        cipher_fork(&encInfo->cipher, &job->macs[index]);
+        cipher_auth(&job->macs[index], secret, data);
+    }
+    if (job->crcs)
+        job->crcs[index] = crc32c(0, secret, data);
+
+    /* One pixel span, or one per tile when scattered */
+    while (n > 0)
+    {
+        size_t piece = scatter_piece(encInfo->layout, c, n, job->bits);
+        uint64_t c0 = scatter_channel(encInfo->layout, c);
+        uint64_t span_start = bmp_channel_offset(bmp, c0);
+        size_t span = bmp_channel_offset(bmp, c0 + LSB_CHANNELS(piece, job->bits)) - span_start;
+        const unsigned char *src = image;
+
+        if (encInfo->src_map)
+            src = encInfo->src_map + span_start;
+        else if (pread(fileno(encInfo->fptr_src_image), image, span, (off_t)span_start) != (ssize_t)span)
+        {
+            atomic_store(&job->failed, 1);
+            return;
+        }
+        else
+            stats_io(encInfo->stats, STAT_BYTES_READ, span);
+
+        const unsigned char *before = src;
+        if (job->orig_bufs[worker] && src == image)
+            before = memcpy(job->orig_bufs[worker], image, span);
+
+        bmp_embed(bmp, image, src, span_start, c0, secret, piece, job->bits);
+        stats_count_changes(encInfo->stats, bmp, before, image, span, span_start);
+        if (pwrite(fileno(encInfo->fptr_stego_image), image, span, (off_t)span_start) != (ssize_t)span)
+        {
+            atomic_store(&job->failed, 1);
+            return;
+        }
+        stats_io(encInfo->stats, STAT_BYTES_WRITTEN, span);
+
+        c += LSB_CHANNELS(piece, job->bits);
+        secret += piece;
+        n -= piece;
+    }
+}
+
+static Status encode_secret_file_data_parallel(EncodeInfo *encInfo)
+{
+    ParallelEncode job;
+    int threads = encInfo->threads > MAX_THREADS ? MAX_THREADS : encInfo->threads;
+    size_t image_buf_len = bmp_span_max(&encInfo->bmp, PARALLEL_CHUNK_SIZE * 8);
+    Status ret = e_success;
+
+    /* Embed the queued header so both files sit at the start of the data */
+    if (flush_payload_block(encInfo) == e_failure)
+        return e_failure;
+
+    memset(&job, 0, sizeof(job));
+    job.encInfo = encInfo;
+    job.data_pos = encInfo->channel_pos;
+    job.fsize = job.padded = encInfo->size_secret_file;
+    job.bits = encInfo->stream_bits;
+    atomic_init(&job.failed, 0);
+
+    /* MAC pieces can only be joined on whole 16 byte blocks */
+    size_t align = LSB_GROUP_BYTES(job.bits) * ((encInfo->hdr_flags & STEGO_FLAG_ENCRYPT) ? 16 : 1);
+    job.chunk = PARALLEL_CHUNK_SIZE / align * align;
+
+    /* The last chunk takes the zero padding, so the trailer goes in alone afterwards */
+    if (stego_trailer_size(encInfo->hdr_flags) > 0)
+        job.padded = stego_trailer_offset(job.fsize, job.bits);
+
+    size_t chunks = (job.padded + job.chunk - 1) / job.chunk;
+    uint64_t channels = LSB_CHANNELS(job.padded, job.bits);
+    uint64_t data_end = bmp_channel_offset(&encInfo->bmp, job.data_pos + channels);
+    if (job.data_pos + channels > encInfo->bmp.capacity ||
+        (encInfo->src_map && data_end > encInfo->src_map_len))
+    {
+        printf("ERROR: Source image ended before secret data\n");
+        return e_failure;
+    }
+
+    if ((encInfo->hdr_flags & STEGO_FLAG_CRC) && (job.crcs = malloc(sizeof(*job.crcs) * (chunks + 1))) == NULL)
+        atomic_store(&job.failed, 1);
+    if ((encInfo->hdr_flags & STEGO_FLAG_ENCRYPT) && (job.macs = malloc(sizeof(*job.macs) * (chunks + 1))) == NULL)
+        atomic_store(&job.failed, 1);
+
+    for (int t = 0; t < threads; t++)
+    {
+        job.secret_bufs[t] = malloc(PARALLEL_CHUNK_SIZE);
+        job.image_bufs[t] = malloc(image_buf_len);
+        if (encInfo->stats && !encInfo->src_map)
+            job.orig_bufs[t] = malloc(image_buf_len);
+        if (job.secret_bufs[t] == NULL || job.image_bufs[t] == NULL ||
+            (encInfo->stats && !encInfo->src_map && job.orig_bufs[t] == NULL))
+            atomic_store(&job.failed, 1);
+    }
+
+    if (!atomic_load(&job.failed))
+        parallel_for(threads, chunks, encode_chunk, &job);
+
+    if (atomic_load(&job.failed))
+    {
+        printf("ERROR: Parallel encode of secret data failed\n");
+        ret = e_failure;
+    }
+    else
+    {
+        /* Chunk CRCs and MACs chain into those of the whole data */
+        for (size_t i = 0; i < chunks; i++)
+        {
+            uint64_t off = (uint64_t)i * job.chunk;
+            uint64_t len = job.fsize - off < job.chunk ? job.fsize - off : job.chunk;
+
+            if (job.crcs)
+                encInfo->data_crc = crc32c_combine(encInfo->data_crc, job.crcs[i], len);
+            if (job.macs)
+                cipher_join(&encInfo->cipher, &job.macs[i]);
+        }
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        free(job.secret_bufs[t]);
+        free(job.image_bufs[t]);
+        free(job.orig_bufs[t]);
+    }
+    free(job.crcs);
+    free(job.macs);
+
+    /* Leave both streams after the data so the tail copy continues from there */
+    encInfo->channel_pos += channels;
+    source_seek(encInfo, (off_t)data_end);
+    fseeko(encInfo->fptr_stego_image, (off_t)data_end, SEEK_SET);
+    return ret;
+}
+
+/* Frames and chunks are produced in order, pipes cannot pread/pwrite */
+static int parallel_data(const EncodeInfo *encInfo)
+{
+    return encInfo->threads > 1 && !encInfo->in_place && !encInfo->compress && encInfo->seekable &&
+           !encInfo->archive;
+}
+
+/* Read the secret up to the end of the shard; a piped one is counted as it goes by */
+static size_t read_secret(EncodeInfo *encInfo, unsigned char *buf, size_t n)
+{
+    if (encInfo->shard.count > 0 && n > encInfo->secret_left)
+        n = (size_t)encInfo->secret_left;
+
+    size_t got = fread(buf, 1, n, encInfo->fptr_secret);
+
+    stats_io(encInfo->stats, STAT_BYTES_READ, got);
+    if (encInfo->shard.count > 0)
+        encInfo->secret_left -= got;
+
+    if (encInfo->streamed)
+        encInfo->size_secret_file += got;
+    return got;
+}
+
+/*
+ * Next secret bytes as they are stored: the file itself, or its
+ * LZ frames built one chunk at a time. Returns 0 at the end.
+ */
+static size_t read_stored_data(EncodeInfo *encInfo, unsigned char *buf, size_t room)
+{
+    size_t done = 0;
+
+    if (!encInfo->framed)
+        return read_secret(encInfo, buf, room);
+
+    while (done < room)
+    {
+        if (encInfo->lz_frame_pos == encInfo->lz_frame_len)
+        {
+            size_t n = read_secret(encInfo, encInfo->lz_raw, LZ_CHUNK_SIZE);
+            if (n == 0)
+                break;
+            encInfo->lz_frame_len = lz_frame(encInfo->lz_raw, n, encInfo->lz_frame);
+            encInfo->lz_frame_pos = 0;
+        }
+
+        size_t take = encInfo->lz_frame_len - encInfo->lz_frame_pos;
+        if (take > room - done)
+            take = room - done;
+        memcpy(buf + done, encInfo->lz_frame + encInfo->lz_frame_pos, take);
+        encInfo->lz_frame_pos += take;
+        done += take;
+    }
+    return done;
+}
+
+/* Next stored bytes as they go into the image: encrypted with -p */
+static size_t read_payload_data(EncodeInfo *encInfo, unsigned char *buf, size_t room)
+{
+    size_t n = read_stored_data(encInfo, buf, room);
+
+    if (encInfo->hdr_flags & STEGO_FLAG_ENCRYPT)
+        cipher_encrypt(&encInfo->cipher, buf, n);
+    return n;
+}
+
+/*
+ * Stored bytes of a piped secret, cut into length-prefixed chunks
+ * and closed by a zero length. Returns 0 after the last one.
+ */
+static size_t read_secret_chunks(EncodeInfo *encInfo, unsigned char *buf, size_t room)
+{
+    size_t done = 0;
+
+    while (done < room)
+    {
+        if (encInfo->chunk_pos == encInfo->chunk_len)
+        {
+            if (encInfo->chunk_end)
+                break;
+
+            size_t n = 0, got;
+            while (n < STEGO_STREAM_CHUNK &&
+                   (got = read_payload_data(encInfo, encInfo->chunk + 4 + n, STEGO_STREAM_CHUNK - n)) > 0)
+                n += got;
+            stego_put_u32(encInfo->chunk, (uint32_t)n);
+            encInfo->chunk_len = 4 + n;
+            encInfo->chunk_pos = 0;
+            encInfo->chunk_end = n == 0;
+            encInfo->size_stored += encInfo->chunk_len;
+        }
+
+        size_t take = encInfo->chunk_len - encInfo->chunk_pos;
+        if (take > room - done)
+            take = room - done;
+        memcpy(buf + done, encInfo->chunk + encInfo->chunk_pos, take);
+        encInfo->chunk_pos += take;
+        done += take;
+    }
+    return done;
+}
+
+/* Queue the open secret as stored up to its end; *queued counts the bytes */
+static Status queue_secret(EncodeInfo *encInfo, uint64_t *queued)
+{
+    size_t block = block_size(encInfo);
+    size_t n;
+
+    /* Read the secret straight into the free part of the payload block */
+    *queued = 0;
+    do
+    {
+        size_t room = block - encInfo->secret_pending;
+
+        if (encInfo->streamed)
+            n = read_secret_chunks(encInfo, encInfo->secret_data + encInfo->secret_pending, room);
+        else
+            n = read_payload_data(encInfo, encInfo->secret_data + encInfo->secret_pending, room);
+        if (encInfo->hdr_flags & STEGO_FLAG_CRC)
+            encInfo->data_crc = crc32c(encInfo->data_crc, encInfo->secret_data + encInfo->secret_pending, n);
+        encInfo->secret_pending += n;
+        *queued += n;
+
+        if (encInfo->secret_pending == block &&
+            flush_payload_block(encInfo) == e_failure)
+            return e_failure;
+    } while (n > 0);
+
+    return e_success;
+}
+
+/*===========================================================
+ * FUNCTION NAME : encode_archive_data
+ * PURPOSE       : Queue the TOC, then every member body in
+ *                 TOC order (framed where the entry says LZ)
+ ===========================================================*/
+static Status encode_archive_data(EncodeInfo *encInfo)
+{
+    if (encInfo->hdr_flags & STEGO_FLAG_ENCRYPT)
+        cipher_encrypt(&encInfo->cipher, encInfo->toc_buf, encInfo->toc_len);
+    if (encode_payload_bytes(encInfo, encInfo->toc_buf, encInfo->toc_len) == e_failure)
+        return e_failure;
+    if (encInfo->hdr_flags & STEGO_FLAG_CRC)
+        encInfo->data_crc = crc32c(encInfo->data_crc, encInfo->toc_buf, encInfo->toc_len);
+
+    for (int i = 0; i < encInfo->n_members; i++)
+    {
+        const ArchiveEntry *entry = &encInfo->toc[i];
+        uint64_t queued;
+
+        encInfo->fptr_secret = fopen(encInfo->members[i], "r");
+        if (encInfo->fptr_secret == NULL)
+        {
+            perror(encInfo->members[i]);
+            return e_failure;
+        }
+        setvbuf(encInfo->fptr_secret, NULL, _IONBF, 0);
+        encInfo->framed = (entry->flags & ARCHIVE_MEMBER_LZ) != 0;
+        encInfo->lz_frame_len = encInfo->lz_frame_pos = 0;
+
+        Status ret = queue_secret(encInfo, &queued);
+        fclose(encInfo->fptr_secret);
+        encInfo->fptr_secret = NULL;
+        if (ret == e_failure)
+            return e_failure;
+
+        /* The TOC was written from the sizes seen by check_capacity */
+        if (queued != entry->stored)
+        {
+            printf("ERROR: %s changed while it was being encoded\n", encInfo->members[i]);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Queue the trailer: pad zero bytes up to a whole group, the tag, then the CRC */
+static Status encode_trailer(EncodeInfo *encInfo, size_t pad)
+{
+    unsigned char trailer[3 + STEGO_TAG_SIZE + STEGO_CRC_SIZE] = {0};
+    unsigned char *p = trailer + pad;
+
+    if (encInfo->hdr_flags & STEGO_FLAG_ENCRYPT)
+    {
+        cipher_tag(&encInfo->cipher, p);
+        p += STEGO_TAG_SIZE;
+    }
+    if (encInfo->hdr_flags & STEGO_FLAG_CRC)
+        stego_put_u32(p, encInfo->data_crc);
+    return encode_payload_bytes(encInfo, trailer, pad + stego_trailer_size(encInfo->hdr_flags));
+}
+
+/* Encode entire secret file content, one block at a time */
+Status encode_secret_file_data(EncodeInfo *encInfo)
+{
+    uint64_t queued;
+    int padded = 0;
+
+    /* Header went in at 1 bit per channel, data uses the chosen depth */
+    if (set_stream_bits(encInfo, encInfo->bits) == e_failure)
+        return e_failure;
+    encInfo->data_crc = 0;
+
+    if (encInfo->archive)
+    {
+        if (encode_archive_data(encInfo) == e_failure)
+            return e_failure;
+    }
+    else if (parallel_data(encInfo))
+    {
+        /* Workers pad the last group themselves */
+        if (encode_secret_file_data_parallel(encInfo) == e_failure)
+            return e_failure;
+        padded = 1;
+    }
+    else if (queue_secret(encInfo, &queued) == e_failure)
+        return e_failure;
+
+    /* Tag and checksum follow the data in the same pass */
+    if (stego_trailer_size(encInfo->hdr_flags) > 0)
+    {
+        size_t pad = padded ? 0 : (size_t)(stego_trailer_offset(encInfo->size_stored, encInfo->bits) -
+                                           encInfo->size_stored);
+        if (encode_trailer(encInfo, pad) == e_failure)
+            return e_failure;
+    }
+
+    /* Embed whatever is left of the last block */
+    return flush_payload_block(encInfo);
+}
+
+/* Write all leftover image bytes without encoding */
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, Stats *stats)
+{
+    size_t buf_len = IMAGE_BUF_SIZE(DEFAULT_SECRET_BUF_SIZE);
+    unsigned char *buffer = malloc(buf_len);
+    size_t bytes_read;
+    Status ret = e_success;
+
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to allocate copy buffer\n");
+        return e_failure;
+    }
+
+    while ((bytes_read = fread(buffer, 1, buf_len, fptr_src)) > 0)
+    {
+        stats_io(stats, STAT_BYTES_READ, bytes_read);
+        if (fwrite(buffer, 1, bytes_read, fptr_dest) != bytes_read)
+        {
+            perror("fwrite");
+            ret = e_failure;
+            break;
+        }
+        stats_io(stats, STAT_BYTES_WRITTEN, bytes_read);
+    }
+
+    free(buffer);
+    return ret;
+}
+
+/* Write the leftover bytes of a mapped source image in one call */
+static Status copy_remaining_map_data(EncodeInfo *encInfo)
+{
+    off_t pos = source_tell(encInfo);
+
+    if (pos < 0 || (size_t)pos > encInfo->src_map_len)
+        return e_failure;
+
+    size_t len = encInfo->src_map_len - pos;
+    if (fwrite(encInfo->src_map + pos, 1, len, encInfo->fptr_stego_image) != len)
+    {
+        perror("fwrite");
+        return e_failure;
+    }
+    stats_io(encInfo->stats, STAT_BYTES_WRITTEN, len);
+    return e_success;
+}
+
+/*===========================================================
+ * FUNCTION NAME : copy_remaining_kernel
+ * PURPOSE       : Let the kernel copy (or reflink) the leftover
+ *                 bytes when both images are files, so the
+ *                 untouched part of the image never passes
+ *                 through userspace
+ * RETURN        : e_success if it took all of them; otherwise
+ *                 both files are left after what was copied
+ ===========================================================*/
+static Status copy_remaining_kernel(EncodeInfo *encInfo)
+{
+    off_t src_pos = source_tell(encInfo);
+    off_t dst_pos = ftello(encInfo->fptr_stego_image);
+    struct stat st;
+
+    if (src_pos < 0 || dst_pos < 0 || fstat(fileno(encInfo->fptr_src_image), &st) < 0 ||
+        !S_ISREG(st.st_mode) || st.st_size < src_pos)
+        return e_failure;
+
+    uint64_t len = (uint64_t)(st.st_size - src_pos);
+    uint64_t done = copy_range(fileno(encInfo->fptr_src_image), (uint64_t)src_pos,
+                               fileno(encInfo->fptr_stego_image), (uint64_t)dst_pos, len);
+
+    stats_add(encInfo->stats, STAT_BYTES_COPIED, done);
+    source_seek(encInfo, src_pos + (off_t)done);
+    fseeko(encInfo->fptr_stego_image, dst_pos + (off_t)done, SEEK_SET);
+    return done == len ? e_success : e_failure;
+}
+
+/* Copy the pixels from the current position to the end of the image */
+static Status copy_remaining(EncodeInfo *encInfo)
+{
+    stats_stage(encInfo->stats, "remaining_copy");
+    LOG_INFO(encInfo, "INFO: Copying Remaining Image Data...\n");
+    if (copy_remaining_kernel(encInfo) == e_success)
+        return e_success;
+
+    /* Pipes, and whatever the kernel would not copy, go through a buffer */
+    if (encInfo->src_map)
+        return copy_remaining_map_data(encInfo);
+    return copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->stats);
+}
+
+/*===========================================================
+ * FUNCTION NAME : start_overlap
+ * PURPOSE       : Let the serial pass read the pixels ahead and
+ *                 write them behind on helper threads, so block
+ *                 N is embedded while N + 1 is read and N - 1
+ *                 written. The parallel and scattered passes do
+ *                 their own pread/pwrite. Without a ring the
+ *                 pass uses stdio as before.
+ ===========================================================*/
+static void start_overlap(EncodeInfo *encInfo)
+{
+    const BmpInfo *bmp = &encInfo->bmp;
+    off_t pos = source_tell(encInfo);
+
+    if (encInfo->scatter || parallel_data(encInfo) || !ioring_enabled())
+        return;
+
+    /* Reads stop at the last payload pixel (a streamed size is unknown), the tail copy does the rest */
+    if (!encInfo->src_map && pos >= 0 && pipe_seekable(encInfo->fptr_src_image))
+    {
+        uint64_t channels = encInfo->payload_channels && encInfo->payload_channels < bmp->capacity
+                                ? encInfo->payload_channels : bmp->capacity;
+        encInfo->src_ring = ioring_reader(fileno(encInfo->fptr_src_image), (uint64_t)pos,
+                                          bmp_channel_offset(bmp, channels), encInfo->image_buf_len);
+    }
+    encInfo->dst_ring = ioring_writer(fileno(encInfo->fptr_stego_image), encInfo->image_buf_len);
+}
+
+/* Drain the rings; both files are left right after the payload pixels */
+static Status stop_overlap(EncodeInfo *encInfo)
+{
+    int failed = ioring_close(encInfo->dst_ring);
+
+    if (encInfo->src_ring)
+        source_seek(encInfo, (off_t)bmp_channel_offset(&encInfo->bmp, encInfo->channel_pos));
+    ioring_close(encInfo->src_ring);
+    encInfo->src_ring = encInfo->dst_ring = NULL;
+
+    if (failed)
+    {
+        printf("ERROR: Unable to write stego image %s\n", encInfo->stego_image_fname);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*===========================================================
+ * Encode the full payload stream (magic string, extension
+ * size, extension, file size and data) into the image
+ ===========================================================*/
+static Status encode_payload(EncodeInfo *encInfo)
+{
+    /* Encode magic string */
+    stats_stage(encInfo->stats, "magic");
+    LOG_INFO(encInfo, "INFO: Encoding Magic String...\n");
+    encInfo->stream_bits = 1;
+    if (encode_magic_string(MAGIC_STRING, encInfo) == e_failure)
+        return e_failure;
+
+    /* Only payloads the original layout cannot describe get the extended header */
+    if (encInfo->hdr_version != 0)
+    {
+        stats_stage(encInfo->stats, "format");
+        LOG_INFO(encInfo, "INFO: Encoding Payload Format...\n");
+        if (encode_payload_format(encInfo) == e_failure)
+            return e_failure;
+    }
+
+    int ext_size = strlen(encInfo->extn_secret_file);
+
+    /* Encode extension metadata */
+    stats_stage(encInfo->stats, "extn_size");
+    LOG_INFO(encInfo, "INFO: Encoding Secret File Extension Size...\n");
+    if (encode_secret_file_extn_size(ext_size, encInfo) == e_failure)
+        return e_failure;
+
+    stats_stage(encInfo->stats, "extn");
+    LOG_INFO(encInfo, "INFO: Encoding Secret File Extension...\n");
+    if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_failure)
+        return e_failure;
+
+    /* Encode size of secret text */
+    stats_stage(encInfo->stats, "file_size");
+    LOG_INFO(encInfo, "INFO: Encoding Secret File Size...\n");
+    if (encode_secret_file_size(encInfo->size_stored, encInfo) == e_failure)
+        return e_failure;
+
+    /* Compressed payloads also record the size to restore */
+    if (encInfo->hdr_flags & STEGO_FLAG_LZ)
+    {
+        stats_stage(encInfo->stats, "raw_size");
+        LOG_INFO(encInfo, "INFO: Encoding Secret File Original Size...\n");
+        if (encode_payload_size(encInfo, encInfo->size_secret_file) == e_failure)
+            return e_failure;
+    }
+
+    /* A shard of a striped payload records where its data belongs */
+    if (encInfo->hdr_flags & STEGO_FLAG_SHARD)
+    {
+        stats_stage(encInfo->stats, "shard");
+        LOG_INFO(encInfo, "INFO: Encoding Shard Record...\n");
+        if (encode_shard_record(encInfo) == e_failure)
+            return e_failure;
+    }
+
+    /* Encrypted payloads record the salt of their key */
+    if (encInfo->hdr_flags & STEGO_FLAG_ENCRYPT)
+    {
+        stats_stage(encInfo->stats, "kdf");
+        LOG_INFO(encInfo, "INFO: Deriving Key and Encoding Salt...\n");
+        if (encode_key_salt(encInfo) == e_failure)
+            return e_failure;
+    }
+
+    /* Encode the actual file data */
+    stats_stage(encInfo->stats, "data");
+    LOG_INFO(encInfo, "INFO: Encoding Secret File Data...\n");
+    if (encode_secret_file_data(encInfo) == e_failure)
+        return e_failure;
+
+    return e_success;
+}
+
+/*===========================================================
+ * Encoding pipeline:
+ * Performs the whole encoding pipeline step-by-step
+ ===========================================================*/
+static Status encode_image(EncodeInfo *encInfo)
+{
+    /* Open required input/output files */
+    stats_stage(encInfo->stats, "open");
+    if (open_files(encInfo) == e_failure)
+        return e_failure;
+
+    /* Check if image is large enough */
+    stats_stage(encInfo->stats, "capacity");
+    if (check_capacity(encInfo) == e_failure)
+        return e_failure;
+
+    /* Copy BMP header unmodified (a piped image was read already, a shared cover is mapped) */
+    stats_stage(encInfo->stats, "header_copy");
+    LOG_INFO(encInfo, "INFO: Copying BMP header...\n");
+    if (encInfo->src_header || encInfo->cover)
+    {
+        const unsigned char *header = encInfo->cover ? encInfo->cover->map : encInfo->src_header;
+        size_t header_len = encInfo->cover ? encInfo->bmp.pixel_offset : encInfo->src_header_len;
+
+        if (fwrite(header, 1, header_len, encInfo->fptr_stego_image) != header_len)
+        {
+            perror("fwrite");
+            return e_failure;
+        }
+        stats_io(encInfo->stats, STAT_BYTES_WRITTEN, header_len);
+        encInfo->cover_pos = header_len;
+    }
+    else if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->stats) == e_failure)
+        return e_failure;
+
+    /* Scattered tiles are patched into a whole copy of the pixels */
+    if (encInfo->scatter && copy_remaining(encInfo) == e_failure)
+        return e_failure;
+
+    /* Magic string, extension, size and data */
+    start_overlap(encInfo);
+    if (encode_payload(encInfo) == e_failure || stop_overlap(encInfo) == e_failure)
+        return e_failure;
+
+    /* Copy remaining pixels */
+    if (!encInfo->scatter && copy_remaining(encInfo) == e_failure)
+        return e_failure;
+
+    stats_stage(encInfo->stats, NULL);
+    LOG_INFO(encInfo, "INFO: Encoding completed successfully.\n");
+    return e_success;
+}
+
+/*===========================================================
+ * FUNCTION NAME : discard_stego_image
+ * PURPOSE       : Close and remove the stego output of a
+ *                 failed encode, so no truncated image is
+ *                 left behind. Only a regular file this
+ *                 encode opened goes; a pipe or stdout has
+ *                 been handed the bytes already.
+ ===========================================================*/
+void discard_stego_image(EncodeInfo *encInfo)
+{
+    if (!encInfo->output_file)
+        return;
+
+    /* The write-behind ring uses the file until it is closed */
+    ioring_close(encInfo->dst_ring);
+    encInfo->dst_ring = NULL;
+    if (encInfo->fptr_stego_image)
+        fclose(encInfo->fptr_stego_image);
+    encInfo->fptr_stego_image = NULL;
+    if (remove(encInfo->stego_image_fname) == 0)
+        LOG_INFO(encInfo, "INFO: Removed %s\n", encInfo->stego_image_fname);
+    encInfo->output_file = 0;
+}
+
+/*===========================================================
+ * Top-level encoding: a piped secret only shows it does not
+ * fit once the image has been started, so whatever fails
+ * after the output is opened takes the output with it
+ ===========================================================*/
+Status do_encoding(EncodeInfo *encInfo)
+{
+    if (encode_image(encInfo) == e_success)
+        return e_success;
+    discard_stego_image(encInfo);
+    return e_failure;
+}
+
+/*===========================================================
+ * Where the payload stored in the image lies: old_end gets the
+ * channel bytes of its header and data (0 if there is none),
+ * old_hdr_end those of its 1-bit header and old_bits the depth
+ * of its data; *flags receives its flags. The header sits in
+ * the first pixel row(s), so this is one small pread. Fails
+ * only when the image cannot be read.
+ ===========================================================*/
+static Status stored_payload_channels(EncodeInfo *encInfo, uint32_t *flags)
+{
+    const BmpInfo *bmp = &encInfo->bmp;
+    unsigned char bytes[STEGO_MAX_HEADER_SIZE];
+    StegoHeader hdr;
+    size_t hdr_len;
+
+    encInfo->old_end = encInfo->old_hdr_end = 0;
+    encInfo->old_bits = 1;
+    if (bmp->capacity < sizeof(bytes) * 8)
+        return e_success;
+
+    size_t span = bmp_channel_offset(bmp, sizeof(bytes) * 8) - bmp->pixel_offset;
+    if (pread(fileno(encInfo->fptr_src_image), encInfo->image_data, span, bmp->pixel_offset) != (ssize_t)span)
+    {
+        perror("pread");
+        printf("ERROR: Unable to read the stored payload header of %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    stats_io(encInfo->stats, STAT_BYTES_READ, span);
+    bmp_extract(bmp, encInfo->image_data, bmp->pixel_offset, 0, bytes, sizeof(bytes), 1);
+
+    if (stego_header_unpack(bytes, sizeof(bytes), &hdr, &hdr_len) != STEGO_OK)
+        return e_success;
+
+    /* A streamed payload records no sizes: walk its chunks through a mapping */
+    if (hdr.flags & STEGO_FLAG_STREAM)
+    {
+        size_t map_len = 0;
+        const unsigned char *map = map_input_file(encInfo->fptr_src_image, &map_len);
+
+        if (!map)
+        {
+            printf("ERROR: Unable to map %s to size its stored payload\n", encInfo->src_image_fname);
+            return e_failure;
+        }
+        StegoError err = stego_payload_info(map, map_len, &hdr);
+
+        unmap_input_file(map, map_len);
+        if (err != STEGO_OK)
+            return e_success;
+    }
+
+    /* A length past the end of the image is not one of ours */
+    uint64_t total = stego_channels_needed(&hdr);
+    if (total > encInfo->image_capacity)
+        return e_success;
+    encInfo->old_end = total;
+    encInfo->old_hdr_end = (uint64_t)stego_header_size(&hdr) * 8;
+    encInfo->old_bits = hdr.bits > 0 ? hdr.bits : 1;
+    *flags = hdr.flags;
+    return e_success;
+}
+
+/*===========================================================
+ * Top-level in-place update:
+ * Re-embeds a new secret into an existing image. Only pixel
+ * bytes that change are written back. Bits of the previous
+ * payload the new one leaves alone (deeper planes where it was
+ * stored deeper, the tail where it was longer) are cleared.
+ ===========================================================*/
+Status do_inplace_update(EncodeInfo *encInfo)
+{
+    stats_stage(encInfo->stats, "open");
+    if (open_update_files(encInfo) == e_failure)
+        return e_failure;
+
+    stats_stage(encInfo->stats, "capacity");
+    if (check_capacity(encInfo) == e_failure)
+        return e_failure;
+
+    stats_stage(encInfo->stats, "previous_payload");
+    uint32_t old_flags = 0;
+    if (stored_payload_channels(encInfo, &old_flags) == e_failure)
+        return e_failure;
+
+    /* Scattered tiles cannot be diffed or cleared in payload order */
+    if (encInfo->scatter || (old_flags & STEGO_FLAG_SCATTER))
+    {
+        printf("ERROR: In-place update does not support scattered payloads\n");
+        return e_failure;
+    }
+
+    /* Payload starts at the first pixel */
+    encInfo->channel_pos = 0;
+    encInfo->bytes_written = encInfo->write_calls = 0;
+
+    if (encode_payload(encInfo) == e_failure)
+        return e_failure;
+
+    /* Clear what is left of a longer previous payload, at its own depth */
+    uint64_t old_end = encInfo->old_end;
+    if (old_end > encInfo->channel_pos)
+    {
+        stats_stage(encInfo->stats, "clear");
+        LOG_INFO(encInfo, "INFO: Clearing %llu channel bytes of the previous payload...\n",
+                 (unsigned long long)(old_end - encInfo->channel_pos));
+        while (encInfo->channel_pos < old_end)
+        {
+            int in_hdr = encInfo->channel_pos < encInfo->old_hdr_end;
+            uint64_t left = (in_hdr ? encInfo->old_hdr_end : old_end) - encInfo->channel_pos;
+
+            encInfo->stream_bits = in_hdr ? 1 : encInfo->old_bits;
+            size_t n = (left * encInfo->stream_bits + 7) / 8;
+
+            if (n > block_size(encInfo))
+                n = block_size(encInfo);
+            /* Never run past the image on a partly covered last byte */
+            while (n > 0 && encInfo->channel_pos + LSB_CHANNELS(n, encInfo->stream_bits) > encInfo->bmp.capacity)
+                n--;
+            if (n == 0)
+                break;
+
+            memset(encInfo->secret_data, 0, n);
+            encInfo->secret_pending = n;
+            if (flush_payload_block(encInfo) == e_failure)
+                return e_failure;
+        }
+    }
 
-    printf("INFO: Encoding completed successfully.\n");
+    stats_stage(encInfo->stats, NULL);
+    LOG_INFO(encInfo, "INFO: Update rewrote %llu bytes in %llu writes\n",
+             (unsigned long long)encInfo->bytes_written, (unsigned long long)encInfo->write_calls);
     return e_success;
 }
@@ -2,7 +2,15 @@
 #define ENCODE_H
 
 #include <stdio.h>
+#include <sys/types.h>
 #include "types.h" // Contains user defined types
+#include "stego.h"
+#include "bmp.h"
+#include "archive.h"
+#include "cipher.h"
+#include "scatter.h"
+#include "ioring.h"
+#include "stats.h"
 
 /* 
  * Structure to store information required for
@@ -11,62 +19,201 @@
  * also stored
  */
 
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX 10    // enough for ".txt", ".png", etc.
+#define DEFAULT_SECRET_BUF_SIZE (256 * 1024)   // payload bytes per block
+#define MIN_SECRET_BUF_SIZE (64 * 1024)
+#define MAX_SECRET_BUF_SIZE (4 * 1024 * 1024)
+#define IMAGE_BUF_SIZE(secret_buf) ((secret_buf) * 8)   // pixel bytes per block
+#define MAX_FILE_SUFFIX (STEGO_MAX_EXTN + 1)    // enough for ".txt", ".png", etc.
+#define INPLACE_MERGE_GAP 64  // unchanged bytes bridged by a single pwrite
+
+/*
+ * A cover read once and encoded many times (fan-out, fanout.h): the
+ * open file, its parsed headers and a read-only mapping of it, shared
+ * by every EncodeInfo that points at it. Each encode reads the fd
+ * only at explicit offsets, so none of them moves its file position.
+ */
+typedef struct
+{
+    int fd;
+    BmpInfo bmp;
+    const unsigned char *map;
+    size_t map_len;
+} SharedCover;
 
 typedef struct _EncodeInfo
 {
     /* Source Image info */
     char *src_image_fname;
     FILE *fptr_src_image;
-    uint image_capacity;
+    BmpInfo bmp;                    /* parsed header: offsets, stride, bpp */
+    uint64_t image_capacity;        /* channel bytes, see bmp.h */
+    const SharedCover *cover;       /* fan-out: headers and pixels come from here, else NULL */
+    uint64_t cover_pos;             /* file position in the shared cover, kept per encode */
+    unsigned char *src_header;      /* headers of a piped source image */
+    size_t src_header_len;
     uint bits_per_pixel;
-    char image_data[MAX_IMAGE_BUF_SIZE];
+    unsigned char *image_data;      /* pixel span of one block (padding included) */
+    size_t image_buf_len;
 
     /* Secret File Info */
     char *secret_fname;
     FILE *fptr_secret;
     char extn_secret_file[MAX_FILE_SUFFIX];
-    char secret_data[MAX_SECRET_BUF_SIZE];
-    long size_secret_file;
+    unsigned char *secret_data;     /* buf_size bytes of pending payload */
+    size_t secret_pending;          /* payload bytes queued in secret_data */
+    uint64_t channel_pos;           /* channel bytes already embedded */
+    int stream_bits;                /* depth of the queued bytes (header: 1) */
+    uint64_t size_secret_file;
+    int streamed;                   /* piped secret: size unknown, chunked */
+
+    /* Secret data bits per channel (--bits): 1..4, STEGO_BITS_AUTO
+     * or 0 for 1; check_capacity replaces it with the depth used */
+    int bits;
+
+    /* Header version and STEGO_FLAG_* from check_capacity (0 = original layout) */
+    uint32_t hdr_version;
+    uint32_t hdr_flags;
+
+    /* LZ compression of the secret (-z) */
+    int compress;
+    uint64_t size_stored;           /* secret bytes as embedded (frames) */
+    unsigned char *lz_raw;          /* one raw chunk of the secret */
+    unsigned char *lz_frame;        /* the frame built from it */
+    size_t lz_frame_len;
+    size_t lz_frame_pos;            /* frame bytes already queued */
+    int framed;                     /* secret read now goes through lz_frame */
+
+    /* CRC32C trailer after the data (--crc), taken as the data is queued */
+    int crc;
+    uint32_t data_crc;
+
+    /* Encryption under a passphrase (-p): stored bytes are encrypted as
+     * they are queued, the tag goes in the trailer */
+    const char *passphrase;
+    unsigned char salt[STEGO_SALT_SIZE];
+    Cipher cipher;
+
+    /* Data tiles spread over the image under the key (--scatter); the
+     * image is copied whole first and the tiles patched in after */
+    int scatter;
+    Scatter tiles;
+    const Scatter *layout;          /* &tiles once the key is known, else NULL */
+
+    /* Chunk of a streamed secret: length word + up to STEGO_STREAM_CHUNK bytes */
+    unsigned char *chunk;
+    size_t chunk_len;
+    size_t chunk_pos;               /* chunk bytes already queued */
+    int chunk_end;                  /* the zero length chunk was queued */
+
+    /* Archive payload (-a): several secrets behind a table of contents */
+    int archive;
+    char **members;                 /* member paths */
+    int n_members;
+    ArchiveEntry *toc;
+    unsigned char *toc_buf;         /* packed TOC, toc_len bytes */
+    size_t toc_len;
+
+    /* Striped payload (stripe.h): the run of the secret this image
+     * holds, shard.count 0 for the whole secret */
+    StegoShard shard;
+    uint64_t shard_len;             /* secret bytes in the shard */
+    uint64_t secret_left;           /* shard bytes not read yet */
 
     /* Stego Image Info */
     char *stego_image_fname;
     FILE *fptr_stego_image;
+    int output_file;                /* a regular file this encode opened: removed if it fails */
+
+    /* Streaming buffer size (payload bytes per block, 0 = default) */
+    size_t buf_size;
+
+    /* Optional read-only mapping of the source image (-m) */
+    int use_mmap;
+    const unsigned char *src_map;
+    size_t src_map_len;
+
+    /* Worker threads for the data region (-j), 0/1 = single thread */
+    int threads;
+
+    /* All three files support pread/pwrite (no pipes) */
+    int seekable;
+
+    /* Read-ahead and write-behind rings of the serial data pass, NULL when off */
+    IoRing *src_ring;
+    IoRing *dst_ring;
+    uint64_t payload_channels;      /* header and data, from check_capacity (0: streamed) */
+
+    /* Suppress INFO messages (errors are still printed) */
+    int quiet;
+
+    /* In-place update (-u): image opened read-write, no stego file */
+    int in_place;
+    unsigned char *prev_pixels;     /* pixel bytes of the block as read */
+    uint64_t old_end;               /* channels of the previous payload... */
+    uint64_t old_hdr_end;           /* ...of its 1-bit header... */
+    int old_bits;                   /* ...and the depth of its data */
+    uint64_t bytes_written;         /* pixel bytes rewritten */
+    uint64_t write_calls;           /* pwrite calls issued */
+
+    /* Stage timings and I/O counters (--stats), NULL when off */
+    Stats *stats;
 
 } EncodeInfo;
 
 
 /* Encoding function prototypes */
 
-/* Check operation type (-e or -d) */
+/* Check operation type (-e, -d, -u or -b) */
 OperationType check_operation_type(char *argv[]);
 
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 
-/* Perform the encoding */
+/* Read and validate archive encode args: cover, output, members */
+Status read_and_validate_archive_args(char *argv[], EncodeInfo *encInfo);
+
+/* Read and validate in-place update args from argv */
+Status read_and_validate_update_args(char *argv[], EncodeInfo *encInfo);
+
+/* Perform the encoding; a failed encode removes the stego file it started */
 Status do_encoding(EncodeInfo *encInfo);
 
+/* Close and remove the stego output if it is a file this encode opened (pipes stay) */
+void discard_stego_image(EncodeInfo *encInfo);
+
+/* Re-embed a new secret into an existing image, rewriting changed bytes only */
+Status do_inplace_update(EncodeInfo *encInfo);
+
+/* Parse and map a cover once for many encodes (e_failure with a message) */
+Status load_shared_cover(const char *fname, SharedCover *cover);
+
+/* Unmap and close a cover loaded by load_shared_cover */
+void free_shared_cover(SharedCover *cover);
+
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close files and release streaming buffers */
+void close_files(EncodeInfo *encInfo);
+
 /* Check capacity of source image */
 Status check_capacity(EncodeInfo *encInfo);
 
 /* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+uint64_t get_image_size_for_bmp(FILE *fptr_image);
 
-/* Get file size */
-uint get_file_size(FILE *fptr);
+/* Get file size (-1 on error) */
+off_t get_file_size(FILE *fptr);
 
 /* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, Stats *stats);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 
+/* Encode the extended header words (version, flags) */
+Status encode_payload_format(EncodeInfo *encInfo);
+
 /* Encode secret file extension size */
 Status encode_secret_file_extn_size(int extn_size, EncodeInfo *encInfo);
 
@@ -74,18 +221,30 @@ Status encode_secret_file_extn_size(int extn_size, EncodeInfo *encInfo);
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
+Status encode_secret_file_size(uint64_t file_size, EncodeInfo *encInfo);
+
+/* Encode the shard record of a striped payload */
+Status encode_shard_record(EncodeInfo *encInfo);
+
+/* Derive the key of an encrypted payload and encode its salt */
+Status encode_key_salt(EncodeInfo *encInfo);
 
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
+/* Queue payload bytes; a block is embedded once the buffer is full */
+Status encode_payload_bytes(EncodeInfo *encInfo, const unsigned char *data, size_t n);
+
+/* Embed all queued payload bytes: one image read and one write */
+Status flush_payload_block(EncodeInfo *encInfo);
+
 /* Encode a byte into LSB of image data array */
 Status encode_byte_to_lsb(char data, char *image_buffer);
 
-/* Encode a 32-bit value (size) into LSB of 32 bytes */
-Status encode_size_to_lsb(long value, unsigned char *buffer);
+/* Encode a size field (4 or 8 bytes) into LSB of 8 bytes per byte */
+Status encode_size_to_lsb(uint64_t value, size_t size_len, unsigned char *buffer);
 
 /* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, Stats *stats);
 
 #endif
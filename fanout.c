@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fanout.h"
+#include "encode.h"
+#include "parallel.h"
+#include "pipeio.h"
+#include "stats.h"
+#include "common.h"
+
+/* One output of the fan-out and its outcome */
+typedef struct
+{
+    char *cover_fname;
+    char *secret;
+    char *output;
+    const SharedCover *cover;
+    const BatchConfig *config;
+    Status status;
+    double elapsed_ms;
+    uint64_t payload_bytes;
+} FanoutJob;
+
+/* Encode one output from the shared cover: same validation and pipeline as the -e command */
+static void fanout_job(void *arg, int worker)
+{
+    FanoutJob *job = arg;
+    char *argv[] = { "stego", "-e", job->cover_fname, job->secret, job->output, NULL };
+    EncodeInfo encInfo;
+    double start = stats_now_ms();
+
+    (void)worker;
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.buf_size = job->config->buf_size;
+    encInfo.bits = job->config->bits;
+    encInfo.compress = job->config->compress;
+    encInfo.crc = job->config->crc;
+    encInfo.passphrase = job->config->passphrase;
+    encInfo.scatter = job->config->scatter;
+    encInfo.cover = job->cover;
+    encInfo.quiet = 1;
+
+    job->status = e_failure;
+    if (read_and_validate_encode_args(argv, &encInfo) == e_success)
+        job->status = do_encoding(&encInfo);
+    job->payload_bytes = encInfo.size_secret_file;
+    close_files(&encInfo);
+    job->elapsed_ms = stats_now_ms() - start;
+}
+
+/*===========================================================
+ * FUNCTION NAME : run_fanout
+ * PURPOSE       : Load the cover once, encode all outputs
+ *                 from it on a pool (-j workers, default one
+ *                 per online CPU) and report each of them
+ ===========================================================*/
+Status run_fanout(const char *cover_fname, char *pairs[], int n, const BatchConfig *config, int quiet)
+{
+    LogTarget log = { quiet };
+    SharedCover cover;
+    int failed = 0;
+
+    /* Outputs are written side by side, so none of them may use stdin/stdout */
+    for (int i = 0; i < 2 * n; i++)
+    {
+        if (pipe_is_std(pairs[i]))
+        {
+            printf("ERROR: --fanout needs the secrets and outputs as files, not pipes\n");
+            return e_failure;
+        }
+    }
+
+    if (load_shared_cover(cover_fname, &cover) == e_failure)
+        return e_failure;
+
+    FanoutJob *jobs = calloc(n, sizeof(*jobs));
+    if (jobs == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        free_shared_cover(&cover);
+        return e_failure;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = config->threads > 0 ? config->threads : (cpus > 0 ? (int)cpus : 1);
+    if (threads > n)
+        threads = n;
+    WorkPool *pool = workpool_create(threads < MAX_THREADS ? threads : MAX_THREADS);
+    if (pool == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to start worker threads\n");
+        free(jobs);
+        free_shared_cover(&cover);
+        return e_failure;
+    }
+
+    double start = stats_now_ms();
+    for (int i = 0; i < n; i++)
+    {
+        FanoutJob *job = &jobs[i];
+
+        job->cover_fname = (char *)cover_fname;
+        job->secret = pairs[2 * i];
+        job->output = pairs[2 * i + 1];
+        job->cover = &cover;
+        job->config = config;
+        job->status = e_failure;
+        if (workpool_submit(pool, fanout_job, job) != 0)
+            fprintf(stderr, "ERROR: Unable to queue %s\n", job->secret);
+    }
+    workpool_wait(pool);
+    double secs = (stats_now_ms() - start) / 1000.0;
+    workpool_destroy(pool);
+
+    /* Per-output status in argument order */
+    for (int i = 0; i < n; i++)
+    {
+        const FanoutJob *job = &jobs[i];
+
+        printf("%-4s %s -> %s (%llu bytes, %.2f ms)\n", job->status == e_success ? "OK" : "FAIL",
+               job->secret, job->output, (unsigned long long)job->payload_bytes, job->elapsed_ms);
+        if (job->status != e_success)
+            failed++;
+    }
+    LOG_INFO(&log, "INFO: Fan-out of %s finished: %d outputs, %d failed, %.3f s, %.1f outputs/s\n",
+             cover_fname, n, failed, secs, secs > 0 ? n / secs : 0.0);
+
+    free(jobs);
+    free_shared_cover(&cover);
+    return failed == 0 ? e_success : e_failure;
+}
@@ -0,0 +1,24 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "types.h"
+#include "batch.h"
+
+/*
+ * Fan-out (--fanout): one cover, many (secret, output) pairs, e.g. a
+ * marked copy of the same image per recipient.
+ *
+ * The cover is opened, parsed and mapped once (SharedCover, encode.h),
+ * so replacing the file mid-run cannot mix two images into one output,
+ * and every output is encoded from that mapping on a work-stealing
+ * pool, one output per task. Each output only embeds the pixels its
+ * payload needs; the headers are copied and the untouched rest of
+ * the image goes through the kernel (reflinked where the file system
+ * shares extents, see copyrange.h), so an output costs about its
+ * payload, not its image.
+ */
+
+/* Embed every secret of pairs (secret, output, secret, output, ...) into its own copy of cover_fname */
+Status run_fanout(const char *cover_fname, char *pairs[], int n, const BatchConfig *config, int quiet);
+
+#endif
@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ioring.h"
+
+struct _IoRing
+{
+    int fd;
+    int writer;
+    unsigned char *bufs[IORING_DEPTH];
+    size_t lens[IORING_DEPTH];      /* bytes held by each full buffer */
+    size_t buf_len;
+
+    /* Full buffers are head .. head + count - 1. The caller works on
+     * the head (reader) or on the one after the full ones (writer)
+     * without the lock; the thread never touches that one. */
+    int head;
+    int count;
+    int fill;                       /* writer: the caller's buffer */
+    size_t pos;                     /* bytes used of the caller's buffer */
+    uint64_t offset;                /* reader: file offset of the caller's next byte */
+    uint64_t file_pos;              /* reader: next offset the thread reads */
+    uint64_t end;
+
+    int done;                       /* reader: nothing more will be read */
+    int failed;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t tid;
+};
+
+/* Reader thread: fill free buffers front to back until end */
+static void *reader_thread(void *arg)
+{
+    IoRing *ring = arg;
+
+    pthread_mutex_lock(&ring->lock);
+    while (!ring->stop && !ring->done)
+    {
+        if (ring->count == IORING_DEPTH)
+        {
+            pthread_cond_wait(&ring->cond, &ring->lock);
+            continue;
+        }
+
+        int slot = (ring->head + ring->count) % IORING_DEPTH;
+        uint64_t left = ring->end - ring->file_pos;
+        size_t want = left < ring->buf_len ? (size_t)left : ring->buf_len;
+        size_t got = 0;
+
+        pthread_mutex_unlock(&ring->lock);
+        while (got < want)
+        {
+            ssize_t n = pread(ring->fd, ring->bufs[slot] + got, want - got, (off_t)(ring->file_pos + got));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            got += (size_t)n;
+        }
+        pthread_mutex_lock(&ring->lock);
+
+        if (got > 0)
+        {
+            ring->lens[slot] = got;
+            ring->file_pos += got;
+            ring->count++;
+        }
+        /* A short read is the end of the file (or an error): the caller runs dry there */
+        if (got < want || ring->file_pos >= ring->end)
+            ring->done = 1;
+        pthread_cond_broadcast(&ring->cond);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return NULL;
+}
+
+/* Writer thread: write full buffers out in order, then exit once stopped */
+static void *writer_thread(void *arg)
+{
+    IoRing *ring = arg;
+
+    pthread_mutex_lock(&ring->lock);
+    for (;;)
+    {
+        if (ring->count == 0)
+        {
+            if (ring->stop)
+                break;
+            pthread_cond_wait(&ring->cond, &ring->lock);
+            continue;
+        }
+
+        int slot = ring->head;
+        size_t len = ring->lens[slot], done = 0;
+        int failed = ring->failed;
+
+        pthread_mutex_unlock(&ring->lock);
+        while (done < len && !failed)
+        {
+            ssize_t n = write(ring->fd, ring->bufs[slot] + done, len - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                failed = 1;
+            else
+                done += (size_t)n;
+        }
+        pthread_mutex_lock(&ring->lock);
+
+        ring->failed = failed;
+        ring->head = (ring->head + 1) % IORING_DEPTH;
+        ring->count--;
+        pthread_cond_broadcast(&ring->cond);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return NULL;
+}
+
+static void ioring_free(IoRing *ring)
+{
+    for (int i = 0; i < IORING_DEPTH; i++)
+        free(ring->bufs[i]);
+    free(ring);
+}
+
+/* Allocate the buffers and start the thread; the ring is fully set up before it runs */
+static IoRing *ioring_start(int fd, int writer, size_t buf_len, uint64_t offset, uint64_t end)
+{
+    IoRing *ring = calloc(1, sizeof(*ring));
+
+    if (ring == NULL)
+        return NULL;
+    ring->fd = fd;
+    ring->writer = writer;
+    ring->buf_len = buf_len;
+    ring->offset = ring->file_pos = offset;
+    ring->end = end;
+    for (int i = 0; i < IORING_DEPTH; i++)
+    {
+        ring->bufs[i] = malloc(buf_len);
+        if (ring->bufs[i] == NULL)
+        {
+            ioring_free(ring);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    if (pthread_create(&ring->tid, NULL, writer ? writer_thread : reader_thread, ring) != 0)
+    {
+        pthread_mutex_destroy(&ring->lock);
+        pthread_cond_destroy(&ring->cond);
+        ioring_free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+int ioring_enabled(void)
+{
+    return sysconf(_SC_NPROCESSORS_ONLN) > 1;
+}
+
+IoRing *ioring_reader(int fd, uint64_t offset, uint64_t end, size_t buf_len)
+{
+    if (end <= offset || buf_len == 0)
+        return NULL;
+    return ioring_start(fd, 0, buf_len, offset, end);
+}
+
+IoRing *ioring_writer(int fd, size_t buf_len)
+{
+    if (buf_len == 0)
+        return NULL;
+    return ioring_start(fd, 1, buf_len, 0, 0);
+}
+
+/*===========================================================
+ * FUNCTION NAME : ioring_read_at
+ * PURPOSE       : Hand out file bytes from the full buffers,
+ *                 dropping those before offset, and give each
+ *                 emptied buffer back to the thread
+ ===========================================================*/
+int ioring_read_at(IoRing *ring, void *dst, size_t n, uint64_t offset)
+{
+    unsigned char *out = dst;
+
+    if (offset < ring->offset)
+        return -1;
+
+    while (n > 0)
+    {
+        pthread_mutex_lock(&ring->lock);
+        while (ring->count == 0 && !ring->done)
+            pthread_cond_wait(&ring->cond, &ring->lock);
+        int empty = ring->count == 0;
+        pthread_mutex_unlock(&ring->lock);
+        if (empty)
+            return -1;
+
+        /* The head buffer is ours until it is given back */
+        size_t avail = ring->lens[ring->head] - ring->pos;
+        uint64_t skip = offset - ring->offset;
+        size_t take = skip < avail ? (size_t)(avail - skip < n ? avail - skip : n) : 0;
+
+        if (skip < avail)
+        {
+            memcpy(out, ring->bufs[ring->head] + ring->pos + skip, take);
+            out += take;
+            n -= take;
+            offset += take;
+        }
+        size_t used = skip < avail ? (size_t)skip + take : avail;
+        ring->pos += used;
+        ring->offset += used;
+
+        if (ring->pos == ring->lens[ring->head])
+        {
+            pthread_mutex_lock(&ring->lock);
+            ring->head = (ring->head + 1) % IORING_DEPTH;
+            ring->count--;
+            ring->pos = 0;
+            pthread_cond_broadcast(&ring->cond);
+            pthread_mutex_unlock(&ring->lock);
+        }
+    }
+    return 0;
+}
+
+/* Hand the buffer being filled to the thread, waiting for a free one after it */
+static void writer_submit(IoRing *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->lens[ring->fill] = ring->pos;
+    ring->fill = (ring->fill + 1) % IORING_DEPTH;
+    ring->count++;
+    ring->pos = 0;
+    pthread_cond_broadcast(&ring->cond);
+    while (ring->count == IORING_DEPTH)
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void *ioring_claim(IoRing *ring, size_t n)
+{
+    if (ring->buf_len - ring->pos < n)
+        writer_submit(ring);
+    return ring->bufs[ring->fill] + ring->pos;
+}
+
+int ioring_commit(IoRing *ring, size_t n)
+{
+    ring->pos += n;
+    if (ring->pos == ring->buf_len)
+        writer_submit(ring);
+
+    pthread_mutex_lock(&ring->lock);
+    int failed = ring->failed;
+    pthread_mutex_unlock(&ring->lock);
+    return failed ? -1 : 0;
+}
+
+int ioring_write(IoRing *ring, const void *src, size_t n)
+{
+    const unsigned char *in = src;
+
+    while (n > 0)
+    {
+        size_t take = ring->buf_len - ring->pos < n ? ring->buf_len - ring->pos : n;
+
+        memcpy(ring->bufs[ring->fill] + ring->pos, in, take);
+        ring->pos += take;
+        in += take;
+        n -= take;
+        if (ring->pos == ring->buf_len)
+            writer_submit(ring);
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    int failed = ring->failed;
+    pthread_mutex_unlock(&ring->lock);
+    return failed ? -1 : 0;
+}
+
+int ioring_close(IoRing *ring)
+{
+    int failed;
+
+    if (ring == NULL)
+        return 0;
+
+    /* A writer still owes the partly filled buffer */
+    if (ring->writer && ring->pos > 0)
+        writer_submit(ring);
+
+    pthread_mutex_lock(&ring->lock);
+    ring->stop = 1;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+    pthread_join(ring->tid, NULL);
+
+    failed = ring->failed;
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->cond);
+    ioring_free(ring);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Overlapped file I/O for the serial encode/decode paths: a ring of
+ * IORING_DEPTH reusable buffers with a helper thread behind it.
+ *
+ * A reader ring preads the file front to back ahead of the caller,
+ * so the next block is already on its way while this one is
+ * embedded or extracted. A writer ring takes the caller's bytes and
+ * writes them out behind it at the descriptor's position. Either way
+ * the caller sees a plain byte stream and never waits for the disk
+ * unless the ring runs dry (reads) or full (writes).
+ */
+
+#define IORING_DEPTH 3          /* buffers per ring: one in use, one in flight, one spare */
+
+typedef struct _IoRing IoRing;
+
+/* True if rings are worth it: the helper thread needs a CPU of its
+ * own, on one CPU it only adds copies */
+int ioring_enabled(void);
+
+/* Read fd from offset up to end (or end of file), buf_len bytes per
+ * buffer; NULL if the buffers or the thread cannot be had */
+IoRing *ioring_reader(int fd, uint64_t offset, uint64_t end, size_t buf_len);
+
+/* Write to fd at its current position, buf_len bytes per buffer */
+IoRing *ioring_writer(int fd, size_t buf_len);
+
+/* Copy the n file bytes at offset into dst. Offsets only move
+ * forward: bytes skipped over are dropped. -1 if offset lies
+ * behind the stream or the file ends or fails first. */
+int ioring_read_at(IoRing *ring, void *dst, size_t n, uint64_t offset);
+
+/* Queue n bytes for writing, -1 once a write has failed */
+int ioring_write(IoRing *ring, const void *src, size_t n);
+
+/* Zero-copy write: room for n bytes (at most buf_len) to fill in
+ * place, then queue them with ioring_commit */
+void *ioring_claim(IoRing *ring, size_t n);
+int ioring_commit(IoRing *ring, size_t n);
+
+/* Stop the thread and free the ring (NULL is ignored). A writer
+ * writes out what is queued first, -1 if a write failed. */
+int ioring_close(IoRing *ring);
+
+#endif
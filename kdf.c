@@ -0,0 +1,201 @@
+#include <string.h>
+#include <errno.h>
+#include <sys/random.h>
+#include "kdf.h"
+
+#define ROTR32(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+typedef struct
+{
+    uint32_t h[8];
+    unsigned char buf[64];
+    size_t n_buf;
+    uint64_t len;
+} Sha256;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void sha256_block(Sha256 *s, const unsigned char *p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h;
+
+    for (int i = 0; i < 16; i++)
+        w[i] = get_be32(p + 4 * i);
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
+    e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) +
+                      sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+    s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+static void sha256_init(Sha256 *s)
+{
+    static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+    memcpy(s->h, iv, sizeof(iv));
+    s->n_buf = 0;
+    s->len = 0;
+}
+
+static void sha256_update(Sha256 *s, const unsigned char *p, size_t n)
+{
+    s->len += n;
+    while (n > 0)
+    {
+        size_t take = 64 - s->n_buf < n ? 64 - s->n_buf : n;
+
+        memcpy(s->buf + s->n_buf, p, take);
+        s->n_buf += take;
+        p += take;
+        n -= take;
+        if (s->n_buf == 64)
+        {
+            sha256_block(s, s->buf);
+            s->n_buf = 0;
+        }
+    }
+}
+
+static void sha256_final(Sha256 *s, unsigned char out[SHA256_SIZE])
+{
+    uint64_t bits = s->len * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t pad_len = (s->n_buf < 56 ? 56 : 120) - s->n_buf;
+
+    put_be32(pad + pad_len, (uint32_t)(bits >> 32));
+    put_be32(pad + pad_len + 4, (uint32_t)bits);
+    sha256_update(s, pad, pad_len + 8);
+    for (int i = 0; i < 8; i++)
+        put_be32(out + 4 * i, s->h[i]);
+}
+
+void sha256(const void *buf, size_t n, unsigned char out[SHA256_SIZE])
+{
+    Sha256 s;
+
+    sha256_init(&s);
+    sha256_update(&s, buf, n);
+    sha256_final(&s, out);
+}
+
+/*===========================================================
+ * FUNCTION NAME : pbkdf2_sha256
+ * PURPOSE       : HMAC keyed by the passphrase, with the
+ *                 inner and outer pad blocks hashed once, so
+ *                 a round is two compressions
+ ===========================================================*/
+void pbkdf2_sha256(const char *pass, size_t pass_len, const unsigned char *salt, size_t salt_len,
+                   uint32_t iterations, unsigned char *out, size_t out_len)
+{
+    unsigned char key[64] = {0}, pad[64], u[SHA256_SIZE], t[SHA256_SIZE], be_index[4];
+    Sha256 inner, outer, s;
+
+    if (pass_len > sizeof(key))
+        sha256(pass, pass_len, key);
+    else
+        memcpy(key, pass, pass_len);
+
+    sha256_init(&inner);
+    sha256_init(&outer);
+    for (int i = 0; i < 64; i++)
+        pad[i] = key[i] ^ 0x36;
+    sha256_update(&inner, pad, 64);
+    for (int i = 0; i < 64; i++)
+        pad[i] = key[i] ^ 0x5c;
+    sha256_update(&outer, pad, 64);
+
+    for (uint32_t index = 1; out_len > 0; index++)
+    {
+        size_t take = out_len < SHA256_SIZE ? out_len : SHA256_SIZE;
+
+        /* U1 = HMAC(salt || index), Uj = HMAC(Uj-1), T = U1 ^ U2 ^ ... */
+        put_be32(be_index, index);
+        s = inner;
+        sha256_update(&s, salt, salt_len);
+        sha256_update(&s, be_index, 4);
+        sha256_final(&s, u);
+        s = outer;
+        sha256_update(&s, u, SHA256_SIZE);
+        sha256_final(&s, u);
+        memcpy(t, u, SHA256_SIZE);
+
+        for (uint32_t j = 1; j < iterations; j++)
+        {
+            s = inner;
+            sha256_update(&s, u, SHA256_SIZE);
+            sha256_final(&s, u);
+            s = outer;
+            sha256_update(&s, u, SHA256_SIZE);
+            sha256_final(&s, u);
+            for (int i = 0; i < SHA256_SIZE; i++)
+                t[i] ^= u[i];
+        }
+
+        memcpy(out, t, take);
+        out += take;
+        out_len -= take;
+    }
+    memset(key, 0, sizeof(key));
+    memset(pad, 0, sizeof(pad));
+}
+
+void kdf_derive_key(const char *passphrase, const unsigned char salt[KDF_SALT_SIZE],
+                    unsigned char key[KDF_KEY_SIZE])
+{
+    pbkdf2_sha256(passphrase, strlen(passphrase), salt, KDF_SALT_SIZE, KDF_ITERATIONS, key, KDF_KEY_SIZE);
+}
+
+int kdf_random(unsigned char *buf, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t got = getrandom(buf, n, 0);
+
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += got;
+        n -= (size_t)got;
+    }
+    return 0;
+}
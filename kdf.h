@@ -0,0 +1,33 @@
+#ifndef KDF_H
+#define KDF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Passphrase to key: PBKDF2-HMAC-SHA256 (RFC 8018) over a random
+ * salt stored in the payload header, so every image gets its own
+ * ChaCha20-Poly1305 key (cipher.h) even under one passphrase.
+ */
+
+#define KDF_SALT_SIZE 16
+#define KDF_ITERATIONS 100000
+#define KDF_KEY_SIZE 32
+
+#define SHA256_SIZE 32
+
+/* SHA-256 of buf */
+void sha256(const void *buf, size_t n, unsigned char out[SHA256_SIZE]);
+
+/* PBKDF2-HMAC-SHA256 with iterations rounds, out_len bytes of key */
+void pbkdf2_sha256(const char *pass, size_t pass_len, const unsigned char *salt, size_t salt_len,
+                   uint32_t iterations, unsigned char *out, size_t out_len);
+
+/* Key for a payload: KDF_ITERATIONS of PBKDF2 over the header salt */
+void kdf_derive_key(const char *passphrase, const unsigned char salt[KDF_SALT_SIZE],
+                    unsigned char key[KDF_KEY_SIZE]);
+
+/* Fill buf with random bytes from the kernel, 0 on success */
+int kdf_random(unsigned char *buf, size_t n);
+
+#endif
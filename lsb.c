@@ -0,0 +1,391 @@
+#include <stdint.h>
+#include <string.h>
+#include "lsb.h"
+
+/*===========================================================
+ * Bulk LSB embed / extract kernels
+ *
+ * Layout: payload byte d is stored in 8 consecutive image
+ * bytes, byte j holding bit (7 - j) of d in its LSB.
+ *
+ * Three implementations share this layout:
+ *   - SWAR   : one payload byte per 64-bit word (portable)
+ *   - SSE2   : 16 payload bytes per iteration
+ *   - AVX2   : 32 payload bytes per iteration
+ * Vector kernels finish their tail with the SWAR kernel.
+ ===========================================================*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LSB_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LSB_LITTLE_ENDIAN 1
+#endif
+
+#define LSB_ONES   0x0101010101010101ULL
+#define LSB_CLEAR  0xFEFEFEFEFEFEFEFEULL
+
+/*-----------------------------------------------------------
+ * Portable kernels
+ -----------------------------------------------------------*/
+
+#ifdef LSB_LITTLE_ENDIAN
+
+/* Spread the 8 bits of d into the LSB of each byte, MSB in byte 0 */
+static inline uint64_t spread_byte(unsigned char d)
+{
+    uint64_t x = ((uint64_t)d * LSB_ONES) & 0x0102040810204080ULL;
+
+    /* Every byte is now either 0 or its own bit mask: turn it into 0/1 */
+    return ((x + 0x7F7F7F7F7F7F7F7FULL) >> 7) & LSB_ONES;
+}
+
+/* Gather the LSB of 8 bytes back into one byte, byte 0 as MSB */
+static inline unsigned char gather_byte(uint64_t x)
+{
+    return (unsigned char)(((x & LSB_ONES) * 0x8040201008040201ULL) >> 56);
+}
+
+static void embed_swar(unsigned char *dst, const unsigned char *src,
+                       const unsigned char *data, size_t n)
+{
+    uint64_t w;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        memcpy(&w, src + i * 8, 8);
+        w = (w & LSB_CLEAR) | spread_byte(data[i]);
+        memcpy(dst + i * 8, &w, 8);
+    }
+}
+
+static void extract_swar(const unsigned char *src, unsigned char *data, size_t n)
+{
+    uint64_t w;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        memcpy(&w, src + i * 8, 8);
+        data[i] = gather_byte(w);
+    }
+}
+
+#else /* big endian or unknown: plain bit loop */
+
+static void embed_swar(unsigned char *dst, const unsigned char *src,
+                       const unsigned char *data, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            dst[i * 8 + j] = (src[i * 8 + j] & 0xFE) | ((data[i] >> (7 - j)) & 1);
+        }
+    }
+}
+
+static void extract_swar(const unsigned char *src, unsigned char *data, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char d = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            d = (d << 1) | (src[i * 8 + j] & 1);
+        }
+        data[i] = d;
+    }
+}
+
+#endif
+
+/*-----------------------------------------------------------
+ * x86 kernels
+ -----------------------------------------------------------*/
+
+#ifdef LSB_HAVE_X86
+
+/* Replace the LSBs of 16 image bytes with bits already replicated in v */
+__attribute__((target("sse2")))
+static inline __m128i embed16_sse2(__m128i img, __m128i v)
+{
+    const __m128i bitsel = _mm_set1_epi64x(0x0102040810204080LL);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i clear = _mm_set1_epi8((char)0xFE);
+
+    __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v, bitsel), bitsel), one);
+    return _mm_or_si128(_mm_and_si128(img, clear), bits);
+}
+
+__attribute__((target("sse2")))
+static void embed_sse2(unsigned char *dst, const unsigned char *src,
+                       const unsigned char *data, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i *)(data + i));
+
+        /* Replicate every payload byte 8 times: d0 x8, d1 x8, ... */
+        __m128i b_lo = _mm_unpacklo_epi8(d, d);
+        __m128i b_hi = _mm_unpackhi_epi8(d, d);
+        __m128i w[4] = {
+            _mm_unpacklo_epi16(b_lo, b_lo), _mm_unpackhi_epi16(b_lo, b_lo),
+            _mm_unpacklo_epi16(b_hi, b_hi), _mm_unpackhi_epi16(b_hi, b_hi)
+        };
+
+        const unsigned char *s = src + i * 8;
+        unsigned char *o = dst + i * 8;
+
+        for (int k = 0; k < 4; k++)
+        {
+            __m128i q0 = _mm_unpacklo_epi32(w[k], w[k]);
+            __m128i q1 = _mm_unpackhi_epi32(w[k], w[k]);
+
+            __m128i img0 = _mm_loadu_si128((const __m128i *)(s + k * 32));
+            __m128i img1 = _mm_loadu_si128((const __m128i *)(s + k * 32 + 16));
+            _mm_storeu_si128((__m128i *)(o + k * 32), embed16_sse2(img0, q0));
+            _mm_storeu_si128((__m128i *)(o + k * 32 + 16), embed16_sse2(img1, q1));
+        }
+    }
+
+    embed_swar(dst + i * 8, src + i * 8, data + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void extract_sse2(const unsigned char *src, unsigned char *data, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 8));
+
+        /* Reverse bytes inside each 8-byte group so bit order matches movemask */
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+        /* Move each LSB to the sign bit and collect them */
+        int m = _mm_movemask_epi8(_mm_slli_epi16(v, 7));
+        data[i] = (unsigned char)m;
+        data[i + 1] = (unsigned char)(m >> 8);
+    }
+
+    extract_swar(src + i * 8, data + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void embed_avx2(unsigned char *dst, const unsigned char *src,
+                       const unsigned char *data, size_t n)
+{
+    const __m256i rep = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0,
+                                         1, 1, 1, 1, 1, 1, 1, 1,
+                                         2, 2, 2, 2, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bitsel = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i clear = _mm256_set1_epi8((char)0xFE);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        int32_t quad;
+        memcpy(&quad, data + i, 4);
+
+        /* Both 128-bit lanes see d0..d3; the shuffle picks 2 bytes per lane */
+        __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(quad), rep);
+        __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(v, bitsel), bitsel), one);
+
+        __m256i img = _mm256_loadu_si256((const __m256i *)(src + i * 8));
+        img = _mm256_or_si256(_mm256_and_si256(img, clear), bits);
+        _mm256_storeu_si256((__m256i *)(dst + i * 8), img);
+    }
+
+    embed_swar(dst + i * 8, src + i * 8, data + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void extract_avx2(const unsigned char *src, unsigned char *data, size_t n)
+{
+    const __m256i rev = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                                         15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0,
+                                         15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 8));
+
+        v = _mm256_shuffle_epi8(v, rev);
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(v, 7));
+        memcpy(data + i, &m, 4);
+    }
+
+    extract_swar(src + i * 8, data + i, n - i);
+}
+
+#endif /* LSB_HAVE_X86 */
+
+/*-----------------------------------------------------------
+ * Runtime dispatch
+ * __builtin_cpu_supports only reads a table filled at start-up,
+ * so checking it per call keeps the kernels free of global state.
+ -----------------------------------------------------------*/
+
+void lsb_embed_bytes(unsigned char *dst, const unsigned char *src,
+                     const unsigned char *data, size_t n)
+{
+#ifdef LSB_HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        embed_avx2(dst, src, data, n);
+        return;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        embed_sse2(dst, src, data, n);
+        return;
+    }
+#endif
+    embed_swar(dst, src, data, n);
+}
+
+void lsb_extract_bytes(const unsigned char *src, unsigned char *data, size_t n)
+{
+#ifdef LSB_HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        extract_avx2(src, data, n);
+        return;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        extract_sse2(src, data, n);
+        return;
+    }
+#endif
+    extract_swar(src, data, n);
+}
+
+/*-----------------------------------------------------------
+ * k-LSB kernels
+ * embed_k/extract_k are always inlined with a constant k, so
+ * every depth gets its own fully unrolled loop.
+ -----------------------------------------------------------*/
+
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+
+KERNEL_INLINE void embed_k(unsigned char *dst, const unsigned char *src,
+                           const unsigned char *data, size_t n, const int k)
+{
+    const unsigned mask = (1u << k) - 1;
+    const size_t g = LSB_GROUP_BYTES(k);
+    const int group_bits = (int)g * 8;
+    size_t i = 0;
+
+    for (; i + g <= n; i += g)
+    {
+        uint32_t bits = data[i];
+        if (g == 3)
+            bits = (bits << 16) | (data[i + 1] << 8) | data[i + 2];
+
+        for (int j = 0; j < group_bits / k; j++)
+        {
+            dst[j] = (src[j] & ~mask) | ((bits >> (group_bits - k * (j + 1))) & mask);
+        }
+        dst += group_bits / k;
+        src += group_bits / k;
+    }
+
+    if (i < n)
+    {
+        /* Short last group (k = 3 only): pad with zero bits */
+        uint32_t bits = (uint32_t)data[i] << 16;
+        if (n - i > 1)
+            bits |= data[i + 1] << 8;
+
+        for (int j = 0; j < (int)LSB_CHANNELS(n - i, k); j++)
+        {
+            dst[j] = (src[j] & ~mask) | ((bits >> (group_bits - k * (j + 1))) & mask);
+        }
+    }
+}
+
+KERNEL_INLINE void extract_k(const unsigned char *src, unsigned char *data, size_t n, const int k)
+{
+    const unsigned mask = (1u << k) - 1;
+    const size_t g = LSB_GROUP_BYTES(k);
+    const int group_bits = (int)g * 8;
+    size_t i = 0;
+
+    for (; i + g <= n; i += g)
+    {
+        uint32_t bits = 0;
+
+        for (int j = 0; j < group_bits / k; j++)
+        {
+            bits = (bits << k) | (src[j] & mask);
+        }
+        if (g == 3)
+        {
+            data[i] = (unsigned char)(bits >> 16);
+            data[i + 1] = (unsigned char)(bits >> 8);
+        }
+        data[i + g - 1] = (unsigned char)bits;
+        src += group_bits / k;
+    }
+
+    if (i < n)
+    {
+        int channels = (int)LSB_CHANNELS(n - i, k);
+        uint32_t bits = 0;
+
+        for (int j = 0; j < channels; j++)
+        {
+            bits = (bits << k) | (src[j] & mask);
+        }
+        bits <<= group_bits - k * channels;
+        data[i] = (unsigned char)(bits >> 16);
+        if (n - i > 1)
+            data[i + 1] = (unsigned char)(bits >> 8);
+    }
+}
+
+void lsb_embed_bits(unsigned char *dst, const unsigned char *src,
+                    const unsigned char *data, size_t n, int k)
+{
+    switch (k)
+    {
+        case 2:  embed_k(dst, src, data, n, 2); break;
+        case 3:  embed_k(dst, src, data, n, 3); break;
+        case 4:  embed_k(dst, src, data, n, 4); break;
+        default: lsb_embed_bytes(dst, src, data, n); break;
+    }
+}
+
+void lsb_extract_bits(const unsigned char *src, unsigned char *data, size_t n, int k)
+{
+    switch (k)
+    {
+        case 2:  extract_k(src, data, n, 2); break;
+        case 3:  extract_k(src, data, n, 3); break;
+        case 4:  extract_k(src, data, n, 4); break;
+        default: lsb_extract_bytes(src, data, n); break;
+    }
+}
+
+const char *lsb_kernel_name(void)
+{
+#ifdef LSB_HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+    if (__builtin_cpu_supports("sse2"))
+        return "sse2";
+#endif
+    return "swar";
+}
@@ -0,0 +1,49 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bulk LSB kernels
+ * Every payload byte is spread over the LSBs of 8 image bytes,
+ * MSB first (same layout as encode_byte_to_lsb).
+ * The best kernel for the running CPU (AVX2, SSE2 or portable
+ * 64-bit SWAR) is picked at runtime.
+ */
+
+/* Embed n payload bytes into 8*n image bytes: dst = src with LSBs replaced.
+ * dst and src may point to the same buffer. */
+void lsb_embed_bytes(unsigned char *dst, const unsigned char *src,
+                     const unsigned char *data, size_t n);
+
+/* Extract n payload bytes from the LSBs of 8*n image bytes */
+void lsb_extract_bytes(const unsigned char *src, unsigned char *data, size_t n);
+
+/*
+ * k-LSB kernels (k = 1..4 bits per image byte)
+ * The payload is one MSB-first bit stream cut into k-bit fields,
+ * field j going to the low k bits of image byte j, so k = 1 is the
+ * layout above. For k = 3, groups of 3 payload bytes fill 8 image
+ * bytes; a short last group is padded with zero bits.
+ * Block boundaries must fall on group boundaries (LSB_GROUP_BYTES).
+ */
+#define LSB_MAX_BITS 4
+
+/* Payload bytes per group: the smallest run ending on an image byte */
+#define LSB_GROUP_BYTES(k) ((k) == 3 ? 3 : 1)
+
+/* Image bytes holding n payload bytes at k bits each */
+#define LSB_CHANNELS(n, k) (((uint64_t)(n) * 8 + (k) - 1) / (k))
+
+/* Embed n payload bytes k bits per image byte (dst may equal src) */
+void lsb_embed_bits(unsigned char *dst, const unsigned char *src,
+                    const unsigned char *data, size_t n, int k);
+
+/* Extract n payload bytes stored k bits per image byte */
+void lsb_extract_bits(const unsigned char *src, unsigned char *data, size_t n, int k);
+
+/* Name of the kernel selected for this CPU ("avx2", "sse2" or "swar") */
+const char *lsb_kernel_name(void);
+
+#endif
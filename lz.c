@@ -0,0 +1,276 @@
+#include <string.h>
+#include "lz.h"
+
+/*===========================================================
+ * Chunked LZ77 codec
+ * Greedy matcher with a 4-byte hash table; chunks are at most
+ * 64 KiB so positions and offsets fit in 16 bits. Runs of
+ * misses skip ahead faster, so incompressible data costs
+ * little before it falls back to a stored frame.
+ ===========================================================*/
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 13
+#define LZ_MATCH_LIMIT 8    /* no match search in the last bytes */
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Length extension: 255 per byte, then the remainder */
+static int put_length(unsigned char *dst, size_t cap, size_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (*op >= cap)
+            return 0;
+        dst[(*op)++] = 255;
+    }
+    if (*op >= cap)
+        return 0;
+    dst[(*op)++] = (unsigned char)len;
+    return 1;
+}
+
+/* One sequence: literals, then a match (match_len 0 = literals only) */
+static int emit_sequence(unsigned char *dst, size_t cap, size_t *op,
+                         const unsigned char *lit, size_t lit_len, size_t offset, size_t match_len)
+{
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    if (*op >= cap)
+        return 0;
+    dst[(*op)++] = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15));
+
+    if (lit_len >= 15 && !put_length(dst, cap, op, lit_len - 15))
+        return 0;
+    if (cap - *op < lit_len)
+        return 0;
+    memcpy(dst + *op, lit, lit_len);
+    *op += lit_len;
+
+    if (match_len == 0)
+        return 1;
+
+    if (cap - *op < 2)
+        return 0;
+    dst[(*op)++] = (unsigned char)offset;
+    dst[(*op)++] = (unsigned char)(offset >> 8);
+    return ml < 15 || put_length(dst, cap, op, ml - 15);
+}
+
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    uint16_t table[1 << LZ_HASH_BITS];
+    size_t ip = 0, anchor = 0, op = 0;
+    unsigned misses = 0;
+
+    if (n > LZ_CHUNK_SIZE)
+        return 0;
+
+    if (n > LZ_MATCH_LIMIT + LZ_MIN_MATCH)
+    {
+        size_t limit = n - LZ_MATCH_LIMIT;
+
+        memset(table, 0, sizeof(table));
+        while (ip < limit)
+        {
+            uint32_t v = read32(src + ip);
+            uint32_t h = hash4(v);
+            size_t ref = table[h];
+
+            table[h] = (uint16_t)ip;
+            if (ref >= ip || read32(src + ref) != v)
+            {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+
+            size_t len = LZ_MIN_MATCH;
+            while (ip + len < n && src[ref + len] == src[ip + len])
+                len++;
+
+            if (!emit_sequence(dst, cap, &op, src + anchor, ip - anchor, ip - ref, len))
+                return 0;
+            ip += len;
+            anchor = ip;
+            misses = 0;
+        }
+    }
+
+    /* Trailing literals close the chunk */
+    if (!emit_sequence(dst, cap, &op, src + anchor, n - anchor, 0, 0))
+        return 0;
+    return op;
+}
+
+/* Read a length extension; SIZE_MAX on truncated input */
+static size_t get_length(const unsigned char *src, size_t n, size_t *ip, size_t len)
+{
+    unsigned char b;
+
+    do
+    {
+        if (*ip >= n)
+            return SIZE_MAX;
+        b = src[(*ip)++];
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+long lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    size_t ip = 0, op = 0;
+
+    while (ip < n)
+    {
+        unsigned token = src[ip++];
+        size_t lit_len = token >> 4;
+        size_t match_len = token & 15;
+
+        if (lit_len == 15 && (lit_len = get_length(src, n, &ip, lit_len)) == SIZE_MAX)
+            return -1;
+        if (n - ip < lit_len || cap - op < lit_len)
+            return -1;
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        /* The last sequence carries no match */
+        if (ip == n)
+            break;
+
+        if (n - ip < 2)
+            return -1;
+        size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (match_len == 15 && (match_len = get_length(src, n, &ip, match_len)) == SIZE_MAX)
+            return -1;
+        match_len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || cap - op < match_len)
+            return -1;
+
+        /* Byte copy: the match may overlap the bytes it produces */
+        const unsigned char *ref = dst + op - offset;
+        for (size_t i = 0; i < match_len; i++)
+            dst[op + i] = ref[i];
+        op += match_len;
+    }
+    return (long)op;
+}
+
+/*===========================================================
+ * FUNCTION NAME : lz_frame
+ * PURPOSE       : Compress one chunk into a frame, storing it
+ *                 raw when that is not smaller
+ ===========================================================*/
+size_t lz_frame(const unsigned char *raw, size_t n, unsigned char *frame)
+{
+    size_t body = lz_compress(raw, n, frame + LZ_FRAME_HEADER, n > 0 ? n - 1 : 0);
+
+    if (body == 0)
+    {
+        memcpy(frame + LZ_FRAME_HEADER, raw, n);
+        body = n;
+    }
+    put_be32(frame, (uint32_t)n);
+    put_be32(frame + 4, (uint32_t)body);
+    return LZ_FRAME_HEADER + body;
+}
+
+int lz_frame_header(const unsigned char *frame, size_t *raw_len, size_t *body_len)
+{
+    *raw_len = get_be32(frame);
+    *body_len = get_be32(frame + 4);
+
+    if (*raw_len > LZ_CHUNK_SIZE || *body_len > *raw_len)
+        return -1;
+    return 0;
+}
+
+long lz_unframe(const unsigned char *frame, unsigned char *raw)
+{
+    size_t raw_len, body_len;
+
+    if (lz_frame_header(frame, &raw_len, &body_len) != 0)
+        return -1;
+
+    if (body_len == raw_len)
+    {
+        memcpy(raw, frame + LZ_FRAME_HEADER, raw_len);
+        return (long)raw_len;
+    }
+    if (lz_decompress(frame + LZ_FRAME_HEADER, body_len, raw, raw_len) != (long)raw_len)
+        return -1;
+    return (long)raw_len;
+}
+
+/*===========================================================
+ * Streaming frame reader
+ ===========================================================*/
+void lz_reader_init(LzReader *r)
+{
+    r->have = 0;
+    r->need = LZ_FRAME_HEADER;
+}
+
+int lz_reader_feed(LzReader *r, const unsigned char *data, size_t n, lz_sink sink, void *ctx)
+{
+    while (n > 0)
+    {
+        size_t take = r->need - r->have < n ? r->need - r->have : n;
+
+        memcpy(r->frame + r->have, data, take);
+        r->have += take;
+        data += take;
+        n -= take;
+        if (r->have < r->need)
+            break;
+
+        if (r->need == LZ_FRAME_HEADER)
+        {
+            size_t raw_len, body_len;
+
+            if (lz_frame_header(r->frame, &raw_len, &body_len) != 0)
+                return -1;
+            r->need = LZ_FRAME_HEADER + body_len;
+            if (body_len > 0)
+                continue;
+        }
+
+        long raw_len = lz_unframe(r->frame, r->raw);
+        if (raw_len < 0 || sink(ctx, r->raw, (size_t)raw_len) != 0)
+            return -1;
+        lz_reader_init(r);
+    }
+    return 0;
+}
+
+int lz_reader_done(const LzReader *r)
+{
+    return r->have == 0;
+}
@@ -0,0 +1,61 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Chunked LZ compression of the secret payload
+ *
+ * The payload is cut into chunks of at most LZ_CHUNK_SIZE raw bytes,
+ * each stored as one self-contained frame:
+ *   raw length (4, big endian) | body length (4, big endian) | body
+ * The body is the LZ77 sequence stream of the chunk, or the raw bytes
+ * when compression does not help (body length == raw length).
+ * Encoder and decoder never hold more than one chunk and one frame.
+ *
+ * Sequence format (LZ4 style): token (literal length << 4 | match
+ * length - 4), length extension bytes of 255, literals, 16-bit little
+ * endian offset. The last sequence of a chunk has literals only.
+ */
+
+#define LZ_CHUNK_SIZE (64 * 1024)
+#define LZ_FRAME_HEADER 8
+#define LZ_FRAME_MAX (LZ_FRAME_HEADER + LZ_CHUNK_SIZE)
+
+/* Compress n (<= LZ_CHUNK_SIZE) bytes; 0 if the result would not fit in cap */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+/* Decompress into dst; bytes produced, or -1 if the input is malformed */
+long lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+/* Build the frame of one chunk into frame (LZ_FRAME_MAX bytes), return its length */
+size_t lz_frame(const unsigned char *raw, size_t n, unsigned char *frame);
+
+/* Decode the frame header: raw and body lengths; -1 if out of range */
+int lz_frame_header(const unsigned char *frame, size_t *raw_len, size_t *body_len);
+
+/* Unpack a complete frame into raw (LZ_CHUNK_SIZE bytes); raw length or -1 */
+long lz_unframe(const unsigned char *frame, unsigned char *raw);
+
+/* Receives every decompressed chunk; non-zero stops the reader */
+typedef int (*lz_sink)(void *ctx, const unsigned char *raw, size_t n);
+
+/* Streaming decoder: collects frame bytes as they are extracted */
+typedef struct
+{
+    unsigned char frame[LZ_FRAME_MAX];
+    unsigned char raw[LZ_CHUNK_SIZE];
+    size_t have;                /* bytes of the current frame collected */
+    size_t need;                /* its full length once the header is in */
+} LzReader;
+
+void lz_reader_init(LzReader *r);
+
+/* Feed stored bytes; 0 on success, -1 on a malformed frame or sink error */
+int lz_reader_feed(LzReader *r, const unsigned char *data, size_t n, lz_sink sink, void *ctx);
+
+/* True when the stream ended on a frame boundary */
+int lz_reader_done(const LzReader *r);
+
+#endif
@@ -0,0 +1,54 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapping.h"
+
+/*===========================================================
+ * FUNCTION NAME : map_input_file
+ * PURPOSE       : mmap a regular input file read-only and
+ *                 tell the kernel it is read front to back
+ * RETURN        : Mapping address, or NULL for pipes, empty
+ *                 files or when mmap fails
+ ===========================================================*/
+const unsigned char *map_input_file(FILE *fptr, size_t *len)
+{
+    struct stat st;
+    int fd = fileno(fptr);
+
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return NULL;
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    *len = (size_t)st.st_size;
+    return map;
+}
+
+/* Release a mapping from map_input_file */
+void unmap_input_file(const unsigned char *map, size_t len)
+{
+    if (map != NULL)
+        munmap((void *)map, len);
+}
+
+/*===========================================================
+ * FUNCTION NAME : map_prefetch
+ * PURPOSE       : MADV_WILLNEED on the pages covering a range
+ *                 so they are read ahead while we compute
+ ===========================================================*/
+void map_prefetch(const unsigned char *map, size_t map_len, size_t offset, size_t len)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+
+    if (offset >= map_len)
+        return;
+    if (len > map_len - offset)
+        len = map_len - offset;
+
+    madvise((void *)(map + start), len + (offset - start), MADV_WILLNEED);
+}
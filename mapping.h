@@ -0,0 +1,22 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Read-only memory mapping of an input image.
+ * Only regular files are mapped; pipes and other
+ * streams return NULL so callers stay on the stdio path.
+ */
+
+/* Map the whole file behind fptr, returns NULL if it cannot be mapped */
+const unsigned char *map_input_file(FILE *fptr, size_t *len);
+
+/* Unmap a mapping created by map_input_file */
+void unmap_input_file(const unsigned char *map, size_t len);
+
+/* Hint that [offset, offset + len) of the mapping is needed soon */
+void map_prefetch(const unsigned char *map, size_t map_len, size_t offset, size_t len);
+
+#endif
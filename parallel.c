@@ -0,0 +1,339 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "parallel.h"
+
+/* State shared by all threads of one parallel_for call */
+typedef struct
+{
+    atomic_size_t next;     /* next unclaimed index */
+    size_t count;
+    parallel_fn fn;
+    void *ctx;
+} ParallelRange;
+
+typedef struct
+{
+    ParallelRange *range;
+    int worker;
+} ParallelWorker;
+
+/* Claim indices until the range is exhausted */
+static void *parallel_worker(void *arg)
+{
+    ParallelWorker *w = arg;
+    ParallelRange *r = w->range;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&r->next, 1)) < r->count)
+    {
+        r->fn(r->ctx, i, w->worker);
+    }
+    return NULL;
+}
+
+/*===========================================================
+ * FUNCTION NAME : parallel_for
+ * PURPOSE       : Run fn(ctx, i, worker) for i in [0, count)
+ *                 on nthreads threads. The calling thread is
+ *                 worker 0, so nthreads == 1 runs inline.
+ ===========================================================*/
+void parallel_for(int nthreads, size_t count, parallel_fn fn, void *ctx)
+{
+    pthread_t tids[MAX_THREADS];
+    ParallelWorker workers[MAX_THREADS];
+    ParallelRange range;
+    int started = 1;
+
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+    if ((size_t)nthreads > count)
+        nthreads = count > 0 ? (int)count : 1;
+
+    atomic_init(&range.next, 0);
+    range.count = count;
+    range.fn = fn;
+    range.ctx = ctx;
+
+    for (int t = 0; t < nthreads; t++)
+    {
+        workers[t].range = &range;
+        workers[t].worker = t;
+    }
+
+    for (; started < nthreads; started++)
+    {
+        if (pthread_create(&tids[started], NULL, parallel_worker, &workers[started]) != 0)
+            break;
+    }
+
+    /* The caller works too and covers any threads that failed to start */
+    parallel_worker(&workers[0]);
+
+    for (int t = 1; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+}
+
+/*===========================================================
+ * Work-stealing pool
+ * Each deque is a growable ring guarded by its own mutex;
+ * the owner takes from the bottom, thieves from the top, so
+ * they only contend when a deque is nearly empty. One pool
+ * mutex is used just for sleeping and waking.
+ ===========================================================*/
+
+typedef struct
+{
+    work_fn fn;
+    void *arg;
+} WorkTask;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    WorkTask *tasks;
+    size_t cap;
+    size_t head;        /* oldest task (steal end) */
+    size_t count;
+} WorkDeque;
+
+typedef struct
+{
+    WorkPool *pool;
+    int index;
+} WorkThread;
+
+struct _WorkPool
+{
+    int nthreads;
+    pthread_t tids[MAX_THREADS];
+    WorkThread threads[MAX_THREADS];
+    WorkDeque deques[MAX_THREADS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;      /* tasks queued or shutting down */
+    pthread_cond_t all_done;        /* unfinished dropped to 0 */
+    atomic_size_t queued;           /* tasks sitting in deques */
+    size_t unfinished;              /* submitted but not finished */
+    size_t next_deque;              /* round robin submit target */
+    int shutdown;
+};
+
+static int deque_push(WorkDeque *dq, WorkTask task)
+{
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap)
+    {
+        size_t cap = dq->cap ? dq->cap * 2 : 64;
+        WorkTask *grown = malloc(cap * sizeof(*grown));
+
+        if (grown == NULL)
+        {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < dq->count; i++)
+        {
+            grown[i] = dq->tasks[(dq->head + i) % dq->cap];
+        }
+        free(dq->tasks);
+        dq->tasks = grown;
+        dq->cap = cap;
+        dq->head = 0;
+    }
+    dq->tasks[(dq->head + dq->count) % dq->cap] = task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+/* Owner end: newest task */
+static int deque_pop(WorkDeque *dq, WorkTask *task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0)
+    {
+        dq->count--;
+        *task = dq->tasks[(dq->head + dq->count) % dq->cap];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/* Thief end: oldest task */
+static int deque_steal(WorkDeque *dq, WorkTask *task)
+{
+    int found = 0;
+
+    if (pthread_mutex_trylock(&dq->lock) != 0)
+        return 0;
+    if (dq->count > 0)
+    {
+        *task = dq->tasks[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/* Own deque first, then walk the others starting next door */
+static int find_task(WorkPool *pool, int self, WorkTask *task)
+{
+    if (deque_pop(&pool->deques[self], task))
+        return 1;
+
+    for (int i = 1; i < pool->nthreads; i++)
+    {
+        if (deque_steal(&pool->deques[(self + i) % pool->nthreads], task))
+            return 1;
+    }
+    return 0;
+}
+
+static void *work_thread(void *arg)
+{
+    WorkThread *self = arg;
+    WorkPool *pool = self->pool;
+    WorkTask task;
+
+    for (;;)
+    {
+        if (find_task(pool, self->index, &task))
+        {
+            atomic_fetch_sub(&pool->queued, 1);
+            task.fn(task.arg, self->index);
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->unfinished == 0)
+                pthread_cond_broadcast(&pool->all_done);
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        /* Nothing to take anywhere: sleep until a submit or shutdown */
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&pool->queued) == 0 && !pool->shutdown)
+        {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        int stop = pool->shutdown && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop)
+            return NULL;
+    }
+}
+
+/* Wake and join the first nstarted workers, then free everything */
+static void workpool_stop(WorkPool *pool, int nstarted)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int t = 0; t < nstarted; t++)
+    {
+        pthread_join(pool->tids[t], NULL);
+    }
+    for (int t = 0; t < MAX_THREADS; t++)
+    {
+        pthread_mutex_destroy(&pool->deques[t].lock);
+        free(pool->deques[t].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool);
+}
+
+WorkPool *workpool_create(int nthreads)
+{
+    WorkPool *pool = calloc(1, sizeof(*pool));
+    int started = 0;
+
+    if (pool == NULL)
+        return NULL;
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    pool->nthreads = nthreads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+    atomic_init(&pool->queued, 0);
+    for (int t = 0; t < MAX_THREADS; t++)
+    {
+        pthread_mutex_init(&pool->deques[t].lock, NULL);
+    }
+
+    for (; started < nthreads; started++)
+    {
+        pool->threads[started].pool = pool;
+        pool->threads[started].index = started;
+        if (pthread_create(&pool->tids[started], NULL, work_thread, &pool->threads[started]) != 0)
+            break;
+    }
+
+    /* A pool short of threads would strand tasks in their deques */
+    if (started < nthreads)
+    {
+        workpool_stop(pool, started);
+        return NULL;
+    }
+    return pool;
+}
+
+int workpool_submit(WorkPool *pool, work_fn fn, void *arg)
+{
+    WorkTask task = { fn, arg };
+
+    /* Counted before it is visible: a worker may pop it the moment it is pushed */
+    pthread_mutex_lock(&pool->lock);
+    int target = pool->next_deque++ % pool->nthreads;
+    pool->unfinished++;
+    atomic_fetch_add(&pool->queued, 1);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (deque_push(&pool->deques[target], task) != 0)
+    {
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_sub(&pool->queued, 1);
+        if (--pool->unfinished == 0)
+            pthread_cond_broadcast(&pool->all_done);
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void workpool_wait(WorkPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->unfinished > 0)
+    {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void workpool_destroy(WorkPool *pool)
+{
+    if (pool != NULL)
+        workpool_stop(pool, pool->nthreads);
+}
@@ -0,0 +1,45 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+/*
+ * Data-parallel helper used by the multi-threaded encode/decode
+ * paths. The payload is cut into PARALLEL_CHUNK_SIZE byte chunks
+ * (8x that in pixels, sized to stay in L2) which worker threads
+ * claim one at a time.
+ */
+
+#define PARALLEL_CHUNK_SIZE (32 * 1024)   // payload bytes per chunk
+#define MAX_THREADS 64
+
+/* Called once per chunk index; worker is in [0, nthreads) */
+typedef void (*parallel_fn)(void *ctx, size_t index, int worker);
+
+/* Run fn for every index in [0, count) on up to nthreads threads (caller
+ * included). If a thread cannot be started the others pick up its share. */
+void parallel_for(int nthreads, size_t count, parallel_fn fn, void *ctx);
+
+/*
+ * Work-stealing pool for independent jobs (batch mode).
+ * Every worker owns a deque: it pops its own newest task and,
+ * when empty, steals the oldest task of another worker.
+ */
+typedef struct _WorkPool WorkPool;
+
+/* Task body; worker is the index of the running thread */
+typedef void (*work_fn)(void *arg, int worker);
+
+/* Start a pool of nthreads workers, NULL on failure */
+WorkPool *workpool_create(int nthreads);
+
+/* Queue a task (round robin over the worker deques) */
+int workpool_submit(WorkPool *pool, work_fn fn, void *arg);
+
+/* Block until every submitted task has finished */
+void workpool_wait(WorkPool *pool);
+
+/* Stop the workers and free the pool (waits for queued tasks) */
+void workpool_destroy(WorkPool *pool);
+
+#endif
@@ -0,0 +1,65 @@
+#include <string.h>
+#include <unistd.h>
+#include "pipeio.h"
+
+/* Duplicate of the original stdout once claimed, -1 before */
+static int data_fd = -1;
+
+int pipe_is_std(const char *fname)
+{
+    return fname != NULL && strcmp(fname, PIPE_NAME) == 0;
+}
+
+/*===========================================================
+ * FUNCTION NAME : pipe_claim_stdout
+ * PURPOSE       : Move the real stdout to a private descriptor
+ *                 and point fd 1 at stderr, so INFO and ERROR
+ *                 lines never mix with the data
+ ===========================================================*/
+void pipe_claim_stdout(void)
+{
+    if (data_fd >= 0)
+        return;
+    fflush(stdout);
+    data_fd = dup(STDOUT_FILENO);
+    if (data_fd >= 0)
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+}
+
+FILE *pipe_open(const char *fname, const char *mode)
+{
+    if (!pipe_is_std(fname))
+        return fopen(fname, mode);
+    if (mode[0] == 'r')
+        return stdin;
+
+    pipe_claim_stdout();
+    return data_fd >= 0 ? fdopen(data_fd, mode) : NULL;
+}
+
+int pipe_seekable(FILE *fptr)
+{
+    return lseek(fileno(fptr), 0, SEEK_CUR) >= 0;
+}
+
+Status pipe_skip(FILE *fptr, uint64_t n)
+{
+    unsigned char buf[4096];
+
+    while (n > 0)
+    {
+        size_t want = n < sizeof(buf) ? (size_t)n : sizeof(buf);
+        if (fread(buf, 1, want, fptr) != want)
+            return e_failure;
+        n -= want;
+    }
+    return e_success;
+}
+
+void pipe_drain(FILE *fptr)
+{
+    unsigned char buf[4096];
+
+    while (fread(buf, 1, sizeof(buf), fptr) > 0)
+        ;
+}
@@ -0,0 +1,34 @@
+#ifndef PIPEIO_H
+#define PIPEIO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * "-" as a file argument: stdin for inputs, stdout for outputs.
+ * When stdout carries data, every message (printf included) is
+ * moved to stderr first, so nothing else ends up in the stream.
+ */
+
+#define PIPE_NAME "-"
+
+/* True if fname is "-" */
+int pipe_is_std(const char *fname);
+
+/* Keep stdout for data and send printf output to stderr; call before printing */
+void pipe_claim_stdout(void);
+
+/* fopen, or stdin ("r") / the claimed stdout ("w") for "-" */
+FILE *pipe_open(const char *fname, const char *mode);
+
+/* True if the stream can seek (pread/pwrite and fseeko work) */
+int pipe_seekable(FILE *fptr);
+
+/* Read and drop n bytes */
+Status pipe_skip(FILE *fptr, uint64_t n);
+
+/* Read and drop everything up to end of file */
+void pipe_drain(FILE *fptr);
+
+#endif
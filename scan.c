@@ -0,0 +1,255 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "scan.h"
+#include "bmp.h"
+#include "parallel.h"
+#include "stego.h"
+#include "stats.h"
+
+/* Shared by every task of one scan */
+typedef struct
+{
+    WorkPool *pool;
+    pthread_mutex_t out_lock;   /* keeps report lines whole */
+    atomic_size_t files;
+    atomic_size_t bitmaps;
+    atomic_size_t hits;
+    atomic_size_t errors;
+} ScanState;
+
+/* A directory or file waiting to be walked/probed */
+typedef struct
+{
+    ScanState *state;
+    int is_dir;
+    char path[];
+} ScanTask;
+
+static void scan_error(ScanState *state, const char *path, const char *what)
+{
+    atomic_fetch_add(&state->errors, 1);
+    pthread_mutex_lock(&state->out_lock);
+    printf("ERROR: %s: %s\n", path, what);
+    pthread_mutex_unlock(&state->out_lock);
+}
+
+/* Read channel bytes [0, channels) of the image (file bytes from the pixel offset) */
+static int read_channels(int fd, const BmpInfo *info, uint64_t channels, unsigned char *buf, size_t cap)
+{
+    size_t span = bmp_channel_offset(info, channels) - info->pixel_offset;
+
+    if (span > cap)
+        return -1;
+    return pread(fd, buf, span, info->pixel_offset) == (ssize_t)span ? 0 : -1;
+}
+
+/*===========================================================
+ * FUNCTION NAME : probe_file
+ * PURPOSE       : Check one file for a payload: headers, then
+ *                 the 16 channel bytes of the magic string,
+ *                 then (on a match) the header fields
+ ===========================================================*/
+static void probe_file(ScanState *state, const char *path)
+{
+    /* 32 bpp puts 3 channels in 4 bytes; a row can add padding */
+    unsigned char pixels[STEGO_MAX_HEADER_SIZE * 8 * 4 / 3 + 64];
+    unsigned char bytes[STEGO_MAX_HEADER_SIZE];
+    BmpInfo info;
+    StegoHeader hdr;
+    size_t hdr_len;
+    int fd = open(path, O_RDONLY);
+
+    atomic_fetch_add(&state->files, 1);
+    if (fd < 0)
+    {
+        scan_error(state, path, strerror(errno));
+        return;
+    }
+
+    /* Anything that does not parse as a BMP is simply not a candidate */
+    if (bmp_read_fd(fd, &info) != STEGO_OK)
+    {
+        close(fd);
+        return;
+    }
+    atomic_fetch_add(&state->bitmaps, 1);
+
+    uint64_t channels = info.capacity < STEGO_MAX_HEADER_SIZE * 8 ? info.capacity : STEGO_MAX_HEADER_SIZE * 8;
+    if (channels < STEGO_MAGIC_LEN * 8 ||
+        read_channels(fd, &info, STEGO_MAGIC_LEN * 8, pixels, sizeof(pixels)) != 0)
+    {
+        close(fd);
+        return;
+    }
+    bmp_extract(&info, pixels, info.pixel_offset, 0, bytes, STEGO_MAGIC_LEN, 1);
+    if (memcmp(bytes, STEGO_MAGIC, STEGO_MAGIC_LEN) != 0)
+    {
+        close(fd);
+        return;
+    }
+
+    /* Magic found: fetch the rest of the header fields */
+    int ok = read_channels(fd, &info, channels, pixels, sizeof(pixels)) == 0;
+    close(fd);
+    if (ok)
+    {
+        bmp_extract(&info, pixels, info.pixel_offset, 0, bytes, channels / 8, 1);
+        ok = stego_header_unpack(bytes, channels / 8, &hdr, &hdr_len) == STEGO_OK &&
+             ((hdr.flags & STEGO_FLAG_STREAM) || stego_channels_needed(&hdr) <= info.capacity);
+    }
+    if (!ok)
+    {
+        /* The magic alone is two bytes: noise matches it now and then */
+        return;
+    }
+
+    atomic_fetch_add(&state->hits, 1);
+    const char *extn = hdr.extn_len ? hdr.extn : "-";
+    const char *encrypted = (hdr.flags & STEGO_FLAG_ENCRYPT) ? " encrypted" : "";
+    char shard[32] = "";
+    if (hdr.flags & STEGO_FLAG_SHARD)
+        snprintf(shard, sizeof(shard), " shard=%u/%u", (unsigned)hdr.shard.index + 1, (unsigned)hdr.shard.count);
+    pthread_mutex_lock(&state->out_lock);
+    if (hdr.flags & STEGO_FLAG_STREAM)
+        printf("HIT %s extn=%s size=- stored=- bits=%d used=-%s\n", path, extn, hdr.bits, encrypted);
+    else
+        printf("HIT %s extn=%s size=%llu stored=%llu bits=%d used=%.2f%%%s%s\n", path, extn,
+               (unsigned long long)((hdr.flags & STEGO_FLAG_LZ) ? hdr.raw_len : hdr.payload_len),
+               (unsigned long long)hdr.payload_len, hdr.bits,
+               100.0 * stego_channels_needed(&hdr) / info.capacity, encrypted, shard);
+    pthread_mutex_unlock(&state->out_lock);
+}
+
+static void run_task(void *arg, int worker);
+
+/* Queue a directory walk or a probe of path */
+static void submit_path(ScanState *state, const char *path, int is_dir)
+{
+    size_t len = strlen(path) + 1;
+    ScanTask *task = malloc(sizeof(*task) + len);
+
+    if (task == NULL)
+    {
+        scan_error(state, path, "out of memory");
+        return;
+    }
+    task->state = state;
+    task->is_dir = is_dir;
+    memcpy(task->path, path, len);
+    if (workpool_submit(state->pool, run_task, task) != 0)
+    {
+        scan_error(state, path, "unable to queue");
+        free(task);
+    }
+}
+
+/*===========================================================
+ * FUNCTION NAME : walk_dir
+ * PURPOSE       : List one directory: subdirectories become
+ *                 new tasks, regular files are probed here
+ ===========================================================*/
+static void walk_dir(ScanState *state, const char *dir)
+{
+    DIR *dp = opendir(dir);
+    struct dirent *ent;
+    char path[PATH_MAX];
+
+    if (dp == NULL)
+    {
+        scan_error(state, dir, strerror(errno));
+        return;
+    }
+
+    while ((ent = readdir(dp)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) >= (int)sizeof(path))
+        {
+            scan_error(state, ent->d_name, "path too long");
+            continue;
+        }
+
+        unsigned char type = ent->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if (lstat(path, &st) != 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR)
+            submit_path(state, path, 1);
+        else if (type == DT_REG)
+            probe_file(state, path);
+    }
+    closedir(dp);
+}
+
+static void run_task(void *arg, int worker)
+{
+    ScanTask *task = arg;
+
+    (void)worker;
+    if (task->is_dir)
+        walk_dir(task->state, task->path);
+    else
+        probe_file(task->state, task->path);
+    free(task);
+}
+
+/*===========================================================
+ * FUNCTION NAME : run_scan
+ * PURPOSE       : Walk path on a work-stealing pool, print
+ *                 every hit as it is found, then totals
+ ===========================================================*/
+Status run_scan(const char *path, int threads)
+{
+    ScanState state;
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        perror("stat");
+        printf("ERROR: Unable to scan %s\n", path);
+        return e_failure;
+    }
+
+    memset(&state, 0, sizeof(state));
+    pthread_mutex_init(&state.out_lock, NULL);
+    atomic_init(&state.files, 0);
+    atomic_init(&state.bitmaps, 0);
+    atomic_init(&state.hits, 0);
+    atomic_init(&state.errors, 0);
+
+    state.pool = workpool_create(threads > 0 ? threads : SCAN_DEFAULT_THREADS);
+    if (state.pool == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to start worker threads\n");
+        pthread_mutex_destroy(&state.out_lock);
+        return e_failure;
+    }
+
+    double start = stats_now_ms();
+    submit_path(&state, path, S_ISDIR(st.st_mode));
+    workpool_wait(state.pool);
+    double secs = (stats_now_ms() - start) / 1000.0;
+    workpool_destroy(state.pool);
+    pthread_mutex_destroy(&state.out_lock);
+
+    size_t files = atomic_load(&state.files);
+    printf("INFO: Scan finished: %zu files, %zu bitmaps, %zu with payload, %zu errors, %.3f s, %.1f files/s\n",
+           files, atomic_load(&state.bitmaps), atomic_load(&state.hits), atomic_load(&state.errors),
+           secs, secs > 0 ? files / secs : 0.0);
+    return atomic_load(&state.errors) == 0 ? e_success : e_failure;
+}
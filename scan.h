@@ -0,0 +1,27 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "types.h"
+
+/*
+ * Scan mode: walk a directory tree on a work-stealing pool and
+ * report the images that carry a payload, without decoding them.
+ *
+ * Each probe reads the BMP headers and the pixel bytes holding the
+ * magic string; only images that match read on to the extension and
+ * size fields (well under 1 KB in total). Symbolic links are not
+ * followed.
+ *
+ * One line per hit:
+ *   HIT <path> extn=<.ext> size=<bytes> stored=<bytes> bits=<k> used=<%>
+ * size is the decoded size and stored what the image holds (they
+ * differ for -z payloads); streamed payloads record no sizes and
+ * print "-" for size, stored and used.
+ */
+
+#define SCAN_DEFAULT_THREADS 8  // probes wait on I/O, so more than the core count helps
+
+/* Probe every regular file under path (or path itself); e_failure if the walk hit errors */
+Status run_scan(const char *path, int threads);
+
+#endif
@@ -0,0 +1,153 @@
+#include <string.h>
+#include "scatter.h"
+#include "lsb.h"
+#include "kdf.h"
+
+#define SCATTER_ROUNDS 4
+
+#define ROTL64(v, n) (((v) << (n)) | ((v) >> (64 - (n))))
+
+#define SIPROUND(v0, v1, v2, v3)                                            \
+    do                                                                      \
+    {                                                                       \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);      \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;                            \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;                            \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);      \
+    } while (0)
+
+/* SipHash-2-4 of one 8 byte message */
+static uint64_t siphash64(uint64_t k0, uint64_t k1, uint64_t m)
+{
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    uint64_t last = 8ULL << 56;
+
+    v3 ^= m;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= m;
+    v3 ^= last;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; i++)
+        SIPROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+    uint64_t v = 0;
+
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+void scatter_init(Scatter *s, const unsigned char key[32], uint64_t c0, uint64_t capacity)
+{
+    static const char label[] = "libstego scatter";
+    unsigned char buf[sizeof(label) - 1 + 32], sub[SHA256_SIZE];
+    int width = 2;
+
+    /* A key of its own, so the layout says nothing about the cipher key */
+    memcpy(buf, label, sizeof(label) - 1);
+    memcpy(buf + sizeof(label) - 1, key, 32);
+    sha256(buf, sizeof(buf), sub);
+    s->k0 = get_le64(sub);
+    s->k1 = get_le64(sub + 8);
+    memset(buf, 0, sizeof(buf));
+    memset(sub, 0, sizeof(sub));
+
+    s->c0 = c0;
+    s->tiles = capacity > c0 ? (capacity - c0) / SCATTER_TILE : 0;
+
+    /* Smallest even width that holds every tile index: cycle walking takes < 4 steps on average */
+    while (width < 64 && (s->tiles - 1) >> width != 0)
+        width += 2;
+    s->half = width / 2;
+}
+
+uint64_t scatter_tile(const Scatter *s, uint64_t i)
+{
+    uint64_t mask = (1ULL << s->half) - 1;
+
+    if (s->tiles < 2)
+        return i;
+
+    /* A permutation of [0, 2^(2 * half)), applied again until it lands below tiles */
+    do
+    {
+        uint64_t l = i >> s->half, r = i & mask;
+
+        for (uint64_t round = 0; round < SCATTER_ROUNDS; round++)
+        {
+            uint64_t f = siphash64(s->k0, s->k1, (round << 56) | r) & mask;
+            uint64_t t = l ^ f;
+
+            l = r;
+            r = t;
+        }
+        i = (l << s->half) | r;
+    } while (i >= s->tiles);
+    return i;
+}
+
+uint64_t scatter_channel(const Scatter *s, uint64_t c)
+{
+    if (s == NULL || c < s->c0 || c - s->c0 >= s->tiles * SCATTER_TILE)
+        return c;
+
+    uint64_t off = c - s->c0;
+    return s->c0 + scatter_tile(s, off / SCATTER_TILE) * SCATTER_TILE + off % SCATTER_TILE;
+}
+
+size_t scatter_piece(const Scatter *s, uint64_t c, size_t n, int bits)
+{
+    uint64_t channels = LSB_CHANNELS(n, bits);
+    uint64_t run;
+
+    if (s == NULL)
+        return n;
+    if (c < s->c0)
+        run = s->c0 - c;
+    else if (c - s->c0 < s->tiles * SCATTER_TILE)
+        run = SCATTER_TILE - (c - s->c0) % SCATTER_TILE;
+    else
+        return n;
+
+    /* Pieces start on whole groups and tiles hold whole groups, so the split is exact */
+    return channels <= run ? n : (size_t)(run * bits / 8);
+}
+
+void scatter_embed(const Scatter *s, const BmpInfo *bmp, unsigned char *dst, const unsigned char *src,
+                   uint64_t c0, const unsigned char *data, size_t n, int bits)
+{
+    while (n > 0)
+    {
+        size_t piece = scatter_piece(s, c0, n, bits);
+
+        bmp_embed(bmp, dst, src, 0, scatter_channel(s, c0), data, piece, bits);
+        c0 += LSB_CHANNELS(piece, bits);
+        data += piece;
+        n -= piece;
+    }
+}
+
+void scatter_extract(const Scatter *s, const BmpInfo *bmp, const unsigned char *buf,
+                     uint64_t c0, unsigned char *out, size_t n, int bits)
+{
+    while (n > 0)
+    {
+        size_t piece = scatter_piece(s, c0, n, bits);
+
+        bmp_extract(bmp, buf, 0, scatter_channel(s, c0), out, piece, bits);
+        c0 += LSB_CHANNELS(piece, bits);
+        out += piece;
+        n -= piece;
+    }
+}
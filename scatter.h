@@ -0,0 +1,56 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bmp.h"
+
+/*
+ * Keyed tile layout of a STEGO_FLAG_SCATTER payload.
+ *
+ * The channels from the end of the header to the end of the image
+ * are cut into tiles of SCATTER_TILE channel bytes, and payload tile
+ * i is stored in image tile scatter_tile(i): a permutation keyed by
+ * the payload key, so the data is spread over the whole image while
+ * every tile is still read and written front to back (a page or so
+ * of pixels). The header, and the channels past the last whole tile,
+ * stay where they are.
+ *
+ * The permutation is a 4 round Feistel network over SipHash-2-4,
+ * cycle-walked down to the tile count: nothing is stored, any tile
+ * is looked up on its own.
+ *
+ * Every function takes NULL for the sequential layout, so callers
+ * pass their Scatter pointer either way.
+ */
+
+#define SCATTER_TILE 4096       /* channel bytes per tile (whole groups at any depth) */
+
+typedef struct
+{
+    uint64_t c0;                /* first scattered channel: the data after the header */
+    uint64_t tiles;             /* whole tiles from c0 to the end of the image */
+    uint64_t k0, k1;            /* SipHash key of the tile permutation */
+    int half;                   /* Feistel half width in bits */
+} Scatter;
+
+/* Tile permutation of an image with capacity channels, data from channel c0 */
+void scatter_init(Scatter *s, const unsigned char key[32], uint64_t c0, uint64_t capacity);
+
+/* Image tile holding payload tile i (i < s->tiles) */
+uint64_t scatter_tile(const Scatter *s, uint64_t i);
+
+/* Image channel of payload channel c */
+uint64_t scatter_channel(const Scatter *s, uint64_t c);
+
+/* How many of the n payload bytes from payload channel c (at depth
+ * bits) lie in one run of image channels: n, or up to the tile end */
+size_t scatter_piece(const Scatter *s, uint64_t c, size_t n, int bits);
+
+/* bmp_embed / bmp_extract on a whole image in memory, tile by tile */
+void scatter_embed(const Scatter *s, const BmpInfo *bmp, unsigned char *dst, const unsigned char *src,
+                   uint64_t c0, const unsigned char *data, size_t n, int bits);
+void scatter_extract(const Scatter *s, const BmpInfo *bmp, const unsigned char *buf,
+                     uint64_t c0, unsigned char *out, size_t n, int bits);
+
+#endif
@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "serve.h"
+#include "parallel.h"
+#include "pipeio.h"
+#include "stego.h"
+
+/* One accepted connection, owned by the worker that serves it */
+typedef struct
+{
+    int sock;
+    const BatchConfig *config;
+} ServeConn;
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_on_signal(int sig)
+{
+    (void)sig;
+    serve_stop = 1;
+}
+
+/* Fill a sockaddr_un, -1 if the path does not fit */
+static int serve_address(const char *sock_path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(sock_path) >= sizeof(addr->sun_path))
+        return -1;
+    strcpy(addr->sun_path, sock_path);
+    return 0;
+}
+
+static int send_all(int sock, const void *buf, size_t n)
+{
+    const char *p = buf;
+
+    while (n > 0)
+    {
+        ssize_t sent = send(sock, p, n, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+        p += sent;
+        n -= (size_t)sent;
+    }
+    return 0;
+}
+
+static int recv_all(int sock, void *buf, size_t n)
+{
+    char *p = buf;
+
+    while (n > 0)
+    {
+        ssize_t got = recv(sock, p, n, 0);
+
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        p += got;
+        n -= (size_t)got;
+    }
+    return 0;
+}
+
+/*===========================================================
+ * FUNCTION NAME : send_frame
+ * PURPOSE       : Send one length-prefixed frame, with the
+ *                 n_fds descriptors attached to its first byte
+ * RETURN        : 0, or -1 if the peer is gone
+ ===========================================================*/
+static int send_frame(int sock, const char *body, size_t len, const int *fds, int n_fds)
+{
+    unsigned char hdr[4];
+    struct iovec iov[2] = { { hdr, sizeof(hdr) }, { (void *)body, len } };
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(SERVE_MAX_FDS * sizeof(int))];
+    } control;
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+    ssize_t sent;
+
+    stego_put_u32(hdr, (uint32_t)len);
+    if (n_fds > 0)
+    {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+    }
+
+    do
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while (sent < 0 && errno == EINTR);
+    if (sent < 0)
+        return -1;
+
+    /* The descriptors went with the first byte, the rest is plain data */
+    size_t total = sizeof(hdr) + len;
+    if ((size_t)sent < sizeof(hdr))
+        return send_all(sock, hdr + sent, sizeof(hdr) - sent) == 0 ? send_all(sock, body, len) : -1;
+    return send_all(sock, body + (sent - sizeof(hdr)), total - (size_t)sent);
+}
+
+/*===========================================================
+ * FUNCTION NAME : recv_frame
+ * PURPOSE       : Receive one frame into buf (NUL terminated)
+ *                 and the descriptors sent with it
+ * RETURN        : 1 for a frame, 0 at end of stream, -1 on a
+ *                 broken or oversized frame
+ ===========================================================*/
+static int recv_frame(int sock, char *buf, size_t cap, int *fds, int *n_fds)
+{
+    unsigned char hdr[4];
+    struct iovec iov = { hdr, sizeof(hdr) };
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(SERVE_MAX_FDS * sizeof(int))];
+    } control;
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+    ssize_t got;
+
+    *n_fds = 0;
+    do
+        got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    while (got < 0 && errno == EINTR);
+    if (got == 0)
+        return 0;
+    if (got < 0)
+        return -1;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            int passed[SERVE_MAX_FDS + 1];
+
+            /* The control buffer rounds up, so one descriptor too many can arrive */
+            memcpy(passed, CMSG_DATA(cmsg), count * sizeof(int));
+            for (int i = 0; i < count; i++)
+            {
+                if (*n_fds < SERVE_MAX_FDS)
+                    fds[(*n_fds)++] = passed[i];
+                else
+                {
+                    close(passed[i]);
+                    msg.msg_flags |= MSG_CTRUNC;
+                }
+            }
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC)
+        return -1;
+
+    if ((size_t)got < sizeof(hdr) && recv_all(sock, hdr + got, sizeof(hdr) - got) != 0)
+        return -1;
+
+    uint32_t len = stego_get_u32(hdr);
+    if (len >= cap || recv_all(sock, buf, len) != 0)
+        return -1;
+    buf[len] = '\0';
+    return 1;
+}
+
+/*===========================================================
+ * FUNCTION NAME : bind_passed_files
+ * PURPOSE       : Point every "@name" field of a job at the
+ *                 next passed descriptor
+ * RETURN        : 0, or -1 if the counts do not match
+ ===========================================================*/
+static int bind_passed_files(BatchJob *job, const int *fds, int n_fds, char paths[][32])
+{
+    int used = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (job->fields[i] == NULL || job->fields[i][0] != '@')
+            continue;
+        if (used == n_fds)
+            return -1;
+
+        /* The job reopens the caller's file through its descriptor */
+        snprintf(paths[i], 32, "/proc/self/fd/%d", fds[used++]);
+        job->open_as[i] = paths[i];
+    }
+    return used == n_fds ? 0 : -1;
+}
+
+/* Worker side: run the requests of one connection until it closes */
+static void serve_connection(void *arg, int worker)
+{
+    ServeConn *conn = arg;
+    char request[MAX_MANIFEST_LINE], reply[64], paths[3][32];
+    int fds[SERVE_MAX_FDS], n_fds, got;
+    BatchJob job;
+
+    while ((got = recv_frame(conn->sock, request, sizeof(request), fds, &n_fds)) != 0)
+    {
+        memset(&job, 0, sizeof(job));
+        job.config = conn->config;
+        job.status = e_failure;
+
+        if (got > 0 && strlen(request) < sizeof(job.text))
+        {
+            strcpy(job.text, request);
+            if (batch_parse_line(job.text, &job) > 0 && bind_passed_files(&job, fds, n_fds, paths) == 0)
+                batch_run_job(&job, worker);
+        }
+        for (int i = 0; i < n_fds; i++)
+            close(fds[i]);
+
+        if (job.status == e_success)
+            snprintf(reply, sizeof(reply), "OK %llu %.0f",
+                     (unsigned long long)job.payload_bytes, job.elapsed_ms * 1000.0);
+        else
+        {
+            printf("FAIL %s\n", got > 0 ? request : "(broken request)");
+            strcpy(reply, "FAIL");
+        }
+        if (got < 0 || send_frame(conn->sock, reply, strlen(reply), NULL, 0) != 0)
+            break;
+    }
+
+    close(conn->sock);
+    free(conn);
+}
+
+/*===========================================================
+ * FUNCTION NAME : run_serve
+ * PURPOSE       : Listen on sock_path and hand every
+ *                 connection to the worker pool until
+ *                 SIGINT or SIGTERM, then finish the
+ *                 connections in flight
+ ===========================================================*/
+Status run_serve(const char *sock_path, const BatchConfig *config)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct stat st;
+    int threads = config->threads > 0 ? config->threads : 1;
+
+    if (serve_address(sock_path, &addr) != 0)
+    {
+        printf("ERROR: Socket path %s is too long\n", sock_path);
+        return e_failure;
+    }
+
+    /* No SA_RESTART: the signal has to break accept() */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return e_failure;
+    }
+
+    /* A socket left behind by a previous daemon is replaced, anything else is not */
+    if (lstat(sock_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(sock_path);
+
+    /* Jobs read and write files as this user, so only this user may connect */
+    mode_t old_mask = umask(077);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound != 0 || listen(fd, SERVE_BACKLOG) != 0)
+    {
+        perror(sock_path);
+        close(fd);
+        return e_failure;
+    }
+
+    WorkPool *pool = workpool_create(threads);
+    if (pool == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to start worker threads\n");
+        close(fd);
+        unlink(sock_path);
+        return e_failure;
+    }
+
+    printf("INFO: Serving on %s with %d workers\n", sock_path, threads);
+    fflush(stdout);
+
+    while (!serve_stop)
+    {
+        int sock = accept(fd, NULL, NULL);
+        if (sock < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            break;
+        }
+
+        ServeConn *conn = malloc(sizeof(*conn));
+        if (conn != NULL)
+        {
+            conn->sock = sock;
+            conn->config = config;
+        }
+        if (conn == NULL || workpool_submit(pool, serve_connection, conn) != 0)
+        {
+            fprintf(stderr, "ERROR: Unable to queue a connection\n");
+            free(conn);
+            close(sock);
+        }
+    }
+
+    close(fd);
+    unlink(sock_path);
+    workpool_destroy(pool);
+    printf("INFO: Daemon on %s stopped\n", sock_path);
+    return e_success;
+}
+
+/* "@" plus the base name of path, kept to one manifest token */
+static void passed_name(char *out, size_t cap, const char *path)
+{
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+    snprintf(out, cap, "@%s", name);
+    for (char *p = out; *p; p++)
+    {
+        if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '#')
+            *p = '_';
+    }
+}
+
+/*===========================================================
+ * FUNCTION NAME : run_client
+ * PURPOSE       : Open the files of a -e / -d job here, pass
+ *                 them to the daemon and report its reply
+ * EXPECTED ARGS :
+ *      argv[1] = -e or -d
+ *      argv[2...] = the files of that command (the output
+ *                   defaults as for the command itself)
+ ===========================================================*/
+Status run_client(const char *sock_path, char *argv[], int quiet)
+{
+    int encode = strcmp(argv[1], "-e") == 0;
+    const char *files[3];
+    int flags[3] = { O_RDONLY, O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC };
+    int fds[3], n_fds = 0, reply_fds[SERVE_MAX_FDS], n_reply;
+    char names[3][256], request[MAX_MANIFEST_LINE], reply[64];
+    struct sockaddr_un addr;
+    Status ret = e_failure;
+    int sock = -1;
+
+    files[0] = argv[2];
+    files[1] = encode ? argv[3] : NULL;
+    files[2] = encode ? (argv[3] && argv[4] ? argv[4] : "stego.bmp") : (argv[3] ? argv[3] : "decoded_secret.txt");
+    if (files[0] == NULL || (encode && files[1] == NULL))
+    {
+        printf("ERROR: Missing required files\n");
+        return e_failure;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (files[i] == NULL)
+            continue;
+        if (pipe_is_std(files[i]))
+        {
+            printf("ERROR: --client jobs need files, not pipes\n");
+            goto out;
+        }
+        fds[n_fds] = open(files[i], flags[i] | O_CLOEXEC, 0644);
+        if (fds[n_fds] < 0)
+        {
+            perror(files[i]);
+            goto out;
+        }
+        n_fds++;
+        passed_name(names[i], sizeof(names[i]), files[i]);
+    }
+
+    if (encode)
+        snprintf(request, sizeof(request), "e %s %s %s", names[0], names[1], names[2]);
+    else
+        snprintf(request, sizeof(request), "d %s %s", names[0], names[2]);
+
+    if (serve_address(sock_path, &addr) != 0)
+    {
+        printf("ERROR: Socket path %s is too long\n", sock_path);
+        goto out;
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror(sock_path);
+        goto out;
+    }
+
+    if (send_frame(sock, request, strlen(request), fds, n_fds) != 0 ||
+        recv_frame(sock, reply, sizeof(reply), reply_fds, &n_reply) <= 0)
+    {
+        printf("ERROR: No reply from the daemon on %s\n", sock_path);
+        goto out;
+    }
+
+    unsigned long long bytes;
+    double us;
+    if (sscanf(reply, "OK %llu %lf", &bytes, &us) == 2)
+    {
+        if (!quiet)
+            printf("INFO: %s %s -> %s (%llu bytes, %.2f ms in the daemon)\n",
+                   encode ? "Encoded" : "Decoded", files[0], files[2], bytes, us / 1000.0);
+        ret = e_success;
+    }
+    else
+        printf("ERROR: The daemon could not run the job, see its log\n");
+
+out:
+    if (sock >= 0)
+        close(sock);
+    for (int i = 0; i < n_fds; i++)
+        close(fds[i]);
+    return ret;
+}
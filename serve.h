@@ -0,0 +1,36 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "types.h"
+#include "batch.h"
+
+/*
+ * Daemon mode: one process keeps a work-stealing pool and runs
+ * encode/decode jobs sent over a Unix domain socket, so a busy
+ * caller pays a connect and a round trip per job instead of a
+ * process start.
+ *
+ * Every message is a frame: a 4 byte big-endian length, then that
+ * many bytes. A request is one manifest line (batch.h):
+ *   e <cover.bmp> <secret.txt> <output.bmp>
+ *   d <stego.bmp> <output_secret>
+ * Plain paths are opened by the daemon, relative to its own working
+ * directory. A field "@name" is a file passed along with the request
+ * (SCM_RIGHTS, one descriptor per "@" field in field order): the job
+ * works on the caller's open file, and name is only used for the
+ * extension checks. The reply is "OK <payload bytes> <microseconds>"
+ * or "FAIL". A connection may send any number of requests; it keeps
+ * one worker while it is open.
+ */
+
+#define SERVE_MAX_FDS 3
+#define SERVE_BACKLOG 128
+
+/* Serve jobs on sock_path with the options of config until SIGINT/SIGTERM */
+Status run_serve(const char *sock_path, const BatchConfig *config);
+
+/* Send the -e / -d job of argv (argv[1] is the operation) to the
+ * daemon on sock_path, passing the files as descriptors */
+Status run_client(const char *sock_path, char *argv[], int quiet);
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+static const char *const counter_names[STAT_COUNT] = {
+    "bytes_read", "read_calls", "bytes_written", "write_calls", "bytes_copied",
+    "channels_modified", "pixels_modified", "lsbs_flipped",
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+double stats_now_ms(void)
+{
+    return now_ns() / 1e6;
+}
+
+void stats_init(Stats *s, int json)
+{
+    memset(s, 0, sizeof(*s));
+    s->json = json;
+    s->current = -1;
+    for (int c = 0; c < STAT_COUNT; c++)
+        atomic_init(&s->counters[c], 0);
+}
+
+void stats_free(Stats *s)
+{
+    if (s == NULL)
+        return;
+    free(s->scratch);
+    s->scratch = NULL;
+    s->scratch_len = 0;
+}
+
+/*===========================================================
+ * FUNCTION NAME : stats_stage
+ * PURPOSE       : Charge the time since the last call to the
+ *                 running stage and start the next one. A
+ *                 stage entered again accumulates.
+ ===========================================================*/
+void stats_stage(Stats *s, const char *name)
+{
+    if (s == NULL)
+        return;
+
+    uint64_t now = now_ns();
+
+    if (s->current >= 0)
+        s->stages[s->current].ns += now - s->stage_start_ns;
+    else if (s->n_stages == 0)
+        s->start_ns = now;
+
+    s->current = -1;
+    s->stage_start_ns = now;
+    if (name == NULL)
+        return;
+
+    for (int i = 0; i < s->n_stages; i++)
+    {
+        if (strcmp(s->stages[i].name, name) == 0)
+            s->current = i;
+    }
+    if (s->current < 0 && s->n_stages < STATS_MAX_STAGES)
+    {
+        s->current = s->n_stages++;
+        s->stages[s->current].name = name;
+    }
+    if (s->current >= 0)
+        s->stages[s->current].calls++;
+}
+
+void stats_add(Stats *s, StatCounter c, uint64_t n)
+{
+    if (s)
+        atomic_fetch_add_explicit(&s->counters[c], n, memory_order_relaxed);
+}
+
+void stats_io(Stats *s, StatCounter bytes, uint64_t n)
+{
+    if (s == NULL)
+        return;
+    stats_add(s, bytes, n);
+    stats_add(s, bytes == STAT_BYTES_READ ? STAT_READ_CALLS : STAT_WRITE_CALLS, 1);
+}
+
+unsigned char *stats_scratch(Stats *s, size_t len)
+{
+    if (len > s->scratch_len)
+    {
+        unsigned char *buf = realloc(s->scratch, len);
+        if (buf == NULL)
+            return NULL;
+        s->scratch = buf;
+        s->scratch_len = len;
+    }
+    return s->scratch;
+}
+
+/*===========================================================
+ * FUNCTION NAME : stats_count_changes
+ * PURPOSE       : Count changed channel bytes, pixels and
+ *                 flipped bits of one embedded span. Equal
+ *                 8-byte words are skipped, so mostly
+ *                 unchanged spans (in-place updates) are cheap.
+ ===========================================================*/
+void stats_count_changes(Stats *s, const BmpInfo *info, const unsigned char *before,
+                         const unsigned char *after, size_t len, uint64_t buf_off)
+{
+    uint64_t channels = 0, pixels = 0, bits = 0;
+    uint64_t last_pixel = UINT64_MAX;
+    size_t i = 0;
+
+    if (s == NULL)
+        return;
+
+    while (i < len)
+    {
+        uint64_t a, b;
+
+        if (len - i >= 8)
+        {
+            memcpy(&a, before + i, 8);
+            memcpy(&b, after + i, 8);
+            if (a == b)
+            {
+                i += 8;
+                continue;
+            }
+        }
+
+        size_t end = len - i >= 8 ? i + 8 : len;
+        for (; i < end; i++)
+        {
+            unsigned char diff = before[i] ^ after[i];
+            if (diff == 0)
+                continue;
+
+            uint64_t rel = buf_off + i - info->pixel_offset;
+            uint64_t pixel = rel / info->stride * info->width + rel % info->stride / (info->bpp / 8);
+
+            channels++;
+            bits += (uint64_t)__builtin_popcount(diff);
+            if (pixel != last_pixel)
+                pixels++;
+            last_pixel = pixel;
+        }
+    }
+
+    stats_add(s, STAT_CHANNELS_MODIFIED, channels);
+    stats_add(s, STAT_PIXELS_MODIFIED, pixels);
+    stats_add(s, STAT_LSBS_FLIPPED, bits);
+}
+
+/*===========================================================
+ * FUNCTION NAME : stats_print
+ * PURPOSE       : Print the summary to stdout as key=value
+ *                 lines or one JSON object. Stages print in
+ *                 the order they first ran.
+ ===========================================================*/
+void stats_print(Stats *s, const char *op)
+{
+    if (s == NULL)
+        return;
+
+    stats_stage(s, NULL);
+    double total_us = (s->stage_start_ns - s->start_ns) / 1e3;
+
+    if (s->json)
+    {
+        printf("{\"op\": \"%s\", \"total_us\": %.1f, \"stages\": {", op, total_us);
+        for (int i = 0; i < s->n_stages; i++)
+            printf("%s\"%s\": {\"us\": %.1f, \"calls\": %llu}", i ? ", " : "", s->stages[i].name,
+                   s->stages[i].ns / 1e3, (unsigned long long)s->stages[i].calls);
+        printf("}, \"counters\": {");
+        for (int c = 0; c < STAT_COUNT; c++)
+            printf("%s\"%s\": %llu", c ? ", " : "", counter_names[c],
+                   (unsigned long long)atomic_load(&s->counters[c]));
+        printf("}}\n");
+    }
+    else
+    {
+        printf("stats.op=%s\nstats.total_us=%.1f\n", op, total_us);
+        for (int i = 0; i < s->n_stages; i++)
+            printf("stats.stage.%s_us=%.1f\n", s->stages[i].name, s->stages[i].ns / 1e3);
+        for (int c = 0; c < STAT_COUNT; c++)
+            printf("stats.%s=%llu\n", counter_names[c], (unsigned long long)atomic_load(&s->counters[c]));
+    }
+    fflush(stdout);
+}
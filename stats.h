@@ -0,0 +1,83 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "bmp.h"
+
+/*
+ * Per-stage timing and I/O counters for --stats
+ *
+ * Encode and decode name their stages as they enter them; the time
+ * until the next stage (or stats_stage(s, NULL)) is added to that
+ * stage. Counters are atomic so the -j workers update them directly.
+ * Every call accepts NULL, which is how the tools run without --stats.
+ */
+
+#define STATS_MAX_STAGES 16
+
+typedef enum
+{
+    STAT_BYTES_READ,
+    STAT_READ_CALLS,            /* read/pread/fread calls issued */
+    STAT_BYTES_WRITTEN,
+    STAT_WRITE_CALLS,           /* write/pwrite/fwrite calls issued */
+    STAT_BYTES_COPIED,          /* copied or reflinked by the kernel, never read */
+    STAT_CHANNELS_MODIFIED,     /* channel bytes whose value changed */
+    STAT_PIXELS_MODIFIED,
+    STAT_LSBS_FLIPPED,
+    STAT_COUNT
+} StatCounter;
+
+typedef struct
+{
+    const char *name;
+    uint64_t ns;
+    uint64_t calls;
+} StatsStage;
+
+typedef struct
+{
+    int json;                   /* --stats=json, else key=value lines */
+    int track_changes;          /* encode: compare pixels before and after embedding */
+    uint64_t start_ns;
+    uint64_t stage_start_ns;
+    int current;                /* running stage, -1 if none */
+    StatsStage stages[STATS_MAX_STAGES];
+    int n_stages;
+    atomic_ullong counters[STAT_COUNT];
+    unsigned char *scratch;     /* pixel bytes before embedding (serial path) */
+    size_t scratch_len;
+} Stats;
+
+/* Monotonic clock in milliseconds, for wall times outside a Stats */
+double stats_now_ms(void);
+
+void stats_init(Stats *s, int json);
+void stats_free(Stats *s);
+
+/* Close the running stage and start `name` (NULL closes only) */
+void stats_stage(Stats *s, const char *name);
+
+/* Add n to a counter */
+void stats_add(Stats *s, StatCounter c, uint64_t n);
+
+/* Count one I/O call of n bytes (STAT_BYTES_READ or STAT_BYTES_WRITTEN) */
+void stats_io(Stats *s, StatCounter bytes, uint64_t n);
+
+/* Scratch buffer of at least len bytes, NULL if it cannot be allocated */
+unsigned char *stats_scratch(Stats *s, size_t len);
+
+/*
+ * Compare len file bytes at file offset buf_off before and after
+ * embedding and count the channel bytes, pixels and bits that
+ * changed. A pixel split across two calls is counted twice.
+ */
+void stats_count_changes(Stats *s, const BmpInfo *info, const unsigned char *before,
+                         const unsigned char *after, size_t len, uint64_t buf_off);
+
+/* Print the summary of operation op ("encode", "decode", "update") */
+void stats_print(Stats *s, const char *op);
+
+#endif
@@ -0,0 +1,933 @@
+#include <stdlib.h>
+#include <string.h>
+#include "stego.h"
+#include "lz.h"
+#include "bmp.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "cipher.h"
+#include "kdf.h"
+#include "scatter.h"
+
+/*===========================================================
+ * libstego: in-memory encode/decode
+ * Every function works on caller buffers and returns a
+ * StegoError, nothing here prints or keeps state.
+ ===========================================================*/
+
+const char *stego_strerror(StegoError err)
+{
+    switch (err)
+    {
+        case STEGO_OK:                   return "success";
+        case STEGO_ERR_ARGS:             return "invalid argument";
+        case STEGO_ERR_NOT_BMP:          return "not a supported BMP image";
+        case STEGO_ERR_CAPACITY:         return "image is too small for the payload";
+        case STEGO_ERR_BUFFER_TOO_SMALL: return "output buffer is too small";
+        case STEGO_ERR_NO_PAYLOAD:       return "no hidden payload (magic string mismatch)";
+        case STEGO_ERR_CORRUPT:          return "corrupt payload header";
+        case STEGO_ERR_UNSUPPORTED:      return "payload format not supported by this version";
+        case STEGO_ERR_NO_MEMORY:        return "out of memory";
+        case STEGO_ERR_CHECKSUM:         return "payload does not match its checksum";
+        case STEGO_ERR_NEED_PASSPHRASE:  return "payload is encrypted, a passphrase is needed";
+        case STEGO_ERR_AUTH:             return "wrong passphrase, or the payload was modified";
+    }
+    return "unknown error";
+}
+
+void stego_put_u32(unsigned char *buf, uint32_t value)
+{
+    buf[0] = (unsigned char)(value >> 24);
+    buf[1] = (unsigned char)(value >> 16);
+    buf[2] = (unsigned char)(value >> 8);
+    buf[3] = (unsigned char)value;
+}
+
+uint32_t stego_get_u32(const unsigned char *buf)
+{
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+void stego_put_u64(unsigned char *buf, uint64_t value)
+{
+    stego_put_u32(buf, (uint32_t)(value >> 32));
+    stego_put_u32(buf + 4, (uint32_t)value);
+}
+
+uint64_t stego_get_u64(const unsigned char *buf)
+{
+    return ((uint64_t)stego_get_u32(buf) << 32) | stego_get_u32(buf + 4);
+}
+
+void stego_shard_pack(const StegoShard *shard, unsigned char *buf)
+{
+    stego_put_u64(buf, shard->id);
+    stego_put_u32(buf + 8, shard->index);
+    stego_put_u32(buf + 12, shard->count);
+    stego_put_u64(buf + 16, shard->offset);
+    stego_put_u64(buf + 24, shard->total);
+}
+
+void stego_shard_unpack(const unsigned char *buf, StegoShard *shard)
+{
+    shard->id = stego_get_u64(buf);
+    shard->index = stego_get_u32(buf + 8);
+    shard->count = stego_get_u32(buf + 12);
+    shard->offset = stego_get_u64(buf + 16);
+    shard->total = stego_get_u64(buf + 24);
+}
+
+/*===========================================================
+ * FUNCTION NAME : stego_header_version
+ * PURPOSE       : A parsed header keeps its version; a new one
+ *                 gets the original layout unless the depth,
+ *                 flags or a size of 4 GiB and up need more
+ ===========================================================*/
+uint32_t stego_header_version(const StegoHeader *hdr)
+{
+    if (hdr->version != 0)
+        return hdr->version;
+    if (hdr->bits > 1 || hdr->flags != 0 || hdr->payload_len > UINT32_MAX || hdr->raw_len > UINT32_MAX)
+        return STEGO_HDR_VERSION;
+    return 0;
+}
+
+/* Bytes of each size field: 8 from version 2 on */
+static size_t size_field_len(uint32_t version)
+{
+    return version >= STEGO_HDR_VERSION ? 8 : 4;
+}
+
+size_t stego_header_size(const StegoHeader *hdr)
+{
+    uint32_t version = stego_header_version(hdr);
+    size_t size_len = size_field_len(version);
+
+    return STEGO_MAGIC_LEN + (version ? 8 : 0) + 4 + hdr->extn_len + size_len +
+           ((hdr->flags & STEGO_FLAG_LZ) ? size_len : 0) +
+           ((hdr->flags & STEGO_FLAG_SHARD) ? STEGO_SHARD_SIZE : 0) +
+           ((hdr->flags & STEGO_FLAG_ENCRYPT) ? STEGO_SALT_SIZE : 0);
+}
+
+/* The trailer starts on a whole group so it can be extracted on its own */
+uint64_t stego_trailer_offset(uint64_t stored, int bits)
+{
+    uint64_t g = LSB_GROUP_BYTES(bits);
+
+    return (stored + g - 1) / g * g;
+}
+
+size_t stego_trailer_size(uint32_t flags)
+{
+    return ((flags & STEGO_FLAG_ENCRYPT) ? STEGO_TAG_SIZE : 0) +
+           ((flags & STEGO_FLAG_CRC) ? STEGO_CRC_SIZE : 0);
+}
+
+uint64_t stego_channels_needed(const StegoHeader *hdr)
+{
+    int bits = hdr->bits > 0 ? hdr->bits : 1;
+    uint64_t data = hdr->payload_len;
+    size_t trailer = stego_trailer_size(hdr->flags);
+
+    if (trailer > 0)
+        data = stego_trailer_offset(data, bits) + trailer;
+    return (uint64_t)stego_header_size(hdr) * 8 + LSB_CHANNELS(data, bits);
+}
+
+/*===========================================================
+ * FUNCTION NAME : stego_choose_bits
+ * PURPOSE       : Fix the data depth; auto tries 1, 2, 3, 4
+ *                 and keeps the first that fits
+ ===========================================================*/
+StegoError stego_choose_bits(StegoHeader *hdr, uint64_t capacity, int requested)
+{
+    if (requested == 0)
+        requested = 1;
+    if (requested != STEGO_BITS_AUTO && (requested < 1 || requested > LSB_MAX_BITS))
+        return STEGO_ERR_ARGS;
+
+    for (int bits = 1; bits <= LSB_MAX_BITS; bits++)
+    {
+        if (requested != STEGO_BITS_AUTO && bits != requested)
+            continue;
+        hdr->bits = bits;
+        if (stego_channels_needed(hdr) <= capacity)
+            return STEGO_OK;
+    }
+    return STEGO_ERR_CAPACITY;
+}
+
+size_t stego_header_pack(const StegoHeader *hdr, unsigned char *buf)
+{
+    unsigned char *p = buf;
+    uint32_t version = stego_header_version(hdr);
+    size_t size_len = size_field_len(version);
+
+    memcpy(p, STEGO_MAGIC, STEGO_MAGIC_LEN);
+    p += STEGO_MAGIC_LEN;
+    if (version != 0)
+    {
+        stego_put_u32(p, STEGO_HDR_EXTENDED | version);
+        stego_put_u32(p + 4, (uint32_t)hdr->bits | hdr->flags);
+        p += 8;
+    }
+    stego_put_u32(p, hdr->extn_len);
+    p += 4;
+    memcpy(p, hdr->extn, hdr->extn_len);
+    p += hdr->extn_len;
+    if (size_len == 8)
+        stego_put_u64(p, hdr->payload_len);
+    else
+        stego_put_u32(p, (uint32_t)hdr->payload_len);
+    p += size_len;
+    if (hdr->flags & STEGO_FLAG_LZ)
+    {
+        if (size_len == 8)
+            stego_put_u64(p, hdr->raw_len);
+        else
+            stego_put_u32(p, (uint32_t)hdr->raw_len);
+        p += size_len;
+    }
+    if (hdr->flags & STEGO_FLAG_SHARD)
+    {
+        stego_shard_pack(&hdr->shard, p);
+        p += STEGO_SHARD_SIZE;
+    }
+    if (hdr->flags & STEGO_FLAG_ENCRYPT)
+    {
+        memcpy(p, hdr->salt, STEGO_SALT_SIZE);
+        p += STEGO_SALT_SIZE;
+    }
+
+    return p - buf;
+}
+
+/*===========================================================
+ * FUNCTION NAME : stego_header_unpack
+ * PURPOSE       : Parse magic, extension and size from the
+ *                 start of a decoded payload stream
+ ===========================================================*/
+StegoError stego_header_unpack(const unsigned char *buf, size_t len, StegoHeader *hdr, size_t *hdr_len)
+{
+    size_t need = STEGO_MAGIC_LEN + 4;
+
+    if (len < need)
+    {
+        *hdr_len = need;
+        return STEGO_ERR_BUFFER_TOO_SMALL;
+    }
+    if (memcmp(buf, STEGO_MAGIC, STEGO_MAGIC_LEN) != 0)
+        return STEGO_ERR_NO_PAYLOAD;
+
+    uint32_t word = stego_get_u32(buf + STEGO_MAGIC_LEN);
+    hdr->bits = 1;
+    hdr->flags = 0;
+    hdr->version = 0;
+    memset(&hdr->shard, 0, sizeof(hdr->shard));
+    if (word & STEGO_HDR_EXTENDED)
+    {
+        need += 8;
+        if (len < need)
+        {
+            *hdr_len = need;
+            return STEGO_ERR_BUFFER_TOO_SMALL;
+        }
+
+        uint32_t flags = stego_get_u32(buf + STEGO_MAGIC_LEN + 4);
+        hdr->version = word & ~STEGO_HDR_EXTENDED;
+        if (hdr->version < STEGO_HDR_VERSION_SIZE32 || hdr->version > STEGO_HDR_VERSION ||
+            (flags & ~STEGO_KNOWN_FLAGS) != 0)
+            return STEGO_ERR_UNSUPPORTED;
+
+        hdr->bits = (int)(flags & STEGO_FLAG_BITS_MASK);
+        hdr->flags = flags & ~STEGO_FLAG_BITS_MASK;
+        if (hdr->bits < 1 || hdr->bits > LSB_MAX_BITS)
+            return STEGO_ERR_CORRUPT;
+        /* The tile layout is keyed, and a streamed payload must be walkable without the key */
+        if ((hdr->flags & STEGO_FLAG_SCATTER) &&
+            (hdr->flags & (STEGO_FLAG_ENCRYPT | STEGO_FLAG_STREAM)) != STEGO_FLAG_ENCRYPT)
+            return STEGO_ERR_CORRUPT;
+        /* A shard is a fixed run of one secret's bytes */
+        if ((hdr->flags & STEGO_FLAG_SHARD) && (hdr->flags & (STEGO_FLAG_STREAM | STEGO_FLAG_ARCHIVE)))
+            return STEGO_ERR_CORRUPT;
+        word = stego_get_u32(buf + need - 4);
+    }
+
+    hdr->extn_len = word;
+    if (hdr->extn_len > STEGO_MAX_EXTN)
+        return STEGO_ERR_CORRUPT;
+
+    size_t size_len = size_field_len(hdr->version);
+    size_t extn_pos = need;
+    need += hdr->extn_len + size_len + ((hdr->flags & STEGO_FLAG_LZ) ? size_len : 0) +
+            ((hdr->flags & STEGO_FLAG_SHARD) ? STEGO_SHARD_SIZE : 0) +
+            ((hdr->flags & STEGO_FLAG_ENCRYPT) ? STEGO_SALT_SIZE : 0);
+    if (len < need)
+    {
+        *hdr_len = need;
+        return STEGO_ERR_BUFFER_TOO_SMALL;
+    }
+
+    memcpy(hdr->extn, buf + extn_pos, hdr->extn_len);
+    hdr->extn[hdr->extn_len] = '\0';
+    const unsigned char *size = buf + extn_pos + hdr->extn_len;
+    hdr->payload_len = size_len == 8 ? stego_get_u64(size) : stego_get_u32(size);
+    hdr->raw_len = hdr->payload_len;
+    if (hdr->flags & STEGO_FLAG_LZ)
+        hdr->raw_len = size_len == 8 ? stego_get_u64(size + 8) : stego_get_u32(size + 4);
+    if (hdr->flags & STEGO_FLAG_SHARD)
+    {
+        const StegoShard *shard = &hdr->shard;
+
+        stego_shard_unpack(size + size_len * ((hdr->flags & STEGO_FLAG_LZ) ? 2 : 1), &hdr->shard);
+        if (shard->index >= shard->count || shard->offset > shard->total ||
+            hdr->raw_len > shard->total - shard->offset)
+            return STEGO_ERR_CORRUPT;
+    }
+    if (hdr->flags & STEGO_FLAG_ENCRYPT)
+        memcpy(hdr->salt, buf + need - STEGO_SALT_SIZE, STEGO_SALT_SIZE);
+
+    *hdr_len = need;
+    return STEGO_OK;
+}
+
+/*===========================================================
+ * Chunks of a streamed payload
+ ===========================================================*/
+void stego_chunk_reader_init(StegoChunkReader *r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+int stego_chunk_reader_feed(StegoChunkReader *r, const unsigned char *data, size_t n,
+                            stego_sink sink, void *ctx)
+{
+    while (n > 0 && !r->done)
+    {
+        if (r->left == 0)
+        {
+            r->len[r->have++] = *data++;
+            n--;
+            r->stored++;
+            if (r->have < sizeof(r->len))
+                continue;
+
+            r->have = 0;
+            r->left = stego_get_u32(r->len);
+            if (r->left > STEGO_STREAM_CHUNK)
+                return -1;
+            r->done = r->left == 0;
+            continue;
+        }
+
+        size_t take = r->left < n ? r->left : n;
+        if (sink(ctx, data, take) != 0)
+            return -1;
+        r->left -= take;
+        r->stored += take;
+        data += take;
+        n -= take;
+    }
+    return 0;
+}
+
+/*===========================================================
+ * FUNCTION NAME : stego_capacity
+ * PURPOSE       : Payload carrying bytes of the pixel array
+ *                 (row padding and alpha excluded)
+ ===========================================================*/
+StegoError stego_capacity(const unsigned char *bmp, size_t bmp_len, size_t *capacity)
+{
+    BmpInfo info;
+    StegoError err;
+
+    if (bmp == NULL || capacity == NULL)
+        return STEGO_ERR_ARGS;
+    if ((err = bmp_parse(bmp, bmp_len, bmp_len, &info)) != STEGO_OK)
+        return err;
+
+    *capacity = (size_t)info.capacity;
+    return STEGO_OK;
+}
+
+/*
+ * Sequential embed of the data region. Calls may split the stream
+ * anywhere; bytes short of a whole group wait in pending.
+ */
+typedef struct
+{
+    const BmpInfo *bmp;
+    const Scatter *scatter;
+    unsigned char *dst;
+    const unsigned char *src;
+    uint64_t channel;
+    int bits;
+    unsigned char pending[3];
+    size_t n_pending;
+} EmbedStream;
+
+static void stream_put(EmbedStream *es, const unsigned char *data, size_t n)
+{
+    size_t g = LSB_GROUP_BYTES(es->bits);
+
+    while (es->n_pending > 0 && n > 0)
+    {
+        es->pending[es->n_pending++] = *data++;
+        n--;
+        if (es->n_pending == g)
+        {
+            scatter_embed(es->scatter, es->bmp, es->dst, es->src, es->channel, es->pending, g, es->bits);
+            es->channel += LSB_CHANNELS(g, es->bits);
+            es->n_pending = 0;
+        }
+    }
+
+    size_t whole = n / g * g;
+    scatter_embed(es->scatter, es->bmp, es->dst, es->src, es->channel, data, whole, es->bits);
+    es->channel += LSB_CHANNELS(whole, es->bits);
+    memcpy(es->pending + es->n_pending, data + whole, n - whole);
+    es->n_pending += n - whole;
+}
+
+static void stream_finish(EmbedStream *es)
+{
+    scatter_embed(es->scatter, es->bmp, es->dst, es->src, es->channel, es->pending, es->n_pending, es->bits);
+    es->channel += LSB_CHANNELS(es->n_pending, es->bits);
+    es->n_pending = 0;
+}
+
+/*
+ * Cipher of an encrypted payload: key from the passphrase and the
+ * header salt. A scattered payload (data from channel c0) also gets
+ * its tile layout from the key.
+ */
+static void payload_cipher(Cipher *cipher, Scatter *scatter, const StegoHeader *hdr, const BmpInfo *bmp,
+                           uint64_t c0, const char *passphrase)
+{
+    unsigned char key[KDF_KEY_SIZE];
+
+    kdf_derive_key(passphrase, hdr->salt, key);
+    cipher_init(cipher, key);
+    if (hdr->flags & STEGO_FLAG_SCATTER)
+        scatter_init(scatter, key, c0, bmp->capacity);
+    memset(key, 0, sizeof(key));
+}
+
+/* Stored size of the payload as LZ frames (a dry run of the encoder) */
+static uint64_t lz_stored_size(const unsigned char *payload, size_t payload_len, unsigned char *frame)
+{
+    uint64_t total = 0;
+
+    for (size_t off = 0; off < payload_len; off += LZ_CHUNK_SIZE)
+    {
+        size_t n = payload_len - off < LZ_CHUNK_SIZE ? payload_len - off : LZ_CHUNK_SIZE;
+        total += lz_frame(payload + off, n, frame);
+    }
+    return total;
+}
+
+/*===========================================================
+ * FUNCTION NAME : stego_encode_mem
+ * PURPOSE       : Copy cover to out_buf with the header and
+ *                 payload embedded in the LSBs
+ ===========================================================*/
+StegoError stego_encode_mem(const unsigned char *cover, size_t cover_len,
+                            const unsigned char *payload, size_t payload_len,
+                            const char *extn,
+                            unsigned char *out_buf, size_t out_cap, size_t *out_len)
+{
+    return stego_encode_mem_opts(cover, cover_len, payload, payload_len, extn, NULL,
+                                 out_buf, out_cap, out_len);
+}
+
+StegoError stego_encode_mem_opts(const unsigned char *cover, size_t cover_len,
+                                 const unsigned char *payload, size_t payload_len,
+                                 const char *extn, const StegoOptions *opts,
+                                 unsigned char *out_buf, size_t out_cap, size_t *out_len)
+{
+    StegoHeader hdr;
+    unsigned char hdr_bytes[STEGO_MAX_HEADER_SIZE];
+    unsigned char *frame = NULL;
+    Cipher cipher;
+    Scatter scatter, *sp = NULL;
+    BmpInfo bmp;
+    StegoError err;
+
+    if (cover == NULL || out_buf == NULL || out_len == NULL || (payload == NULL && payload_len > 0) ||
+        (opts && opts->scatter && opts->passphrase == NULL))
+        return STEGO_ERR_ARGS;
+
+    if ((err = bmp_parse(cover, cover_len, cover_len, &bmp)) != STEGO_OK)
+        return err;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.extn_len = extn ? strlen(extn) : 0;
+    if (hdr.extn_len > STEGO_MAX_EXTN)
+        return STEGO_ERR_ARGS;
+    memcpy(hdr.extn, extn ? extn : "", hdr.extn_len);
+    hdr.payload_len = hdr.raw_len = payload_len;
+
+    *out_len = cover_len;
+    if (out_cap < cover_len)
+        return STEGO_ERR_BUFFER_TOO_SMALL;
+
+    /* Compression is measured first so the depth and header fit the stored size */
+    if (opts && opts->compress)
+    {
+        if ((frame = malloc(LZ_FRAME_MAX)) == NULL)
+            return STEGO_ERR_NO_MEMORY;
+        hdr.flags |= STEGO_FLAG_LZ;
+        hdr.payload_len = lz_stored_size(payload, payload_len, frame);
+    }
+    if (opts && opts->crc)
+        hdr.flags |= STEGO_FLAG_CRC;
+    if (opts && opts->passphrase)
+    {
+        hdr.flags |= STEGO_FLAG_ENCRYPT | (opts->scatter ? STEGO_FLAG_SCATTER : 0);
+        if (frame == NULL && (frame = malloc(LZ_CHUNK_SIZE)) == NULL)
+            return STEGO_ERR_NO_MEMORY;
+        if (kdf_random(hdr.salt, STEGO_SALT_SIZE) != 0)
+        {
+            free(frame);
+            return STEGO_ERR_UNSUPPORTED;
+        }
+    }
+
+    if ((err = stego_choose_bits(&hdr, bmp.capacity, opts ? opts->bits : 1)) != STEGO_OK)
+    {
+        free(frame);
+        return err;
+    }
+    size_t hdr_len = stego_header_size(&hdr);
+    if (hdr.flags & STEGO_FLAG_ENCRYPT)
+        payload_cipher(&cipher, &scatter, &hdr, &bmp, hdr_len * 8, opts->passphrase);
+    if (hdr.flags & STEGO_FLAG_SCATTER)
+        sp = &scatter;
+
+    /* Untouched header and tail (scattered tiles can be anywhere); the embed copies padding and alpha */
+    size_t used_end = sp ? bmp.pixel_offset : bmp_channel_offset(&bmp, stego_channels_needed(&hdr));
+
+    if (out_buf != cover)
+    {
+        memcpy(out_buf, cover, bmp.pixel_offset);
+        memcpy(out_buf + used_end, cover + used_end, cover_len - used_end);
+    }
+
+    stego_header_pack(&hdr, hdr_bytes);
+    bmp_embed(&bmp, out_buf, cover, 0, 0, hdr_bytes, hdr_len, 1);
+
+    if (frame == NULL && !(hdr.flags & STEGO_FLAG_CRC))
+    {
+        scatter_embed(sp, &bmp, out_buf, cover, hdr_len * 8, payload, payload_len, hdr.bits);
+        return STEGO_OK;
+    }
+
+    /* Frames and the trailer follow the data wherever it ends; the CRC is taken as bytes go in */
+    EmbedStream es = { &bmp, sp, out_buf, cover, hdr_len * 8, hdr.bits, {0}, 0 };
+    uint32_t crc = 0;
+
+    for (size_t off = 0; off < payload_len; off += LZ_CHUNK_SIZE)
+    {
+        size_t n = payload_len - off < LZ_CHUNK_SIZE ? payload_len - off : LZ_CHUNK_SIZE;
+        const unsigned char *stored = payload + off;
+
+        /* Frames are built, and bytes to encrypt copied, in the scratch buffer */
+        if (hdr.flags & STEGO_FLAG_LZ)
+            n = lz_frame(payload + off, n, frame);
+        else if (frame)
+            memcpy(frame, payload + off, n);
+        if (frame)
+        {
+            if (hdr.flags & STEGO_FLAG_ENCRYPT)
+                cipher_encrypt(&cipher, frame, n);
+            stored = frame;
+        }
+        crc = crc32c(crc, stored, n);
+        stream_put(&es, stored, n);
+    }
+
+    size_t trailer_len = stego_trailer_size(hdr.flags);
+    if (trailer_len > 0)
+    {
+        unsigned char trailer[3 + STEGO_TAG_SIZE + STEGO_CRC_SIZE] = {0};
+        size_t pad = (size_t)(stego_trailer_offset(hdr.payload_len, hdr.bits) - hdr.payload_len);
+        unsigned char *p = trailer + pad;
+
+        if (hdr.flags & STEGO_FLAG_ENCRYPT)
+        {
+            cipher_tag(&cipher, p);
+            p += STEGO_TAG_SIZE;
+        }
+        if (hdr.flags & STEGO_FLAG_CRC)
+            stego_put_u32(p, crc);
+        stream_put(&es, trailer, pad + trailer_len);
+    }
+    stream_finish(&es);
+    free(frame);
+    return STEGO_OK;
+}
+
+/* Stored bytes are decrypted, then go straight to the sink or through the LZ reader */
+typedef struct
+{
+    LzReader *lz;
+    Cipher *cipher;
+    unsigned char *plain;       /* decrypted bytes, one extracted block */
+    stego_sink sink;
+    void *ctx;
+    int failed;                 /* sink or LZ reader refused encrypted data */
+} StoredSink;
+
+static int stored_sink(void *ctx, const unsigned char *data, size_t n)
+{
+    StoredSink *out = ctx;
+    int r;
+
+    if (out->cipher)
+    {
+        memcpy(out->plain, data, n);
+        cipher_decrypt(out->cipher, out->plain, n);
+        data = out->plain;
+    }
+    if (out->failed)
+        return 0;
+
+    r = out->lz ? lz_reader_feed(out->lz, data, n, out->sink, out->ctx) : out->sink(out->ctx, data, n);
+
+    /* Garbage from a wrong key is still authenticated to the end, so the tag can tell */
+    if (r != 0 && out->cipher)
+    {
+        out->failed = 1;
+        return 0;
+    }
+    return r;
+}
+
+/*
+ * Check the trailer after stored data bytes (data from channel c0):
+ * the CRC against crc, then the tag against the ciphertext MAC in
+ * cipher (NULL: not checked)
+ */
+static StegoError check_trailer(const BmpInfo *bmp, const Scatter *scatter, const unsigned char *stego,
+                                const StegoHeader *hdr, uint64_t c0, uint64_t stored, uint32_t crc,
+                                const Cipher *cipher)
+{
+    unsigned char trailer[STEGO_TAG_SIZE + STEGO_CRC_SIZE], tag[CIPHER_TAG_SIZE];
+    size_t len = stego_trailer_size(hdr->flags);
+    uint64_t c = c0 + LSB_CHANNELS(stego_trailer_offset(stored, hdr->bits), hdr->bits);
+    const unsigned char *p = trailer;
+
+    if (c + LSB_CHANNELS(len, hdr->bits) > bmp->capacity)
+        return STEGO_ERR_CORRUPT;
+    scatter_extract(scatter, bmp, stego, c, trailer, len, hdr->bits);
+
+    if (hdr->flags & STEGO_FLAG_ENCRYPT)
+        p += STEGO_TAG_SIZE;
+    /* A wrong key also misplaces scattered tiles, so there a bad CRC may be the passphrase */
+    if ((hdr->flags & STEGO_FLAG_CRC) && stego_get_u32(p) != crc)
+        return scatter ? STEGO_ERR_AUTH : STEGO_ERR_CHECKSUM;
+    if (cipher)
+    {
+        cipher_tag(cipher, tag);
+        if (!cipher_tag_equal(tag, trailer))
+            return STEGO_ERR_AUTH;
+    }
+    return STEGO_OK;
+}
+
+/*
+ * Extract the data region from channel c0 on and pass the secret
+ * to sink: plain, LZ frames and/or chunks of a streamed payload.
+ * *stored receives the bytes the data takes in the image; a CRC
+ * is checked over them as they are extracted. With a cipher the
+ * data is decrypted and its tag checked; without one an encrypted
+ * payload reaches the sink as ciphertext.
+ */
+static StegoError decode_data(const BmpInfo *bmp, const Scatter *scatter, const unsigned char *stego,
+                              const StegoHeader *hdr, uint64_t c0, Cipher *cipher, stego_sink sink, void *ctx,
+                              uint64_t *stored)
+{
+    unsigned char block[3 * 1024];      /* whole groups at any depth */
+    unsigned char plain[sizeof(block)];
+    StoredSink out = { NULL, cipher, plain, sink, ctx, 0 };
+    StegoChunkReader chunks;
+    int streamed = (hdr->flags & STEGO_FLAG_STREAM) != 0;
+    uint64_t total = hdr->payload_len;
+    StegoError err = STEGO_OK;
+    uint32_t crc = 0;
+
+    /* A streamed payload ends at its last chunk, at most at the end of the image */
+    if (streamed)
+        total = c0 < bmp->capacity ? (bmp->capacity - c0) * hdr->bits / 8 : 0;
+
+    if (hdr->flags & STEGO_FLAG_LZ)
+    {
+        if ((out.lz = malloc(sizeof(*out.lz))) == NULL)
+            return STEGO_ERR_NO_MEMORY;
+        lz_reader_init(out.lz);
+    }
+    stego_chunk_reader_init(&chunks);
+
+    for (uint64_t off = 0; off < total && err == STEGO_OK; off += sizeof(block))
+    {
+        size_t n = total - off < sizeof(block) ? (size_t)(total - off) : sizeof(block);
+        int r;
+
+        scatter_extract(scatter, bmp, stego, c0 + LSB_CHANNELS(off, hdr->bits), block, n, hdr->bits);
+        if (streamed)
+        {
+            /* Bytes after the last chunk are not part of the data */
+            uint64_t before = chunks.stored;
+            r = stego_chunk_reader_feed(&chunks, block, n, stored_sink, &out);
+            crc = crc32c(crc, block, (size_t)(chunks.stored - before));
+        }
+        else
+        {
+            crc = crc32c(crc, block, n);
+            r = stored_sink(&out, block, n);
+        }
+        if (r != 0)
+            err = STEGO_ERR_CORRUPT;
+        if (streamed && chunks.done)
+            break;
+    }
+    if (err == STEGO_OK && (out.failed || (streamed && !chunks.done) || (out.lz && !lz_reader_done(out.lz))))
+        err = STEGO_ERR_CORRUPT;
+
+    /* A failed check explains undecodable data better than STEGO_ERR_CORRUPT */
+    *stored = streamed ? chunks.stored : total;
+    if ((err == STEGO_OK || out.failed) && ((hdr->flags & STEGO_FLAG_CRC) || cipher))
+    {
+        StegoError check = check_trailer(bmp, scatter, stego, hdr, c0, *stored, crc, cipher);
+        if (check != STEGO_OK)
+            err = check;
+    }
+    free(out.lz);
+    return err;
+}
+
+/* Sink of a sizing pass: count the bytes only */
+static int count_sink(void *ctx, const unsigned char *data, size_t n)
+{
+    (void)data;
+    *(uint64_t *)ctx += n;
+    return 0;
+}
+
+/* Decode the header of an in-memory stego image */
+static StegoError read_header(const unsigned char *stego, size_t stego_len,
+                              StegoHeader *hdr, size_t *hdr_len, BmpInfo *bmp)
+{
+    unsigned char bytes[STEGO_MAX_HEADER_SIZE];
+    size_t have = 0;
+    StegoError err;
+
+    if ((err = bmp_parse(stego, stego_len, stego_len, bmp)) != STEGO_OK)
+        return err;
+
+    /* Extract just as many bytes as the header asks for */
+    for (;;)
+    {
+        err = stego_header_unpack(bytes, have, hdr, hdr_len);
+        if (err != STEGO_ERR_BUFFER_TOO_SMALL)
+            break;
+        if (*hdr_len > bmp->capacity / 8)
+            return STEGO_ERR_NO_PAYLOAD;
+        bmp_extract(bmp, stego, 0, have * 8, bytes + have, *hdr_len - have, 1);
+        have = *hdr_len;
+    }
+    if (err != STEGO_OK)
+        return err;
+
+    /* The header of a streamed payload has no sizes: walk its chunks */
+    if (hdr->flags & STEGO_FLAG_STREAM)
+    {
+        hdr->raw_len = 0;
+        err = decode_data(bmp, NULL, stego, hdr, *hdr_len * 8, NULL, count_sink, &hdr->raw_len, &hdr->payload_len);
+        if (err != STEGO_OK)
+            return err;
+    }
+
+    if (stego_channels_needed(hdr) > bmp->capacity)
+        return STEGO_ERR_CORRUPT;
+    return STEGO_OK;
+}
+
+StegoError stego_payload_info(const unsigned char *stego, size_t stego_len, StegoHeader *hdr)
+{
+    size_t hdr_len;
+    BmpInfo bmp;
+
+    if (stego == NULL || hdr == NULL)
+        return STEGO_ERR_ARGS;
+    return read_header(stego, stego_len, hdr, &hdr_len, &bmp);
+}
+
+/* Sink of the in-memory decoder: append to the caller buffer */
+typedef struct
+{
+    unsigned char *out;
+    size_t cap;
+    size_t len;
+} MemSink;
+
+static int mem_sink(void *ctx, const unsigned char *raw, size_t n)
+{
+    MemSink *sink = ctx;
+
+    if (sink->cap - sink->len < n)
+        return -1;
+    memcpy(sink->out + sink->len, raw, n);
+    sink->len += n;
+    return 0;
+}
+
+/*===========================================================
+ * FUNCTION NAME : stego_decode_mem
+ * PURPOSE       : Extract the hidden payload of an in-memory
+ *                 stego image into out_buf
+ ===========================================================*/
+StegoError stego_decode_mem(const unsigned char *stego, size_t stego_len,
+                            unsigned char *out_buf, size_t out_cap, size_t *out_len,
+                            char *extn, size_t extn_cap)
+{
+    return stego_decode_mem_pass(stego, stego_len, out_buf, out_cap, out_len, extn, extn_cap, NULL);
+}
+
+StegoError stego_decode_mem_pass(const unsigned char *stego, size_t stego_len,
+                                 unsigned char *out_buf, size_t out_cap, size_t *out_len,
+                                 char *extn, size_t extn_cap, const char *passphrase)
+{
+    StegoHeader hdr;
+    size_t hdr_len;
+    BmpInfo bmp;
+    Cipher cipher, *cp = NULL;
+    Scatter scatter, *sp = NULL;
+    StegoError err;
+
+    if (stego == NULL || out_len == NULL || (out_buf == NULL && out_cap > 0))
+        return STEGO_ERR_ARGS;
+
+    if ((err = read_header(stego, stego_len, &hdr, &hdr_len, &bmp)) != STEGO_OK)
+        return err;
+
+    *out_len = hdr.raw_len;
+    if (out_cap < hdr.raw_len)
+        return STEGO_ERR_BUFFER_TOO_SMALL;
+    if ((hdr.flags & STEGO_FLAG_ENCRYPT) && passphrase == NULL)
+        return STEGO_ERR_NEED_PASSPHRASE;
+
+    if (extn != NULL && extn_cap > 0)
+    {
+        size_t n = hdr.extn_len < extn_cap - 1 ? hdr.extn_len : extn_cap - 1;
+        memcpy(extn, hdr.extn, n);
+        extn[n] = '\0';
+    }
+
+    if (hdr.flags & STEGO_FLAG_ENCRYPT)
+    {
+        payload_cipher(&cipher, &scatter, &hdr, &bmp, hdr_len * 8, passphrase);
+        cp = &cipher;
+    }
+    if (hdr.flags & STEGO_FLAG_SCATTER)
+        sp = &scatter;
+
+    if (hdr.flags & (STEGO_FLAG_LZ | STEGO_FLAG_STREAM))
+    {
+        MemSink sink = { out_buf, hdr.raw_len, 0 };
+        uint64_t stored;
+
+        err = decode_data(&bmp, sp, stego, &hdr, hdr_len * 8, cp, mem_sink, &sink, &stored);
+        if (err == STEGO_OK && sink.len != hdr.raw_len)
+            err = STEGO_ERR_CORRUPT;
+    }
+    else
+    {
+        /* Checks run on the stored bytes, decryption is in place */
+        uint32_t crc = 0;
+
+        scatter_extract(sp, &bmp, stego, hdr_len * 8, out_buf, hdr.payload_len, hdr.bits);
+        if (hdr.flags & STEGO_FLAG_CRC)
+            crc = crc32c(0, out_buf, hdr.payload_len);
+        if (cp)
+            cipher_decrypt(cp, out_buf, hdr.payload_len);
+        if (hdr.flags & (STEGO_FLAG_CRC | STEGO_FLAG_ENCRYPT))
+            err = check_trailer(&bmp, sp, stego, &hdr, hdr_len * 8, hdr.payload_len, crc, cp);
+    }
+
+    /* Nothing of a payload that failed authentication is handed out */
+    if (err == STEGO_ERR_AUTH)
+        memset(out_buf, 0, hdr.raw_len);
+    return err;
+}
+
+/*===========================================================
+ * FUNCTION NAME : stego_decode_range
+ * PURPOSE       : Extract a byte range of a plain payload
+ *                 straight from the pixels holding it
+ ===========================================================*/
+StegoError stego_decode_range(const unsigned char *stego, size_t stego_len,
+                              uint64_t offset, size_t len,
+                              unsigned char *out_buf, size_t *out_len)
+{
+    return stego_decode_range_pass(stego, stego_len, offset, len, out_buf, out_len, NULL);
+}
+
+StegoError stego_decode_range_pass(const unsigned char *stego, size_t stego_len,
+                                   uint64_t offset, size_t len,
+                                   unsigned char *out_buf, size_t *out_len, const char *passphrase)
+{
+    unsigned char group[3];             /* one group, depth 3 is the widest */
+    StegoHeader hdr;
+    size_t hdr_len;
+    BmpInfo bmp;
+    Cipher cipher;
+    Scatter scatter, *sp = NULL;
+    StegoError err;
+
+    if (stego == NULL || out_len == NULL || (out_buf == NULL && len > 0))
+        return STEGO_ERR_ARGS;
+
+    if ((err = read_header(stego, stego_len, &hdr, &hdr_len, &bmp)) != STEGO_OK)
+        return err;
+    if (hdr.flags & (STEGO_FLAG_LZ | STEGO_FLAG_STREAM))
+        return STEGO_ERR_UNSUPPORTED;
+    if ((hdr.flags & STEGO_FLAG_ENCRYPT) && passphrase == NULL)
+        return STEGO_ERR_NEED_PASSPHRASE;
+    if (offset > hdr.payload_len)
+        return STEGO_ERR_ARGS;
+
+    *out_len = hdr.payload_len - offset < len ? (size_t)(hdr.payload_len - offset) : len;
+    if (*out_len == 0)
+        return STEGO_OK;
+
+    if (hdr.flags & STEGO_FLAG_ENCRYPT)
+        payload_cipher(&cipher, &scatter, &hdr, &bmp, hdr_len * 8, passphrase);
+    if (hdr.flags & STEGO_FLAG_SCATTER)
+        sp = &scatter;
+
+    /* Extraction starts on a group boundary; a partial first group goes through a bounce buffer */
+    uint64_t g = LSB_GROUP_BYTES(hdr.bits);
+    uint64_t first = offset / g * g;
+    size_t skip = (size_t)(offset - first);
+    uint64_t c0 = hdr_len * 8 + LSB_CHANNELS(first, hdr.bits);
+    size_t done = 0;
+
+    if (skip > 0)
+    {
+        size_t n = g - skip < *out_len ? (size_t)(g - skip) : *out_len;
+        size_t take = hdr.payload_len - first < g ? (size_t)(hdr.payload_len - first) : (size_t)g;
+
+        scatter_extract(sp, &bmp, stego, c0, group, take, hdr.bits);
+        memcpy(out_buf, group + skip, n);
+        done = n;
+        c0 += LSB_CHANNELS(g, hdr.bits);
+    }
+    if (done < *out_len)
+        scatter_extract(sp, &bmp, stego, c0, out_buf + done, *out_len - done, hdr.bits);
+
+    /* The keystream is addressed by payload offset, so a range decrypts on its own */
+    if (hdr.flags & STEGO_FLAG_ENCRYPT)
+        cipher_xor(&cipher, offset, out_buf, *out_len);
+    return STEGO_OK;
+}
@@ -0,0 +1,272 @@
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libstego: reentrant in-memory encode/decode.
+ *
+ * Works on caller-provided buffers only: no FILE*, no argv,
+ * no printing and no global state, so it is safe to call
+ * from many threads at once.
+ *
+ * Payload stream layout (see bmp.h for how channel bytes map to
+ * the pixel array):
+ *   magic (2) | extension size (4, big endian) | extension |
+ *   secret size (4, big endian) | secret data
+ *
+ * The header always takes 1 bit per channel byte (8 channels per
+ * byte). Secret data uses the depth recorded in the header, 1 to 4
+ * bits per channel (see lsb.h), starting right after the header.
+ *
+ * Images that need more than the original layout (depth > 1,
+ * compression or sizes of 4 GiB and up) use an extended header: the
+ * extension size word is replaced by
+ *   STEGO_HDR_EXTENDED | version (4) | flags (4) | extension size (4)
+ * with the depth in the low bits of the flags word. Version 2 stores
+ * the secret size in 8 bytes; version 1 (4 byte sizes) is still read.
+ * With STEGO_FLAG_LZ the secret size is followed by the uncompressed
+ * size (same width) and the data is a stream of LZ frames (lz.h).
+ * With STEGO_FLAG_STREAM the sizes were not known when the header was
+ * written (secret read from a pipe) and are 0: the stored bytes are cut
+ * into chunks of length (4, big endian) | bytes, ended by a zero length.
+ * With STEGO_FLAG_ARCHIVE the data holds several files behind a table
+ * of contents (archive.h); the extension is empty.
+ * With STEGO_FLAG_SHARD (not streamed, not archives) the sizes are
+ * followed by a shard record, StegoShard as payload ID (8) | index (4) |
+ * count (4) | offset (8) | total size (8), all big endian: the data is
+ * secret bytes [offset, offset + secret size) of a payload striped
+ * over count images (stripe.h).
+ * With STEGO_FLAG_ENCRYPT the sizes (and shard record) are followed by a 16 byte salt
+ * and the stored bytes (chunk bodies only, when streamed) are
+ * ChaCha20-Poly1305 ciphertext under a key derived from a passphrase
+ * and the salt (cipher.h, kdf.h).
+ * With STEGO_FLAG_SCATTER (encrypted, not streamed payloads only) the
+ * data channels are spread over the image in keyed tiles (scatter.h).
+ * Encrypted and STEGO_FLAG_CRC data is followed by a trailer at the
+ * data depth, starting on the next whole group (zero padded, depth 3
+ * only): the 16 byte Poly1305 tag, then the CRC32C (crc32c.h) of the
+ * stored bytes, 4 bytes big endian.
+ * Plain 1-bit payloads under 4 GiB keep the original layout, so old
+ * decoders read them.
+ */
+
+#define STEGO_MAGIC "#*"
+#define STEGO_MAGIC_LEN 2
+#define STEGO_MAX_EXTN 9        /* longest extension, without '\0' */
+
+#define STEGO_HDR_EXTENDED 0x80000000u   /* marks the extended header */
+#define STEGO_HDR_VERSION 2              /* written: 64-bit sizes */
+#define STEGO_HDR_VERSION_SIZE32 1       /* read only: 32-bit sizes */
+#define STEGO_FLAG_BITS_MASK 0x0Fu       /* bits per channel, 1..4 */
+#define STEGO_FLAG_LZ 0x10u              /* data is LZ compressed */
+#define STEGO_FLAG_STREAM 0x20u          /* data is length-prefixed chunks */
+#define STEGO_FLAG_ARCHIVE 0x40u         /* data is a multi-file archive */
+#define STEGO_FLAG_CRC 0x80u             /* data is followed by a CRC32C */
+#define STEGO_FLAG_ENCRYPT 0x100u        /* data is ChaCha20-Poly1305 ciphertext */
+#define STEGO_FLAG_SCATTER 0x200u        /* data tiles are spread over the image */
+#define STEGO_FLAG_SHARD 0x400u          /* data is one shard of a striped payload */
+#define STEGO_KNOWN_FLAGS (STEGO_FLAG_BITS_MASK | STEGO_FLAG_LZ | STEGO_FLAG_STREAM | \
+                           STEGO_FLAG_ARCHIVE | STEGO_FLAG_CRC | STEGO_FLAG_ENCRYPT | \
+                           STEGO_FLAG_SCATTER | STEGO_FLAG_SHARD)
+
+#define STEGO_CRC_SIZE 4                 /* bytes of the CRC in the trailer */
+#define STEGO_TAG_SIZE 16                /* bytes of the MAC tag in the trailer */
+#define STEGO_SALT_SIZE 16               /* key derivation salt in the header */
+#define STEGO_SHARD_SIZE 32              /* shard record in the header */
+
+/* Largest chunk body of a STEGO_FLAG_STREAM payload */
+#define STEGO_STREAM_CHUNK (64 * 1024)
+
+/* Largest header of any format */
+#define STEGO_MAX_HEADER_SIZE (STEGO_MAGIC_LEN + 8 + 4 + STEGO_MAX_EXTN + 8 + 8 + STEGO_SHARD_SIZE + \
+                               STEGO_SALT_SIZE)
+
+/* Pass as bits to pick the smallest depth that fits the cover */
+#define STEGO_BITS_AUTO (-1)
+
+typedef enum
+{
+    STEGO_OK = 0,
+    STEGO_ERR_ARGS,             /* NULL pointer or bad argument */
+    STEGO_ERR_NOT_BMP,          /* cover/stego is not a usable BMP */
+    STEGO_ERR_CAPACITY,         /* payload does not fit the cover */
+    STEGO_ERR_BUFFER_TOO_SMALL, /* output buffer too small, see *out_len */
+    STEGO_ERR_NO_PAYLOAD,       /* magic string not found */
+    STEGO_ERR_CORRUPT,          /* header fields out of range */
+    STEGO_ERR_UNSUPPORTED,      /* header version or flags not known */
+    STEGO_ERR_NO_MEMORY,        /* scratch buffer allocation failed */
+    STEGO_ERR_CHECKSUM,         /* data does not match its CRC32C */
+    STEGO_ERR_NEED_PASSPHRASE,  /* payload is encrypted, no passphrase given */
+    STEGO_ERR_AUTH              /* wrong passphrase, or the data was modified */
+} StegoError;
+
+/* Where the data of one image goes in a striped payload */
+typedef struct
+{
+    uint64_t id;                /* the same on every shard of the payload */
+    uint32_t index;             /* 0 .. count - 1 */
+    uint32_t count;             /* images the payload is striped over */
+    uint64_t offset;            /* secret offset of the shard's first byte */
+    uint64_t total;             /* secret size of the whole payload */
+} StegoShard;
+
+/* Parsed payload header */
+typedef struct
+{
+    char extn[STEGO_MAX_EXTN + 1];
+    uint32_t extn_len;
+    uint64_t payload_len;       /* bytes stored in the image */
+    int bits;                   /* secret data bits per channel, 1..4 */
+    uint32_t flags;             /* STEGO_FLAG_LZ, _STREAM, _ARCHIVE, _CRC, _ENCRYPT, _SCATTER, _SHARD */
+    uint64_t raw_len;           /* secret size after decompression */
+    StegoShard shard;           /* STEGO_FLAG_SHARD only */
+    unsigned char salt[STEGO_SALT_SIZE];    /* STEGO_FLAG_ENCRYPT only */
+    uint32_t version;           /* 0 = original layout; on encode 0 picks one */
+} StegoHeader;
+
+/* Encoder options, NULL means defaults (1 bit per channel) */
+typedef struct
+{
+    int bits;                   /* 1..4, STEGO_BITS_AUTO, 0 = 1 */
+    int compress;               /* store the payload LZ compressed */
+    int crc;                    /* append a CRC32C, checked on decode */
+    const char *passphrase;     /* encrypt under this passphrase, NULL = don't */
+    int scatter;                /* spread the data over the image (needs passphrase) */
+} StegoOptions;
+
+/* Receives decoded bytes; non-zero stops the decoder (same shape as lz_sink) */
+typedef int (*stego_sink)(void *ctx, const unsigned char *data, size_t n);
+
+/* Parser of the chunks of a STEGO_FLAG_STREAM payload, fed in pieces */
+typedef struct
+{
+    unsigned char len[4];       /* length word being collected */
+    size_t have;                /* bytes of it collected */
+    uint32_t left;              /* body bytes left in the current chunk */
+    int done;                   /* zero length chunk seen */
+    uint64_t stored;            /* stream bytes consumed, lengths included */
+} StegoChunkReader;
+
+/* Human readable text for an error code */
+const char *stego_strerror(StegoError err);
+
+/* Big endian field helpers shared with the CLI */
+void stego_put_u32(unsigned char *buf, uint32_t value);
+uint32_t stego_get_u32(const unsigned char *buf);
+void stego_put_u64(unsigned char *buf, uint64_t value);
+uint64_t stego_get_u64(const unsigned char *buf);
+
+/* Shard record in its STEGO_SHARD_SIZE byte header form */
+void stego_shard_pack(const StegoShard *shard, unsigned char *buf);
+void stego_shard_unpack(const unsigned char *buf, StegoShard *shard);
+
+/* Header version hdr is written with: 0 (original layout) or STEGO_HDR_VERSION */
+uint32_t stego_header_version(const StegoHeader *hdr);
+
+/* Bytes of payload stream taken by the header (magic + sizes + extension) */
+size_t stego_header_size(const StegoHeader *hdr);
+
+/* Payload byte offset of the trailer after stored data bytes at depth bits */
+uint64_t stego_trailer_offset(uint64_t stored, int bits);
+
+/* Bytes of the trailer (tag and/or CRC) a payload with these flags has */
+size_t stego_trailer_size(uint32_t flags);
+
+/* Channel bytes taken by header, secret data and trailer together */
+uint64_t stego_channels_needed(const StegoHeader *hdr);
+
+/*
+ * Set hdr->bits from the requested depth (1..4, STEGO_BITS_AUTO or 0)
+ * and check the payload fits capacity channel bytes. Auto picks the
+ * smallest depth that fits.
+ */
+StegoError stego_choose_bits(StegoHeader *hdr, uint64_t capacity, int requested);
+
+/* Serialize the header into buf (stego_header_size bytes) */
+size_t stego_header_pack(const StegoHeader *hdr, unsigned char *buf);
+
+/* Parse a header from the first len bytes of the payload stream.
+ * On success *hdr_len is the header size; if len is too short,
+ * STEGO_ERR_BUFFER_TOO_SMALL is returned with *hdr_len = bytes needed. */
+StegoError stego_header_unpack(const unsigned char *buf, size_t len, StegoHeader *hdr, size_t *hdr_len);
+
+void stego_chunk_reader_init(StegoChunkReader *r);
+
+/* Pass chunk bodies to sink; bytes after the last chunk are ignored.
+ * 0 on success, -1 on a bad length or sink error */
+int stego_chunk_reader_feed(StegoChunkReader *r, const unsigned char *data, size_t n,
+                            stego_sink sink, void *ctx);
+
+/* Channel bytes usable for payload in a BMP held in memory */
+StegoError stego_capacity(const unsigned char *bmp, size_t bmp_len, size_t *capacity);
+
+/*
+ * Embed payload (with extension extn, may be NULL) into cover.
+ * out_buf receives the full stego image (cover_len bytes) and may be
+ * the cover buffer itself for an in-place encode.
+ */
+StegoError stego_encode_mem(const unsigned char *cover, size_t cover_len,
+                            const unsigned char *payload, size_t payload_len,
+                            const char *extn,
+                            unsigned char *out_buf, size_t out_cap, size_t *out_len);
+
+/* stego_encode_mem with options (opts may be NULL) */
+StegoError stego_encode_mem_opts(const unsigned char *cover, size_t cover_len,
+                                 const unsigned char *payload, size_t payload_len,
+                                 const char *extn, const StegoOptions *opts,
+                                 unsigned char *out_buf, size_t out_cap, size_t *out_len);
+
+/* Read the payload header of a stego image, e.g. to size the decode
+ * buffer (raw_len is the decoded size). Streamed payloads are walked
+ * once to fill in their sizes. */
+StegoError stego_payload_info(const unsigned char *stego, size_t stego_len,
+                              StegoHeader *hdr);
+
+/*
+ * Extract the payload into out_buf. If out_cap is too small,
+ * STEGO_ERR_BUFFER_TOO_SMALL is returned and *out_len holds the
+ * payload size. extn (optional) receives the stored extension.
+ * A STEGO_FLAG_CRC payload that fails its check gives
+ * STEGO_ERR_CHECKSUM (out_buf holds the damaged bytes).
+ * Encrypted payloads give STEGO_ERR_NEED_PASSPHRASE here.
+ */
+StegoError stego_decode_mem(const unsigned char *stego, size_t stego_len,
+                            unsigned char *out_buf, size_t out_cap, size_t *out_len,
+                            char *extn, size_t extn_cap);
+
+/*
+ * stego_decode_mem with the passphrase of an encrypted payload
+ * (ignored for others). A wrong passphrase or modified data gives
+ * STEGO_ERR_AUTH, with out_buf cleared.
+ */
+StegoError stego_decode_mem_pass(const unsigned char *stego, size_t stego_len,
+                                 unsigned char *out_buf, size_t out_cap, size_t *out_len,
+                                 char *extn, size_t extn_cap, const char *passphrase);
+
+/*
+ * Extract payload bytes [offset, offset + len) into out_buf without
+ * decoding the bytes before them: only the pixel bytes holding the
+ * range are read, so a mapped image pages in just those. The range
+ * is clipped at the end of the payload; *out_len receives the bytes
+ * returned. Compressed and streamed payloads have no fixed byte to
+ * pixel mapping and give STEGO_ERR_UNSUPPORTED. A CRC covers the
+ * whole payload and is not checked here. Encrypted payloads give
+ * STEGO_ERR_NEED_PASSPHRASE here.
+ */
+StegoError stego_decode_range(const unsigned char *stego, size_t stego_len,
+                              uint64_t offset, size_t len,
+                              unsigned char *out_buf, size_t *out_len);
+
+/*
+ * stego_decode_range with the passphrase of an encrypted payload
+ * (ignored for others). The range is decrypted on its own; the tag
+ * covers the whole payload and is not checked, so a wrong
+ * passphrase returns garbage rather than STEGO_ERR_AUTH.
+ */
+StegoError stego_decode_range_pass(const unsigned char *stego, size_t stego_len,
+                                   uint64_t offset, size_t len,
+                                   unsigned char *out_buf, size_t *out_len, const char *passphrase);
+
+#endif
@@ -0,0 +1,374 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "stripe.h"
+#include "encode.h"
+#include "decode.h"
+#include "kdf.h"
+#include "parallel.h"
+#include "pipeio.h"
+#include "stats.h"
+#include "common.h"
+
+/* One image of the set and its outcome */
+typedef struct
+{
+    char *image;                /* cover (encode) or stego image (decode) */
+    char *output;               /* stego image (encode) */
+    const char *secret;         /* secret (encode) or shared output (decode) */
+    const BatchConfig *config;
+    StegoShard shard;           /* encode: assigned, decode: as found */
+    uint64_t len;               /* secret bytes in the shard */
+    uint64_t capacity;          /* encode: channel bytes of the cover */
+    int output_file;            /* encode: this run wrote the output, a failed set removes it */
+    Status status;
+    double elapsed_ms;
+} StripeJob;
+
+/* Encode one shard: same validation and pipeline as the -e command */
+static void stripe_encode_job(void *arg, int worker)
+{
+    StripeJob *job = arg;
+    char *argv[] = { "stego", "-e", job->image, (char *)job->secret, job->output, NULL };
+    EncodeInfo encInfo;
+    double start = stats_now_ms();
+
+    (void)worker;
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.buf_size = job->config->buf_size;
+    encInfo.use_mmap = job->config->use_mmap;
+    encInfo.bits = job->config->bits;
+    encInfo.compress = job->config->compress;
+    encInfo.crc = job->config->crc;
+    encInfo.passphrase = job->config->passphrase;
+    encInfo.scatter = job->config->scatter;
+    encInfo.shard = job->shard;
+    encInfo.shard_len = job->len;
+    encInfo.quiet = 1;
+
+    job->status = e_failure;
+    if (read_and_validate_encode_args(argv, &encInfo) == e_success)
+        job->status = do_encoding(&encInfo);
+    /* A failed encode has removed its own output already */
+    job->output_file = encInfo.output_file;
+    close_files(&encInfo);
+    job->elapsed_ms = stats_now_ms() - start;
+}
+
+/* Decode one shard into its place in the shared output */
+static void stripe_decode_job(void *arg, int worker)
+{
+    StripeJob *job = arg;
+    char *argv[] = { "stego", "-d", job->image, (char *)job->secret, NULL };
+    DecodeInfo decInfo;
+    double start = stats_now_ms();
+
+    (void)worker;
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.buf_size = job->config->buf_size;
+    decInfo.use_mmap = job->config->use_mmap;
+    decInfo.passphrase = job->config->passphrase;
+    decInfo.stripe = 1;
+    decInfo.quiet = 1;
+
+    job->status = e_failure;
+    if (read_and_validate_decode_args(argv, &decInfo) == e_success && open_decode_files(&decInfo) == e_success)
+        job->status = do_decoding(&decInfo);
+    job->shard = decInfo.shard;
+    job->len = decInfo.file_size;
+    close_decode_files(&decInfo);
+    job->elapsed_ms = stats_now_ms() - start;
+}
+
+/* Run every job on a pool, one worker per image unless -j says otherwise */
+static Status run_jobs(StripeJob *jobs, int n, work_fn fn, const BatchConfig *config)
+{
+    int threads = config->threads > 0 ? config->threads : n;
+    WorkPool *pool = workpool_create(threads < MAX_THREADS ? threads : MAX_THREADS);
+    Status ret = e_success;
+
+    if (pool == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to start worker threads\n");
+        return e_failure;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (workpool_submit(pool, fn, &jobs[i]) != 0)
+        {
+            fprintf(stderr, "ERROR: Unable to queue %s\n", jobs[i].image);
+            ret = e_failure;
+        }
+    }
+    workpool_wait(pool);
+    workpool_destroy(pool);
+    return ret;
+}
+
+/* Per-image status in argument order; the number of failures */
+static int report_jobs(const StripeJob *jobs, int n, int encode)
+{
+    int failed = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        const StripeJob *job = &jobs[i];
+
+        if (job->status == e_success)
+            printf("OK   shard %u/%u: %s -> %s (%llu bytes, %.2f ms)\n", (unsigned)job->shard.index + 1,
+                   (unsigned)job->shard.count, job->image, encode ? job->output : job->secret,
+                   (unsigned long long)job->len, job->elapsed_ms);
+        else
+        {
+            printf("FAIL %s\n", job->image);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/*===========================================================
+ * FUNCTION NAME : split_secret
+ * PURPOSE       : Give every cover a run of the secret in
+ *                 proportion to its capacity, less what its
+ *                 header and trailer take
+ ===========================================================*/
+static Status split_secret(StripeJob *jobs, int n, uint64_t size)
+{
+    uint64_t total = 0, sum = 0, offset = 0;
+    unsigned char id[8];
+
+    for (int i = 0; i < n; i++)
+    {
+        if (jobs[i].capacity > STRIPE_RESERVE_CHANNELS)
+            total += jobs[i].capacity - STRIPE_RESERVE_CHANNELS;
+    }
+    if (total == 0)
+    {
+        printf("ERROR: Cover images are too small to hold any data\n");
+        return e_failure;
+    }
+    if (kdf_random(id, sizeof(id)) != 0)
+    {
+        perror("getrandom");
+        return e_failure;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (jobs[i].capacity > STRIPE_RESERVE_CHANNELS)
+            sum += jobs[i].capacity - STRIPE_RESERVE_CHANNELS;
+
+        /* Cumulative ends, so the shards meet exactly and the last one ends the secret */
+        uint64_t end = i == n - 1 ? size : (uint64_t)((long double)size * sum / total);
+        jobs[i].shard.id = stego_get_u64(id);
+        jobs[i].shard.index = (uint32_t)i;
+        jobs[i].shard.count = (uint32_t)n;
+        jobs[i].shard.offset = offset;
+        jobs[i].shard.total = size;
+        jobs[i].len = end - offset;
+        offset = end;
+    }
+    return e_success;
+}
+
+/*===========================================================
+ * FUNCTION NAME : run_stripe_encode
+ * PURPOSE       : Size the covers, split the secret over
+ *                 them and encode all shards concurrently; a
+ *                 failed set leaves no output images
+ ===========================================================*/
+Status run_stripe_encode(const char *secret_fname, char *pairs[], int n, const BatchConfig *config, int quiet)
+{
+    LogTarget log = { quiet };
+    FILE *fptr;
+    off_t size;
+
+    if (pipe_is_std(secret_fname) || (fptr = fopen(secret_fname, "r")) == NULL)
+    {
+        printf("ERROR: --stripe needs the secret as a file\n");
+        return e_failure;
+    }
+    size = get_file_size(fptr);
+    fclose(fptr);
+    if (size < 0)
+    {
+        perror(secret_fname);
+        return e_failure;
+    }
+
+    StripeJob *jobs = calloc(n, sizeof(*jobs));
+    if (jobs == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return e_failure;
+    }
+
+    /* Images are encoded side by side, so none of them may be stdin/stdout */
+    for (int i = 0; i < n; i++)
+    {
+        StripeJob *job = &jobs[i];
+        BmpInfo info;
+        int fd = pipe_is_std(pairs[2 * i]) || pipe_is_std(pairs[2 * i + 1]) ? -1 : open(pairs[2 * i], O_RDONLY);
+        StegoError err = fd < 0 ? STEGO_ERR_ARGS : bmp_read_fd(fd, &info);
+
+        if (fd >= 0)
+            close(fd);
+        if (err != STEGO_OK)
+        {
+            printf("ERROR: %s: %s\n", pairs[2 * i], fd < 0 ? "cannot be opened (no pipes with --stripe)"
+                                                          : stego_strerror(err));
+            free(jobs);
+            return e_failure;
+        }
+        job->image = pairs[2 * i];
+        job->output = pairs[2 * i + 1];
+        job->secret = secret_fname;
+        job->config = config;
+        job->capacity = info.capacity;
+    }
+
+    if (split_secret(jobs, n, (uint64_t)size) == e_failure)
+    {
+        free(jobs);
+        return e_failure;
+    }
+
+    double start = stats_now_ms();
+    Status ret = run_jobs(jobs, n, stripe_encode_job, config);
+    double secs = (stats_now_ms() - start) / 1000.0;
+    int failed = report_jobs(jobs, n, 1);
+
+    /* Part of a set cannot be decoded; outputs this run never opened are not ours to remove */
+    if (ret == e_failure || failed > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            if (jobs[i].output_file)
+                remove(jobs[i].output);
+        }
+        free(jobs);
+        return e_failure;
+    }
+
+    LOG_INFO(&log, "INFO: Striped %llu bytes over %d images in %.3f s (%.2f MB/s)\n",
+             (unsigned long long)size, n, secs, secs > 0 ? size / 1e6 / secs : 0.0);
+    free(jobs);
+    return e_success;
+}
+
+/* Index order, for checking the decoded set */
+static int cmp_shard_index(const void *a, const void *b)
+{
+    const StripeJob *x = a, *y = b;
+
+    return (x->shard.index > y->shard.index) - (x->shard.index < y->shard.index);
+}
+
+/*===========================================================
+ * FUNCTION NAME : check_shard_set
+ * PURPOSE       : All shards of one payload, each once, and
+ *                 together exactly the bytes of the secret
+ ===========================================================*/
+static Status check_shard_set(StripeJob *jobs, int n)
+{
+    uint64_t offset = 0;
+
+    if (jobs[0].shard.count != (uint32_t)n)
+    {
+        printf("ERROR: Payload is striped over %u images, %d given\n", (unsigned)jobs[0].shard.count, n);
+        return e_failure;
+    }
+
+    qsort(jobs, n, sizeof(*jobs), cmp_shard_index);
+    for (int i = 0; i < n; i++)
+    {
+        const StegoShard *shard = &jobs[i].shard;
+
+        if (shard->id != jobs[0].shard.id || shard->count != jobs[0].shard.count ||
+            shard->total != jobs[0].shard.total)
+        {
+            printf("ERROR: %s belongs to another striped payload\n", jobs[i].image);
+            return e_failure;
+        }
+        if (shard->index != (uint32_t)i)
+        {
+            printf("ERROR: Shard %u is given twice\n", (unsigned)shard->index + 1);
+            return e_failure;
+        }
+        if (shard->offset != offset)
+        {
+            printf("ERROR: Shards of %s do not line up\n", jobs[i].image);
+            return e_failure;
+        }
+        offset += jobs[i].len;
+    }
+    if (offset != jobs[0].shard.total)
+    {
+        printf("ERROR: Shards hold %llu of %llu bytes\n", (unsigned long long)offset,
+               (unsigned long long)jobs[0].shard.total);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*===========================================================
+ * FUNCTION NAME : run_stripe_decode
+ * PURPOSE       : Extract all shards concurrently into one
+ *                 output, then check the set was whole; a
+ *                 failed set leaves no output behind
+ ===========================================================*/
+Status run_stripe_decode(const char *output_fname, char *images[], int n, const BatchConfig *config, int quiet)
+{
+    LogTarget log = { quiet };
+    FILE *fptr;
+
+    /* Shards are written at their offsets, so the output must be a file */
+    if (pipe_is_std(output_fname) || (fptr = fopen(output_fname, "w")) == NULL)
+    {
+        printf("ERROR: --stripe needs the output as a file\n");
+        return e_failure;
+    }
+    fclose(fptr);
+
+    StripeJob *jobs = calloc(n, sizeof(*jobs));
+    if (jobs == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        remove(output_fname);
+        return e_failure;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (pipe_is_std(images[i]))
+        {
+            printf("ERROR: --stripe needs the images as files, not pipes\n");
+            free(jobs);
+            remove(output_fname);
+            return e_failure;
+        }
+        jobs[i].image = images[i];
+        jobs[i].secret = output_fname;
+        jobs[i].config = config;
+    }
+
+    double start = stats_now_ms();
+    Status ret = run_jobs(jobs, n, stripe_decode_job, config);
+    double secs = (stats_now_ms() - start) / 1000.0;
+    int failed = report_jobs(jobs, n, 0);
+
+    if (ret == e_failure || failed > 0 || check_shard_set(jobs, n) == e_failure)
+    {
+        free(jobs);
+        remove(output_fname);
+        return e_failure;
+    }
+
+    uint64_t total = jobs[0].shard.total;
+    LOG_INFO(&log, "INFO: Reassembled %llu bytes from %d images in %.3f s (%.2f MB/s)\n",
+             (unsigned long long)total, n, secs, secs > 0 ? total / 1e6 / secs : 0.0);
+    free(jobs);
+    return e_success;
+}
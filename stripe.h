@@ -0,0 +1,31 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include "types.h"
+#include "batch.h"
+
+/*
+ * Striped payloads (--stripe): one secret spread over several cover
+ * images, each holding a shard sized to its capacity, so a payload
+ * can be larger than any one image.
+ *
+ * Every shard is an ordinary payload (own header, options and
+ * trailer) whose data is one run of the secret's bytes. The shard
+ * record in its header (STEGO_FLAG_SHARD, stego.h) carries a random
+ * payload ID shared by the set, the shard's index and the number of
+ * shards, its offset in the secret and the secret's size. All images
+ * are encoded at once on a work-stealing pool. Decode takes the set
+ * in any order, extracts the shards side by side straight to their
+ * offsets in the output, then checks the set was whole.
+ */
+
+/* Capacity set aside in every image for the header and trailer of its shard */
+#define STRIPE_RESERVE_CHANNELS ((STEGO_MAX_HEADER_SIZE + STEGO_TAG_SIZE + STEGO_CRC_SIZE + 4) * 8)
+
+/* Stripe secret_fname over n images: pairs holds cover, output, cover, output, ... */
+Status run_stripe_encode(const char *secret_fname, char *pairs[], int n, const BatchConfig *config, int quiet);
+
+/* Put the secret striped over the n images back together in output_fname */
+Status run_stripe_decode(const char *output_fname, char *images[], int n, const BatchConfig *config, int quiet);
+
+#endif
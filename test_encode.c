@@ -1,38 +1,339 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "encode.h"
 #include "decode.h"
 #include "types.h"
 #include "common.h"
+#include "parallel.h"
+#include "lsb.h"
+#include "batch.h"
+#include "scan.h"
+#include "serve.h"
+#include "stripe.h"
+#include "fanout.h"
+#include "pipeio.h"
+#include "stats.h"
+
+/* Command line options shared by encode and decode */
+typedef struct
+{
+    size_t buf_size;    /* -B <size>: streaming block size in payload bytes */
+    int use_mmap;       /* -m: read the input image through mmap */
+    int threads;        /* -j <n>: worker threads for the data region */
+    int bits;           /* --bits <k|auto>: secret data bits per channel */
+    int compress;       /* -z: LZ compress the secret before embedding */
+    int crc;            /* --crc: store a CRC32C of the secret data */
+    const char *passphrase; /* -p <passphrase>: encrypt / decrypt the payload */
+    int scatter;        /* --scatter: spread the payload tiles over the image (needs -p) */
+    int stats;          /* --stats[=json]: 1 key=value, 2 JSON summary */
+    int quiet;          /* -q: no INFO messages */
+    int archive;        /* -a: encode several files as an archive */
+    int list;           /* --list: print the members of an archive */
+    const char *member; /* --member <name>: extract one archive member */
+    int range;          /* --range off:len: decode only part of the payload */
+    const char *client; /* --client <socket>: run -e / -d on a --serve daemon */
+    int stripe;         /* --stripe: one secret over several images */
+    int fanout;         /* --fanout: several secrets into copies of one image */
+    int64_t range_off;
+    uint64_t range_len;
+} Options;
+
+/* Parse sizes like "65536", "256K" or "4M" */
+static size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    if (*end == 'K' || *end == 'k')
+        value *= 1024, end++;
+    else if (*end == 'M' || *end == 'm')
+        value *= 1024 * 1024, end++;
+
+    return (*end == '\0') ? (size_t)value : 0;
+}
+
+/* Parse "offset:length"; a negative offset counts from the end, no length means to the end */
+static int parse_range(const char *str, Options *opts)
+{
+    int neg = (*str == '-');
+    char *end;
+    unsigned long long off = strtoull(str + neg, &end, 10);
+
+    if (end == str + neg || *end != ':' || off > INT64_MAX)
+        return 1;
+    opts->range_off = neg ? -(int64_t)off : (int64_t)off;
+
+    str = end + 1;
+    opts->range_len = UINT64_MAX;
+    if (*str != '\0')
+    {
+        opts->range_len = strtoull(str, &end, 10);
+        if (*end != '\0' || *str == '-')
+            return 1;
+    }
+    opts->range = 1;
+    return 0;
+}
+
+/*
+ * Remove options from argv[2..] so the positional arguments
+ * keep their place for the read_and_validate_* functions.
+ */
+static int strip_options(int *argc, char *argv[], Options *opts)
+{
+    int out = 2;
+
+    for (int i = 2; i < *argc; i++)
+    {
+        if (strcmp(argv[i], "-B") == 0 && i + 1 < *argc)
+        {
+            opts->buf_size = parse_size(argv[++i]);
+            if (opts->buf_size < MIN_SECRET_BUF_SIZE || opts->buf_size > MAX_SECRET_BUF_SIZE)
+            {
+                printf("ERROR: -B expects a size between 64K and 4M\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < *argc)
+        {
+            opts->threads = atoi(argv[++i]);
+            if (opts->threads < 1 || opts->threads > MAX_THREADS)
+            {
+                printf("ERROR: -j expects a thread count between 1 and %d\n", MAX_THREADS);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--bits") == 0 && i + 1 < *argc)
+        {
+            i++;
+            opts->bits = strcmp(argv[i], "auto") == 0 ? STEGO_BITS_AUTO : atoi(argv[i]);
+            if (opts->bits != STEGO_BITS_AUTO && (opts->bits < 1 || opts->bits > LSB_MAX_BITS))
+            {
+                printf("ERROR: --bits expects 1 to %d or auto\n", LSB_MAX_BITS);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-m") == 0)
+        {
+            opts->use_mmap = 1;
+        }
+        else if (strcmp(argv[i], "-z") == 0)
+        {
+            opts->compress = 1;
+        }
+        else if (strcmp(argv[i], "--crc") == 0)
+        {
+            opts->crc = 1;
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < *argc)
+        {
+            opts->passphrase = argv[++i];
+            if (*opts->passphrase == '\0')
+            {
+                printf("ERROR: -p expects a non-empty passphrase\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--scatter") == 0)
+        {
+            opts->scatter = 1;
+        }
+        else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0)
+        {
+            opts->stats = argv[i][7] ? 2 : 1;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            opts->quiet = 1;
+        }
+        else if (strcmp(argv[i], "-a") == 0)
+        {
+            opts->archive = 1;
+        }
+        else if (strcmp(argv[i], "--list") == 0)
+        {
+            opts->list = 1;
+        }
+        else if (strcmp(argv[i], "--member") == 0 && i + 1 < *argc)
+        {
+            opts->member = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stripe") == 0)
+        {
+            opts->stripe = 1;
+        }
+        else if (strcmp(argv[i], "--fanout") == 0)
+        {
+            opts->fanout = 1;
+        }
+        else if (strcmp(argv[i], "--client") == 0 && i + 1 < *argc)
+        {
+            opts->client = argv[++i];
+        }
+        else if (strcmp(argv[i], "--range") == 0 && i + 1 < *argc)
+        {
+            if (parse_range(argv[++i], opts) != 0)
+            {
+                printf("ERROR: --range expects offset:length, e.g. 0:4096, 1048576: or -4096:\n");
+                return 1;
+            }
+        }
+        else
+        {
+            argv[out++] = argv[i];
+        }
+    }
+
+    /* The tile layout is keyed by the passphrase */
+    if (opts->scatter && opts->passphrase == NULL)
+    {
+        printf("ERROR: --scatter needs a passphrase (-p)\n");
+        return 1;
+    }
+
+    argv[out] = NULL;
+    *argc = out;
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
+    Options opts = {0};
+
     /* Check minimum number of arguments */
-    if (argc < 3)
+    if (argc < 3 || strip_options(&argc, argv, &opts) != 0 || argc < 3)
     {
-        printf("Usage (encode): %s -e <input.bmp> <secret.txt> [output_stego.bmp]\n", argv[0]);
-        printf("Usage (decode): %s -d <stego.bmp> [output_secret.txt]\n", argv[0]);
+        printf("Usage (encode): %s -e [-B size] [-m] [-j N] [-z] [--crc] [-p pass [--scatter]] [--bits k|auto] <input.bmp> <secret.txt> [output_stego.bmp]\n", argv[0]);
+        printf("Usage (archive): %s -e -a [-B size] [-z] [--crc] [-p pass [--scatter]] [--bits k|auto] <input.bmp> <output_stego.bmp> <file>...\n", argv[0]);
+        printf("Usage (decode): %s -d [-B size] [-m] [-j N] [-p pass] <stego.bmp> [output_secret.txt]\n", argv[0]);
+        printf("                archives: [--list] or [--member name] <stego.bmp> [output_dir|output_file]\n");
+        printf("                part of the payload: [--range offset:length] <stego.bmp> [output_file]\n");
+        printf("                \"-\" reads the image or secret from stdin, or writes the output to stdout\n");
+        printf("Usage (stripe): %s -e --stripe [-B size] [-m] [-j N] [-z] [--crc] [-p pass [--scatter]] [--bits k|auto] <secret.txt> <cover.bmp> <output.bmp> [<cover.bmp> <output.bmp>]...\n", argv[0]);
+        printf("                %s -d --stripe [-B size] [-m] [-j N] [-p pass] <output_secret> <stego.bmp>...\n", argv[0]);
+        printf("Usage (fanout): %s -e --fanout [-B size] [-j N] [-z] [--crc] [-p pass [--scatter]] [--bits k|auto] <cover.bmp> <secret.txt> <output.bmp> [<secret.txt> <output.bmp>]...\n", argv[0]);
+        printf("Usage (update): %s -u [-B size] [-z] [--crc] [-p pass] [--bits k|auto] <image.bmp> <secret.txt>\n", argv[0]);
+        printf("                -q drops INFO messages, --stats[=json] prints stage timings and I/O counters\n");
+        printf("Usage (batch) : %s -b [-B size] [-m] [-j N] [-z] [--crc] [-p pass [--scatter]] [--bits k|auto] <manifest.txt>\n", argv[0]);
+        printf("Usage (scan)  : %s -s [-j N] <dir>\n", argv[0]);
+        printf("Usage (serve) : %s --serve [-B size] [-m] [-j N] [-z] [--crc] [-p pass [--scatter]] [--bits k|auto] <socket>\n", argv[0]);
+        printf("Usage (client): %s -e|-d --client <socket> [-q] <files as for -e / -d>\n", argv[0]);
         return 1;
     }
 
     OperationType op_type = check_operation_type(argv);
+    Stats stats;
+    Stats *statsp = NULL;
+
+    if (opts.stats)
+    {
+        stats_init(&stats, opts.stats == 2);
+        statsp = &stats;
+    }
+
+    /* The daemon owns the options, the client only passes the files */
+    if (opts.client)
+    {
+        if ((op_type != e_encode && op_type != e_decode) || opts.archive || opts.list || opts.member ||
+            opts.range || opts.buf_size || opts.use_mmap || opts.threads || opts.bits || opts.compress ||
+            opts.crc || opts.passphrase || opts.stats || opts.stripe || opts.fanout)
+        {
+            printf("ERROR: --client runs plain -e / -d jobs with the options the daemon was started with\n");
+            return 1;
+        }
+        return run_client(opts.client, argv, opts.quiet) == e_success ? 0 : 1;
+    }
+
+    /* ============ STRIPE SECTION ============ */
+    if (opts.stripe)
+    {
+        BatchConfig config = { opts.threads, opts.buf_size, opts.use_mmap, opts.bits, opts.compress, opts.crc,
+                               opts.passphrase, opts.scatter };
+
+        if ((op_type != e_encode && op_type != e_decode) || opts.archive || opts.list || opts.member ||
+            opts.range || opts.stats)
+        {
+            printf("ERROR: --stripe runs -e or -d over a set of images, without -a, --list, --member, --range or --stats\n");
+            return 1;
+        }
+        if (op_type == e_encode && (argc < 5 || (argc - 3) % 2 != 0))
+        {
+            printf("ERROR: --stripe expects the secret, then a cover and an output per image\n");
+            return 1;
+        }
+
+        LOG_INFO(&opts, "INFO: Selected operation: STRIPE %s\n", op_type == e_encode ? "ENCODE" : "DECODE");
+        if (op_type == e_encode)
+            return run_stripe_encode(argv[2], argv + 3, (argc - 3) / 2, &config, opts.quiet) == e_success ? 0 : 1;
+        if (argc < 4)
+        {
+            printf("ERROR: --stripe expects the output, then the images\n");
+            return 1;
+        }
+        return run_stripe_decode(argv[2], argv + 3, argc - 3, &config, opts.quiet) == e_success ? 0 : 1;
+    }
+
+    /* ============ FAN-OUT SECTION ============ */
+    if (opts.fanout)
+    {
+        BatchConfig config = { opts.threads, opts.buf_size, 1, opts.bits, opts.compress, opts.crc,
+                               opts.passphrase, opts.scatter };
+
+        if (op_type != e_encode || opts.archive || opts.stripe || opts.stats)
+        {
+            printf("ERROR: --fanout runs -e, without -a, --stripe or --stats\n");
+            return 1;
+        }
+        if (argc < 5 || (argc - 3) % 2 != 0)
+        {
+            printf("ERROR: --fanout expects the cover, then a secret and an output per copy\n");
+            return 1;
+        }
+
+        LOG_INFO(&opts, "INFO: Selected operation: FAN-OUT\n");
+        return run_fanout(argv[2], argv + 3, (argc - 3) / 2, &config, opts.quiet) == e_success ? 0 : 1;
+    }
+
+    /* Data on stdout: messages go to stderr from here on */
+    if ((op_type == e_encode && opts.archive && argc > 3 && pipe_is_std(argv[3])) ||
+        (op_type == e_encode && !opts.archive && argc > 4 && pipe_is_std(argv[4])) ||
+        (op_type == e_decode && argc > 3 && pipe_is_std(argv[3])))
+        pipe_claim_stdout();
 
     /* ============ ENCODE SECTION ============ */
     if (op_type == e_encode)
     {
-        printf("INFO: Selected operation: ENCODE\n");
+        LOG_INFO(&opts, "INFO: Selected operation: ENCODE\n");
         
         EncodeInfo encInfo;
+        memset(&encInfo, 0, sizeof(encInfo));
+        encInfo.buf_size = opts.buf_size;
+        encInfo.use_mmap = opts.use_mmap;
+        encInfo.threads = opts.threads;
+        encInfo.bits = opts.bits;
+        encInfo.compress = opts.compress;
+        encInfo.crc = opts.crc;
+        encInfo.passphrase = opts.passphrase;
+        encInfo.scatter = opts.scatter;
+        encInfo.quiet = opts.quiet;
+        encInfo.stats = statsp;
 
-        if (read_and_validate_encode_args(argv, &encInfo) == e_failure)
+        if ((opts.archive ? read_and_validate_archive_args(argv, &encInfo)
+                          : read_and_validate_encode_args(argv, &encInfo)) == e_failure)
         {
             printf("ERROR: Read and validate encode arguments failed\n");
             return 1;
         }
 
-        if (do_encoding(&encInfo) == e_success)
+        Status ret = do_encoding(&encInfo);
+        close_files(&encInfo);
+        stats_print(statsp, "encode");
+        stats_free(statsp);
+
+        if (ret == e_success)
         {
-            printf("INFO: Encoding completed successfully!\n");
+            LOG_INFO(&opts, "INFO: Encoding completed successfully!\n");
             return 0;
         }
         else
@@ -42,12 +343,63 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* ============ UPDATE SECTION ============ */
+    else if (op_type == e_update)
+    {
+        LOG_INFO(&opts, "INFO: Selected operation: IN-PLACE UPDATE\n");
+
+        EncodeInfo encInfo;
+        memset(&encInfo, 0, sizeof(encInfo));
+        encInfo.buf_size = opts.buf_size;
+        encInfo.bits = opts.bits;
+        encInfo.compress = opts.compress;
+        encInfo.crc = opts.crc;
+        encInfo.passphrase = opts.passphrase;
+        encInfo.scatter = opts.scatter;
+        encInfo.quiet = opts.quiet;
+        encInfo.stats = statsp;
+
+        if (read_and_validate_update_args(argv, &encInfo) == e_failure)
+        {
+            printf("ERROR: Read and validate update arguments failed\n");
+            return 1;
+        }
+
+        Status ret = do_inplace_update(&encInfo);
+        close_files(&encInfo);
+        stats_print(statsp, "update");
+        stats_free(statsp);
+
+        if (ret == e_success)
+        {
+            LOG_INFO(&opts, "INFO: Update completed successfully!\n");
+            return 0;
+        }
+        else
+        {
+            printf("ERROR: Update failed\n");
+            return 1;
+        }
+    }
+
     /* ============ DECODE SECTION ============ */
     else if (op_type == e_decode)
     {
-        printf("INFO: Selected operation: DECODE\n");
+        LOG_INFO(&opts, "INFO: Selected operation: DECODE\n");
 
         DecodeInfo decInfo;
+        memset(&decInfo, 0, sizeof(decInfo));
+        decInfo.buf_size = opts.buf_size;
+        decInfo.use_mmap = opts.use_mmap;
+        decInfo.threads = opts.threads;
+        decInfo.passphrase = opts.passphrase;
+        decInfo.quiet = opts.quiet;
+        decInfo.stats = statsp;
+        decInfo.archive_list = opts.list;
+        decInfo.member = opts.member;
+        decInfo.range = opts.range;
+        decInfo.range_off = opts.range_off;
+        decInfo.range_len = opts.range_len;
 
         if (read_and_validate_decode_args(argv, &decInfo) == e_failure)
         {
@@ -58,12 +410,18 @@ int main(int argc, char *argv[])
         if (open_decode_files(&decInfo) == e_failure)
         {
             printf("ERROR: Opening decode files failed\n");
+            close_decode_files(&decInfo);
             return 1;
         }
 
-        if (do_decoding(&decInfo) == e_success)
+        Status ret = do_decoding(&decInfo);
+        close_decode_files(&decInfo);
+        stats_print(statsp, "decode");
+        stats_free(statsp);
+
+        if (ret == e_success)
         {
-            printf("INFO: Decoding completed successfully!\n");
+            LOG_INFO(&opts, "INFO: Decoding completed successfully!\n");
             return 0;
         }
         else
@@ -73,10 +431,37 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* ============ BATCH SECTION ============ */
+    else if (op_type == e_batch)
+    {
+        BatchConfig config = { opts.threads, opts.buf_size, opts.use_mmap, opts.bits, opts.compress, opts.crc,
+                               opts.passphrase, opts.scatter };
+
+        LOG_INFO(&opts, "INFO: Selected operation: BATCH\n");
+        return run_batch(argv[2], &config) == e_success ? 0 : 1;
+    }
+
+    /* ============ SCAN SECTION ============ */
+    else if (op_type == e_scan)
+    {
+        LOG_INFO(&opts, "INFO: Selected operation: SCAN\n");
+        return run_scan(argv[2], opts.threads) == e_success ? 0 : 1;
+    }
+
+    /* ============ SERVE SECTION ============ */
+    else if (op_type == e_serve)
+    {
+        BatchConfig config = { opts.threads, opts.buf_size, opts.use_mmap, opts.bits, opts.compress, opts.crc,
+                               opts.passphrase, opts.scatter };
+
+        LOG_INFO(&opts, "INFO: Selected operation: SERVE\n");
+        return run_serve(argv[2], &config) == e_success ? 0 : 1;
+    }
+
     /* ============ UNSUPPORTED ============ */
     else
     {
-        printf("ERROR: Unsupported operation. Use -e or -d\n");
+        printf("ERROR: Unsupported operation. Use -e, -d, -u, -b, -s or --serve\n");
         return 1;
     }
 }
@@ -15,6 +15,10 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_update,
+    e_batch,
+    e_scan,
+    e_serve,
     e_unsupported
 } OperationType;
 